@@ -3,18 +3,53 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 
 class DecoderImpl;
 class Device;
 class ImageBuffer;
 
+#include "avcparser.h"
+#include "codecprobe.h"
+#include "colorconvert.h"
+#include "fileio.h"
+#include "hevcanalyzer.h"
+#include "hevccabac.h"
+#include "hevcindex.h"
+#include "hevcpicture.h"
+#include "hevcsplicer.h"
+#include "latency.h"
+#include "mp4demuxer.h"
+#include "pcapreader.h"
+#include "rtpdepacketizer.h"
+#include "sessionmanager.h"
+#include "simbackend.h"
+#include "trace.h"
+#include "tsdemuxer.h"
+#include "workerpool.h"
+
+#include <vector>
+
+#ifdef _WIN32
 #include "win32decodinglayer.h"
 
 #include <d3dx12.h>
 #include <dxgi1_4.h>
 #include <err.h>
 
+typedef Win32DecodingLayer Decoder;
+#else
+#include "decodepipeline.h"
+
+/* without D3D12 the pipeline decodes on the simulated device, which is
+ * enough to benchmark everything around the GPU */
+typedef DecodePipeline Decoder;
+
+#define MAX_PATH 4096
+#endif
+
+#ifdef _WIN32
 static IDXGIFactory4 *s_factory;
 static ID3D12Device *s_device;
 static IDXGIAdapter1 *s_dxgi_adapter;
@@ -119,16 +154,678 @@ static void InitD3D() {
     }
 
 }
+#endif
+
+static const char *trace_file;
+
+static void dump_latency() {
+    pipeline_latency.Dump(stderr);
+}
+
+/* feed the video track of an MP4/MOV file to dl, a run of samples per read */
+static void demux_mp4(FILE *f, Decoder *dl) {
+    MP4Demuxer demuxer;
+    if (!demuxer.Open(f)) {
+        errx(1, "unable to demux input");
+    }
+    size_t config_size;
+    const uint8_t *config = demuxer.CodecConfig(&config_size);
+    if (!dl->SetCodecConfig(demuxer.Codec(), config, config_size)) {
+        errx(1, "bad decoder configuration in input");
+    }
+
+    size_t max_buffer = 0x200000;
+    auto buffer = new uint8_t[max_buffer];
+    const size_t max_views = 256;
+    MP4Demuxer::SampleView views[max_views];
+    uint64_t demux_ns = 0;
+    for (size_t next = 0;;) {
+        uint64_t start = TraceNow();
+        size_t n = demuxer.ReadSamples(next, buffer, max_buffer, views, max_views);
+        uint64_t ns = TraceNow() - start;
+        pipeline_latency.Record(kStageIngest, ns);
+        demux_ns += ns;
+        if (n == 0 || dl->Done()) {
+            break;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            dl->ReceiveBytes(views[i].data, views[i].size);
+        }
+        next += n;
+    }
+    delete[] buffer;
+
+    MP4Demuxer::Stats stats;
+    demuxer.GetStats(&stats);
+    printf("demuxed %llu of %zu samples in %llu reads, %.1f MB/s\n",
+        (unsigned long long) stats.samples, demuxer.NumSamples(), (unsigned long long) stats.reads,
+        demux_ns ? stats.bytes_read * 1000.0 / demux_ns : 0.0);
+}
+
+struct TSInput {
+    Decoder *dl;
+    int pid; // of the stream being decoded, -1 until one is found
+    int streams;
+};
+
+/* only the first video stream is decoded, any others are demuxed and
+ * dropped */
+static bool ts_stream(TSDemuxer::Stream *stream, void *opaque) {
+    auto in = (TSInput *) opaque;
+    ++in->streams;
+    if (in->pid >= 0) {
+        return false;
+    }
+    printf("decoding program %d PID %d, stream type 0x%02x\n", stream->program, stream->pid, stream->stream_type);
+    in->pid = stream->pid;
+    return true;
+}
+
+static void ts_payload(TSDemuxer::Stream *, const uint8_t *bytes, size_t size, bool, void *opaque) {
+    ((TSInput *) opaque)->dl->ReceiveBytes(bytes, size);
+}
+
+/* feed the first video stream of an MPEG-2 transport stream to dl, buffer
+ * already holds the first size bytes of the file */
+static void demux_ts(FILE *f, Decoder *dl, uint8_t *buffer, size_t size, size_t max_buffer) {
+    TSInput in = { dl, -1, 0 };
+    TSDemuxer demuxer(ts_stream, ts_payload, &in);
+    uint64_t start = TraceNow();
+    while (size && !dl->Done()) {
+        demuxer.Push(buffer, size);
+        uint64_t read_start = TraceNow();
+        size = fread(buffer, 1, max_buffer, f);
+        pipeline_latency.Record(kStageIngest, TraceNow() - read_start);
+    }
+    dl->Flush();
+    uint64_t ns = TraceNow() - start;
+
+    TSDemuxer::Stats stats;
+    demuxer.GetStats(&stats);
+    printf("demuxed %llu packets, %llu of them video, from %d video streams, %.0f packets/s including decode\n",
+        (unsigned long long) stats.packets, (unsigned long long) stats.video_packets, in.streams,
+        ns ? stats.packets * 1e9 / ns : 0.0);
+    if (stats.bytes_skipped || stats.cc_errors || stats.pes_errors || stats.psi_errors) {
+        printf("%llu bytes out of sync, %llu continuity errors, %llu bad PES headers, %llu bad sections\n",
+            (unsigned long long) stats.bytes_skipped, (unsigned long long) stats.cc_errors,
+            (unsigned long long) stats.pes_errors, (unsigned long long) stats.psi_errors);
+    }
+}
+
+static void rtp_nalu(const uint8_t *bytes, size_t size, uint32_t, void *opaque) {
+    ((Decoder *) opaque)->ReceiveNALU(kCodecHEVC, bytes, size);
+}
+
+/* replay an RTP/HEVC stream from a pcap capture, as fast as it decodes. The
+ * UDP port is AMDTEST_RTP_PORT if set, otherwise that of the first datagram
+ * that looks like RTP. */
+static void replay_rtp(FILE *f, Decoder *dl) {
+    PcapReader pcap;
+    if (!pcap.Open(f)) {
+        errx(1, "unable to read capture");
+    }
+    const char *rtp_port = getenv("AMDTEST_RTP_PORT");
+    int port = rtp_port ? atoi(rtp_port) : -1;
+
+    RTPDepacketizer rtp(rtp_nalu, dl);
+    PcapReader::Datagram d;
+    while (!dl->Done() && pcap.Next(&d)) {
+        if (port < 0 && d.size >= 12 && (d.data[0] >> 6) == 2) {
+            port = d.dst_port;
+        }
+        if (d.dst_port == port) {
+            rtp.Push(d.data, d.size, TraceNow());
+        }
+    }
+    rtp.Flush();
+
+    RTPDepacketizer::Stats stats;
+    rtp.GetStats(&stats);
+    printf("depacketized %llu NALUs from %llu packets to port %d, %llu reordered, %llu lost, %llu bytes copied\n",
+        (unsigned long long) stats.nalus, (unsigned long long) stats.packets, port,
+        (unsigned long long) stats.reordered, (unsigned long long) stats.lost,
+        (unsigned long long) stats.bytes_copied);
+}
+
+/* loads the index of the raw HEVC stream in f from the sidecar file next to
+ * the video, building and writing it first if missing or stale */
+static void load_index(const char *video, FILE *f, HEVCIndex *index) {
+    uint64_t stream_size = file_size64(f);
+
+    char sidecar[MAX_PATH];
+    snprintf(sidecar, sizeof(sidecar), "%s.idx", video);
+    FILE *idx = fopen(sidecar, "rb");
+    bool loaded = idx && index->Load(idx, stream_size);
+    if (idx) {
+        fclose(idx);
+    }
+    if (!loaded) {
+        uint64_t start = TraceNow();
+        if (!index->Build(f)) {
+            errx(1, "no random access points in %s", video);
+        }
+        printf("indexed %u pictures, %zu random access points in %.1f ms\n", index->NumPictures(),
+            index->NumPoints(), (TraceNow() - start) / 1e6);
+        idx = fopen(sidecar, "wb");
+        if (!idx || !index->Save(idx)) {
+            warnx("unable to write %s", sidecar);
+        }
+        if (idx) {
+            fclose(idx);
+        }
+    }
+}
+
+/* positions f at the random access point at or before picture, going by the
+ * index of the video, and feeds dl the parameter sets it needs to start
+ * decoding there */
+static void seek_hevc(const char *video, FILE *f, Decoder *dl, uint32_t picture) {
+    HEVCIndex index;
+    load_index(video, f, &index);
+
+    auto point = index.Find(picture);
+    if (!point) {
+        point = &index.GetPoint(0);
+    }
+    const HEVCIndex::ParamSet *param_sets[3];
+    int n = index.GetResumeParamSets(*point, param_sets);
+    std::vector<uint8_t> nalu;
+    for (int i = 0; i < n; ++i) {
+        nalu.resize(param_sets[i]->size);
+        seek64(f, param_sets[i]->offset);
+        if (fread(nalu.data(), 1, nalu.size(), f) != nalu.size()) {
+            errx(1, "unable to read parameter set at %llu", (unsigned long long) param_sets[i]->offset);
+        }
+        dl->ReceiveNALU(kCodecHEVC, nalu.data(), nalu.size());
+    }
+    seek64(f, point->offset);
+    printf("seeking to picture %u, starting at picture %u (POC %d) at offset %llu\n", picture, point->picture,
+        point->poc, (unsigned long long) point->offset);
+}
+
+/* writes video with insert spliced in at the random access point at or
+ * before picture to <video>.spliced.h265, and returns that file opened for
+ * reading, to be decoded instead */
+static FILE *splice_hevc(const char *video, FILE *f, const char *insert, uint32_t picture) {
+    FILE *g = fopen(insert, "rb");
+    if (!g) {
+        err(1, "unable to open %s", insert);
+    }
+    HEVCIndex index, insert_index;
+    load_index(video, f, &index);
+    load_index(insert, g, &insert_index);
+
+    char spliced[MAX_PATH];
+    snprintf(spliced, sizeof(spliced), "%s.spliced.h265", video);
+    FILE *out = fopen(spliced, "wb");
+    if (!out) {
+        err(1, "unable to open %s", spliced);
+    }
+    auto point = index.Find(picture);
+    if (!point) {
+        errx(1, "no keyframe at or before picture %u of %s", picture, video);
+    }
+    uint64_t start = TraceNow();
+    HEVCSplicer splicer(out);
+    if ((point != &index.GetPoint(0) && !splicer.Append(f, index, 0, point->picture))
+        || !splicer.Append(g, insert_index, 0, ~0u) || !splicer.Append(f, index, point->picture, ~0u)) {
+        errx(1, "unable to splice %s into %s at picture %u", insert, video, point->picture);
+    }
+    fclose(out);
+    fclose(g);
+    double seconds = (TraceNow() - start) / 1e9;
+
+    HEVCSplicer::Stats stats;
+    splicer.GetStats(&stats);
+    printf("spliced %s in at picture %u: %llu bytes in %.1f ms (%.1f MB/s), %llu parameter sets added, "
+        "%llu CRA slices made BLA\n", insert, point->picture, (unsigned long long) stats.bytes_copied,
+        seconds * 1e3, seconds > 0 ? stats.bytes_copied / seconds / 1e6 : 0.0,
+        (unsigned long long) stats.param_sets_written, (unsigned long long) stats.cra_rewritten);
+
+    fclose(f);
+    f = fopen(spliced, "rb");
+    if (!f) {
+        err(1, "unable to open %s", spliced);
+    }
+    return f;
+}
+
+/* parses the whole video on 1, 2, 4, ... up to max_threads threads, see
+ * HEVCAnalyzer, and prints how parsing scales with them */
+static void analyze_hevc(const char *video, FILE *f, int max_threads) {
+    HEVCIndex index;
+    load_index(video, f, &index);
+    std::vector<uint8_t> bytes((size_t) index.StreamSize());
+    seek64(f, 0);
+    if (fread(bytes.data(), 1, bytes.size(), f) != bytes.size()) {
+        errx(1, "unable to read %s", video);
+    }
+    if (max_threads <= 0) {
+        max_threads = (int) std::thread::hardware_concurrency();
+    }
+
+    printf("%8s %8s %10s %12s %8s %8s %8s\n", "threads", "segments", "ms", "pictures/s", "speedup", "errors",
+        "dropped");
+    double base = 0;
+    std::vector<HEVCPictureInfo> first;
+    for (int threads = 1;; threads = std::min(threads * 2, max_threads)) {
+        HEVCAnalyzer analyzer(threads);
+        analyzer.Analyze(bytes.data(), bytes.size(), index);
+        HEVCAnalyzer::Stats stats;
+        analyzer.GetStats(&stats);
+        double seconds = stats.elapsed_ns / 1e9;
+        if (threads == 1) {
+            base = seconds;
+            first = analyzer.GetPictures();
+        } else if (analyzer.GetPictures().size() != first.size()
+            || memcmp(analyzer.GetPictures().data(), first.data(), first.size() * sizeof(HEVCPictureInfo))) {
+            warnx("results on %d threads differ from those on one", threads);
+        }
+        printf("%8d %8d %10.1f %12.0f %8.2f %8zu %8zu\n", threads, stats.segments, seconds * 1e3,
+            seconds > 0 ? stats.pictures / seconds : 0.0, seconds > 0 ? base / seconds : 0.0, stats.errors.errors,
+            stats.errors.nals_dropped);
+        if (threads == max_threads) {
+            break;
+        }
+    }
+}
+
+struct CabacRun {
+    HEVCParser *parser;
+    HEVCCabacParser *cabac;
+};
+
+static void cabac_slice(const uint8_t *bytes, size_t size, void *opaque) {
+    auto run = (CabacRun *) opaque;
+    run->cabac->Parse(*run->parser, bytes, size);
+}
+
+/* parses the slice data of every picture in software, see HEVCCabacParser,
+ * and prints the rate at which bins are decoded */
+static void cabac_hevc(const char *video) {
+    FILE *f = fopen(video, "rb");
+    if (!f) {
+        err(1, "unable to open %s", video);
+    }
+    auto parser = new HEVCParser();
+    auto cabac = new HEVCCabacParser();
+    CabacRun run = { parser, cabac };
+    std::vector<uint8_t> buffer(0x200000);
+    size_t r;
+    while ((r = fread(buffer.data(), 1, buffer.size(), f))) {
+        parser->Parse(buffer.data(), r, cabac_slice, &run);
+    }
+    parser->Flush(cabac_slice, &run);
+    fclose(f);
+
+    HEVCCabacParser::Stats stats;
+    cabac->GetStats(&stats);
+    uint64_t bins = stats.context_bins + stats.bypass_bins + stats.terminate_bins;
+    double seconds = stats.elapsed_ns / 1e9;
+    printf("%llu slices, %llu in error, %llu not supported\n", (unsigned long long) stats.slices,
+        (unsigned long long) stats.errors, (unsigned long long) stats.unsupported);
+    printf("%llu CTUs, %llu CUs, %llu coefficients in %llu bytes\n", (unsigned long long) stats.ctus,
+        (unsigned long long) stats.cus, (unsigned long long) stats.coefficients, (unsigned long long) stats.bytes);
+    printf("%llu bins (%llu context, %llu bypass, %llu terminate) in %.1f ms, %.1f Mbins/s\n",
+        (unsigned long long) bins, (unsigned long long) stats.context_bins, (unsigned long long) stats.bypass_bins,
+        (unsigned long long) stats.terminate_bins, seconds * 1e3, seconds > 0 ? bins / seconds / 1e6 : 0.0);
+    delete cabac;
+    delete parser;
+}
+
+struct ParamsRun {
+    HEVCParser *parser;
+    int repeats;
+    uint64_t pictures = 0;
+    uint64_t fill_ns = 0;
+    uint64_t build_ns = 0;
+    DXVA_PicParams_HEVC pic_params;
+    DXVA_Qmatrix_HEVC qmatrix;
+    HEVCPicture picture;
+};
+
+static void params_slice(const uint8_t *bytes, size_t size, void *opaque) {
+    auto run = (ParamsRun *) opaque;
+    uint64_t start = TraceNow();
+    for (int i = 0; i < run->repeats; ++i) {
+        run->parser->FillDXVA(&run->pic_params, &run->qmatrix);
+    }
+    uint64_t filled = TraceNow();
+    for (int i = 0; i < run->repeats; ++i) {
+        run->picture.BuildInPlace(run->parser, bytes, size);
+    }
+    run->fill_ns += filled - start;
+    run->build_ns += TraceNow() - filled;
+    ++run->pictures;
+}
+
+/* parses the video and builds the DXVA parameters of every picture repeats
+ * times over, without a GPU, printing the cost per picture of parsing, of
+ * FillDXVA() and of building the whole HEVCPicture */
+static void params_bench(const char *video, int repeats) {
+    FILE *f = fopen(video, "rb");
+    if (!f) {
+        err(1, "unable to open %s", video);
+    }
+    std::vector<uint8_t> bytes((size_t) file_size64(f));
+    seek64(f, 0);
+    if (fread(bytes.data(), 1, bytes.size(), f) != bytes.size()) {
+        errx(1, "unable to read %s", video);
+    }
+    fclose(f);
+
+    HEVCParser parser;
+    ParamsRun run;
+    run.parser = &parser;
+    run.repeats = repeats;
+    uint64_t start = TraceNow();
+    parser.Parse(bytes.data(), bytes.size(), params_slice, &run);
+    parser.Flush(params_slice, &run);
+    uint64_t total = TraceNow() - start;
+    if (!run.pictures) {
+        errx(1, "no pictures in %s", video);
+    }
+
+    double pictures = (double) run.pictures;
+    double parse_us = (total - run.fill_ns - run.build_ns) / pictures / 1e3;
+    printf("%llu pictures, %d builds each\n", (unsigned long long) run.pictures, repeats);
+    printf("parse %.2f us/picture, FillDXVA %.2f us/picture, HEVCPicture %.2f us/picture\n", parse_us,
+        run.fill_ns / (pictures * repeats) / 1e3, run.build_ns / (pictures * repeats) / 1e3);
+}
+
+static void count_picture(const uint8_t *, size_t, void *opaque) {
+    ++*(uint64_t *) opaque;
+}
+
+/* parses each video, with the parser for the codec probed for, repeats times
+ * over without decoding, and prints the fastest run per picture and per byte.
+ * Given the same content encoded as H.264 and as HEVC this compares the cost
+ * of AVCParser with that of HEVCParser. */
+static void parse_bench(int count, char **videos, int repeats) {
+    for (int i = 0; i < count; ++i) {
+        FILE *f = fopen(videos[i], "rb");
+        if (!f) {
+            err(1, "unable to open %s", videos[i]);
+        }
+        std::vector<uint8_t> bytes((size_t) file_size64(f));
+        seek64(f, 0);
+        if (fread(bytes.data(), 1, bytes.size(), f) != bytes.size()) {
+            errx(1, "unable to read %s", videos[i]);
+        }
+        fclose(f);
+
+        CodecProbeResult probe;
+        ProbeCodec(bytes.data(), std::min(bytes.size(), CodecProbe::kMaxProbeSize), &probe);
+        if (probe.codec == kCodecUnknown) {
+            warnx("%s: unable to identify the codec, skipping", videos[i]);
+            continue;
+        }
+        uint64_t best = UINT64_MAX, pictures = 0;
+        size_t errors = 0;
+        for (int r = 0; r < repeats; ++r) {
+            pictures = 0;
+            uint64_t start = TraceNow();
+            if (probe.codec == kCodecHEVC) {
+                HEVCParser parser;
+                parser.Parse(bytes.data(), bytes.size(), count_picture, &pictures);
+                parser.Flush(count_picture, &pictures);
+                HEVCParser::ErrorStats stats;
+                parser.GetErrorStats(&stats);
+                errors = stats.errors;
+            } else {
+                AVCParser parser;
+                parser.Parse(bytes.data(), bytes.size(), count_picture, &pictures);
+                parser.Flush(count_picture, &pictures);
+                AVCParser::ErrorStats stats;
+                parser.GetErrorStats(&stats);
+                errors = stats.errors;
+            }
+            best = std::min(best, TraceNow() - start);
+        }
+        printf("%s: %s, %llu slices, %zu bytes, %zu errors, best of %d: %.2f us/slice, %.1f MB/s\n", videos[i],
+            probe.codec == kCodecHEVC ? "HEVC" : "H.264", (unsigned long long) pictures, bytes.size(), errors,
+            repeats, pictures ? best / 1e3 / pictures : 0.0, best ? bytes.size() * 1e3 / best : 0.0);
+    }
+}
+
+/* decoded pictures are converted to RGBA on the host, as the CPU fallback
+ * of Win32DecodingLayer does */
+struct HostConversion {
+    Decoder *dl;
+    ColorConverter converter{ kPixelNV12, kPixelRGBA, kMatrixBT709, kRangeStudio };
+    WorkerPool pool;
+    std::vector<uint8_t> rgba;
+};
+
+static void convert_picture(DecodeBackend *session, uint64_t ticket, void *opaque) {
+    auto c = (HostConversion *) opaque;
+    ScopedLatency latency(kStageConvert);
+    MappedPicture picture;
+    if (!session->Map(ticket, &picture)) {
+        errx(1, "unable to map decoded picture");
+    }
+    ColorMatrix matrix;
+    ColorRange range;
+    c->dl->GetColorSpace(&matrix, &range);
+    c->converter.SetColorSpace(matrix, range);
+    CropRect crop;
+    c->dl->GetCropRect(&crop.x, &crop.y, &crop.width, &crop.height);
+    c->rgba.resize((size_t) crop.width * crop.height * 4);
+    c->converter.Convert(picture.y + crop.y * picture.y_stride + crop.x, picture.y_stride,
+        picture.uv + (crop.y / 2) * picture.uv_stride + crop.x, picture.uv_stride,
+        c->rgba.data(), (size_t) crop.width * 4, crop.width, crop.height, &c->pool);
+    session->Unmap();
+}
+
+/* time the CPU colour converter on synthetic pictures of the usual sizes,
+ * coded with 8 rows of padding below the picture as HEVC 1080p streams are,
+ * converting the cropped picture as is and scaled to 720p */
+static void convert_bench(int frames) {
+    struct {
+        const char *name;
+        int width, height;
+    } sizes[] = {
+        { "1080p", 1920, 1080 },
+        { "4K", 3840, 2160 },
+        { "8K", 7680, 4320 },
+    };
+    WorkerPool pool;
+    uint32_t seed = 1;
+    for (int p010 = 0; p010 < 2; ++p010) {
+        ColorConverter converter(p010 ? kPixelP010 : kPixelNV12, kPixelRGBA, kMatrixBT709, kRangeStudio);
+        printf("%s to RGBA, %s kernels, %d worker threads\n", p010 ? "P010" : "NV12", converter.KernelName(),
+            pool.NumThreads());
+        for (auto &size : sizes) {
+            int coded_height = size.height + 8;
+            size_t stride = (size_t) size.width * (p010 ? 2 : 1);
+            std::vector<uint8_t> y(stride * coded_height), uv(stride * coded_height / 2);
+            for (auto &b : y) {
+                b = (uint8_t) ((seed = seed * 1103515245 + 12345) >> 16);
+            }
+            for (auto &b : uv) {
+                b = (uint8_t) ((seed = seed * 1103515245 + 12345) >> 16);
+            }
+            std::vector<uint8_t> rgba((size_t) size.width * size.height * 4);
+            CropRect crop = { 0, 0, size.width, size.height };
+            double pixels = (double) size.width * size.height * frames;
+
+            uint64_t start = TraceNow();
+            for (int i = 0; i < frames; ++i) {
+                converter.Convert(y.data(), stride, uv.data(), stride, rgba.data(), (size_t) size.width * 4,
+                    size.width, size.height);
+            }
+            double one_thread = (TraceNow() - start) / 1e9;
+            start = TraceNow();
+            for (int i = 0; i < frames; ++i) {
+                converter.Convert(y.data(), stride, uv.data(), stride, rgba.data(), (size_t) size.width * 4,
+                    size.width, size.height, &pool);
+            }
+            double threaded = (TraceNow() - start) / 1e9;
+            start = TraceNow();
+            for (int i = 0; i < frames; ++i) {
+                converter.ConvertScaled(y.data(), stride, uv.data(), stride, crop, rgba.data(), 1280 * 4, 1280, 720,
+                    kScaleBilinear, &pool);
+            }
+            double bilinear = (TraceNow() - start) / 1e9;
+            start = TraceNow();
+            for (int i = 0; i < frames; ++i) {
+                converter.ConvertScaled(y.data(), stride, uv.data(), stride, crop, rgba.data(), 1280 * 4, 1280, 720,
+                    kScaleLanczos3, &pool);
+            }
+            double lanczos = (TraceNow() - start) / 1e9;
+
+            /* scaled rates are in source pixels, the work grows with those */
+            printf("%-6s %8.1f Mpix/s on 1 thread, %8.1f Mpix/s threaded, to 720p %8.1f Mpix/s bilinear, "
+                   "%8.1f Mpix/s Lanczos-3\n",
+                size.name, pixels / one_thread / 1e6, pixels / threaded / 1e6, pixels / bilinear / 1e6,
+                pixels / lanczos / 1e6);
+        }
+    }
+}
+
+/* flips one bit at a pseudo-random position in every interval bytes, on
+ * average, of a raw stream, the same ones on every run, leaving the
+ * parameter sets at the start of the stream alone */
+struct Corruption {
+    uint64_t interval;
+    uint64_t next = 0x1000;
+    uint64_t offset = 0; // of the bytes passed to apply()
+    uint32_t seed = 1;
+    uint64_t flipped = 0;
+
+    void apply(uint8_t *bytes, size_t size) {
+        while (interval && next < offset + size) {
+            seed = seed * 1103515245 + 12345;
+            bytes[next - offset] ^= (uint8_t) (1 << ((seed >> 16) & 7));
+            ++flipped;
+            next += 1 + (seed >> 8) % (2 * interval);
+        }
+        offset += size;
+    }
+};
+
+/* decodes sessions copies of the video at once with SessionManager, on a
+ * simulated device with two queues, first round robin and then earliest
+ * deadline first, and prints the stats of every session. Session n is given
+ * a latency target of 20 ms * (n + 1), so the policies differ in who misses
+ * deadlines. */
+static void sessions_bench(const char *video, int sessions) {
+    FILE *f = fopen(video, "rb");
+    if (!f) {
+        err(1, "unable to open %s", video);
+    }
+    std::vector<uint8_t> bytes((size_t) file_size64(f));
+    seek64(f, 0);
+    if (fread(bytes.data(), 1, bytes.size(), f) != bytes.size()) {
+        errx(1, "unable to read %s", video);
+    }
+    fclose(f);
+    CodecProbeResult probe;
+    ProbeCodec(bytes.data(), std::min(bytes.size(), CodecProbe::kMaxProbeSize), &probe);
+    if (probe.codec == kCodecUnknown) {
+        errx(1, "%s is not a raw H.264 or HEVC stream", video);
+    }
+
+    const char *sim_us = getenv("AMDTEST_SIM_US");
+    SimulatedDevice device(2, sim_us ? strtoull(sim_us, nullptr, 0) * 1000 : 500000);
+    const size_t chunk = 0x10000;
+    for (auto policy : { kScheduleRoundRobin, kScheduleDeadline }) {
+        SessionManager manager(&device, policy);
+        std::vector<int> ids;
+        for (int i = 0; i < sessions; ++i) {
+            int id = manager.OpenSession(20000000ull * (i + 1), probe.codec);
+            if (id < 0) {
+                errx(1, "unable to open session %d", i);
+            }
+            ids.push_back(id);
+        }
+        /* one producer per session, as for one per camera */
+        uint64_t start = TraceNow();
+        std::vector<std::thread> producers;
+        for (int id : ids) {
+            producers.emplace_back([&, id] {
+                for (size_t offset = 0; offset < bytes.size(); offset += chunk) {
+                    manager.ReceiveBytes(id, bytes.data() + offset, std::min(chunk, bytes.size() - offset));
+                }
+            });
+        }
+        for (auto &t : producers) {
+            t.join();
+        }
+        manager.Drain();
+        printf("%d sessions, %s, %.1f ms\n", sessions,
+            policy == kScheduleRoundRobin ? "round robin" : "earliest deadline first", (TraceNow() - start) / 1e6);
+        manager.DumpStats(stdout);
+        for (int id : ids) {
+            manager.CloseSession(id);
+        }
+    }
+}
+
+static void flush_trace() {
+    if (!TraceFlush(trace_file)) {
+        warnx("unable to write trace to %s\n", trace_file);
+    }
+}
 
 int main(int argc, char **argv) {
-    setvbuf(stdout, NULL, _IONBF, 0);
-    setvbuf(stderr, NULL, _IONBF, 0);
+    /* AMDTEST_CONVERT_BENCH=<frames> times the CPU colour converter on that
+     * many synthetic pictures at each size, without any input */
+    const char *convert_frames = getenv("AMDTEST_CONVERT_BENCH");
+    if (convert_frames) {
+        convert_bench(atoi(convert_frames) > 0 ? atoi(convert_frames) : 1);
+        return 0;
+    }
 
     if (argc < 2) {
         errx(1, "usage: %s input-video", argv[0]);
     }
 
-    InitD3D();
+    /* AMDTEST_TRACE=<level> enables logging and trace events, which are
+     * written to AMDTEST_TRACE_FILE (default amdtest1-trace.json) on exit. */
+    const char *level = getenv("AMDTEST_TRACE");
+    if (level) {
+        trace_level = atoi(level);
+        trace_file = getenv("AMDTEST_TRACE_FILE");
+        if (!trace_file) {
+            trace_file = "amdtest1-trace.json";
+        }
+        atexit(flush_trace);
+    }
+
+    atexit(dump_latency);
+
+    /* AMDTEST_CABAC=1 parses the slice data of the video in software instead
+     * of decoding it, without a GPU */
+    const char *cabac = getenv("AMDTEST_CABAC");
+    if (cabac && atoi(cabac)) {
+        cabac_hevc(argv[1]);
+        return 0;
+    }
+
+    /* AMDTEST_PARSE_BENCH=<repeats> times parsing each video given, H.264 or
+     * HEVC, without decoding */
+    const char *parse_repeats = getenv("AMDTEST_PARSE_BENCH");
+    if (parse_repeats) {
+        parse_bench(argc - 1, argv + 1, atoi(parse_repeats) > 0 ? atoi(parse_repeats) : 1);
+        return 0;
+    }
+
+    /* AMDTEST_PARAMS_BENCH=<repeats> times building the DXVA parameters of
+     * every picture of the video, without a GPU */
+    const char *params_repeats = getenv("AMDTEST_PARAMS_BENCH");
+    if (params_repeats) {
+        params_bench(argv[1], atoi(params_repeats) > 0 ? atoi(params_repeats) : 1);
+        return 0;
+    }
+
+    /* AMDTEST_SESSIONS=<n> decodes n copies of the video at once on a
+     * simulated device shared between them, and prints per-session stats */
+    const char *sessions = getenv("AMDTEST_SESSIONS");
+    if (sessions) {
+        sessions_bench(argv[1], atoi(sessions) > 0 ? atoi(sessions) : 1);
+        return 0;
+    }
 
     char *video = argv[1];
     FILE *f = fopen(video, "rb");
@@ -136,18 +833,182 @@ int main(int argc, char **argv) {
         err(1, "unable to open %s", video);
     }
 
-    auto dl = new Win32DecodingLayer(nullptr);
+    /* AMDTEST_CONVERT=1 converts every decoded picture to RGBA, with the
+     * video processor where there is one, =2 on the CPU always */
+    const char *convert = getenv("AMDTEST_CONVERT");
+    int convert_mode = convert ? atoi(convert) : 0;
+#ifdef _WIN32
+    InitD3D();
+    auto dl = new Decoder(nullptr);
+    if (convert_mode) {
+        dl->SetOutputConversion(true, convert_mode == 2);
+    }
+#else
+    /* AMDTEST_SIM_US=<us> is the time the simulated device takes to decode
+     * a picture, 0 by default so that only the host side is measured */
+    const char *sim_us = getenv("AMDTEST_SIM_US");
+    SimulatedDevice sim_device(1, sim_us ? strtoull(sim_us, nullptr, 0) * 1000 : 0);
+    HostConversion conversion;
+    auto dl = new Decoder(&sim_device, convert_mode ? convert_picture : nullptr, &conversion);
+    conversion.dl = dl;
+#endif
+
+    /* AMDTEST_PREWARM=1920x1088,1280x720,... creates decoder surfaces for
+     * those coded sizes before the first frame */
+    const char *prewarm = getenv("AMDTEST_PREWARM");
+    if (prewarm) {
+        Resolution resolutions[16];
+        int count = 0;
+        for (const char *p = prewarm; count < 16;) {
+            Resolution r;
+            int n;
+            if (sscanf(p, "%dx%d%n", &r.width, &r.height, &n) != 2) {
+                break;
+            }
+            resolutions[count++] = r;
+            p += n;
+            if (*p != ',') {
+                break;
+            }
+            ++p;
+        }
+        printf("prewarm requested for %d sizes, %d created up front\n", count, dl->Prewarm(resolutions, count));
+    }
+
+    /* AMDTEST_DUMP_PARAMS=<file> writes the DXVA parameters built for every
+     * picture to file, for diffing against a known good dump, and skips
+     * decoding. The FillDXVA latency stage gives the cost per picture. */
+    const char *dump = getenv("AMDTEST_DUMP_PARAMS");
+    FILE *dump_file = nullptr;
+    if (dump) {
+        dump_file = fopen(dump, "w");
+        if (!dump_file) {
+            err(1, "unable to open %s", dump);
+        }
+        dl->SetParamDump(dump_file);
+    }
+
+    /* AMDTEST_FRAMES=<n> stops after decoding n pictures, 0 for all of them.
+     * On D3D12 only the first is decoded unless asked otherwise, as this test
+     * always did; the stats below are printed either way. */
+#ifdef _WIN32
+    uint64_t frames = 1;
+#else
+    uint64_t frames = 0;
+#endif
+    const char *frame_limit = getenv("AMDTEST_FRAMES");
+    if (frame_limit) {
+        frames = strtoull(frame_limit, nullptr, 0);
+    }
+    dl->SetFrameLimit(frames);
+
+    /* AMDTEST_KEYFRAMES=1 decodes IRAP pictures only, as for thumbnails */
+    const char *keyframes = getenv("AMDTEST_KEYFRAMES");
+    bool keyframes_only = keyframes && atoi(keyframes);
+    if (keyframes_only) {
+        dl->SetKeyframesOnly(true);
+    }
+    /* AMDTEST_MAX_TID=<n> drops HEVC temporal sub-layers above n */
+    const char *max_tid = getenv("AMDTEST_MAX_TID");
+    if (max_tid) {
+        dl->SetMaxTemporalId(atoi(max_tid));
+    }
+    /* AMDTEST_VERIFY=1 checks decoded pictures against the picture hash SEI */
+    const char *verify = getenv("AMDTEST_VERIFY");
+    bool verify_hashes = verify && atoi(verify);
+    if (verify_hashes) {
+        dl->SetVerification(true);
+    }
+    /* AMDTEST_CORRUPT=<n> flips a bit in every n bytes or so of a raw
+     * stream, and drops each picture with a broken slice as a whole */
+    const char *corrupt = getenv("AMDTEST_CORRUPT");
+    if (corrupt) {
+        dl->SetHoldPictures(true);
+    }
 
     size_t max_buffer = 0x200000;
     auto buffer = new uint8_t[max_buffer];
-    for (;;) {
-        int r = fread(buffer, 1, max_buffer, f);
-        if (r == 0) {
-            break;
+    uint64_t start = TraceNow();
+    uint64_t run_start = start;
+    size_t r = fread(buffer, 1, max_buffer, f);
+    pipeline_latency.Record(kStageIngest, TraceNow() - start);
+    if (MP4Demuxer::Probe(buffer, r)) {
+        demux_mp4(f, dl);
+    } else if (PcapReader::Probe(buffer, r)) {
+        replay_rtp(f, dl);
+    } else if (TSDemuxer::Probe(buffer, r)) {
+        demux_ts(f, dl, buffer, r, max_buffer);
+    } else {
+        /* AMDTEST_SPLICE=<file>@<picture> decodes the video with the raw
+         * HEVC stream in file spliced in at picture */
+        const char *splice = getenv("AMDTEST_SPLICE");
+        const char *seek = getenv("AMDTEST_SEEK");
+        /* AMDTEST_ANALYZE=<threads> parses the whole video on up to that many
+         * threads instead of decoding it, 0 for one per hardware thread */
+        const char *analyze = getenv("AMDTEST_ANALYZE");
+        if (analyze) {
+            analyze_hevc(video, f, atoi(analyze));
+            r = 0;
+        } else if (splice) {
+            char insert[MAX_PATH];
+            snprintf(insert, sizeof(insert), "%s", splice);
+            char *at = strrchr(insert, '@');
+            uint32_t picture = 0;
+            if (at) {
+                picture = atoi(at + 1);
+                *at = '\0';
+            }
+            f = splice_hevc(video, f, insert, picture);
+            r = fread(buffer, 1, max_buffer, f);
+        } else if (seek) {
+            seek_hevc(video, f, dl, atoi(seek));
+            r = fread(buffer, 1, max_buffer, f);
+        }
+        Corruption corruption = { corrupt ? strtoull(corrupt, nullptr, 0) : 0 };
+        while (r && !dl->Done()) {
+            corruption.apply(buffer, r);
+            dl->ReceiveBytes(buffer, r);
+            start = TraceNow();
+            r = fread(buffer, 1, max_buffer, f);
+            pipeline_latency.Record(kStageIngest, TraceNow() - start);
+        }
+        dl->Flush();
+        if (corrupt) {
+            DecoderErrorStats errors;
+            dl->GetErrorStats(&errors);
+            printf("%llu bits flipped: %zu errors, %zu resyncs, %zu NALUs (%zu bytes) dropped\n",
+                (unsigned long long) corruption.flipped, errors.errors, errors.resyncs, errors.nals_dropped,
+                errors.bytes_skipped);
         }
-        dl->ReceiveBytes(buffer, r);
     }
     fclose(f);
+    if (dl->Done()) {
+        printf("stopped after %llu decoded pictures (AMDTEST_FRAMES=0 decodes them all)\n",
+            (unsigned long long) frames);
+    }
+    double seconds = (TraceNow() - run_start) / 1e9;
+    uint64_t pictures = dl->GetPictureCount();
+    printf("%llu %s in %.1f ms, %.1f %s/s\n", (unsigned long long) pictures,
+        keyframes_only ? "keyframes" : "pictures", seconds * 1e3, seconds > 0 ? pictures / seconds : 0.0,
+        keyframes_only ? "thumbnails" : "pictures");
+    if (dump_file) {
+        fclose(dump_file);
+    }
+
+    if (verify_hashes) {
+        DecoderVerifyStats verified;
+        dl->GetVerifyStats(&verified);
+        printf("picture hashes: %llu verified, %llu mismatches, %llu pictures without one, %llu unsupported, "
+               "%llu dropped\n",
+            (unsigned long long) verified.verified, (unsigned long long) verified.mismatches,
+            (unsigned long long) verified.unhashed, (unsigned long long) verified.unsupported,
+            (unsigned long long) verified.dropped);
+    }
+
+    DecoderMemoryStats mem;
+    dl->GetMemoryStats(&mem);
+    printf("decoder memory: %zu bytes in %zu surface sets (%d references), %zu readback bytes\n",
+        mem.surface_bytes, mem.surface_sets, mem.num_references, mem.readback_bytes);
 
     return 0;
 }
@@ -0,0 +1,126 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <new>
+
+/* a simple bump allocator. Memory is carved out of a chain of chunks that
+ * are only returned to the heap when the arena is destroyed. Reset() rewinds
+ * to the first chunk in O(1), so once an arena has grown to its high water
+ * mark it never touches the heap again. Objects allocated from an arena never
+ * have their destructors run, so only use it for trivially destructible
+ * types. */
+
+class Arena {
+
+    struct Chunk {
+        Chunk *next;
+        size_t size;
+
+        uint8_t *data() {
+            return (uint8_t *) (this + 1);
+        }
+    };
+
+    Chunk *head = nullptr;
+    Chunk *current = nullptr;
+    size_t offset = 0;
+    const size_t chunk_size;
+
+public:
+    struct Stats {
+        size_t heap_allocations; // number of chunks malloc'ed, ever
+        size_t heap_bytes; // total size of all chunks
+        size_t allocations; // number of Alloc() calls, ever
+        size_t bytes_in_use; // bytes handed out since last Reset()
+        size_t high_water; // max bytes_in_use seen
+        size_t resets;
+    };
+
+private:
+    Stats stats = {};
+
+    Chunk *NewChunk(size_t min_size) {
+        size_t size = min_size > chunk_size ? min_size : chunk_size;
+        auto c = (Chunk *) malloc(sizeof(Chunk) + size);
+        if (!c) {
+            throw std::bad_alloc();
+        }
+        c->next = nullptr;
+        c->size = size;
+        ++stats.heap_allocations;
+        stats.heap_bytes += size;
+        return c;
+    }
+
+    static size_t Align(uintptr_t p, size_t align) {
+        return (size_t) (((p + align - 1) & ~(uintptr_t) (align - 1)) - p);
+    }
+
+public:
+    Arena(size_t chunk_size = 0x10000)
+        : chunk_size(chunk_size) {
+    }
+
+    ~Arena() {
+        while (head) {
+            auto next = head->next;
+            free(head);
+            head = next;
+        }
+    }
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    void *Alloc(size_t size, size_t align = alignof(max_align_t)) {
+        ++stats.allocations;
+        if (!current) {
+            head = current = NewChunk(size + align);
+            offset = 0;
+        }
+        for (;;) {
+            size_t pad = Align((uintptr_t) (current->data() + offset), align);
+            if (offset + pad + size <= current->size) {
+                void *r = current->data() + offset + pad;
+                offset += pad + size;
+                stats.bytes_in_use += pad + size;
+                if (stats.bytes_in_use > stats.high_water) {
+                    stats.high_water = stats.bytes_in_use;
+                }
+                return r;
+            }
+            /* move on to the next chunk, splicing in a fresh one if we have
+             * run out or the one we had is too small for this request. */
+            stats.bytes_in_use += current->size - offset;
+            if (!current->next || current->next->size < size + align) {
+                auto c = NewChunk(size + align);
+                c->next = current->next;
+                current->next = c;
+            }
+            current = current->next;
+            offset = 0;
+        }
+    }
+
+    template <class T>
+    T *New() {
+        return new (Alloc(sizeof(T), alignof(T))) T();
+    }
+
+    void Reset() {
+        current = head;
+        offset = 0;
+        stats.bytes_in_use = 0;
+        ++stats.resets;
+    }
+
+    const Stats &GetStats() const {
+        return stats;
+    }
+};
+
+#endif /* __ARENA_H__ */
@@ -0,0 +1,1618 @@
+// The parameter set and slice header parsing in this file is derived from
+//
+// Copyright 2014 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// The code that does not overlap with Chromium is Copyright 2023 Jamscape ApS.
+
+#undef NDEBUG
+#include <algorithm>
+#include <iterator>
+
+#include "avcparser.h"
+
+#include <windows.h>
+#include <dxva.h>
+
+H264NALU::H264NALU() {
+    memset(this, 0, sizeof(*this));
+}
+
+H264SPS::H264SPS() {
+    memset(this, 0, sizeof(*this));
+}
+
+H264PPS::H264PPS() {
+    memset(this, 0, sizeof(*this));
+}
+
+H264SliceHeader::H264SliceHeader() {
+    memset(this, 0, sizeof(*this));
+}
+
+H264SliceHeader::H264SliceHeader(const H264SliceHeader &) = default;
+H264SliceHeader &H264SliceHeader::operator=(const H264SliceHeader &) = default;
+
+bool H264SliceHeader::IsPSlice() const {
+    return (slice_type % 5 == kPSlice);
+}
+
+bool H264SliceHeader::IsBSlice() const {
+    return (slice_type % 5 == kBSlice);
+}
+
+bool H264SliceHeader::IsISlice() const {
+    return (slice_type % 5 == kISlice);
+}
+
+bool H264SliceHeader::IsSPSlice() const {
+    return (slice_type % 5 == kSPSlice);
+}
+
+bool H264SliceHeader::IsSISlice() const {
+    return (slice_type % 5 == kSISlice);
+}
+
+static void FillDefaultSeqScalingLists(H264SPS *sps) {
+    memset(sps->scaling_list4x4, 16, sizeof(sps->scaling_list4x4));
+    memset(sps->scaling_list8x8, 16, sizeof(sps->scaling_list8x8));
+}
+
+// Fall-back rule A of Table 7-2 for the SPS, and rule B for the PPS, where
+// the first list of each kind falls back to the given list rather than to
+// the default one.
+static void FallbackScalingList4x4(int i, const uint8_t default_scaling_list_intra[], const uint8_t default_scaling_list_inter[], uint8_t scaling_list4x4[][kH264ScalingList4x4Length]) {
+    static const int kScalingList4x4ByteSize = sizeof(scaling_list4x4[0][0]) * kH264ScalingList4x4Length;
+
+    switch (i) {
+        case 0:
+            memcpy(scaling_list4x4[i], default_scaling_list_intra, kScalingList4x4ByteSize);
+            break;
+
+        case 1:
+        case 2:
+        case 4:
+        case 5:
+            memcpy(scaling_list4x4[i], scaling_list4x4[i - 1], kScalingList4x4ByteSize);
+            break;
+
+        case 3:
+            memcpy(scaling_list4x4[i], default_scaling_list_inter, kScalingList4x4ByteSize);
+            break;
+
+        default:
+            errx(1, "%s: invalid scaling list %d", __PRETTY_FUNCTION__, i);
+    }
+}
+
+static void FallbackScalingList8x8(int i, const uint8_t default_scaling_list_intra[], const uint8_t default_scaling_list_inter[], uint8_t scaling_list8x8[][kH264ScalingList8x8Length]) {
+    static const int kScalingList8x8ByteSize = sizeof(scaling_list8x8[0][0]) * kH264ScalingList8x8Length;
+
+    switch (i) {
+        case 0:
+            memcpy(scaling_list8x8[i], default_scaling_list_intra, kScalingList8x8ByteSize);
+            break;
+
+        case 1:
+            memcpy(scaling_list8x8[i], default_scaling_list_inter, kScalingList8x8ByteSize);
+            break;
+
+        case 2:
+        case 3:
+        case 4:
+        case 5:
+            memcpy(scaling_list8x8[i], scaling_list8x8[i - 2], kScalingList8x8ByteSize);
+            break;
+
+        default:
+            errx(1, "%s: invalid scaling list %d", __PRETTY_FUNCTION__, i);
+    }
+}
+
+AVCParser::Result AVCParser::ParseScalingList(int size, uint8_t *scaling_list, bool *use_default) {
+    // See chapter 7.3.2.1.1.1.
+    int last_scale = 8;
+    int next_scale = 8;
+    int delta_scale;
+
+    *use_default = false;
+
+    for (int j = 0; j < size; ++j) {
+        if (next_scale != 0) {
+            READ_SE_OR_RETURN(&delta_scale);
+            IN_RANGE_OR_RETURN(delta_scale, -128, 127);
+            next_scale = (last_scale + delta_scale + 256) & 0xff;
+
+            if (j == 0 && next_scale == 0) {
+                *use_default = true;
+                return kOk;
+            }
+        }
+
+        scaling_list[j] = (next_scale == 0) ? last_scale : next_scale;
+        last_scale = scaling_list[j];
+    }
+
+    return kOk;
+}
+
+AVCParser::Result AVCParser::ParseSPSScalingLists(H264SPS *sps) {
+    // See 7.4.2.1.1.
+    bool seq_scaling_list_present_flag;
+    bool use_default;
+    Result res;
+
+    // Parse scaling_list4x4.
+    for (int i = 0; i < 6; ++i) {
+        READ_BOOL_OR_RETURN(&seq_scaling_list_present_flag);
+
+        if (seq_scaling_list_present_flag) {
+            res = ParseScalingList(std::size(sps->scaling_list4x4[i]), sps->scaling_list4x4[i], &use_default);
+            if (res != kOk) {
+                return res;
+            }
+
+            if (use_default) {
+                memcpy(sps->scaling_list4x4[i], i < 3 ? kDefault4x4Intra : kDefault4x4Inter, sizeof(sps->scaling_list4x4[i]));
+            }
+
+        } else {
+            FallbackScalingList4x4(i, kDefault4x4Intra, kDefault4x4Inter, sps->scaling_list4x4);
+        }
+    }
+
+    // Parse scaling_list8x8.
+    for (int i = 0; i < ((sps->chroma_format_idc != 3) ? 2 : 6); ++i) {
+        READ_BOOL_OR_RETURN(&seq_scaling_list_present_flag);
+
+        if (seq_scaling_list_present_flag) {
+            res = ParseScalingList(std::size(sps->scaling_list8x8[i]), sps->scaling_list8x8[i], &use_default);
+            if (res != kOk) {
+                return res;
+            }
+
+            if (use_default) {
+                memcpy(sps->scaling_list8x8[i], i % 2 == 0 ? kDefault8x8Intra : kDefault8x8Inter, sizeof(sps->scaling_list8x8[i]));
+            }
+
+        } else {
+            FallbackScalingList8x8(i, kDefault8x8Intra, kDefault8x8Inter, sps->scaling_list8x8);
+        }
+    }
+
+    return kOk;
+}
+
+AVCParser::Result AVCParser::ParsePPSScalingLists(const H264SPS &sps, H264PPS *pps) {
+    // See 7.4.2.2.
+    bool pic_scaling_list_present_flag;
+    bool use_default;
+    Result res;
+
+    for (int i = 0; i < 6; ++i) {
+        READ_BOOL_OR_RETURN(&pic_scaling_list_present_flag);
+
+        if (pic_scaling_list_present_flag) {
+            res = ParseScalingList(std::size(pps->scaling_list4x4[i]), pps->scaling_list4x4[i], &use_default);
+            if (res != kOk) {
+                return res;
+            }
+
+            if (use_default) {
+                memcpy(pps->scaling_list4x4[i], i < 3 ? kDefault4x4Intra : kDefault4x4Inter, sizeof(pps->scaling_list4x4[i]));
+            }
+
+        } else {
+            if (!sps.seq_scaling_matrix_present_flag) {
+                // Table 7-2 fallback rule A in spec.
+                FallbackScalingList4x4(i, kDefault4x4Intra, kDefault4x4Inter, pps->scaling_list4x4);
+            } else {
+                // Table 7-2 fallback rule B in spec.
+                FallbackScalingList4x4(i, sps.scaling_list4x4[0], sps.scaling_list4x4[3], pps->scaling_list4x4);
+            }
+        }
+    }
+
+    if (pps->transform_8x8_mode_flag) {
+        for (int i = 0; i < ((sps.chroma_format_idc != 3) ? 2 : 6); ++i) {
+            READ_BOOL_OR_RETURN(&pic_scaling_list_present_flag);
+
+            if (pic_scaling_list_present_flag) {
+                res = ParseScalingList(std::size(pps->scaling_list8x8[i]), pps->scaling_list8x8[i], &use_default);
+                if (res != kOk) {
+                    return res;
+                }
+
+                if (use_default) {
+                    memcpy(pps->scaling_list8x8[i], i % 2 == 0 ? kDefault8x8Intra : kDefault8x8Inter, sizeof(pps->scaling_list8x8[i]));
+                }
+
+            } else {
+                if (!sps.seq_scaling_matrix_present_flag) {
+                    // Table 7-2 fallback rule A in spec.
+                    FallbackScalingList8x8(i, kDefault8x8Intra, kDefault8x8Inter, pps->scaling_list8x8);
+                } else {
+                    // Table 7-2 fallback rule B in spec.
+                    FallbackScalingList8x8(i, sps.scaling_list8x8[0], sps.scaling_list8x8[1], pps->scaling_list8x8);
+                }
+            }
+        }
+    } else {
+        /* no 8x8 transforms, but keep the lists well defined */
+        memcpy(pps->scaling_list8x8, sps.scaling_list8x8, sizeof(pps->scaling_list8x8));
+    }
+    return kOk;
+}
+
+/* E.1.2, NAL HRD parameters are kept in the SPS, pass a null sps to skip the
+ * VCL ones */
+AVCParser::Result AVCParser::ParseHRDParameters(H264SPS *sps) {
+    int cpb_cnt_minus1;
+    READ_UE_OR_RETURN(&cpb_cnt_minus1);
+    IN_RANGE_OR_RETURN(cpb_cnt_minus1, 0, 31);
+    int bit_rate_scale, cpb_size_scale;
+    READ_BITS_OR_RETURN(4, &bit_rate_scale);
+    READ_BITS_OR_RETURN(4, &cpb_size_scale);
+    if (sps) {
+        sps->cpb_cnt_minus1 = cpb_cnt_minus1;
+        sps->bit_rate_scale = bit_rate_scale;
+        sps->cpb_size_scale = cpb_size_scale;
+    }
+    for (int i = 0; i <= cpb_cnt_minus1; ++i) {
+        int bit_rate_value_minus1, cpb_size_value_minus1;
+        bool cbr_flag;
+        READ_UE_OR_RETURN(&bit_rate_value_minus1);
+        READ_UE_OR_RETURN(&cpb_size_value_minus1);
+        READ_BOOL_OR_RETURN(&cbr_flag);
+        if (sps) {
+            sps->bit_rate_value_minus1[i] = bit_rate_value_minus1;
+            sps->cpb_size_value_minus1[i] = cpb_size_value_minus1;
+            sps->cbr_flag[i] = cbr_flag;
+        }
+    }
+    int lengths[4];
+    for (auto &length : lengths) {
+        READ_BITS_OR_RETURN(5, &length);
+    }
+    if (sps) {
+        sps->initial_cpb_removal_delay_length_minus_1 = lengths[0];
+        sps->cpb_removal_delay_length_minus1 = lengths[1];
+        sps->dpb_output_delay_length_minus1 = lengths[2];
+        sps->time_offset_length = lengths[3];
+    }
+    return kOk;
+}
+
+AVCParser::Result AVCParser::ParseVUIParameters(H264SPS *sps) {
+    // E.1.1
+    int data;
+    bool flag;
+    Result res;
+
+    bool aspect_ratio_info_present_flag;
+    READ_BOOL_OR_RETURN(&aspect_ratio_info_present_flag);
+    if (aspect_ratio_info_present_flag) {
+        int aspect_ratio_idc;
+        READ_BITS_OR_RETURN(8, &aspect_ratio_idc);
+        if (aspect_ratio_idc == H264SPS::kExtendedSar) {
+            READ_BITS_OR_RETURN(16, &sps->sar_width);
+            READ_BITS_OR_RETURN(16, &sps->sar_height);
+        } else {
+            const int max_aspect_ratio_idc = std::size(kTableSarWidth) - 1;
+            IN_RANGE_OR_RETURN(aspect_ratio_idc, 0, max_aspect_ratio_idc);
+            sps->sar_width = kTableSarWidth[aspect_ratio_idc];
+            sps->sar_height = kTableSarHeight[aspect_ratio_idc];
+        }
+    }
+
+    // Read and ignore overscan info.
+    READ_BOOL_OR_RETURN(&flag); // overscan_info_present_flag
+    if (flag) {
+        READ_BITS_OR_RETURN(1, &data); // overscan_appropriate_flag
+    }
+
+    READ_BOOL_OR_RETURN(&sps->video_signal_type_present_flag);
+    if (sps->video_signal_type_present_flag) {
+        READ_BITS_OR_RETURN(3, &sps->video_format);
+        READ_BOOL_OR_RETURN(&sps->video_full_range_flag);
+        READ_BOOL_OR_RETURN(&sps->colour_description_present_flag);
+        if (sps->colour_description_present_flag) {
+            // color description syntax elements
+            READ_BITS_OR_RETURN(8, &sps->colour_primaries);
+            READ_BITS_OR_RETURN(8, &sps->transfer_characteristics);
+            READ_BITS_OR_RETURN(8, &sps->matrix_coefficients);
+        }
+    }
+
+    READ_BOOL_OR_RETURN(&flag); // chroma_loc_info_present_flag
+    if (flag) {
+        READ_UE_OR_RETURN(&data); // chroma_sample_loc_type_top_field
+        READ_UE_OR_RETURN(&data); // chroma_sample_loc_type_bottom_field
+    }
+
+    READ_BOOL_OR_RETURN(&sps->timing_info_present_flag);
+    if (sps->timing_info_present_flag) {
+        /* 32 bit fields, and the bit reader stops at 31 */
+        int hi, lo;
+        READ_BITS_OR_RETURN(16, &hi);
+        READ_BITS_OR_RETURN(16, &lo);
+        sps->num_units_in_tick = (int) ((uint32_t) hi << 16 | lo);
+        READ_BITS_OR_RETURN(16, &hi);
+        READ_BITS_OR_RETURN(16, &lo);
+        sps->time_scale = (int) ((uint32_t) hi << 16 | lo);
+        TRUE_OR_RETURN(sps->num_units_in_tick > 0 && sps->time_scale > 0);
+        READ_BOOL_OR_RETURN(&sps->fixed_frame_rate_flag);
+    }
+
+    READ_BOOL_OR_RETURN(&sps->nal_hrd_parameters_present_flag);
+    if (sps->nal_hrd_parameters_present_flag) {
+        res = ParseHRDParameters(sps);
+        if (res != kOk) {
+            return res;
+        }
+    }
+    bool vcl_hrd_parameters_present_flag;
+    READ_BOOL_OR_RETURN(&vcl_hrd_parameters_present_flag);
+    if (vcl_hrd_parameters_present_flag) {
+        res = ParseHRDParameters(nullptr);
+        if (res != kOk) {
+            return res;
+        }
+    }
+    if (sps->nal_hrd_parameters_present_flag || vcl_hrd_parameters_present_flag) {
+        READ_BOOL_OR_RETURN(&sps->low_delay_hrd_flag);
+    }
+
+    READ_BITS_OR_RETURN(1, &data); // pic_struct_present_flag
+    READ_BOOL_OR_RETURN(&sps->bitstream_restriction_flag);
+    if (sps->bitstream_restriction_flag) {
+        READ_BITS_OR_RETURN(1, &data); // motion_vectors_over_pic_boundaries_flag
+        READ_UE_OR_RETURN(&data); // max_bytes_per_pic_denom
+        READ_UE_OR_RETURN(&data); // max_bits_per_mb_denom
+        READ_UE_OR_RETURN(&data); // log2_max_mv_length_horizontal
+        READ_UE_OR_RETURN(&data); // log2_max_mv_length_vertical
+        READ_UE_OR_RETURN(&sps->max_num_reorder_frames);
+        READ_UE_OR_RETURN(&sps->max_dec_frame_buffering);
+        TRUE_OR_RETURN(sps->max_dec_frame_buffering >= sps->max_num_ref_frames);
+        IN_RANGE_OR_RETURN(sps->max_dec_frame_buffering, 0, kMaxRefFrames);
+        IN_RANGE_OR_RETURN(sps->max_num_reorder_frames, 0, sps->max_dec_frame_buffering);
+    }
+
+    return kOk;
+}
+
+AVCParser::Result AVCParser::ParseSPS(H264SPS *sps) {
+    // See 7.4.2.1.
+    int data;
+    Result res;
+
+    READ_BITS_OR_RETURN(8, &sps->profile_idc);
+    READ_BOOL_OR_RETURN(&sps->constraint_set0_flag);
+    READ_BOOL_OR_RETURN(&sps->constraint_set1_flag);
+    READ_BOOL_OR_RETURN(&sps->constraint_set2_flag);
+    READ_BOOL_OR_RETURN(&sps->constraint_set3_flag);
+    READ_BOOL_OR_RETURN(&sps->constraint_set4_flag);
+    READ_BOOL_OR_RETURN(&sps->constraint_set5_flag);
+    READ_BITS_OR_RETURN(2, &data); // reserved_zero_2bits
+    READ_BITS_OR_RETURN(8, &sps->level_idc);
+    READ_UE_OR_RETURN(&sps->seq_parameter_set_id);
+    IN_RANGE_OR_RETURN(sps->seq_parameter_set_id, 0, 31);
+
+    if (sps->profile_idc == 100 || sps->profile_idc == 110 || sps->profile_idc == 122 || sps->profile_idc == 244 || sps->profile_idc == 44 || sps->profile_idc == 83 || sps->profile_idc == 86 || sps->profile_idc == 118 || sps->profile_idc == 128) {
+        READ_UE_OR_RETURN(&sps->chroma_format_idc);
+        IN_RANGE_OR_RETURN(sps->chroma_format_idc, 0, 3);
+
+        if (sps->chroma_format_idc == 3) {
+            READ_BOOL_OR_RETURN(&sps->separate_colour_plane_flag);
+        }
+
+        READ_UE_OR_RETURN(&sps->bit_depth_luma_minus8);
+        IN_RANGE_OR_RETURN(sps->bit_depth_luma_minus8, 0, 6);
+
+        READ_UE_OR_RETURN(&sps->bit_depth_chroma_minus8);
+        IN_RANGE_OR_RETURN(sps->bit_depth_chroma_minus8, 0, 6);
+
+        READ_BOOL_OR_RETURN(&sps->qpprime_y_zero_transform_bypass_flag);
+        READ_BOOL_OR_RETURN(&sps->seq_scaling_matrix_present_flag);
+
+        if (sps->seq_scaling_matrix_present_flag) {
+            DVLOG(4) << "Scaling matrix present";
+            res = ParseSPSScalingLists(sps);
+            if (res != kOk) {
+                return res;
+            }
+        } else {
+            FillDefaultSeqScalingLists(sps);
+        }
+    } else {
+        sps->chroma_format_idc = 1;
+        FillDefaultSeqScalingLists(sps);
+    }
+
+    if (sps->separate_colour_plane_flag) {
+        sps->chroma_array_type = 0;
+    } else {
+        sps->chroma_array_type = sps->chroma_format_idc;
+    }
+
+    READ_UE_OR_RETURN(&sps->log2_max_frame_num_minus4);
+    IN_RANGE_OR_RETURN(sps->log2_max_frame_num_minus4, 0, 12);
+
+    READ_UE_OR_RETURN(&sps->pic_order_cnt_type);
+    IN_RANGE_OR_RETURN(sps->pic_order_cnt_type, 0, 2);
+
+    if (sps->pic_order_cnt_type == 0) {
+        READ_UE_OR_RETURN(&sps->log2_max_pic_order_cnt_lsb_minus4);
+        IN_RANGE_OR_RETURN(sps->log2_max_pic_order_cnt_lsb_minus4, 0, 12);
+    } else if (sps->pic_order_cnt_type == 1) {
+        READ_BOOL_OR_RETURN(&sps->delta_pic_order_always_zero_flag);
+        READ_SE_OR_RETURN(&sps->offset_for_non_ref_pic);
+        READ_SE_OR_RETURN(&sps->offset_for_top_to_bottom_field);
+        READ_UE_OR_RETURN(&sps->num_ref_frames_in_pic_order_cnt_cycle);
+        IN_RANGE_OR_RETURN(sps->num_ref_frames_in_pic_order_cnt_cycle, 0, 254);
+
+        sps->expected_delta_per_pic_order_cnt_cycle = 0;
+        for (int i = 0; i < sps->num_ref_frames_in_pic_order_cnt_cycle; ++i) {
+            READ_SE_OR_RETURN(&sps->offset_for_ref_frame[i]);
+            sps->expected_delta_per_pic_order_cnt_cycle += sps->offset_for_ref_frame[i];
+        }
+    }
+
+    READ_UE_OR_RETURN(&sps->max_num_ref_frames);
+    IN_RANGE_OR_RETURN(sps->max_num_ref_frames, 0, kMaxRefFrames);
+    READ_BOOL_OR_RETURN(&sps->gaps_in_frame_num_value_allowed_flag);
+
+    READ_UE_OR_RETURN(&sps->pic_width_in_mbs_minus1);
+    READ_UE_OR_RETURN(&sps->pic_height_in_map_units_minus1);
+
+    READ_BOOL_OR_RETURN(&sps->frame_mbs_only_flag);
+    if (!sps->frame_mbs_only_flag) {
+        READ_BOOL_OR_RETURN(&sps->mb_adaptive_frame_field_flag);
+    }
+
+    READ_BOOL_OR_RETURN(&sps->direct_8x8_inference_flag);
+
+    // base::CheckedNumeric<int>, the coded size in luma samples must fit
+    int64_t width = ((int64_t) sps->pic_width_in_mbs_minus1 + 1) * 16;
+    int64_t height = ((int64_t) sps->pic_height_in_map_units_minus1 + 1) * 16 * (2 - sps->frame_mbs_only_flag);
+    TRUE_OR_RETURN(width * height <= INT32_MAX);
+
+    READ_BOOL_OR_RETURN(&sps->frame_cropping_flag);
+    if (sps->frame_cropping_flag) {
+        READ_UE_OR_RETURN(&sps->frame_crop_left_offset);
+        READ_UE_OR_RETURN(&sps->frame_crop_right_offset);
+        READ_UE_OR_RETURN(&sps->frame_crop_top_offset);
+        READ_UE_OR_RETURN(&sps->frame_crop_bottom_offset);
+
+        // Equations 7-19 to 7-22, the crop must leave something visible.
+        int crop_unit_x = sps->chroma_array_type == 1 || sps->chroma_array_type == 2 ? 2 : 1;
+        int crop_unit_y = (sps->chroma_array_type == 1 ? 2 : 1) * (2 - sps->frame_mbs_only_flag);
+        TRUE_OR_RETURN(((int64_t) sps->frame_crop_left_offset + sps->frame_crop_right_offset) * crop_unit_x < width);
+        TRUE_OR_RETURN(((int64_t) sps->frame_crop_top_offset + sps->frame_crop_bottom_offset) * crop_unit_y < height);
+    }
+
+    READ_BOOL_OR_RETURN(&sps->vui_parameters_present_flag);
+    if (sps->vui_parameters_present_flag) {
+        DVLOG(4) << "VUI parameters present";
+        res = ParseVUIParameters(sps);
+        if (res != kOk) {
+            return res;
+        }
+    }
+
+    return kOk;
+}
+
+AVCParser::Result AVCParser::ParsePPS(H264PPS *pps) {
+    // See 7.4.2.2.
+    Result res;
+
+    READ_UE_OR_RETURN(&pps->pic_parameter_set_id);
+    IN_RANGE_OR_RETURN(pps->pic_parameter_set_id, 0, 255);
+    READ_UE_OR_RETURN(&pps->seq_parameter_set_id);
+    IN_RANGE_OR_RETURN(pps->seq_parameter_set_id, 0, 31);
+
+    auto sps_slot = sps_slots[pps->seq_parameter_set_id];
+    if (!sps_slot) {
+        DVLOG(1) << "PPS " << pps->pic_parameter_set_id << " refers to missing SPS " << pps->seq_parameter_set_id;
+        return kMissingParameterSet;
+    }
+    auto &sps = sps_slot->ps;
+
+    READ_BOOL_OR_RETURN(&pps->entropy_coding_mode_flag);
+    READ_BOOL_OR_RETURN(&pps->bottom_field_pic_order_in_frame_present_flag);
+
+    READ_UE_OR_RETURN(&pps->num_slice_groups_minus1);
+    if (pps->num_slice_groups_minus1 > 0) {
+        DVLOG(1) << "Slice groups not supported";
+        return kUnsupportedStream;
+    }
+
+    READ_UE_OR_RETURN(&pps->num_ref_idx_l0_default_active_minus1);
+    IN_RANGE_OR_RETURN(pps->num_ref_idx_l0_default_active_minus1, 0, 31);
+
+    READ_UE_OR_RETURN(&pps->num_ref_idx_l1_default_active_minus1);
+    IN_RANGE_OR_RETURN(pps->num_ref_idx_l1_default_active_minus1, 0, 31);
+
+    READ_BOOL_OR_RETURN(&pps->weighted_pred_flag);
+    READ_BITS_OR_RETURN(2, &pps->weighted_bipred_idc);
+    IN_RANGE_OR_RETURN(pps->weighted_bipred_idc, 0, 2);
+
+    READ_SE_OR_RETURN(&pps->pic_init_qp_minus26);
+    IN_RANGE_OR_RETURN(pps->pic_init_qp_minus26, -26, 25);
+
+    READ_SE_OR_RETURN(&pps->pic_init_qs_minus26);
+    IN_RANGE_OR_RETURN(pps->pic_init_qs_minus26, -26, 25);
+
+    READ_SE_OR_RETURN(&pps->chroma_qp_index_offset);
+    IN_RANGE_OR_RETURN(pps->chroma_qp_index_offset, -12, 12);
+    pps->second_chroma_qp_index_offset = pps->chroma_qp_index_offset;
+
+    READ_BOOL_OR_RETURN(&pps->deblocking_filter_control_present_flag);
+    READ_BOOL_OR_RETURN(&pps->constrained_intra_pred_flag);
+    READ_BOOL_OR_RETURN(&pps->redundant_pic_cnt_present_flag);
+
+    if (br_.HasMoreRBSPData()) {
+        READ_BOOL_OR_RETURN(&pps->transform_8x8_mode_flag);
+        READ_BOOL_OR_RETURN(&pps->pic_scaling_matrix_present_flag);
+
+        if (pps->pic_scaling_matrix_present_flag) {
+            DVLOG(4) << "Picture scaling matrix present";
+            res = ParsePPSScalingLists(sps, pps);
+            if (res != kOk) {
+                return res;
+            }
+        }
+
+        READ_SE_OR_RETURN(&pps->second_chroma_qp_index_offset);
+        IN_RANGE_OR_RETURN(pps->second_chroma_qp_index_offset, -12, 12);
+    }
+
+    if (!pps->pic_scaling_matrix_present_flag) {
+        /* the SPS lists apply, copy them so FillDXVA() need not care */
+        memcpy(pps->scaling_list4x4, sps.scaling_list4x4, sizeof(pps->scaling_list4x4));
+        memcpy(pps->scaling_list8x8, sps.scaling_list8x8, sizeof(pps->scaling_list8x8));
+    }
+
+    return kOk;
+}
+
+AVCParser::Result AVCParser::ParseRefPicListModification(int num_ref_idx_active_minus1, H264ModificationOfPicNum *ref_list_mods) {
+    H264ModificationOfPicNum *pic_num_mod;
+
+    if (num_ref_idx_active_minus1 >= 32) {
+        return kInvalidStream;
+    }
+
+    for (int i = 0; i < 32; ++i) {
+        pic_num_mod = &ref_list_mods[i];
+        READ_UE_OR_RETURN(&pic_num_mod->modification_of_pic_nums_idc);
+        IN_RANGE_OR_RETURN(pic_num_mod->modification_of_pic_nums_idc, 0, 3);
+
+        switch (pic_num_mod->modification_of_pic_nums_idc) {
+            case 0:
+            case 1:
+                READ_UE_OR_RETURN(&pic_num_mod->abs_diff_pic_num_minus1);
+                break;
+
+            case 2:
+                READ_UE_OR_RETURN(&pic_num_mod->long_term_pic_num);
+                break;
+
+            case 3:
+                return kOk;
+
+            default:
+                return kInvalidStream;
+        }
+    }
+
+    // If we got here, we didn't get loop end marker prematurely,
+    // so make sure it is there for our client.
+    int modification_of_pic_nums_idc;
+    READ_UE_OR_RETURN(&modification_of_pic_nums_idc);
+    TRUE_OR_RETURN(modification_of_pic_nums_idc == 3);
+
+    return kOk;
+}
+
+AVCParser::Result AVCParser::ParseRefPicListModifications(H264SliceHeader *shdr) {
+    Result res;
+
+    if (!shdr->IsISlice() && !shdr->IsSISlice()) {
+        READ_BOOL_OR_RETURN(&shdr->ref_pic_list_modification_flag_l0);
+        if (shdr->ref_pic_list_modification_flag_l0) {
+            res = ParseRefPicListModification(shdr->num_ref_idx_l0_active_minus1, shdr->ref_list_l0_modifications);
+            if (res != kOk) {
+                return res;
+            }
+        }
+    }
+
+    if (shdr->IsBSlice()) {
+        READ_BOOL_OR_RETURN(&shdr->ref_pic_list_modification_flag_l1);
+        if (shdr->ref_pic_list_modification_flag_l1) {
+            res = ParseRefPicListModification(shdr->num_ref_idx_l1_active_minus1, shdr->ref_list_l1_modifications);
+            if (res != kOk) {
+                return res;
+            }
+        }
+    }
+
+    return kOk;
+}
+
+AVCParser::Result AVCParser::ParseWeightingFactors(int num_ref_idx_active_minus1, int chroma_array_type, int luma_log2_weight_denom, int chroma_log2_weight_denom, H264WeightingFactors *w_facts) {
+    int def_luma_weight = 1 << luma_log2_weight_denom;
+    int def_chroma_weight = 1 << chroma_log2_weight_denom;
+
+    for (int i = 0; i < num_ref_idx_active_minus1 + 1; ++i) {
+        READ_BOOL_OR_RETURN(&w_facts->luma_weight_flag);
+        if (w_facts->luma_weight_flag) {
+            READ_SE_OR_RETURN(&w_facts->luma_weight[i]);
+            IN_RANGE_OR_RETURN(w_facts->luma_weight[i], -128, 127);
+
+            READ_SE_OR_RETURN(&w_facts->luma_offset[i]);
+            IN_RANGE_OR_RETURN(w_facts->luma_offset[i], -128, 127);
+        } else {
+            w_facts->luma_weight[i] = def_luma_weight;
+            w_facts->luma_offset[i] = 0;
+        }
+
+        if (chroma_array_type != 0) {
+            READ_BOOL_OR_RETURN(&w_facts->chroma_weight_flag);
+            if (w_facts->chroma_weight_flag) {
+                for (int j = 0; j < 2; ++j) {
+                    READ_SE_OR_RETURN(&w_facts->chroma_weight[i][j]);
+                    IN_RANGE_OR_RETURN(w_facts->chroma_weight[i][j], -128, 127);
+
+                    READ_SE_OR_RETURN(&w_facts->chroma_offset[i][j]);
+                    IN_RANGE_OR_RETURN(w_facts->chroma_offset[i][j], -128, 127);
+                }
+            } else {
+                for (int j = 0; j < 2; ++j) {
+                    w_facts->chroma_weight[i][j] = def_chroma_weight;
+                    w_facts->chroma_offset[i][j] = 0;
+                }
+            }
+        }
+    }
+
+    return kOk;
+}
+
+AVCParser::Result AVCParser::ParsePredWeightTable(const H264SPS &sps, H264SliceHeader *shdr) {
+    READ_UE_OR_RETURN(&shdr->luma_log2_weight_denom);
+    IN_RANGE_OR_RETURN(shdr->luma_log2_weight_denom, 0, 7);
+
+    if (sps.chroma_array_type != 0) {
+        READ_UE_OR_RETURN(&shdr->chroma_log2_weight_denom);
+        IN_RANGE_OR_RETURN(shdr->chroma_log2_weight_denom, 0, 7);
+    }
+
+    Result res = ParseWeightingFactors(shdr->num_ref_idx_l0_active_minus1, sps.chroma_array_type, shdr->luma_log2_weight_denom, shdr->chroma_log2_weight_denom, &shdr->pred_weight_table_l0);
+    if (res != kOk) {
+        return res;
+    }
+
+    if (shdr->IsBSlice()) {
+        res = ParseWeightingFactors(shdr->num_ref_idx_l1_active_minus1, sps.chroma_array_type, shdr->luma_log2_weight_denom, shdr->chroma_log2_weight_denom, &shdr->pred_weight_table_l1);
+        if (res != kOk) {
+            return res;
+        }
+    }
+
+    return kOk;
+}
+
+AVCParser::Result AVCParser::ParseDecRefPicMarking(H264SliceHeader *shdr) {
+    size_t bits_left_at_start = br_.NumBitsLeft();
+
+    if (shdr->idr_pic_flag) {
+        READ_BOOL_OR_RETURN(&shdr->no_output_of_prior_pics_flag);
+        READ_BOOL_OR_RETURN(&shdr->long_term_reference_flag);
+    } else {
+        READ_BOOL_OR_RETURN(&shdr->adaptive_ref_pic_marking_mode_flag);
+
+        H264DecRefPicMarking *marking;
+        if (shdr->adaptive_ref_pic_marking_mode_flag) {
+            size_t i;
+            for (i = 0; i < std::size(shdr->ref_pic_marking); ++i) {
+                marking = &shdr->ref_pic_marking[i];
+
+                READ_UE_OR_RETURN(&marking->memory_mgmnt_control_operation);
+                if (marking->memory_mgmnt_control_operation == 0) {
+                    break;
+                }
+
+                if (marking->memory_mgmnt_control_operation == 1 || marking->memory_mgmnt_control_operation == 3) {
+                    READ_UE_OR_RETURN(&marking->difference_of_pic_nums_minus1);
+                }
+
+                if (marking->memory_mgmnt_control_operation == 2) {
+                    READ_UE_OR_RETURN(&marking->long_term_pic_num);
+                }
+
+                if (marking->memory_mgmnt_control_operation == 3 || marking->memory_mgmnt_control_operation == 6) {
+                    READ_UE_OR_RETURN(&marking->long_term_frame_idx);
+                }
+
+                if (marking->memory_mgmnt_control_operation == 4) {
+                    READ_UE_OR_RETURN(&marking->max_long_term_frame_idx_plus1);
+                }
+
+                if (marking->memory_mgmnt_control_operation > 6) {
+                    return kInvalidStream;
+                }
+            }
+
+            if (i == std::size(shdr->ref_pic_marking)) {
+                DVLOG(1) << "Ran out of dec ref pic marking fields";
+                return kUnsupportedStream;
+            }
+        }
+    }
+
+    shdr->dec_ref_pic_marking_bit_size = bits_left_at_start - br_.NumBitsLeft();
+    return kOk;
+}
+
+AVCParser::Result AVCParser::ParseSliceHeader(const H264NALU &nalu, H264SliceHeader *shdr) {
+    // See 7.4.3.
+    Result res;
+
+    *shdr = {};
+
+    shdr->idr_pic_flag = (nalu.nal_unit_type == 5);
+    shdr->nal_ref_idc = nalu.nal_ref_idc;
+    shdr->nalu_data = nalu.data;
+    shdr->nalu_size = nalu.size;
+
+    READ_UE_OR_RETURN(&shdr->first_mb_in_slice);
+    READ_UE_OR_RETURN(&shdr->slice_type);
+    IN_RANGE_OR_RETURN(shdr->slice_type, 0, 9);
+
+    READ_UE_OR_RETURN(&shdr->pic_parameter_set_id);
+    IN_RANGE_OR_RETURN(shdr->pic_parameter_set_id, 0, 255);
+
+    auto pps_slot = pps_slots[shdr->pic_parameter_set_id];
+    if (!pps_slot || !sps_slots[pps_slot->ps.seq_parameter_set_id]) {
+        DVLOG(1) << "slice refers to missing PPS " << shdr->pic_parameter_set_id;
+        return kMissingParameterSet;
+    }
+    pps = &pps_slot->ps;
+    sps = &sps_slots[pps->seq_parameter_set_id]->ps;
+
+    if (sps->separate_colour_plane_flag) {
+        DVLOG(1) << "Separate colour planes not supported";
+        return kUnsupportedStream;
+    }
+
+    READ_BITS_OR_RETURN(sps->log2_max_frame_num_minus4 + 4, &shdr->frame_num);
+    if (!sps->frame_mbs_only_flag) {
+        READ_BOOL_OR_RETURN(&shdr->field_pic_flag);
+        if (shdr->field_pic_flag) {
+            DVLOG(1) << "Field pictures not supported";
+            return kUnsupportedStream;
+        }
+    }
+
+    if (shdr->idr_pic_flag) {
+        READ_UE_OR_RETURN(&shdr->idr_pic_id);
+    }
+
+    size_t bits_left_at_pic_order_cnt_start = br_.NumBitsLeft();
+    if (sps->pic_order_cnt_type == 0) {
+        READ_BITS_OR_RETURN(sps->log2_max_pic_order_cnt_lsb_minus4 + 4, &shdr->pic_order_cnt_lsb);
+        if (pps->bottom_field_pic_order_in_frame_present_flag && !shdr->field_pic_flag) {
+            READ_SE_OR_RETURN(&shdr->delta_pic_order_cnt_bottom);
+        }
+    }
+
+    if (sps->pic_order_cnt_type == 1 && !sps->delta_pic_order_always_zero_flag) {
+        READ_SE_OR_RETURN(&shdr->delta_pic_order_cnt0);
+        if (pps->bottom_field_pic_order_in_frame_present_flag && !shdr->field_pic_flag) {
+            READ_SE_OR_RETURN(&shdr->delta_pic_order_cnt1);
+        }
+    }
+
+    shdr->pic_order_cnt_bit_size = bits_left_at_pic_order_cnt_start - br_.NumBitsLeft();
+
+    if (pps->redundant_pic_cnt_present_flag) {
+        READ_UE_OR_RETURN(&shdr->redundant_pic_cnt);
+        IN_RANGE_OR_RETURN(shdr->redundant_pic_cnt, 0, 127);
+    }
+
+    if (shdr->IsBSlice()) {
+        READ_BOOL_OR_RETURN(&shdr->direct_spatial_mv_pred_flag);
+    }
+
+    if (shdr->IsPSlice() || shdr->IsSPSlice() || shdr->IsBSlice()) {
+        READ_BOOL_OR_RETURN(&shdr->num_ref_idx_active_override_flag);
+        if (shdr->num_ref_idx_active_override_flag) {
+            READ_UE_OR_RETURN(&shdr->num_ref_idx_l0_active_minus1);
+            if (shdr->IsBSlice()) {
+                READ_UE_OR_RETURN(&shdr->num_ref_idx_l1_active_minus1);
+            }
+        } else {
+            shdr->num_ref_idx_l0_active_minus1 = pps->num_ref_idx_l0_default_active_minus1;
+            if (shdr->IsBSlice()) {
+                shdr->num_ref_idx_l1_active_minus1 = pps->num_ref_idx_l1_default_active_minus1;
+            }
+        }
+    }
+    // frames only, fields may use up to 32
+    IN_RANGE_OR_RETURN(shdr->num_ref_idx_l0_active_minus1, 0, 15);
+    IN_RANGE_OR_RETURN(shdr->num_ref_idx_l1_active_minus1, 0, 15);
+
+    res = ParseRefPicListModifications(shdr);
+    if (res != kOk) {
+        return res;
+    }
+
+    if ((pps->weighted_pred_flag && (shdr->IsPSlice() || shdr->IsSPSlice())) || (pps->weighted_bipred_idc == 1 && shdr->IsBSlice())) {
+        res = ParsePredWeightTable(*sps, shdr);
+        if (res != kOk) {
+            return res;
+        }
+    }
+
+    if (nalu.nal_ref_idc != 0) {
+        res = ParseDecRefPicMarking(shdr);
+        if (res != kOk) {
+            return res;
+        }
+    }
+
+    if (pps->entropy_coding_mode_flag && !shdr->IsISlice() && !shdr->IsSISlice()) {
+        READ_UE_OR_RETURN(&shdr->cabac_init_idc);
+        IN_RANGE_OR_RETURN(shdr->cabac_init_idc, 0, 2);
+    }
+
+    READ_SE_OR_RETURN(&shdr->slice_qp_delta);
+
+    if (shdr->IsSPSlice() || shdr->IsSISlice()) {
+        if (shdr->IsSPSlice()) {
+            READ_BOOL_OR_RETURN(&shdr->sp_for_switch_flag);
+        }
+        READ_SE_OR_RETURN(&shdr->slice_qs_delta);
+    }
+
+    if (pps->deblocking_filter_control_present_flag) {
+        READ_UE_OR_RETURN(&shdr->disable_deblocking_filter_idc);
+        IN_RANGE_OR_RETURN(shdr->disable_deblocking_filter_idc, 0, 2);
+
+        if (shdr->disable_deblocking_filter_idc != 1) {
+            READ_SE_OR_RETURN(&shdr->slice_alpha_c0_offset_div2);
+            IN_RANGE_OR_RETURN(shdr->slice_alpha_c0_offset_div2, -6, 6);
+
+            READ_SE_OR_RETURN(&shdr->slice_beta_offset_div2);
+            IN_RANGE_OR_RETURN(shdr->slice_beta_offset_div2, -6, 6);
+        }
+    }
+
+    size_t epb = br_.NumEmulationPreventionBytesRead();
+    shdr->header_bit_size = (shdr->nalu_size - epb) * 8 - br_.NumBitsLeft();
+
+    return kOk;
+}
+
+/* 7.3.2.3, only looks for a recovery point, which marks a picture decoding
+ * can start from when a stream has no IDR pictures after the first */
+AVCParser::Result AVCParser::ParseSEI(bool *recovery_point) {
+    *recovery_point = false;
+    do {
+        int byte;
+        int payload_type = 0;
+        do {
+            READ_BITS_OR_RETURN(8, &byte);
+            payload_type += byte;
+        } while (byte == 0xff);
+
+        int payload_size = 0;
+        do {
+            READ_BITS_OR_RETURN(8, &byte);
+            payload_size += byte;
+        } while (byte == 0xff);
+        TRUE_OR_RETURN((off_t) payload_size * 8 <= br_.NumBitsLeft());
+
+        if (payload_type == H264SEIMessage::kSEIRecoveryPoint) {
+            H264SEIRecoveryPoint rp;
+            READ_UE_OR_RETURN(&rp.recovery_frame_cnt);
+            READ_BOOL_OR_RETURN(&rp.exact_match_flag);
+            READ_BOOL_OR_RETURN(&rp.broken_link_flag);
+            READ_BITS_OR_RETURN(2, &rp.changing_slice_group_idc);
+            *recovery_point = true;
+            return kOk;
+        }
+        SKIP_BITS_OR_RETURN(payload_size * 8);
+    } while (br_.HasMoreRBSPData());
+
+    return kOk;
+}
+
+// Code below is Copyright 2023 Jamscape ApS. All rights reserved.
+
+void AVCParser::GetDimensions(int *pw, int *ph) {
+    if (!sps) {
+        errx(1, "%s: no SPS", __PRETTY_FUNCTION__);
+    }
+    *pw = (sps->pic_width_in_mbs_minus1 + 1) * 16;
+    *ph = (sps->pic_height_in_map_units_minus1 + 1) * 16 * (2 - sps->frame_mbs_only_flag);
+}
+
+void AVCParser::GetCropRect(int *px, int *py, int *pw, int *ph) {
+    if (!sps) {
+        errx(1, "%s: no SPS", __PRETTY_FUNCTION__);
+    }
+
+    /* Equations 7-19 to 7-22, offsets are in chroma samples and for
+     * interlaced content in field rows */
+    int crop_unit_x = sps->chroma_array_type == 1 || sps->chroma_array_type == 2 ? 2 : 1;
+    int crop_unit_y = (sps->chroma_array_type == 1 ? 2 : 1) * (2 - sps->frame_mbs_only_flag);
+    int width, height;
+    GetDimensions(&width, &height);
+    *px = sps->frame_crop_left_offset * crop_unit_x;
+    *py = sps->frame_crop_top_offset * crop_unit_y;
+    *pw = width - (sps->frame_crop_left_offset + sps->frame_crop_right_offset) * crop_unit_x;
+    *ph = height - (sps->frame_crop_top_offset + sps->frame_crop_bottom_offset) * crop_unit_y;
+}
+
+void AVCParser::GetUnpaddedDimensions(int *pw, int *ph) {
+    int x, y;
+    GetCropRect(&x, &y, pw, ph);
+}
+
+void AVCParser::GetColorDescription(int *matrix_coefficients, bool *full_range) {
+    if (!sps) {
+        errx(1, "%s: no SPS", __PRETTY_FUNCTION__);
+    }
+    *matrix_coefficients = sps->colour_description_present_flag ? sps->matrix_coefficients : 2;
+    *full_range = sps->video_signal_type_present_flag && sps->video_full_range_flag;
+}
+
+/* number of frames the decoder needs to hold for the active SPS, including
+ * the current one. Without bitstream restrictions in the VUI this is
+ * MaxDpbFrames for the level, from MaxDpbMbs of Table A-1. */
+int AVCParser::GetMaxDecPicBuffering() {
+    if (!sps) {
+        errx(1, "%s: no SPS", __PRETTY_FUNCTION__);
+    }
+    int n;
+    if (sps->bitstream_restriction_flag) {
+        n = sps->max_dec_frame_buffering;
+    } else {
+        int max_dpb_mbs;
+        switch (sps->level_idc) {
+            case 9:
+            case 10:
+                max_dpb_mbs = 396;
+                break;
+            case 11:
+                max_dpb_mbs = 900;
+                break;
+            case 12:
+            case 13:
+            case 20:
+                max_dpb_mbs = 2376;
+                break;
+            case 21:
+                max_dpb_mbs = 4752;
+                break;
+            case 22:
+            case 30:
+                max_dpb_mbs = 8100;
+                break;
+            case 31:
+                max_dpb_mbs = 18000;
+                break;
+            case 32:
+                max_dpb_mbs = 20480;
+                break;
+            case 40:
+            case 41:
+                max_dpb_mbs = 32768;
+                break;
+            case 42:
+                max_dpb_mbs = 34816;
+                break;
+            case 50:
+                max_dpb_mbs = 110400;
+                break;
+            case 51:
+            case 52:
+                max_dpb_mbs = 184320;
+                break;
+            default:
+                max_dpb_mbs = 696320;
+                break;
+        }
+        int width, height;
+        GetDimensions(&width, &height);
+        n = std::min(max_dpb_mbs / ((width / 16) * (height / 16)), kMaxRefFrames);
+    }
+    return std::max(n, sps->max_num_ref_frames) + 1;
+}
+
+/* index into dpb of the short-term frame with the given PicNum, or -1 */
+int AVCParser::FindShortTerm(int pic_num) {
+    int max_frame_num = 1 << (sps->log2_max_frame_num_minus4 + 4);
+    for (int i = 0; i < dpb_size; ++i) {
+        // 8.2.4.1: FrameNumWrap, which is PicNum for frames
+        int frame_num = dpb[i].frame_num;
+        if (frame_num > curr.entry.frame_num) {
+            frame_num -= max_frame_num;
+        }
+        if (!dpb[i].long_term && frame_num == pic_num) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int AVCParser::FindLongTerm(int long_term_pic_num) {
+    for (int i = 0; i < dpb_size; ++i) {
+        if (dpb[i].long_term && dpb[i].long_term_frame_idx == long_term_pic_num) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void AVCParser::RemoveReference(int i) {
+    std::copy(dpb + i + 1, dpb + dpb_size, dpb + i);
+    --dpb_size;
+}
+
+/* 8.2.1, returns TopFieldOrderCnt */
+int AVCParser::ComputePOC(int *bottom) {
+    auto slice_hdr = &shdr1;
+    bool idr = slice_hdr->idr_pic_flag;
+    int max_frame_num = 1 << (sps->log2_max_frame_num_minus4 + 4);
+    int top = 0;
+
+    /* FrameNumOffset, for types 1 and 2 */
+    int frame_num_offset = 0;
+    if (!idr) {
+        int prev_offset = prev_mmco5 ? 0 : prev_frame_num_offset;
+        frame_num_offset = prev_frame_num > slice_hdr->frame_num ? prev_offset + max_frame_num : prev_offset;
+    }
+    curr.frame_num_offset = frame_num_offset;
+
+    switch (sps->pic_order_cnt_type) {
+        case 0: {
+            int max_lsb = 1 << (sps->log2_max_pic_order_cnt_lsb_minus4 + 4);
+            int prev_msb = idr ? 0 : prev_poc_msb;
+            int prev_lsb = idr ? 0 : prev_poc_lsb;
+            int lsb = slice_hdr->pic_order_cnt_lsb;
+            int msb;
+            if (lsb < prev_lsb && prev_lsb - lsb >= max_lsb / 2) {
+                msb = prev_msb + max_lsb;
+            } else if (lsb > prev_lsb && lsb - prev_lsb > max_lsb / 2) {
+                msb = prev_msb - max_lsb;
+            } else {
+                msb = prev_msb;
+            }
+            curr.poc_msb = msb;
+            curr.poc_lsb = lsb;
+            top = msb + lsb;
+            *bottom = top + slice_hdr->delta_pic_order_cnt_bottom;
+            break;
+        }
+        case 1: {
+            int n = sps->num_ref_frames_in_pic_order_cnt_cycle;
+            int abs_frame_num = n ? frame_num_offset + slice_hdr->frame_num : 0;
+            if (!slice_hdr->nal_ref_idc && abs_frame_num > 0) {
+                --abs_frame_num;
+            }
+            int expected = 0;
+            if (abs_frame_num > 0) {
+                int cycle_cnt = (abs_frame_num - 1) / n;
+                int in_cycle = (abs_frame_num - 1) % n;
+                expected = cycle_cnt * sps->expected_delta_per_pic_order_cnt_cycle;
+                for (int i = 0; i <= in_cycle; ++i) {
+                    expected += sps->offset_for_ref_frame[i];
+                }
+            }
+            if (!slice_hdr->nal_ref_idc) {
+                expected += sps->offset_for_non_ref_pic;
+            }
+            top = expected + slice_hdr->delta_pic_order_cnt0;
+            *bottom = top + sps->offset_for_top_to_bottom_field + slice_hdr->delta_pic_order_cnt1;
+            break;
+        }
+        case 2: {
+            if (!idr) {
+                top = 2 * (frame_num_offset + slice_hdr->frame_num) - !slice_hdr->nal_ref_idc;
+            }
+            *bottom = top;
+            break;
+        }
+    }
+    return top;
+}
+
+/* called on the first slice of each picture */
+void AVCParser::UpdateReferences() {
+    auto slice_hdr = &shdr1;
+    int max_frame_num = 1 << (sps->log2_max_frame_num_minus4 + 4);
+
+    if (have_curr) {
+        MarkReferences();
+        have_curr = false;
+    }
+
+    bool idr = slice_hdr->idr_pic_flag;
+    if (idr) {
+        /* 8.2.5.1: all reference pictures are marked as unused */
+        dpb_size = 0;
+    } else if (slice_hdr->frame_num != prev_ref_frame_num && slice_hdr->frame_num != (prev_ref_frame_num + 1) % max_frame_num) {
+        /* 8.2.5.2 would fill the gap with "non-existing" frames, we rely on
+         * the sliding window instead. Unless the SPS allows gaps, frames
+         * were lost. */
+        if (!sps->gaps_in_frame_num_value_allowed_flag) {
+            ++error_stats.missing_references;
+        }
+    }
+
+    curr.idr = idr;
+    curr.reference = slice_hdr->nal_ref_idc != 0;
+    curr.long_term_reference_flag = slice_hdr->long_term_reference_flag;
+    curr.adaptive_ref_pic_marking_mode_flag = slice_hdr->adaptive_ref_pic_marking_mode_flag;
+    curr.mmco5 = false;
+    curr.num_mmcos = 0;
+    if (curr.adaptive_ref_pic_marking_mode_flag) {
+        for (auto &marking : slice_hdr->ref_pic_marking) {
+            if (marking.memory_mgmnt_control_operation == 0) {
+                break;
+            }
+            curr.mmco5 |= marking.memory_mgmnt_control_operation == 5;
+            curr.mmcos[curr.num_mmcos++] = marking;
+        }
+    }
+
+    auto &e = curr.entry;
+    e.frame_num = slice_hdr->frame_num;
+    e.top_poc = ComputePOC(&e.bottom_poc);
+    e.long_term = false;
+    e.long_term_frame_idx = 0;
+
+    bool taken[kMaxRefFrames + 1] = {};
+    for (int i = 0; i < dpb_size; ++i) {
+        taken[dpb[i].slot] = true;
+    }
+    int slot = 0;
+    while (taken[slot]) {
+        ++slot;
+    }
+    e.slot = slot;
+    have_curr = true;
+}
+
+/* 8.2.5, once the current picture is decoded */
+void AVCParser::MarkReferences() {
+    auto &e = curr.entry;
+    int max_frame_num = 1 << (sps->log2_max_frame_num_minus4 + 4);
+
+    if (curr.reference) {
+        if (curr.idr) {
+            if (curr.long_term_reference_flag) {
+                e.long_term = true;
+                e.long_term_frame_idx = 0;
+                max_long_term_frame_idx = 0;
+            } else {
+                max_long_term_frame_idx = -1;
+            }
+        } else if (curr.adaptive_ref_pic_marking_mode_flag) {
+            // 8.2.5.4
+            for (int i = 0; i < curr.num_mmcos; ++i) {
+                auto &m = curr.mmcos[i];
+                int j, k;
+                switch (m.memory_mgmnt_control_operation) {
+                    case 1:
+                        j = FindShortTerm(e.frame_num - (m.difference_of_pic_nums_minus1 + 1));
+                        if (j < 0) {
+                            ++error_stats.missing_references;
+                            break;
+                        }
+                        RemoveReference(j);
+                        break;
+                    case 2:
+                        j = FindLongTerm(m.long_term_pic_num);
+                        if (j < 0) {
+                            ++error_stats.missing_references;
+                            break;
+                        }
+                        RemoveReference(j);
+                        break;
+                    case 3:
+                        j = FindShortTerm(e.frame_num - (m.difference_of_pic_nums_minus1 + 1));
+                        if (j < 0) {
+                            ++error_stats.missing_references;
+                            break;
+                        }
+                        k = FindLongTerm(m.long_term_frame_idx);
+                        if (k >= 0) {
+                            RemoveReference(k);
+                            j -= k < j;
+                        }
+                        dpb[j].long_term = true;
+                        dpb[j].long_term_frame_idx = m.long_term_frame_idx;
+                        break;
+                    case 4:
+                        max_long_term_frame_idx = m.max_long_term_frame_idx_plus1 - 1;
+                        for (j = dpb_size - 1; j >= 0; --j) {
+                            if (dpb[j].long_term && dpb[j].long_term_frame_idx > max_long_term_frame_idx) {
+                                RemoveReference(j);
+                            }
+                        }
+                        break;
+                    case 5:
+                        dpb_size = 0;
+                        max_long_term_frame_idx = -1;
+                        break;
+                    case 6:
+                        k = FindLongTerm(m.long_term_frame_idx);
+                        if (k >= 0) {
+                            RemoveReference(k);
+                        }
+                        e.long_term = true;
+                        e.long_term_frame_idx = m.long_term_frame_idx;
+                        break;
+                }
+            }
+        } else {
+            // 8.2.5.3 Sliding window
+            int num_short_term = 0;
+            for (int i = 0; i < dpb_size; ++i) {
+                num_short_term += !dpb[i].long_term;
+            }
+            if (num_short_term && dpb_size >= std::max(sps->max_num_ref_frames, 1)) {
+                int oldest = -1;
+                int oldest_wrap = INT32_MAX;
+                for (int i = 0; i < dpb_size; ++i) {
+                    int wrap = dpb[i].frame_num > e.frame_num ? dpb[i].frame_num - max_frame_num : dpb[i].frame_num;
+                    if (!dpb[i].long_term && wrap < oldest_wrap) {
+                        oldest = i;
+                        oldest_wrap = wrap;
+                    }
+                }
+                RemoveReference(oldest);
+            }
+        }
+
+        if (curr.mmco5) {
+            /* the picture now counts as frame_num 0 with POC 0 */
+            int temp = std::min(e.top_poc, e.bottom_poc);
+            e.frame_num = 0;
+            e.top_poc -= temp;
+            e.bottom_poc -= temp;
+        }
+        /* a broken stream may ask for more references than we can hold */
+        if (dpb_size == kMaxRefFrames) {
+            RemoveReference(0);
+        }
+        dpb[dpb_size++] = e;
+
+        prev_ref_frame_num = e.frame_num;
+        prev_poc_msb = curr.mmco5 ? 0 : curr.poc_msb;
+        prev_poc_lsb = curr.mmco5 ? e.top_poc : curr.poc_lsb;
+    }
+
+    prev_frame_num = curr.mmco5 ? 0 : e.frame_num;
+    prev_frame_num_offset = curr.frame_num_offset;
+    prev_mmco5 = curr.mmco5;
+}
+
+void AVCParser::FillDXVA(DXVA_PicParams_H264 *pp, DXVA_Qmatrix_H264 *pim) {
+    memset(pp, 0, sizeof(*pp));
+    memset(pim, 0, sizeof(*pim));
+
+    auto slice_hdr = &shdr1;
+    pp->wFrameWidthInMbsMinus1 = sps->pic_width_in_mbs_minus1;
+    pp->wFrameHeightInMbsMinus1 = (sps->pic_height_in_map_units_minus1 + 1) * (2 - sps->frame_mbs_only_flag) - 1;
+    pp->CurrPic.Index7Bits = curr.entry.slot;
+    pp->CurrPic.AssociatedFlag = 0; // frame, or top field
+    pp->num_ref_frames = sps->max_num_ref_frames;
+
+    pp->field_pic_flag = slice_hdr->field_pic_flag;
+    pp->MbaffFrameFlag = sps->mb_adaptive_frame_field_flag && !slice_hdr->field_pic_flag;
+    pp->residual_colour_transform_flag = sps->separate_colour_plane_flag;
+    pp->sp_for_switch_flag = slice_hdr->sp_for_switch_flag;
+    pp->chroma_format_idc = sps->chroma_format_idc;
+    pp->RefPicFlag = curr.reference;
+    pp->constrained_intra_pred_flag = pps->constrained_intra_pred_flag;
+    pp->weighted_pred_flag = pps->weighted_pred_flag;
+    pp->weighted_bipred_idc = pps->weighted_bipred_idc;
+    pp->MbsConsecutiveFlag = 1; // no slice groups
+    pp->frame_mbs_only_flag = sps->frame_mbs_only_flag;
+    pp->transform_8x8_mode_flag = pps->transform_8x8_mode_flag;
+    pp->MinLumaBipredSize8x8Flag = sps->level_idc >= 31;
+    /* judged from the first slice, like IntraPicFlag for HEVC */
+    pp->IntraPicFlag = slice_hdr->IsISlice() || slice_hdr->IsSISlice();
+
+    pp->bit_depth_luma_minus8 = sps->bit_depth_luma_minus8;
+    pp->bit_depth_chroma_minus8 = sps->bit_depth_chroma_minus8;
+    pp->StatusReportFeedbackNumber = 1;
+
+    pp->CurrFieldOrderCnt[0] = curr.entry.top_poc;
+    pp->CurrFieldOrderCnt[1] = curr.entry.bottom_poc;
+
+    memset(pp->RefFrameList, 0xff, sizeof(pp->RefFrameList));
+    for (int i = 0; i < dpb_size; ++i) {
+        pp->RefFrameList[i].Index7Bits = dpb[i].slot;
+        pp->RefFrameList[i].AssociatedFlag = dpb[i].long_term;
+        pp->FieldOrderCntList[i][0] = dpb[i].top_poc;
+        pp->FieldOrderCntList[i][1] = dpb[i].bottom_poc;
+        pp->FrameNumList[i] = dpb[i].long_term ? dpb[i].long_term_frame_idx : dpb[i].frame_num;
+        pp->UsedForReferenceFlags |= 3 << (2 * i); // both fields
+    }
+
+    pp->pic_init_qs_minus26 = pps->pic_init_qs_minus26;
+    pp->chroma_qp_index_offset = pps->chroma_qp_index_offset;
+    pp->second_chroma_qp_index_offset = pps->second_chroma_qp_index_offset;
+    pp->ContinuationFlag = 1;
+    pp->pic_init_qp_minus26 = pps->pic_init_qp_minus26;
+    pp->num_ref_idx_l0_active_minus1 = pps->num_ref_idx_l0_default_active_minus1;
+    pp->num_ref_idx_l1_active_minus1 = pps->num_ref_idx_l1_default_active_minus1;
+    pp->frame_num = slice_hdr->frame_num;
+    pp->log2_max_frame_num_minus4 = sps->log2_max_frame_num_minus4;
+    pp->pic_order_cnt_type = sps->pic_order_cnt_type;
+    pp->log2_max_pic_order_cnt_lsb_minus4 = sps->log2_max_pic_order_cnt_lsb_minus4;
+    pp->delta_pic_order_always_zero_flag = sps->delta_pic_order_always_zero_flag;
+    pp->direct_8x8_inference_flag = sps->direct_8x8_inference_flag;
+    pp->entropy_coding_mode_flag = pps->entropy_coding_mode_flag;
+    pp->pic_order_present_flag = pps->bottom_field_pic_order_in_frame_present_flag;
+    pp->num_slice_groups_minus1 = pps->num_slice_groups_minus1;
+    pp->deblocking_filter_control_present_flag = pps->deblocking_filter_control_present_flag;
+    pp->redundant_pic_cnt_present_flag = pps->redundant_pic_cnt_present_flag;
+
+    /* lists are passed in the zig-zag order they were parsed in, the PPS
+     * holds the ones that apply, see ParsePPS() */
+    memcpy(pim->bScalingLists4x4, pps->scaling_list4x4, sizeof(pim->bScalingLists4x4));
+    memcpy(pim->bScalingLists8x8[0], pps->scaling_list8x8[0], sizeof(pim->bScalingLists8x8[0]));
+    memcpy(pim->bScalingLists8x8[1], pps->scaling_list8x8[1], sizeof(pim->bScalingLists8x8[1]));
+}
+
+AVCParser::AVCParser()
+    : ps_arena(0x100000), au_arena(0x40000),
+      /* see HEVCParser, the NALU buffer is allocated once, up front */
+      scanner((uint8_t *) ps_arena.Alloc(max_buffer), max_buffer) {
+}
+
+void AVCParser::GetAllocationStats(AllocationStats *stats) const {
+    stats->param_sets = ps_arena.GetStats();
+    stats->access_unit = au_arena.GetStats();
+}
+
+template <class T, size_t N>
+bool AVCParser::IsCachedParamSet(ParamSetSlot<T> *(&slots)[N], const uint8_t *bytes, size_t size) {
+    for (auto slot : slots) {
+        if (slot && slot->raw_size == size && !memcmp(slot->raw, bytes, size)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+template <class T>
+T *AVCParser::StoreParamSet(ParamSetSlot<T> **pslot, const T *ps, const uint8_t *bytes, size_t size) {
+    auto slot = *pslot;
+    if (!slot) {
+        slot = *pslot = ps_arena.New<ParamSetSlot<T>>();
+    }
+    slot->ps = *ps;
+    if (size <= kMaxCachedParamSetSize) {
+        memcpy(slot->raw, bytes, size);
+        slot->raw_size = size;
+    } else {
+        slot->raw_size = 0;
+    }
+    return &slot->ps;
+}
+
+void AVCParser::StartAccessUnit(const uint8_t *bytes, size_t size, unsigned type) {
+    /* 7.4.1.2.3: the first slice of a picture, or an SEI, SPS, PPS, AUD or
+     * NALU type 14..18 following a VCL NALU, starts a new access unit. */
+    bool is_vcl = type >= H264NALU::kNonIDRSlice && type <= H264NALU::kIDRSlice;
+    bool starts_au;
+    if (is_vcl) {
+        starts_au = size > 1 && (bytes[1] & 0x80); // first_mb_in_slice == 0
+    } else {
+        starts_au = au_has_vcl && ((type >= H264NALU::kSEIMessage && type <= H264NALU::kAUD) || (type >= H264NALU::kPrefix && type <= H264NALU::kReserved18));
+    }
+    if (starts_au) {
+        au_arena.Reset();
+        au_has_vcl = false;
+    }
+    au_has_vcl |= is_vcl;
+}
+
+void AVCParser::DropNALU(Result res, size_t size) {
+    DVLOG(1) << "dropping NALU of " << size << " bytes, error " << res;
+    TRACE_INSTANT(1, "drop", res);
+    ++error_stats.errors;
+    ++error_stats.nals_dropped;
+    error_stats.bytes_skipped += size;
+    error_stats.last_error = res;
+    if (!resync) {
+        ++error_stats.resyncs;
+        resync = true;
+    }
+}
+
+AVCParser::Result AVCParser::ParseNALU(const uint8_t *p, size_t size) {
+
+    br_.Initialize(p, size);
+
+    // Read NALU header, skip the forbidden_zero_bit, but check for it.
+    int data;
+    READ_BITS_OR_RETURN(1, &data);
+    TRUE_OR_RETURN(data == 0);
+
+    READ_BITS_OR_RETURN(2, &nalu.nal_ref_idc);
+    READ_BITS_OR_RETURN(5, &nalu.nal_unit_type);
+    nalu.data = p;
+    nalu.size = size;
+
+    unsigned type = nalu.nal_unit_type;
+    StartAccessUnit(p, size, type);
+
+    /* after an error, drop everything up to the next IDR picture, recovery
+     * point or parameter set, as HEVCParser does */
+    if (resync && type == H264NALU::kNonIDRSlice) {
+        ++error_stats.nals_dropped;
+        error_stats.bytes_skipped += size;
+        return kOk;
+    }
+
+    Result res = kOk;
+    if (type == H264NALU::kSPS) {
+        if (!IsCachedParamSet(sps_slots, p, size)) {
+            auto scratch = au_arena.New<H264SPS>();
+            res = ParseSPS(scratch);
+            if (res != kOk) {
+                return res;
+            }
+            StoreParamSet(&sps_slots[scratch->seq_parameter_set_id], scratch, p, size);
+            /* PPS scaling lists and trailing fields depend on their SPS, so
+             * force a re-parse of any PPS that refers to the new one. */
+            for (auto slot : pps_slots) {
+                if (slot && slot->ps.seq_parameter_set_id == scratch->seq_parameter_set_id) {
+                    slot->raw_size = 0;
+                }
+            }
+        }
+        resync = false;
+    } else if (type == H264NALU::kPPS) {
+        if (!IsCachedParamSet(pps_slots, p, size)) {
+            auto scratch = au_arena.New<H264PPS>();
+            res = ParsePPS(scratch);
+            if (res != kOk) {
+                return res;
+            }
+            StoreParamSet(&pps_slots[scratch->pic_parameter_set_id], scratch, p, size);
+        }
+        resync = false;
+    } else if (type == H264NALU::kNonIDRSlice || type == H264NALU::kIDRSlice) {
+        TRACE_INSTANT(3, "slice", type);
+        res = ParseSliceHeader(nalu, &shdr1);
+        if (res != kOk) {
+            return res;
+        }
+        if (shdr1.idr_pic_flag) {
+            resync = false;
+        }
+        if (shdr1.redundant_pic_cnt) {
+            /* the primary coded picture is all we need */
+            ++error_stats.nals_dropped;
+            error_stats.bytes_skipped += size;
+            return kOk;
+        }
+        if (shdr1.first_mb_in_slice == 0) {
+            UpdateReferences();
+        }
+        have_frame = true;
+        decode_cb(p, size, decode_opaque);
+    } else if (type >= H264NALU::kSliceDataA && type <= H264NALU::kSliceDataC) {
+        return kUnsupportedStream;
+    } else if (type == H264NALU::kSEIMessage) {
+        /* an SEI we cannot make sense of is no reason to drop pictures */
+        bool recovery_point;
+        if (ParseSEI(&recovery_point) == kOk && recovery_point) {
+            resync = false;
+        }
+    } else {
+        /* AUD, end of sequence/stream, filler data, SPS extensions, and
+         * reserved or unspecified NALU types carry nothing the decoder
+         * needs. */
+    }
+    return res;
+}
+
+void AVCParser::OnNALU(const uint8_t *bytes, size_t size, void *opaque) {
+    auto parser = (AVCParser *) opaque;
+    if (!bytes) {
+        parser->DropNALU(kInvalidStream, size);
+        return;
+    }
+    auto res = parser->ParseNALU(bytes, size);
+    if (res != kOk) {
+        parser->DropNALU(res, size);
+    }
+}
+
+/* AVCDecoderConfigurationRecord, ISO/IEC 14496-15 5.3.3.1: version,
+ * profile, compatibility and level, lengthSizeMinusOne, then the SPS and PPS
+ * with 16 bit lengths. The extension for high profiles that may follow
+ * carries nothing we need. */
+bool AVCParser::ParseAvcC(const uint8_t *bytes, size_t size) {
+    const size_t header_size = 6;
+    if (size < header_size || bytes[0] != 1) {
+        return false;
+    }
+    int length_size = (bytes[4] & 3) + 1;
+    if (length_size == 3) {
+        return false;
+    }
+
+    size_t i = header_size - 1;
+    for (int list = 0; list < 2; ++list) {
+        if (size - i < 1) {
+            return false;
+        }
+        int count = list == 0 ? bytes[i] & 0x1f : bytes[i];
+        unsigned type = list == 0 ? H264NALU::kSPS : H264NALU::kPPS;
+        ++i;
+        for (int n = 0; n < count; ++n) {
+            if (size - i < 2) {
+                return false;
+            }
+            size_t len = (bytes[i] << 8) | bytes[i + 1];
+            i += 2;
+            if (len > size - i) {
+                return false;
+            }
+            if (len && (bytes[i] & 0x1f) == type) {
+                OnNALU(bytes + i, len, this);
+            }
+            i += len;
+        }
+    }
+    scanner.SetLengthSize(length_size);
+    return true;
+}
+
+bool AVCParser::Parse(const uint8_t *bytes, size_t compressed_size, decode_callback_t cb, void *opaque) {
+
+    TRACE_EVENT(2, "Parse", compressed_size);
+
+    decode_cb = cb;
+    decode_opaque = opaque;
+    have_frame = false;
+    scanner.Scan(bytes, compressed_size, OnNALU, this);
+    return have_frame;
+}
+
+bool AVCParser::Flush(decode_callback_t cb, void *opaque) {
+
+    TRACE_EVENT(2, "Flush", 0);
+
+    decode_cb = cb;
+    decode_opaque = opaque;
+    have_frame = false;
+    scanner.Flush(OnNALU, this);
+    return have_frame;
+}
+
+bool AVCParser::PushNALU(const uint8_t *bytes, size_t size, decode_callback_t cb, void *opaque) {
+
+    TRACE_EVENT(3, "PushNALU", size);
+
+    decode_cb = cb;
+    decode_opaque = opaque;
+    have_frame = false;
+    OnNALU(bytes, size, this);
+    return have_frame;
+}
@@ -0,0 +1,223 @@
+#ifndef __AVCPARSER_H__
+#define __AVCPARSER_H__
+
+#include <assert.h>
+#include <err.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "arena.h"
+#include "bit_reader_macros.h"
+#include "h264_parser.h"
+#include "nalscanner.h"
+#include "trace.h"
+
+struct _DXVA_PicParams_H264;
+struct _DXVA_Qmatrix_H264;
+
+/* H.264 counterpart of HEVCParser, with the same allocation-free design:
+ * parameter sets live in slots carved out of ps_arena, anything per access
+ * unit comes from au_arena, and NALUs are split by the same NALScanner.
+ * Slice NALUs are handed to the decode callback, and FillDXVA() builds the
+ * picture parameters for the picture they belong to. Only frame coding is
+ * supported, field pictures and FMO are reported as kUnsupportedStream. */
+
+class AVCParser {
+
+    typedef void (*decode_callback_t)(const uint8_t *bytes, size_t compressed_size, void *opaque);
+
+    H264BitReader br_;
+    H264NALU nalu;
+    H264SliceHeader shdr1;
+
+    /* active parameter sets, pointing into the slot tables below */
+    H264SPS *sps = nullptr;
+    H264PPS *pps = nullptr;
+
+    /* see HEVCParser, identical parameter sets repeated in front of every
+     * IDR are recognized by their raw bytes and not parsed again */
+    static const size_t kMaxCachedParamSetSize = 512;
+
+    template <class T>
+    struct ParamSetSlot {
+        T ps;
+        size_t raw_size;
+        uint8_t raw[kMaxCachedParamSetSize];
+    };
+
+    ParamSetSlot<H264SPS> *sps_slots[32] = {};
+    ParamSetSlot<H264PPS> *pps_slots[256] = {};
+
+    Arena ps_arena; // lives as long as the parser
+    Arena au_arena; // reset at the start of each access unit
+    bool au_has_vcl = false;
+
+    static const size_t max_buffer = 0x200000;
+    NALScanner scanner;
+
+    /* the callback and result of the Parse(), Flush() or PushNALU() call in
+     * progress */
+    decode_callback_t decode_cb = nullptr;
+    void *decode_opaque = nullptr;
+    bool have_frame = false;
+
+public:
+    enum Result {
+        kOk,
+        kInvalidStream, // error in stream
+        kUnsupportedStream, // stream not supported by the parser
+        kEOStream, // end of stream
+        kMissingParameterSet,
+    };
+
+    struct ErrorStats {
+        size_t errors; // NALUs that failed to parse
+        size_t resyncs; // times we had to wait for an IDR, recovery point or parameter set
+        size_t nals_dropped; // NALUs not passed on, including the failed ones
+        size_t bytes_skipped;
+        size_t missing_references; // frame_num gaps and MMCOs naming pictures not in the DPB
+        Result last_error;
+    };
+
+private:
+    ErrorStats error_stats = {};
+    bool resync = false;
+
+    /* reference picture state (8.2.1, 8.2.4, 8.2.5), updated on the first
+     * slice of each picture by UpdateReferences(). As in HEVCParser every
+     * picture gets the lowest DPB slot not held by a reference picture, and
+     * the current picture is only marked and added to dpb once the next
+     * one starts. */
+    static constexpr int kMaxRefFrames = 16;
+
+    struct DpbEntry {
+        int frame_num;
+        int long_term_frame_idx;
+        int top_poc;
+        int bottom_poc;
+        int slot;
+        bool long_term;
+    };
+
+    DpbEntry dpb[kMaxRefFrames];
+    int dpb_size = 0;
+
+    /* the current picture, and what its slice header asks of the marking
+     * process once it is done */
+    struct CurrPicture {
+        DpbEntry entry;
+        bool idr;
+        bool reference;
+        bool long_term_reference_flag;
+        bool adaptive_ref_pic_marking_mode_flag;
+        bool mmco5;
+        int poc_lsb;
+        int poc_msb;
+        int frame_num_offset;
+        int num_mmcos;
+        H264DecRefPicMarking mmcos[H264SliceHeader::kRefListSize];
+    };
+
+    CurrPicture curr = {};
+    bool have_curr = false;
+    int max_long_term_frame_idx = -1; // -1 for "no long-term frame indices"
+
+    /* 8.2.1 state carried from the previous (reference) picture */
+    int prev_poc_msb = 0;
+    int prev_poc_lsb = 0;
+    int prev_frame_num = 0;
+    int prev_frame_num_offset = 0;
+    int prev_ref_frame_num = 0;
+    bool prev_mmco5 = false;
+
+    // Table 7-2 and 7-3, in zig-zag order like the parsed lists.
+    static constexpr uint8_t kDefault4x4Intra[] = {
+        6, 13, 13, 20, 20, 20, 28, 28, 28, 28, 32, 32, 32, 37, 37, 42 };
+    static constexpr uint8_t kDefault4x4Inter[] = {
+        10, 14, 14, 20, 20, 20, 24, 24, 24, 24, 27, 27, 27, 30, 30, 34 };
+    static constexpr uint8_t kDefault8x8Intra[] = {
+        // clang-format off
+    6,  10, 10, 13, 11, 13, 16, 16, 16, 16, 18, 18, 18, 18, 18, 23,
+    23, 23, 23, 23, 23, 25, 25, 25, 25, 25, 25, 25, 27, 27, 27, 27,
+    27, 27, 27, 27, 29, 29, 29, 29, 29, 29, 29, 31, 31, 31, 31, 31,
+    31, 33, 33, 33, 33, 33, 36, 36, 36, 36, 38, 38, 38, 40, 40, 42, };
+    // clang-format on
+    static constexpr uint8_t kDefault8x8Inter[] = {
+        // clang-format off
+    9,  13, 13, 15, 13, 15, 17, 17, 17, 17, 19, 19, 19, 19, 19, 21,
+    21, 21, 21, 21, 21, 22, 22, 22, 22, 22, 22, 22, 24, 24, 24, 24,
+    24, 24, 24, 24, 25, 25, 25, 25, 25, 25, 25, 27, 27, 27, 27, 27,
+    27, 28, 28, 28, 28, 28, 30, 30, 30, 30, 32, 32, 32, 33, 33, 35, };
+    // clang-format on
+
+    // VUI parameters: Table E-1 "Meaning of sample aspect ratio indicator"
+    static constexpr int kTableSarWidth[] = { 0, 1, 12, 10, 16, 40, 24, 20, 32,
+        80, 18, 15, 64, 160, 4, 3, 2 };
+    static constexpr int kTableSarHeight[] = { 0, 1, 11, 11, 11, 33, 11, 11, 11,
+        33, 11, 11, 33, 99, 3, 2, 1 };
+
+    Result ParseScalingList(int size, uint8_t *scaling_list, bool *use_default);
+    Result ParseSPSScalingLists(H264SPS *sps);
+    Result ParsePPSScalingLists(const H264SPS &sps, H264PPS *pps);
+    Result ParseHRDParameters(H264SPS *sps);
+    Result ParseVUIParameters(H264SPS *sps);
+    Result ParseSPS(H264SPS *sps);
+    Result ParsePPS(H264PPS *pps);
+    Result ParseRefPicListModification(int num_ref_idx_active_minus1, H264ModificationOfPicNum *ref_list_mods);
+    Result ParseRefPicListModifications(H264SliceHeader *shdr);
+    Result ParseWeightingFactors(int num_ref_idx_active_minus1, int chroma_array_type, int luma_log2_weight_denom, int chroma_log2_weight_denom, H264WeightingFactors *w_facts);
+    Result ParsePredWeightTable(const H264SPS &sps, H264SliceHeader *shdr);
+    Result ParseDecRefPicMarking(H264SliceHeader *shdr);
+    Result ParseSliceHeader(const H264NALU &nalu, H264SliceHeader *shdr);
+    Result ParseSEI(bool *recovery_point);
+
+    template <class T, size_t N>
+    bool IsCachedParamSet(ParamSetSlot<T> *(&slots)[N], const uint8_t *bytes, size_t size);
+    template <class T>
+    T *StoreParamSet(ParamSetSlot<T> **pslot, const T *ps, const uint8_t *bytes, size_t size);
+    void StartAccessUnit(const uint8_t *bytes, size_t size, unsigned type);
+    Result ParseNALU(const uint8_t *bytes, size_t size);
+    static void OnNALU(const uint8_t *bytes, size_t size, void *opaque);
+    void DropNALU(Result res, size_t size);
+    void UpdateReferences();
+    void MarkReferences();
+    int ComputePOC(int *bottom);
+    int FindShortTerm(int pic_num);
+    int FindLongTerm(int long_term_pic_num);
+    void RemoveReference(int i);
+
+public:
+    struct AllocationStats {
+        Arena::Stats param_sets;
+        Arena::Stats access_unit;
+    };
+
+    AVCParser();
+
+    /* see HEVCParser::ParseHvcC(), for an avcC box */
+    bool ParseAvcC(const uint8_t *bytes, size_t size);
+    bool Parse(const uint8_t *bytes, size_t compressed_size, decode_callback_t cb, void *opaque);
+    /* see HEVCParser::Flush() */
+    bool Flush(decode_callback_t cb, void *opaque);
+    /* see HEVCParser::PushNALU() */
+    bool PushNALU(const uint8_t *bytes, size_t size, decode_callback_t cb, void *opaque);
+    void FillDXVA(_DXVA_PicParams_H264 *pp, _DXVA_Qmatrix_H264 *pim);
+    void GetDimensions(int *pw, int *ph);
+    void GetUnpaddedDimensions(int *pw, int *ph);
+    void GetCropRect(int *px, int *py, int *pw, int *ph);
+    /* see HEVCParser::GetColorDescription() */
+    void GetColorDescription(int *matrix_coefficients, bool *full_range);
+    int GetMaxDecPicBuffering();
+    void GetAllocationStats(AllocationStats *stats) const;
+    void GetErrorStats(ErrorStats *stats) const {
+        *stats = error_stats;
+    }
+
+}; // AVCParser
+
+#endif /* __AVCPARSER_H__ */
@@ -0,0 +1,36 @@
+#ifndef __AVCPICTURE_H__
+#define __AVCPICTURE_H__
+
+#include <windows.h>
+#include <dxva.h>
+
+#include <vector>
+
+#include "avcparser.h"
+#include "decodebackend.h"
+
+/* H.264 counterpart of HEVCPicture, the DXVA parameter buffers and slice
+ * data for one picture, built from the parser state in its decode callback.
+ * As there, BuildInPlace() refers to the slice data instead of copying it. */
+
+class AVCPicture {
+    DXVA_PicParams_H264 pic_params;
+    DXVA_Qmatrix_H264 qmatrix;
+    DXVA_Slice_H264_Short slice;
+    std::vector<uint8_t> bitstream;
+    DecodePicture picture;
+
+    void fill(AVCParser *parser, const uint8_t *bytes, size_t size);
+
+public:
+    /* bytes is one VCL NAL unit without start code, as passed to the
+     * parser's decode callback */
+    void Build(AVCParser *parser, const uint8_t *bytes, size_t size);
+    void BuildInPlace(AVCParser *parser, const uint8_t *bytes, size_t size);
+
+    const DecodePicture *Get() const {
+        return &picture;
+    }
+};
+
+#endif /* __AVCPICTURE_H__ */
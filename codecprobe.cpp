@@ -0,0 +1,172 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "avcparser.h"
+#include "codecprobe.h"
+#include "hevcparser.h"
+#include "trace.h"
+
+/* 7.4.1 of H.264: forbidden_zero_bit must be clear, nal_ref_idc must be set
+ * for parameter sets and IDR slices and clear for SEI, AUD, end of sequence
+ * or stream and filler data. Types 16-18, 22 and 23 are reserved, 0 and
+ * 24-31 are unspecified and never appear in an elementary stream. */
+static bool valid_h264_header(const uint8_t *p, size_t size) {
+    if (size < 1 || (p[0] & 0x80)) {
+        return false;
+    }
+    unsigned ref_idc = (p[0] >> 5) & 3;
+    unsigned type = p[0] & 0x1f;
+    switch (type) {
+        case 5:
+        case 7:
+        case 8:
+            return ref_idc != 0;
+        case 6:
+        case 9:
+        case 10:
+        case 11:
+        case 12:
+            return ref_idc == 0;
+        case 1:
+        case 2:
+        case 3:
+        case 4:
+        case 13:
+        case 14:
+        case 15:
+        case 19:
+        case 20:
+        case 21:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* 7.4.2.2 of HEVC: forbidden_zero_bit must be clear and TemporalId is one
+ * less than nuh_temporal_id_plus1, which must not be 0, and must be 0 for
+ * IRAP pictures, parameter sets and end of sequence or bitstream. We only
+ * decode the base layer, so nuh_layer_id must be 0 too. Types 10-15, 22-31
+ * and 41-47 are reserved, 48-63 unspecified. */
+static bool valid_hevc_header(const uint8_t *p, size_t size) {
+    if (size < 2 || (p[0] & 0x80)) {
+        return false;
+    }
+    unsigned type = (p[0] >> 1) & 0x3f;
+    unsigned layer_id = ((p[0] & 1) << 5) | (p[1] >> 3);
+    unsigned tid_plus1 = p[1] & 7;
+    if (layer_id != 0 || tid_plus1 == 0) {
+        return false;
+    }
+    if (type <= H265NALU::RASL_R || (type >= H265NALU::VPS_NUT && type <= H265NALU::SUFFIX_SEI_NUT)) {
+        bool tid0 = type == H265NALU::VPS_NUT || type == H265NALU::SPS_NUT || type == H265NALU::EOS_NUT || type == H265NALU::EOB_NUT;
+        return !tid0 || tid_plus1 == 1;
+    }
+    if (type >= H265NALU::BLA_W_LP && type <= H265NALU::RSV_IRAP_VCL23) {
+        return tid_plus1 == 1;
+    }
+    return false;
+}
+
+static void count_slice(const uint8_t *, size_t, void *opaque) {
+    ++*(int *) opaque;
+}
+
+void ProbeCodec(const uint8_t *bytes, size_t size, CodecProbeResult *result) {
+    TRACE_EVENT(1, "ProbeCodec", size);
+    uint64_t start = TraceNow();
+    *result = {};
+
+    /* find the start codes, only NALUs followed by another start code are
+     * known to be complete */
+    size_t last = 0;
+    /* where each parser starts, at the first parameter set for it: slices
+     * before that, as when joining a stream, refer to ones not seen and
+     * would fail to parse whatever the codec */
+    size_t first_h264 = SIZE_MAX, first_hevc = SIZE_MAX;
+    size_t nalu_start = 0;
+    bool have_nalu = false;
+    size_t zeros = 0;
+    for (size_t i = 0; i < size; ++i) {
+        uint8_t c = bytes[i];
+        if (zeros >= 2 && c == 1) {
+            size_t start_code = i - (zeros > 3 ? 3 : zeros);
+            if (have_nalu) {
+                ++result->nalus;
+                result->invalid_h264 += !valid_h264_header(bytes + nalu_start, start_code - nalu_start);
+                result->invalid_hevc += !valid_hevc_header(bytes + nalu_start, start_code - nalu_start);
+                last = start_code;
+            }
+            if (i + 1 < size) {
+                uint8_t header = bytes[i + 1];
+                if (first_h264 == SIZE_MAX && (header & 0x1f) == 7) {
+                    first_h264 = start_code;
+                }
+                unsigned hevc_type = (header >> 1) & 0x3f;
+                if (first_hevc == SIZE_MAX && (hevc_type == H265NALU::VPS_NUT || hevc_type == H265NALU::SPS_NUT)) {
+                    first_hevc = start_code;
+                }
+            }
+            nalu_start = i + 1;
+            have_nalu = true;
+        }
+        zeros = c ? 0 : zeros + 1;
+    }
+    if (!result->nalus) {
+        result->ns = TraceNow() - start;
+        return;
+    }
+    result->bytes_examined = last;
+
+    /* a parser run over the wrong codec fails early, on parameter sets it
+     * cannot parse or slices with no parameter set to refer to, and never
+     * gets to the callback. The parsers are only constructed here, their
+     * big buffers are not touched beyond the probed bytes. */
+    AVCParser::ErrorStats avc_errors = {};
+    if (first_h264 < last) {
+        auto avc = new AVCParser();
+        avc->Parse(bytes + first_h264, last - first_h264, count_slice, &result->slices_h264);
+        avc->Flush(count_slice, &result->slices_h264);
+        avc->GetErrorStats(&avc_errors);
+        delete avc;
+    }
+
+    HEVCParser::ErrorStats hevc_errors = {};
+    if (first_hevc < last) {
+        auto hevc = new HEVCParser();
+        hevc->Parse(bytes + first_hevc, last - first_hevc, count_slice, &result->slices_hevc);
+        hevc->Flush(count_slice, &result->slices_hevc);
+        hevc->GetErrorStats(&hevc_errors);
+        delete hevc;
+    }
+
+    bool h264_ok = result->slices_h264 && !avc_errors.errors && !result->invalid_h264;
+    bool hevc_ok = result->slices_hevc && !hevc_errors.errors && !result->invalid_hevc;
+    if (h264_ok && !hevc_ok) {
+        result->codec = kCodecH264;
+    } else if (hevc_ok && !h264_ok) {
+        result->codec = kCodecHEVC;
+    }
+    result->ns = TraceNow() - start;
+}
+
+CodecProbe::CodecProbe()
+    : buffer((uint8_t *) malloc(kMaxProbeSize)) {
+}
+
+CodecProbe::~CodecProbe() {
+    free(buffer);
+}
+
+bool CodecProbe::Append(const uint8_t *bytes, size_t n) {
+    if (n > kMaxProbeSize - size) {
+        return false;
+    }
+    memcpy(buffer + size, bytes, n);
+    size += n;
+    return true;
+}
+
+void CodecProbe::Probe(CodecProbeResult *result) {
+    ProbeCodec(buffer, size, result);
+}
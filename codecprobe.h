@@ -0,0 +1,67 @@
+#ifndef __CODECPROBE_H__
+#define __CODECPROBE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "decodebackend.h"
+
+/* decides whether an Annex-B stream is H.264 or HEVC from its first few KB,
+ * so the decoding layer can pick a parser and decoder once, up front, and
+ * the parsers never have to second-guess the NAL units they are given.
+ *
+ * Every complete NALU in the probed bytes has its header checked against the
+ * rules of both codecs (forbidden bit, nal_ref_idc or nuh_layer_id and
+ * TemporalId, reserved types), and the bytes are then run through both
+ * parsers, each from the first parameter set for it so that a stream joined
+ * part way can be identified too. A codec is only chosen once its parser has
+ * accepted the parameter sets and at least one slice referring to them,
+ * without errors and without any NALU header that is invalid for it. */
+
+struct CodecProbeResult {
+    VideoCodec codec; // kCodecUnknown until the stream has been identified
+    size_t bytes_examined; // up to the start of the last, incomplete NALU
+    int nalus;
+    int invalid_h264; // NALU headers not valid for H.264
+    int invalid_hevc; // NALU headers not valid for HEVC
+    int slices_h264; // slices accepted by the H.264 parser
+    int slices_hevc;
+    uint64_t ns; // time taken by the probe
+};
+
+class CodecProbe {
+    uint8_t *buffer;
+    size_t size = 0;
+
+public:
+    /* streams that have not been identified once this much has been seen
+     * are not going to be */
+    static constexpr size_t kMaxProbeSize = 0x10000;
+
+    CodecProbe();
+    ~CodecProbe();
+    CodecProbe(const CodecProbe &) = delete;
+    CodecProbe &operator=(const CodecProbe &) = delete;
+
+    /* adds bytes to the probe buffer, or returns false if they do not fit,
+     * so that a chunk is never split. The bytes are kept so they can be
+     * replayed into the chosen parser. */
+    bool Append(const uint8_t *bytes, size_t size);
+    void Probe(CodecProbeResult *result);
+    void Reset() {
+        size = 0;
+    }
+
+    const uint8_t *Bytes() const {
+        return buffer;
+    }
+
+    size_t Size() const {
+        return size;
+    }
+};
+
+/* probes a buffer in one go */
+void ProbeCodec(const uint8_t *bytes, size_t size, CodecProbeResult *result);
+
+#endif /* __CODECPROBE_H__ */
@@ -0,0 +1,724 @@
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#include <vector>
+
+#include "colorconvert.h"
+#include "workerpool.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define COLORCONVERT_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define COLORCONVERT_NEON
+#include <arm_neon.h>
+#endif
+
+/* gcc and clang want to be told which functions may use AVX2/SSE4.1 when the
+ * rest of the file is built for baseline x86-64, MSVC does not care. */
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#else
+#define TARGET_AVX2
+#define TARGET_SSE41
+#endif
+
+template <bool p010>
+static inline int32_t Sample(const uint8_t *p, int i) {
+    if (p010) {
+        return ((const uint16_t *) p)[i] >> 6;
+    } else {
+        return p[i] << 2;
+    }
+}
+
+static inline uint8_t Clamp(int32_t v) {
+    v >>= 16;
+    return v < 0 ? 0 : v > 255 ? 255 : (uint8_t) v;
+}
+
+template <bool p010>
+static void ConvertRowScalar(const ColorCoefficients &k, const uint8_t *y, const uint8_t *uv, uint8_t *dst, int width) {
+    for (int x = 0; x < width; ++x) {
+        int32_t l = k.y_scale * Sample<p010>(y, x) + k.y_bias;
+        int32_t u = Sample<p010>(uv, x & ~1) - 512;
+        int32_t v = Sample<p010>(uv, (x & ~1) + 1) - 512;
+        dst[4 * x + 0] = Clamp(l + k.u[0] * u + k.v[0] * v);
+        dst[4 * x + 1] = Clamp(l + k.u[1] * u + k.v[1] * v);
+        dst[4 * x + 2] = Clamp(l + k.u[2] * u + k.v[2] * v);
+        dst[4 * x + 3] = 0xff;
+    }
+}
+
+#ifdef COLORCONVERT_X86
+
+static void CpuId(int leaf, int subleaf, int regs[4]) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    __cpuidex(regs, leaf, subleaf);
+#else
+    unsigned a, b, c, d;
+    __cpuid_count(leaf, subleaf, a, b, c, d);
+    regs[0] = a;
+    regs[1] = b;
+    regs[2] = c;
+    regs[3] = d;
+#endif
+}
+
+static uint64_t XGetBV() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    return _xgetbv(0);
+#else
+    uint32_t lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((uint64_t) hi << 32) | lo;
+#endif
+}
+
+static bool HasSSE41() {
+    int regs[4];
+    CpuId(1, 0, regs);
+    return regs[2] & (1 << 19);
+}
+
+static bool HasAVX2() {
+    int regs[4];
+    CpuId(0, 0, regs);
+    if (regs[0] < 7) {
+        return false;
+    }
+    CpuId(1, 0, regs);
+    bool osxsave = regs[2] & (1 << 27);
+    /* the OS must be saving the YMM registers for us */
+    if (!osxsave || (XGetBV() & 6) != 6) {
+        return false;
+    }
+    CpuId(7, 0, regs);
+    return regs[1] & (1 << 5);
+}
+
+/* clamp((l + cu * u + cv * v) >> 16) to 0..255 */
+TARGET_AVX2 static inline __m256i ChannelAVX2(__m256i l, __m256i u, __m256i v, __m256i cu, __m256i cv) {
+    __m256i r = _mm256_add_epi32(l, _mm256_add_epi32(_mm256_mullo_epi32(u, cu), _mm256_mullo_epi32(v, cv)));
+    r = _mm256_srai_epi32(r, 16);
+    return _mm256_min_epi32(_mm256_max_epi32(r, _mm256_setzero_si256()), _mm256_set1_epi32(255));
+}
+
+template <bool p010>
+TARGET_AVX2 static void ConvertRowAVX2(const ColorCoefficients &k, const uint8_t *y, const uint8_t *uv, uint8_t *dst, int width) {
+    const __m256i ys = _mm256_set1_epi32(k.y_scale);
+    const __m256i yb = _mm256_set1_epi32(k.y_bias);
+    const __m256i c512 = _mm256_set1_epi32(512);
+    const __m256i u0 = _mm256_set1_epi32(k.u[0]), u1 = _mm256_set1_epi32(k.u[1]), u2 = _mm256_set1_epi32(k.u[2]);
+    const __m256i v0 = _mm256_set1_epi32(k.v[0]), v1 = _mm256_set1_epi32(k.v[1]), v2 = _mm256_set1_epi32(k.v[2]);
+    const __m256i alpha = _mm256_set1_epi32((int32_t) 0xff000000);
+    const __m256i u_index = _mm256_setr_epi32(0, 0, 2, 2, 4, 4, 6, 6);
+    const __m256i v_index = _mm256_setr_epi32(1, 1, 3, 3, 5, 5, 7, 7);
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m256i l, c;
+        if (p010) {
+            l = _mm256_srli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) (y + 2 * x))), 6);
+            c = _mm256_srli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) (uv + 2 * x))), 6);
+        } else {
+            l = _mm256_slli_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (y + x))), 2);
+            c = _mm256_slli_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (uv + x))), 2);
+        }
+        __m256i u = _mm256_sub_epi32(_mm256_permutevar8x32_epi32(c, u_index), c512);
+        __m256i v = _mm256_sub_epi32(_mm256_permutevar8x32_epi32(c, v_index), c512);
+        l = _mm256_add_epi32(_mm256_mullo_epi32(l, ys), yb);
+
+        __m256i out = _mm256_or_si256(ChannelAVX2(l, u, v, u0, v0), alpha);
+        out = _mm256_or_si256(out, _mm256_slli_epi32(ChannelAVX2(l, u, v, u1, v1), 8));
+        out = _mm256_or_si256(out, _mm256_slli_epi32(ChannelAVX2(l, u, v, u2, v2), 16));
+        _mm256_storeu_si256((__m256i *) (dst + 4 * x), out);
+    }
+    const int bpp = p010 ? 2 : 1;
+    ConvertRowScalar<p010>(k, y + bpp * x, uv + bpp * x, dst + 4 * x, width - x);
+}
+
+TARGET_SSE41 static inline __m128i ChannelSSE41(__m128i l, __m128i u, __m128i v, __m128i cu, __m128i cv) {
+    __m128i r = _mm_add_epi32(l, _mm_add_epi32(_mm_mullo_epi32(u, cu), _mm_mullo_epi32(v, cv)));
+    r = _mm_srai_epi32(r, 16);
+    return _mm_min_epi32(_mm_max_epi32(r, _mm_setzero_si128()), _mm_set1_epi32(255));
+}
+
+template <bool p010>
+TARGET_SSE41 static void ConvertRowSSE41(const ColorCoefficients &k, const uint8_t *y, const uint8_t *uv, uint8_t *dst, int width) {
+    const __m128i ys = _mm_set1_epi32(k.y_scale);
+    const __m128i yb = _mm_set1_epi32(k.y_bias);
+    const __m128i c512 = _mm_set1_epi32(512);
+    const __m128i u0 = _mm_set1_epi32(k.u[0]), u1 = _mm_set1_epi32(k.u[1]), u2 = _mm_set1_epi32(k.u[2]);
+    const __m128i v0 = _mm_set1_epi32(k.v[0]), v1 = _mm_set1_epi32(k.v[1]), v2 = _mm_set1_epi32(k.v[2]);
+    const __m128i alpha = _mm_set1_epi32((int32_t) 0xff000000);
+
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m128i l, c;
+        if (p010) {
+            l = _mm_srli_epi32(_mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *) (y + 2 * x))), 6);
+            c = _mm_srli_epi32(_mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *) (uv + 2 * x))), 6);
+        } else {
+            int32_t l4, c4;
+            memcpy(&l4, y + x, 4);
+            memcpy(&c4, uv + x, 4);
+            l = _mm_slli_epi32(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(l4)), 2);
+            c = _mm_slli_epi32(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(c4)), 2);
+        }
+        __m128i u = _mm_sub_epi32(_mm_shuffle_epi32(c, _MM_SHUFFLE(2, 2, 0, 0)), c512);
+        __m128i v = _mm_sub_epi32(_mm_shuffle_epi32(c, _MM_SHUFFLE(3, 3, 1, 1)), c512);
+        l = _mm_add_epi32(_mm_mullo_epi32(l, ys), yb);
+
+        __m128i out = _mm_or_si128(ChannelSSE41(l, u, v, u0, v0), alpha);
+        out = _mm_or_si128(out, _mm_slli_epi32(ChannelSSE41(l, u, v, u1, v1), 8));
+        out = _mm_or_si128(out, _mm_slli_epi32(ChannelSSE41(l, u, v, u2, v2), 16));
+        _mm_storeu_si128((__m128i *) (dst + 4 * x), out);
+    }
+    const int bpp = p010 ? 2 : 1;
+    ConvertRowScalar<p010>(k, y + bpp * x, uv + bpp * x, dst + 4 * x, width - x);
+}
+
+#endif /* COLORCONVERT_X86 */
+
+#ifdef COLORCONVERT_NEON
+
+template <bool p010>
+static void ConvertRowNEON(const ColorCoefficients &k, const uint8_t *y, const uint8_t *uv, uint8_t *dst, int width) {
+    const int32x4_t ys = vdupq_n_s32(k.y_scale);
+    const int32x4_t yb = vdupq_n_s32(k.y_bias);
+    const int32x4_t c512 = vdupq_n_s32(512);
+
+    auto widen = [](uint16x4_t v) {
+        return vreinterpretq_s32_u32(vmovl_u16(v));
+    };
+
+    /* saturating narrow of (l + cu * u + cv * v) >> 16 to 8 bits */
+    auto channel = [&](int32x4_t l_lo, int32x4_t l_hi, int32x4_t u_lo, int32x4_t u_hi,
+                       int32x4_t v_lo, int32x4_t v_hi, int32_t cu, int32_t cv) {
+        int32x4_t lo = vmlaq_n_s32(vmlaq_n_s32(l_lo, u_lo, cu), v_lo, cv);
+        int32x4_t hi = vmlaq_n_s32(vmlaq_n_s32(l_hi, u_hi, cu), v_hi, cv);
+        return vqmovn_u16(vcombine_u16(vqshrun_n_s32(lo, 16), vqshrun_n_s32(hi, 16)));
+    };
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        uint16x8_t l, c;
+        if (p010) {
+            l = vshrq_n_u16(vld1q_u16((const uint16_t *) y + x), 6);
+            c = vshrq_n_u16(vld1q_u16((const uint16_t *) uv + x), 6);
+        } else {
+            l = vshlq_n_u16(vmovl_u8(vld1_u8(y + x)), 2);
+            c = vshlq_n_u16(vmovl_u8(vld1_u8(uv + x)), 2);
+        }
+        uint16x8_t u = vuzp1q_u16(c, c);
+        uint16x8_t v = vuzp2q_u16(c, c);
+        u = vzip1q_u16(u, u);
+        v = vzip1q_u16(v, v);
+
+        int32x4_t l_lo = vmlaq_s32(yb, widen(vget_low_u16(l)), ys);
+        int32x4_t l_hi = vmlaq_s32(yb, widen(vget_high_u16(l)), ys);
+        int32x4_t u_lo = vsubq_s32(widen(vget_low_u16(u)), c512);
+        int32x4_t u_hi = vsubq_s32(widen(vget_high_u16(u)), c512);
+        int32x4_t v_lo = vsubq_s32(widen(vget_low_u16(v)), c512);
+        int32x4_t v_hi = vsubq_s32(widen(vget_high_u16(v)), c512);
+
+        uint8x8x4_t out;
+        out.val[0] = channel(l_lo, l_hi, u_lo, u_hi, v_lo, v_hi, k.u[0], k.v[0]);
+        out.val[1] = channel(l_lo, l_hi, u_lo, u_hi, v_lo, v_hi, k.u[1], k.v[1]);
+        out.val[2] = channel(l_lo, l_hi, u_lo, u_hi, v_lo, v_hi, k.u[2], k.v[2]);
+        out.val[3] = vdup_n_u8(0xff);
+        vst4_u8(dst + 4 * x, out);
+    }
+    const int bpp = p010 ? 2 : 1;
+    ConvertRowScalar<p010>(k, y + bpp * x, uv + bpp * x, dst + 4 * x, width - x);
+}
+
+#endif /* COLORCONVERT_NEON */
+
+/* acc[i] += w * src[i] for n samples of a source row */
+template <bool p010>
+static void AccumulateRowScalar(float *acc, const uint8_t *src, float w, int n) {
+    for (int i = 0; i < n; ++i) {
+        acc[i] += w * (p010 ? ((const uint16_t *) src)[i] : src[i]);
+    }
+}
+
+#ifdef COLORCONVERT_X86
+
+template <bool p010>
+TARGET_AVX2 static void AccumulateRowAVX2(float *acc, const uint8_t *src, float w, int n) {
+    const __m256 wv = _mm256_set1_ps(w);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i s;
+        if (p010) {
+            s = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) (src + 2 * i)));
+        } else {
+            s = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (src + i)));
+        }
+        __m256 a = _mm256_loadu_ps(acc + i);
+        a = _mm256_add_ps(a, _mm256_mul_ps(wv, _mm256_cvtepi32_ps(s)));
+        _mm256_storeu_ps(acc + i, a);
+    }
+    const int bpp = p010 ? 2 : 1;
+    AccumulateRowScalar<p010>(acc + i, src + bpp * i, w, n - i);
+}
+
+template <bool p010>
+TARGET_SSE41 static void AccumulateRowSSE41(float *acc, const uint8_t *src, float w, int n) {
+    const __m128 wv = _mm_set1_ps(w);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i s;
+        if (p010) {
+            s = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *) (src + 2 * i)));
+        } else {
+            int32_t s4;
+            memcpy(&s4, src + i, 4);
+            s = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(s4));
+        }
+        __m128 a = _mm_loadu_ps(acc + i);
+        a = _mm_add_ps(a, _mm_mul_ps(wv, _mm_cvtepi32_ps(s)));
+        _mm_storeu_ps(acc + i, a);
+    }
+    const int bpp = p010 ? 2 : 1;
+    AccumulateRowScalar<p010>(acc + i, src + bpp * i, w, n - i);
+}
+
+#endif /* COLORCONVERT_X86 */
+
+#ifdef COLORCONVERT_NEON
+
+template <bool p010>
+static void AccumulateRowNEON(float *acc, const uint8_t *src, float w, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint16x8_t s = p010 ? vld1q_u16((const uint16_t *) src + i) : vmovl_u8(vld1_u8(src + i));
+        float32x4_t lo = vcvtq_f32_u32(vmovl_u16(vget_low_u16(s)));
+        float32x4_t hi = vcvtq_f32_u32(vmovl_u16(vget_high_u16(s)));
+        vst1q_f32(acc + i, vmlaq_n_f32(vld1q_f32(acc + i), lo, w));
+        vst1q_f32(acc + i + 4, vmlaq_n_f32(vld1q_f32(acc + i + 4), hi, w));
+    }
+    const int bpp = p010 ? 2 : 1;
+    AccumulateRowScalar<p010>(acc + i, src + bpp * i, w, n - i);
+}
+
+#endif /* COLORCONVERT_NEON */
+
+void ColorSpaceFromVUI(int matrix_coefficients, bool full_range, int height, ColorMatrix *matrix, ColorRange *range) {
+    switch (matrix_coefficients) {
+        case 1:
+            *matrix = kMatrixBT709;
+            break;
+        case 5: // BT.470 BG
+        case 6: // SMPTE 170M
+            *matrix = kMatrixBT601;
+            break;
+        case 9: // non-constant luminance, the constant one is not supported
+        case 10:
+            *matrix = kMatrixBT2020;
+            break;
+        default:
+            *matrix = height <= 576 ? kMatrixBT601 : kMatrixBT709;
+            break;
+    }
+    *range = full_range ? kRangeFull : kRangeStudio;
+}
+
+ColorConverter::ColorConverter(PixelFormat input, PixelFormat output, ColorMatrix matrix, ColorRange range)
+    : matrix(matrix), range(range) {
+    assert(input == kPixelNV12 || input == kPixelP010);
+    assert(output == kPixelRGBA || output == kPixelBGRA);
+
+    bgra = output == kPixelBGRA;
+    set_coefficients();
+
+    p010 = input == kPixelP010;
+    convert_row = p010 ? ConvertRowScalar<true> : ConvertRowScalar<false>;
+    accumulate_row = p010 ? AccumulateRowScalar<true> : AccumulateRowScalar<false>;
+    kernel_name = "scalar";
+#ifdef COLORCONVERT_X86
+    if (HasAVX2()) {
+        convert_row = p010 ? ConvertRowAVX2<true> : ConvertRowAVX2<false>;
+        accumulate_row = p010 ? AccumulateRowAVX2<true> : AccumulateRowAVX2<false>;
+        kernel_name = "avx2";
+    } else if (HasSSE41()) {
+        convert_row = p010 ? ConvertRowSSE41<true> : ConvertRowSSE41<false>;
+        accumulate_row = p010 ? AccumulateRowSSE41<true> : AccumulateRowSSE41<false>;
+        kernel_name = "sse4.1";
+    }
+#endif
+#ifdef COLORCONVERT_NEON
+    convert_row = p010 ? ConvertRowNEON<true> : ConvertRowNEON<false>;
+    accumulate_row = p010 ? AccumulateRowNEON<true> : AccumulateRowNEON<false>;
+    kernel_name = "neon";
+#endif
+}
+
+void ColorConverter::SetColorSpace(ColorMatrix matrix, ColorRange range) {
+    if (matrix != this->matrix || range != this->range) {
+        this->matrix = matrix;
+        this->range = range;
+        set_coefficients();
+    }
+}
+
+void ColorConverter::set_coefficients() {
+    double kr, kb;
+    switch (matrix) {
+        case kMatrixBT601:
+            kr = 0.299;
+            kb = 0.114;
+            break;
+        case kMatrixBT709:
+        default:
+            kr = 0.2126;
+            kb = 0.0722;
+            break;
+        case kMatrixBT2020:
+            kr = 0.2627;
+            kb = 0.0593;
+            break;
+    }
+    double kg = 1.0 - kr - kb;
+
+    /* samples are normalized to 10 bits, output is 8 bits */
+    double y_scale, c_scale;
+    int y_offset;
+    if (range == kRangeStudio) {
+        y_scale = 255.0 / (219 << 2);
+        c_scale = 255.0 / (224 << 2);
+        y_offset = 16 << 2;
+    } else {
+        y_scale = 255.0 / 1023;
+        c_scale = 255.0 / 1023;
+        y_offset = 0;
+    }
+
+    /* R, G and B in terms of Cb and Cr */
+    double cb[3] = { 0.0, -2.0 * kb * (1.0 - kb) / kg, 2.0 * (1.0 - kb) };
+    double cr[3] = { 2.0 * (1.0 - kr), -2.0 * kr * (1.0 - kr) / kg, 0.0 };
+
+    const double one = 1 << 16;
+    k.y_scale = (int32_t) (y_scale * one + 0.5);
+    k.y_bias = (1 << 15) - k.y_scale * y_offset;
+    for (int i = 0; i < 3; ++i) {
+        int ch = bgra ? 2 - i : i;
+        k.u[ch] = (int32_t) (cb[i] * c_scale * one + (cb[i] < 0 ? -0.5 : 0.5));
+        k.v[ch] = (int32_t) (cr[i] * c_scale * one + (cr[i] < 0 ? -0.5 : 0.5));
+    }
+}
+
+struct ConvertJob {
+    const ColorCoefficients *k;
+    ColorConverter::row_fn_t convert_row;
+    const uint8_t *y;
+    size_t y_stride;
+    const uint8_t *uv;
+    size_t uv_stride;
+    uint8_t *dst;
+    size_t dst_stride;
+    int width;
+    int height;
+    int rows_per_band;
+};
+
+static void ConvertBand(int band, void *opaque) {
+    auto job = (ConvertJob *) opaque;
+    int begin = band * job->rows_per_band;
+    int end = begin + job->rows_per_band;
+    if (end > job->height) {
+        end = job->height;
+    }
+    for (int row = begin; row < end; ++row) {
+        job->convert_row(*job->k,
+            job->y + row * job->y_stride,
+            job->uv + (row >> 1) * job->uv_stride,
+            job->dst + row * job->dst_stride,
+            job->width);
+    }
+}
+
+void ColorConverter::Convert(const uint8_t *y, size_t y_stride, const uint8_t *uv, size_t uv_stride,
+    uint8_t *dst, size_t dst_stride, int width, int height, WorkerPool *pool) const {
+
+    /* a few bands per thread evens out the load if some threads are busy
+     * elsewhere, but keep bands tall enough to amortize the handoff. */
+    const int min_rows_per_band = 16;
+    int bands = 1;
+    if (pool) {
+        bands = pool->NumThreads() * 4;
+        int max_bands = (height + min_rows_per_band - 1) / min_rows_per_band;
+        if (bands > max_bands) {
+            bands = max_bands;
+        }
+    }
+    if (bands < 1) {
+        bands = 1;
+    }
+
+    ConvertJob job = {
+        &k, convert_row,
+        y, y_stride,
+        uv, uv_stride,
+        dst, dst_stride,
+        width, height,
+        (height + bands - 1) / bands,
+    };
+    if (pool && bands > 1) {
+        pool->Run(bands, ConvertBand, &job);
+    } else {
+        ConvertBand(0, &job);
+    }
+}
+
+/* resampling weights for one dimension: output sample i is the sum over t of
+ * weights[i * taps + t] * src[first[i] + t]. Taps falling outside the source
+ * are folded onto the edge samples when the table is built, so every index
+ * is valid and padding never bleeds into the picture. */
+struct FilterTable {
+    int taps;
+    std::vector<int> first;
+    std::vector<float> weights;
+};
+
+static double FilterKernel(ScaleFilter filter, double x) {
+    x = fabs(x);
+    if (filter == kScaleBilinear) {
+        return x < 1.0 ? 1.0 - x : 0.0;
+    }
+    if (x < 1e-8) {
+        return 1.0;
+    }
+    if (x >= 3.0) {
+        return 0.0;
+    }
+    const double pi = 3.14159265358979323846;
+    return 3.0 * sin(pi * x) * sin(pi * x / 3.0) / (pi * pi * x * x);
+}
+
+/* scale is in source samples per output sample, and output sample i is
+ * centred on source position (i + 0.5) * scale - 0.5 - offset. */
+static void BuildFilter(FilterTable *table, ScaleFilter filter, int src_len, int dst_len, double scale, double offset) {
+    double radius = filter == kScaleBilinear ? 1.0 : 3.0;
+    /* when downscaling, stretch the kernel to cover all contributing samples */
+    double stretch = scale > 1.0 ? scale : 1.0;
+    double support = radius * stretch;
+    int taps = (int) ceil(support) * 2 + 1;
+    if (taps > src_len) {
+        taps = src_len;
+    }
+
+    table->taps = taps;
+    table->first.resize(dst_len);
+    table->weights.assign((size_t) dst_len * taps, 0.0f);
+    /* large downscales need many more taps than upscales, so this is sized
+     * per table rather than for some maximum */
+    std::vector<double> w(taps);
+    for (int i = 0; i < dst_len; ++i) {
+        double center = (i + 0.5) * scale - 0.5 - offset;
+        int lo = (int) floor(center - support) + 1;
+        int hi = (int) ceil(center + support);
+        int first = (int) floor(center) - taps / 2;
+        if (first > src_len - taps) {
+            first = src_len - taps;
+        }
+        if (first < 0) {
+            first = 0;
+        }
+
+        for (auto &v : w) {
+            v = 0.0;
+        }
+        for (int j = lo; j < hi; ++j) {
+            double f = FilterKernel(filter, (j - center) / stretch);
+            int t = (j < 0 ? 0 : j >= src_len ? src_len - 1 : j) - first;
+            if (t < 0) {
+                t = 0;
+            } else if (t >= taps) {
+                t = taps - 1;
+            }
+            w[t] += f;
+        }
+        /* normalize over the weights as stored, so the taps always sum to 1 */
+        double sum = 0.0;
+        for (auto v : w) {
+            sum += v;
+        }
+        float *out = &table->weights[(size_t) i * taps];
+        for (int t = 0; t < taps; ++t) {
+            out[t] = (float) (w[t] / sum);
+        }
+        table->first[i] = first;
+    }
+}
+
+struct ScaleJob {
+    const ColorCoefficients *k;
+    ColorConverter::accumulate_fn_t accumulate_row;
+    int bpp;
+    float sample_scale; // normalizes raw samples to 10 bits
+    const uint8_t *y;
+    size_t y_stride;
+    const uint8_t *uv;
+    size_t uv_stride;
+    CropRect crop;
+    uint8_t *dst;
+    size_t dst_stride;
+    int dst_width;
+    int dst_height;
+    FilterTable luma_x, luma_y, chroma_x, chroma_y;
+    int rows_per_band;
+};
+
+static inline uint8_t ClampFloat(float v) {
+    return v <= 0.0f ? 0 : v >= 255.0f ? 255 : (uint8_t) (v + 0.5f);
+}
+
+/* each output row is produced by first filtering the contributing source
+ * rows vertically into a single row of the cropped width, then filtering
+ * that horizontally and converting. The vertical pass is where nearly all of
+ * the work is, and runs over contiguous samples with the SIMD kernels. */
+static void ScaleBand(int band, void *opaque) {
+    auto job = (ScaleJob *) opaque;
+    int begin = band * job->rows_per_band;
+    int end = begin + job->rows_per_band;
+    if (end > job->dst_height) {
+        end = job->dst_height;
+    }
+    if (begin >= end) {
+        return;
+    }
+
+    const int w = job->dst_width;
+    const int luma_width = job->crop.width;
+    const int chroma_samples = 2 * ((job->crop.width + 1) / 2); // interleaved U and V
+    std::vector<float> rows((size_t) luma_width + chroma_samples);
+    float *luma_row = &rows[0];
+    float *chroma_row = &rows[luma_width];
+
+    /* fold the Q16 fixed point coefficients back into floats, without the
+     * rounding bias since ClampFloat rounds */
+    const auto &k = *job->k;
+    const float one = 1.0f / 65536;
+    const float ys = k.y_scale * one;
+    const float yb = (k.y_bias - (1 << 15)) * one;
+    float cu[3], cv[3];
+    for (int i = 0; i < 3; ++i) {
+        cu[i] = k.u[i] * one;
+        cv[i] = k.v[i] * one;
+    }
+
+    const uint8_t *y_origin = job->y + (size_t) job->crop.y * job->y_stride + job->crop.x * job->bpp;
+    const uint8_t *uv_origin = job->uv + (size_t) (job->crop.y / 2) * job->uv_stride + job->crop.x * job->bpp;
+
+    for (int row = begin; row < end; ++row) {
+        for (auto &r : rows) {
+            r = 0.0f;
+        }
+
+        const float *lw = &job->luma_y.weights[(size_t) row * job->luma_y.taps];
+        for (int t = 0; t < job->luma_y.taps; ++t) {
+            if (lw[t] != 0.0f) {
+                const uint8_t *src = y_origin + (size_t) (job->luma_y.first[row] + t) * job->y_stride;
+                job->accumulate_row(luma_row, src, lw[t] * job->sample_scale, luma_width);
+            }
+        }
+        const float *cw = &job->chroma_y.weights[(size_t) row * job->chroma_y.taps];
+        for (int t = 0; t < job->chroma_y.taps; ++t) {
+            if (cw[t] != 0.0f) {
+                const uint8_t *src = uv_origin + (size_t) (job->chroma_y.first[row] + t) * job->uv_stride;
+                job->accumulate_row(chroma_row, src, cw[t] * job->sample_scale, chroma_samples);
+            }
+        }
+
+        uint8_t *out = job->dst + (size_t) row * job->dst_stride;
+        for (int x = 0; x < w; ++x) {
+            const float *hw = &job->luma_x.weights[(size_t) x * job->luma_x.taps];
+            const float *src = luma_row + job->luma_x.first[x];
+            float l = 0.0f;
+            for (int t = 0; t < job->luma_x.taps; ++t) {
+                l += hw[t] * src[t];
+            }
+
+            hw = &job->chroma_x.weights[(size_t) x * job->chroma_x.taps];
+            src = chroma_row + 2 * job->chroma_x.first[x];
+            float u = 0.0f, v = 0.0f;
+            for (int t = 0; t < job->chroma_x.taps; ++t) {
+                u += hw[t] * src[2 * t];
+                v += hw[t] * src[2 * t + 1];
+            }
+
+            l = ys * l + yb;
+            u -= 512.0f;
+            v -= 512.0f;
+            out[4 * x + 0] = ClampFloat(l + cu[0] * u + cv[0] * v);
+            out[4 * x + 1] = ClampFloat(l + cu[1] * u + cv[1] * v);
+            out[4 * x + 2] = ClampFloat(l + cu[2] * u + cv[2] * v);
+            out[4 * x + 3] = 0xff;
+        }
+    }
+}
+
+void ColorConverter::ConvertScaled(const uint8_t *y, size_t y_stride, const uint8_t *uv, size_t uv_stride, const CropRect &crop,
+    uint8_t *dst, size_t dst_stride, int dst_width, int dst_height, ScaleFilter filter, WorkerPool *pool) const {
+
+    assert((crop.x & 1) == 0 && (crop.y & 1) == 0);
+    if (dst_width <= 0 || dst_height <= 0 || crop.width <= 0 || crop.height <= 0) {
+        return;
+    }
+
+    ScaleJob job = {};
+    job.k = &k;
+    job.accumulate_row = accumulate_row;
+    job.bpp = p010 ? 2 : 1;
+    job.sample_scale = p010 ? 1.0f / 64 : 4.0f;
+    job.y = y;
+    job.y_stride = y_stride;
+    job.uv = uv;
+    job.uv_stride = uv_stride;
+    job.crop = crop;
+    job.dst = dst;
+    job.dst_stride = dst_stride;
+    job.dst_width = dst_width;
+    job.dst_height = dst_height;
+
+    int chroma_width = (crop.width + 1) / 2;
+    int chroma_height = (crop.height + 1) / 2;
+    double scale_x = (double) crop.width / dst_width;
+    double scale_y = (double) crop.height / dst_height;
+    BuildFilter(&job.luma_x, filter, crop.width, dst_width, scale_x, 0.0);
+    BuildFilter(&job.luma_y, filter, crop.height, dst_height, scale_y, 0.0);
+    /* chroma sample i sits at luma column 2i, and between luma rows 2i
+     * and 2i + 1, so only the horizontal phase needs adjusting */
+    BuildFilter(&job.chroma_x, filter, chroma_width, dst_width, scale_x / 2, -0.25);
+    BuildFilter(&job.chroma_y, filter, chroma_height, dst_height, scale_y / 2, 0.0);
+
+    const int min_rows_per_band = 8;
+    int bands = 1;
+    if (pool) {
+        bands = pool->NumThreads() * 2;
+        int max_bands = (dst_height + min_rows_per_band - 1) / min_rows_per_band;
+        if (bands > max_bands) {
+            bands = max_bands;
+        }
+    }
+    if (bands < 1) {
+        bands = 1;
+    }
+    job.rows_per_band = (dst_height + bands - 1) / bands;
+
+    if (pool && bands > 1) {
+        pool->Run(bands, ScaleBand, &job);
+    } else {
+        ScaleBand(0, &job);
+    }
+}
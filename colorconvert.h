@@ -0,0 +1,107 @@
+#ifndef __COLORCONVERT_H__
+#define __COLORCONVERT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+class WorkerPool;
+
+/* CPU conversion of decoded 4:2:0 frames (NV12, or P010 with 10 bits in the
+ * top of each 16-bit sample) to 8-bit RGBA or BGRA, for when the D3D12 video
+ * processor is unavailable or the consumer wants the pixels on the host
+ * anyway. Rows are converted by the best of the AVX2, SSE4.1, NEON and scalar
+ * kernels available at runtime, split into bands across a WorkerPool. */
+
+enum PixelFormat {
+    kPixelNV12,
+    kPixelP010,
+    kPixelRGBA,
+    kPixelBGRA,
+};
+
+enum ColorMatrix {
+    kMatrixBT601,
+    kMatrixBT709,
+    kMatrixBT2020,
+};
+
+enum ColorRange {
+    kRangeStudio, // Y in 16..235, Cb/Cr in 16..240
+    kRangeFull,
+};
+
+enum ScaleFilter {
+    kScaleBilinear,
+    kScaleLanczos3,
+};
+
+/* the matrix and range for the colour description in a stream's VUI, given
+ * as its matrix_coefficients (Table E.5 of H.264 and H.265) and
+ * video_full_range_flag. Unspecified matrices are guessed from the picture
+ * height, BT.601 up to 576 lines and BT.709 above. */
+void ColorSpaceFromVUI(int matrix_coefficients, bool full_range, int height, ColorMatrix *matrix, ColorRange *range);
+
+/* region of the source picture to convert, in luma samples. x and y must be
+ * even, which HEVCParser::GetCropRect() guarantees for 4:2:0 streams. */
+struct CropRect {
+    int x, y;
+    int width, height;
+};
+
+/* fixed point Q16 coefficients, applied to samples normalized to 10 bits.
+ * Output channel i is
+ *
+ *   (y_scale * Y + y_bias + u[i] * (U - 512) + v[i] * (V - 512)) >> 16
+ *
+ * in memory order, so BGRA just swaps channels 0 and 2. */
+struct ColorCoefficients {
+    int32_t y_scale;
+    int32_t y_bias;
+    int32_t u[3];
+    int32_t v[3];
+};
+
+class ColorConverter {
+
+public:
+    typedef void (*row_fn_t)(const ColorCoefficients &k, const uint8_t *y, const uint8_t *uv, uint8_t *dst, int width);
+    typedef void (*accumulate_fn_t)(float *acc, const uint8_t *src, float w, int n);
+
+private:
+    ColorCoefficients k;
+    row_fn_t convert_row;
+    accumulate_fn_t accumulate_row;
+    const char *kernel_name;
+    bool p010;
+    bool bgra;
+    ColorMatrix matrix;
+    ColorRange range;
+
+    void set_coefficients();
+
+public:
+    ColorConverter(PixelFormat input, PixelFormat output, ColorMatrix matrix, ColorRange range);
+
+    /* switch to the colour space of a new stream, cheap when it is the one
+     * already in use */
+    void SetColorSpace(ColorMatrix matrix, ColorRange range);
+
+    /* strides are in bytes. Height and width need not be even, the last
+     * odd row/column shares chroma with its neighbour. */
+    void Convert(const uint8_t *y, size_t y_stride, const uint8_t *uv, size_t uv_stride,
+        uint8_t *dst, size_t dst_stride, int width, int height, WorkerPool *pool = nullptr) const;
+
+    /* crop, resample and convert in one pass, using one row of scratch per
+     * band of output rows rather than any frame-sized buffers. Chroma is
+     * taken to be co-sited with even luma columns and halfway between luma
+     * rows, as for HEVC chroma_sample_loc_type 0. */
+    void ConvertScaled(const uint8_t *y, size_t y_stride, const uint8_t *uv, size_t uv_stride, const CropRect &crop,
+        uint8_t *dst, size_t dst_stride, int dst_width, int dst_height, ScaleFilter filter,
+        WorkerPool *pool = nullptr) const;
+
+    const char *KernelName() const {
+        return kernel_name;
+    }
+};
+
+#endif /* __COLORCONVERT_H__ */
@@ -0,0 +1,133 @@
+#ifndef __COMMANDRING_H__
+#define __COMMANDRING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+/* ring of command recording contexts (on D3D12 a command allocator and the
+ * command list recorded with it), each tagged with the fence value signalled
+ * after its commands were executed. A context is only reset for recording
+ * once that fence has completed, so recording a readback does not wait for
+ * the readbacks before it as a single allocator must. When every context is
+ * still in flight a new one is created, up to max_contexts, after which the
+ * oldest is waited for.
+ *
+ * Like ReadbackPool, the ring only talks to the device through
+ * CommandContextAllocator, so the bookkeeping does not depend on D3D12. */
+
+class CommandContextAllocator {
+public:
+    virtual ~CommandContextAllocator() {
+    }
+
+    /* create a context, not yet open for recording. Returns an opaque
+     * handle, or nullptr on failure. */
+    virtual void *Create() = 0;
+    virtual void Destroy(void *context) = 0;
+    /* reset the context and open it for recording, its previous commands
+     * having completed */
+    virtual void Reset(void *context) = 0;
+
+    /* highest fence value known to have completed */
+    virtual uint64_t CompletedValue() = 0;
+    virtual void WaitFor(uint64_t fence_value) = 0;
+};
+
+class CommandRing {
+
+public:
+    struct Stats {
+        size_t contexts;
+        size_t resets;
+        size_t waits; // Begin() calls that had to wait for the GPU
+    };
+
+private:
+    struct Context {
+        void *context;
+        uint64_t fence_value; // 0 once known to have completed
+    };
+
+    CommandContextAllocator *allocator;
+    size_t max_contexts;
+    std::vector<Context> contexts; // in the order they were last begun
+    size_t next = 0; // oldest context, the first to be reused
+    int current = -1;
+    Stats stats = {};
+
+public:
+    CommandRing(CommandContextAllocator *allocator, size_t max_contexts = 4)
+        : allocator(allocator), max_contexts(max_contexts ? max_contexts : 1) {
+    }
+
+    ~CommandRing() {
+        for (auto &c : contexts) {
+            allocator->Destroy(c.context);
+        }
+    }
+
+    CommandRing(const CommandRing &) = delete;
+    CommandRing &operator=(const CommandRing &) = delete;
+
+    /* returns a context open for recording, reusing the oldest one if its
+     * fence has passed, otherwise creating one, or waiting for the oldest if
+     * there are max_contexts already. Returns nullptr if the allocator
+     * failed to create one. */
+    void *Begin() {
+        if (!contexts.empty()) {
+            Context &oldest = contexts[next];
+            if (oldest.fence_value && oldest.fence_value > allocator->CompletedValue()
+                && contexts.size() < max_contexts) {
+                void *context = allocator->Create();
+                if (!context) {
+                    return nullptr;
+                }
+                /* the new context goes in before the oldest, so that it is
+                 * the last to be reused */
+                contexts.insert(contexts.begin() + next, Context{ context, 0 });
+                ++stats.contexts;
+                return begin(next);
+            }
+            if (oldest.fence_value && oldest.fence_value > allocator->CompletedValue()) {
+                ++stats.waits;
+                allocator->WaitFor(oldest.fence_value);
+            }
+            return begin(next);
+        }
+        void *context = allocator->Create();
+        if (!context) {
+            return nullptr;
+        }
+        contexts.push_back(Context{ context, 0 });
+        ++stats.contexts;
+        return begin(0);
+    }
+
+    /* the commands recorded since Begin() were executed, followed by a
+     * signal of fence_value */
+    void End(uint64_t fence_value) {
+        if (current >= 0) {
+            contexts[current].fence_value = fence_value;
+            current = -1;
+        }
+    }
+
+    void GetStats(Stats *s) const {
+        *s = stats;
+    }
+
+private:
+    void *begin(size_t index) {
+        Context &c = contexts[index];
+        allocator->Reset(c.context);
+        c.fence_value = 0;
+        ++stats.resets;
+        current = (int) index;
+        next = (index + 1) % contexts.size();
+        return c.context;
+    }
+};
+
+#endif /* __COMMANDRING_H__ */
@@ -5,6 +5,8 @@
 
 #if defined(_WIN32)
 #include <synchapi.h>
+#else
+#include <pthread.h>
 #endif
 
 class Condition {
@@ -43,6 +45,10 @@ public:
         WakeAllConditionVariable(&c);
     }
 
+    void Broadcast() {
+        WakeAllConditionVariable(&c);
+    }
+
 #else
 
     pthread_mutex_t l;
@@ -75,6 +81,10 @@ public:
         pthread_cond_signal(&c);
     }
 
+    void Broadcast() {
+        pthread_cond_broadcast(&c);
+    }
+
 #endif
 };
 
@@ -0,0 +1,736 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "d3d12backend.h"
+#include "latency.h"
+#include "trace.h"
+
+void *D3D12CopyQueue::D3D12ReadbackAllocator::Create(size_t size, uint8_t **mapped) {
+    HRESULT hr;
+    ID3D12Resource *resource;
+    CD3DX12_HEAP_PROPERTIES heap_properties(D3D12_HEAP_TYPE_READBACK);
+    const D3D12_RESOURCE_DESC resource_desc = CD3DX12_RESOURCE_DESC::Buffer(size);
+    hr = queue->device->CreateCommittedResource(&heap_properties, D3D12_HEAP_FLAG_NONE, &resource_desc,
+        D3D12_RESOURCE_STATE_COPY_DEST, NULL, IID_PPV_ARGS(&resource));
+    if (FAILED(hr)) {
+        return nullptr;
+    }
+    hr = resource->Map(0, NULL, (void **) mapped);
+    if (FAILED(hr)) {
+        resource->Release();
+        return nullptr;
+    }
+    return resource;
+}
+
+void D3D12CopyQueue::D3D12ReadbackAllocator::Destroy(void *resource) {
+    auto r = (ID3D12Resource *) resource;
+    r->Unmap(0, nullptr);
+    r->Release();
+}
+
+uint64_t D3D12CopyQueue::D3D12ReadbackAllocator::CompletedValue() {
+    return queue->fence->GetCompletedValue();
+}
+
+void *D3D12CopyQueue::D3D12CommandContextAllocator::Create() {
+    HRESULT hr;
+    auto c = new D3D12CommandContext();
+    hr = queue->device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&c->allocator));
+    if (FAILED(hr)) {
+        delete c;
+        return nullptr;
+    }
+    hr = queue->device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, c->allocator, nullptr,
+        IID_PPV_ARGS(&c->list));
+    if (FAILED(hr)) {
+        c->allocator->Release();
+        delete c;
+        return nullptr;
+    }
+    c->list->SetName(L"direct_command_list");
+    c->list->Close();
+    return c;
+}
+
+void D3D12CopyQueue::D3D12CommandContextAllocator::Destroy(void *context) {
+    auto c = (D3D12CommandContext *) context;
+    c->list->Release();
+    c->allocator->Release();
+    delete c;
+}
+
+void D3D12CopyQueue::D3D12CommandContextAllocator::Reset(void *context) {
+    HRESULT hr;
+    auto c = (D3D12CommandContext *) context;
+    hr = c->allocator->Reset();
+    CHECK(hr);
+    hr = c->list->Reset(c->allocator, nullptr);
+    CHECK(hr);
+}
+
+uint64_t D3D12CopyQueue::D3D12CommandContextAllocator::CompletedValue() {
+    return queue->fence->GetCompletedValue();
+}
+
+void D3D12CopyQueue::D3D12CommandContextAllocator::WaitFor(uint64_t fence_value) {
+    queue->wait_for(fence_value);
+}
+
+D3D12CopyQueue::D3D12CopyQueue(ID3D12Device *device)
+    : device(device) {
+    HRESULT hr;
+
+    hr = device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&fence));
+    CHECK(hr);
+
+    // Create an event handle to use for frame synchronization.
+    event = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    if (event == nullptr) {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        CHECK(hr);
+    }
+
+    // Describe and create the command queue.
+    D3D12_COMMAND_QUEUE_DESC queueDesc = {};
+    queueDesc.Flags = D3D12_COMMAND_QUEUE_FLAG_NONE;
+    queueDesc.Type = D3D12_COMMAND_LIST_TYPE_DIRECT;
+
+    hr = device->CreateCommandQueue(&queueDesc, IID_PPV_ARGS(&queue));
+    CHECK(hr);
+}
+
+D3D12CopyQueue::~D3D12CopyQueue() {
+    wait_for(fence_value);
+    readback_pool.Poll();
+    readback_pool.Trim();
+    queue->Release();
+    CloseHandle(event);
+    fence->Release();
+}
+
+UINT64 D3D12CopyQueue::signal() {
+    HRESULT hr;
+    auto val = ++fence_value;
+    hr = queue->Signal(fence, val);
+    CHECK(hr);
+    return val;
+}
+
+void D3D12CopyQueue::wait_for(UINT64 val) {
+    TRACE_EVENT(2, "direct_wait");
+    HRESULT hr;
+    if (fence->GetCompletedValue() >= val) {
+        return;
+    }
+    hr = fence->SetEventOnCompletion(val, event);
+    CHECK(hr);
+    if (WaitForSingleObject(event, INFINITE) != WAIT_OBJECT_0) {
+        errx(1, "WaitForSingleObject failed");
+    }
+}
+
+void D3D12CopyQueue::reset() {
+    auto c = (D3D12CommandContext *) command_ring.Begin();
+    if (!c) {
+        errx(1, "%s: unable to create command allocator", __PRETTY_FUNCTION__);
+    }
+    list = c->list;
+}
+
+UINT64 D3D12CopyQueue::execute() {
+    HRESULT hr;
+    hr = list->Close();
+    CHECK(hr);
+    ID3D12CommandList *pcl[] = { list };
+    queue->ExecuteCommandLists(1, pcl);
+    UINT64 val = signal();
+    command_ring.End(val);
+    return val;
+}
+
+void D3D12CopyQueue::copy_to_host_async(ID3D12Resource *resource, size_t size, ReadbackPool::readback_callback_t cb, void *opaque) {
+    auto b = readback_pool.Acquire(size);
+    if (!b) {
+        errx(1, "%s: unable to allocate %zu byte readback buffer", __PRETTY_FUNCTION__, size);
+    }
+
+    reset();
+    barrier(resource, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_SOURCE);
+    list->CopyBufferRegion((ID3D12Resource *) b->resource, 0, resource, 0, size);
+    barrier(resource, D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_COMMON);
+    readback_pool.Submit(b, execute(), size, cb, opaque);
+}
+
+static void copy_done(const uint8_t *data, size_t size, void *opaque) {
+    memcpy(opaque, data, size);
+}
+
+void D3D12CopyQueue::copy_to_host(void *dst, ID3D12Resource *resource, size_t size) {
+    copy_to_host_async(resource, size, copy_done, dst);
+    wait_for(fence_value);
+    readback_pool.Poll();
+}
+
+void D3D12CopyQueue::copy_texture(ID3D12Resource *dst, ID3D12Resource *src) {
+    reset();
+    barrier(src, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_SOURCE);
+    barrier(dst, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_DEST);
+    list->CopyResource(dst, src);
+    barrier(src, D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_COMMON);
+    barrier(dst, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COMMON);
+    execute();
+    wait();
+}
+
+D3D12DecodeDevice::D3D12DecodeDevice(ID3D12Device *device, int num_queues)
+    : device(device) {
+    HRESULT hr;
+
+    hr = device->QueryInterface(IID_PPV_ARGS(&video_device));
+    CHECK(hr);
+
+    for (int i = 0; i < num_queues; ++i) {
+        ID3D12CommandQueue *queue;
+        D3D12_COMMAND_QUEUE_DESC video_queue_desc = { D3D12_COMMAND_LIST_TYPE_VIDEO_DECODE, 0, D3D12_COMMAND_QUEUE_FLAG_NONE };
+        hr = device->CreateCommandQueue(&video_queue_desc, IID_PPV_ARGS(&queue));
+        CHECK(hr);
+        queue->SetName(L"video_command_queue");
+        video_queues.push_back(queue);
+    }
+}
+
+D3D12DecodeDevice::~D3D12DecodeDevice() {
+    for (auto queue : video_queues) {
+        queue->Release();
+    }
+    video_device->Release();
+}
+
+bool D3D12DecodeDevice::check_decode_support(const D3D12_VIDEO_DECODE_CONFIGURATION &config) {
+    HRESULT hr;
+
+    UINT width = 1280;
+    UINT height = 720;
+
+    D3D12_FEATURE_DATA_VIDEO_DECODE_SUPPORT decode_support = {};
+    decode_support.Configuration = config;
+    decode_support.Width = width;
+    decode_support.Height = height;
+    decode_support.DecodeFormat = DXGI_FORMAT_NV12;
+    decode_support.FrameRate.Numerator = 30;
+    decode_support.FrameRate.Denominator = 1;
+    decode_support.BitRate = 0;
+    hr = video_device->CheckFeatureSupport(D3D12_FEATURE_VIDEO_DECODE_SUPPORT, &decode_support, sizeof(decode_support));
+    CHECK(hr);
+
+    if (decode_support.SupportFlags != D3D12_VIDEO_DECODE_SUPPORT_FLAG_SUPPORTED || decode_support.DecodeTier < D3D12_VIDEO_DECODE_TIER_1) {
+        return false;
+    }
+
+    auto cf = decode_support.ConfigurationFlags;
+    DVLOG(1) << "flags " << std::hex << cf << std::dec;
+    switch (cf) {
+        case D3D12_VIDEO_DECODE_CONFIGURATION_FLAG_NONE:
+            break;
+        case D3D12_VIDEO_DECODE_CONFIGURATION_FLAG_HEIGHT_ALIGNMENT_MULTIPLE_32_REQUIRED:
+            DVLOG(1) << "32 mult";
+            break;
+        case D3D12_VIDEO_DECODE_CONFIGURATION_FLAG_POST_PROCESSING_SUPPORTED:
+            DVLOG(1) << "post proc";
+            break;
+        case D3D12_VIDEO_DECODE_CONFIGURATION_FLAG_REFERENCE_ONLY_ALLOCATIONS_REQUIRED:
+            DVLOG(1) << "reference only";
+            break;
+        case D3D12_VIDEO_DECODE_CONFIGURATION_FLAG_ALLOW_RESOLUTION_CHANGE_ON_NON_KEY_FRAME:
+            DVLOG(1) << "non key";
+            break;
+    }
+    return true;
+}
+
+DecodeBackend *D3D12DecodeDevice::OpenSession(VideoCodec codec) {
+    D3D12_VIDEO_DECODE_CONFIGURATION config = {};
+    switch (codec) {
+        case kCodecH264:
+            config.DecodeProfile = D3D12_VIDEO_DECODE_PROFILE_H264;
+            break;
+        case kCodecHEVC:
+            config.DecodeProfile = D3D12_VIDEO_DECODE_PROFILE_HEVC_MAIN;
+            break;
+        default:
+            return nullptr;
+    }
+
+    if (!check_decode_support(config)) {
+        warnx("%s: codec %d not supported", __PRETTY_FUNCTION__, codec);
+        return nullptr;
+    }
+    return new D3D12DecodeSession(this, config);
+}
+
+bool D3D12DecodeSession::D3D12SurfaceAllocator::Create(int w, int h, int num_references, DecodeSurfaces *s) {
+    HRESULT hr;
+    ID3D12VideoDecoderHeap *heap = nullptr;
+    ID3D12Resource *output = nullptr;
+    ID3D12Resource *references = nullptr;
+    auto device = session->device;
+    auto video_device = session->dev->video_device;
+
+    D3D12_VIDEO_DECODER_HEAP_DESC heap_desc = {};
+    heap_desc.NodeMask = 0;
+    heap_desc.Configuration = session->decode_config;
+    heap_desc.DecodeWidth = w;
+    heap_desc.DecodeHeight = h;
+    heap_desc.Format = DXGI_FORMAT_NV12;
+
+    DVLOG(1) << "create " << w << "x" << h << " decoder heap, " << num_references << " references";
+    TRACE_EVENT(1, "create_surfaces", w * h);
+    hr = video_device->CreateVideoDecoderHeap(&heap_desc, IID_PPV_ARGS(&heap));
+    if (FAILED(hr)) {
+        return false;
+    }
+
+    D3D12_RESOURCE_DESC nv12_resource_desc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_NV12, w, h, 1, 1);
+    CD3DX12_HEAP_PROPERTIES heapProperties(D3D12_HEAP_TYPE_DEFAULT);
+    hr = device->CreateCommittedResource(
+        &heapProperties,
+        D3D12_HEAP_FLAG_NONE,
+        &nv12_resource_desc,
+        D3D12_RESOURCE_STATE_COMMON, NULL, IID_PPV_ARGS(&output));
+    if (FAILED(hr)) {
+        heap->Release();
+        return false;
+    }
+    output->SetName(L"nv12_texture");
+
+    D3D12_RESOURCE_DESC reference_resource_desc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_NV12, w, h, num_references, 1);
+    reference_resource_desc.Flags = D3D12_RESOURCE_FLAG_VIDEO_DECODE_REFERENCE_ONLY | D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE;
+
+    hr = device->CreateCommittedResource(
+        &heapProperties,
+        D3D12_HEAP_FLAG_NONE,
+        &reference_resource_desc,
+        D3D12_RESOURCE_STATE_COMMON, NULL, IID_PPV_ARGS(&references));
+    if (FAILED(hr)) {
+        output->Release();
+        heap->Release();
+        return false;
+    }
+    references->SetName(L"reference_texture");
+
+    D3D12_FEATURE_DATA_VIDEO_DECODER_HEAP_SIZE heap_size = {};
+    heap_size.VideoDecoderHeapDesc = heap_desc;
+    if (FAILED(video_device->CheckFeatureSupport(D3D12_FEATURE_VIDEO_DECODER_HEAP_SIZE, &heap_size, sizeof(heap_size)))) {
+        heap_size.MemoryPoolL0Size = 0;
+        heap_size.MemoryPoolL1Size = 0;
+    }
+
+    s->heap = heap;
+    s->output = output;
+    s->references = references;
+    s->num_references = num_references;
+    s->bytes = heap_size.MemoryPoolL0Size + heap_size.MemoryPoolL1Size
+        + device->GetResourceAllocationInfo(0, 1, &nv12_resource_desc).SizeInBytes
+        + device->GetResourceAllocationInfo(0, 1, &reference_resource_desc).SizeInBytes;
+    return true;
+}
+
+void D3D12DecodeSession::D3D12SurfaceAllocator::Destroy(DecodeSurfaces *s) {
+    ((ID3D12Resource *) s->references)->Release();
+    ((ID3D12Resource *) s->output)->Release();
+    ((ID3D12VideoDecoderHeap *) s->heap)->Release();
+}
+
+D3D12DecodeSession::D3D12DecodeSession(D3D12DecodeDevice *dev, const D3D12_VIDEO_DECODE_CONFIGURATION &decode_config)
+    : dev(dev), device(dev->device), decode_config(decode_config), copy_queue(dev->device) {
+    HRESULT hr;
+
+    D3D12_VIDEO_DECODER_DESC decoder_desc = { 0, decode_config };
+    hr = dev->video_device->CreateVideoDecoder(&decoder_desc, IID_PPV_ARGS(&video_decoder));
+    CHECK(hr);
+
+    hr = device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_VIDEO_DECODE, IID_PPV_ARGS(&video_command_allocator));
+    CHECK(hr);
+
+    hr = device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_VIDEO_DECODE, video_command_allocator, nullptr, IID_PPV_ARGS(&video_command_list));
+    CHECK(hr);
+
+    hr = video_command_list->Close();
+    CHECK(hr);
+
+    hr = device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&video_fence));
+    CHECK(hr);
+
+    // Create an event handle to use for frame synchronization.
+    video_event = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    if (video_event == nullptr) {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        CHECK(hr);
+    }
+
+    /* not all drivers support timestamps on the video decode queue, in
+     * which case we just go without GPU decode times. All queues of a device
+     * share a timestamp frequency. */
+    if (SUCCEEDED(dev->video_queues[0]->GetTimestampFrequency(&timestamp_frequency))) {
+        D3D12_QUERY_HEAP_DESC query_heap_desc = { D3D12_QUERY_HEAP_TYPE_TIMESTAMP, 2, 0 };
+        hr = device->CreateQueryHeap(&query_heap_desc, IID_PPV_ARGS(&timestamp_heap));
+        if (SUCCEEDED(hr)) {
+            CD3DX12_HEAP_PROPERTIES readback_properties(D3D12_HEAP_TYPE_READBACK);
+            const D3D12_RESOURCE_DESC readback_desc = CD3DX12_RESOURCE_DESC::Buffer(2 * sizeof(UINT64));
+            hr = device->CreateCommittedResource(&readback_properties, D3D12_HEAP_FLAG_NONE, &readback_desc,
+                D3D12_RESOURCE_STATE_COPY_DEST, NULL, IID_PPV_ARGS(&timestamp_readback));
+            CHECK(hr);
+        } else {
+            DVLOG(1) << "no timestamp queries on video decode queue";
+            timestamp_heap = nullptr;
+        }
+    }
+}
+
+D3D12DecodeSession::~D3D12DecodeSession() {
+    Wait(video_fencevalue);
+    Unmap();
+    surface_cache.Clear();
+    if (bitstream_upload) {
+        bitstream_upload->Release();
+        bitstream_buffer->Release();
+    }
+    if (timestamp_heap) {
+        timestamp_readback->Release();
+        timestamp_heap->Release();
+    }
+    CloseHandle(video_event);
+    video_fence->Release();
+    video_command_list->Release();
+    video_command_allocator->Release();
+    video_decoder->Release();
+}
+
+size_t D3D12DecodeSession::upload_bitstream(const DecodePicture *picture) {
+    ScopedLatency latency(kStageUpload);
+    HRESULT hr;
+
+    static const uint8_t start_code[] = { 0, 0, 1 };
+    size_t prefix = picture->add_start_code ? sizeof(start_code) : 0;
+    size_t size = prefix + picture->bitstream_size;
+
+    if (size > bitstream_capacity) {
+        if (bitstream_upload) {
+            bitstream_upload->Release();
+            bitstream_buffer->Release();
+        }
+        size_t capacity = 0x10000;
+        while (capacity < size) {
+            capacity *= 2;
+        }
+
+        const D3D12_RESOURCE_DESC resource_desc = CD3DX12_RESOURCE_DESC::Buffer(capacity);
+        CD3DX12_HEAP_PROPERTIES heap_properties(D3D12_HEAP_TYPE_UPLOAD);
+        hr = device->CreateCommittedResource(
+            &heap_properties,
+            D3D12_HEAP_FLAG_NONE,
+            &resource_desc,
+            D3D12_RESOURCE_STATE_GENERIC_READ, NULL, IID_PPV_ARGS(&bitstream_upload));
+        CHECK(hr);
+
+        CD3DX12_HEAP_PROPERTIES heap_properties2(D3D12_HEAP_TYPE_DEFAULT);
+        hr = device->CreateCommittedResource(
+            &heap_properties2,
+            D3D12_HEAP_FLAG_NONE,
+            &resource_desc,
+            D3D12_RESOURCE_STATE_COMMON, NULL, IID_PPV_ARGS(&bitstream_buffer));
+        CHECK(hr);
+        bitstream_buffer->SetName(L"compressed data");
+        bitstream_capacity = capacity;
+    }
+
+    uint8_t *ptr = nullptr;
+    hr = bitstream_upload->Map(0, NULL, (void **) &ptr);
+    CHECK(hr);
+    memcpy(ptr, start_code, prefix);
+    memcpy(ptr + prefix, picture->bitstream, picture->bitstream_size);
+    bitstream_upload->Unmap(0, nullptr);
+
+    /* copy from upload buffer to compressed resource */
+    copy_queue.reset();
+    copy_queue.barrier(bitstream_buffer, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_DEST);
+    copy_queue.list->CopyBufferRegion(bitstream_buffer, 0, bitstream_upload, 0, size);
+    copy_queue.barrier(bitstream_buffer, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COMMON);
+    copy_queue.execute();
+    copy_queue.wait();
+    return size;
+}
+
+void D3D12DecodeSession::select_surfaces(int w, int h, int needed_references) {
+    if (needed_references > num_references) {
+        DVLOG(1) << "SPS needs " << needed_references << " reference pictures, had " << num_references;
+        num_references = needed_references;
+    }
+
+    if (w != heap_width || h != heap_height || num_references > surface_references) {
+        /* change of image size or DPB size detected, switch to the surfaces
+         * for the new size, creating them unless they were prewarmed or
+         * cached */
+        auto surfaces = surface_cache.Acquire(w, h, num_references);
+        if (!surfaces) {
+            errx(1, "%s: unable to create %dx%d decoder surfaces", __PRETTY_FUNCTION__, w, h);
+        }
+        decoder_heap = (ID3D12VideoDecoderHeap *) surfaces->heap;
+        nv12_texture = (ID3D12Resource *) surfaces->output;
+        reference_texture = (ID3D12Resource *) surfaces->references;
+        surface_references = surfaces->num_references;
+        heap_width = w;
+        heap_height = h;
+    }
+}
+
+uint64_t D3D12DecodeSession::Submit(int queue, const DecodePicture *picture) {
+    TRACE_EVENT(2, "Submit", picture->is_key);
+    HRESULT hr;
+
+    /* the command allocator, bitstream buffer and surfaces are reused for
+     * every picture, so the previous one must be done with them */
+    Wait(video_fencevalue);
+    Unmap();
+    copy_queue.readback_pool.Poll();
+
+    select_surfaces(picture->width, picture->height, picture->num_references);
+
+    /* the picture is decoded into its DPB slot of the reference array, and
+     * predicted from the slots its RefPicList entries name, which index
+     * ReferenceFrames below */
+    int slot = picture->output_slot;
+    uint32_t ref_slots = 0;
+    if (slot < 0 || slot >= surface_references) {
+        warnx("%s: output slot %d out of range", __PRETTY_FUNCTION__, slot);
+        return 0;
+    }
+    for (int i = 0; i < picture->num_refs; ++i) {
+        int ref = picture->refs[i];
+        if (ref < 0 || ref >= surface_references) {
+            warnx("%s: reference slot %d out of range", __PRETTY_FUNCTION__, ref);
+            return 0;
+        }
+        ref_slots |= 1u << ref;
+    }
+    /* the second field of an H.264 frame refers to the first, in the slot
+     * being written */
+    ref_slots &= ~(1u << slot);
+
+    size_t bitstream_size = upload_bitstream(picture);
+
+    D3D12_VIDEO_DECODE_INPUT_STREAM_ARGUMENTS input_arguments = {};
+    assert(decoder_heap);
+    input_arguments.pHeap = decoder_heap;
+    input_arguments.NumFrameArguments = 3;
+
+    input_arguments.FrameArguments[0].Type = D3D12_VIDEO_DECODE_ARGUMENT_TYPE_PICTURE_PARAMETERS;
+    input_arguments.FrameArguments[0].Size = (UINT) picture->pic_params_size;
+    input_arguments.FrameArguments[0].pData = (void *) picture->pic_params;
+
+    input_arguments.FrameArguments[1].Type = D3D12_VIDEO_DECODE_ARGUMENT_TYPE_INVERSE_QUANTIZATION_MATRIX;
+    input_arguments.FrameArguments[1].Size = (UINT) picture->qmatrix_size;
+    input_arguments.FrameArguments[1].pData = (void *) picture->qmatrix;
+
+    input_arguments.FrameArguments[2].Type = D3D12_VIDEO_DECODE_ARGUMENT_TYPE_SLICE_CONTROL;
+    input_arguments.FrameArguments[2].Size = (UINT) picture->slice_control_size;
+    input_arguments.FrameArguments[2].pData = (void *) picture->slice_control;
+
+    input_arguments.CompressedBitstream.pBuffer = bitstream_buffer;
+    input_arguments.CompressedBitstream.Offset = 0;
+    input_arguments.CompressedBitstream.Size = bitstream_size;
+
+    input_arguments.ReferenceFrames.NumTexture2Ds = surface_references;
+
+    /* AMD seems to only support TIER1 decoding, which means we have to pass the
+     * references textures as a texture array, and provide a list of identical
+     * resources here, each with the subresource of its slot. */
+    ID3D12Resource *references[kMaxDecodeReferences];
+    UINT subresources[kMaxDecodeReferences];
+    for (int i = 0; i < surface_references; ++i) {
+        references[i] = reference_texture;
+        subresources[i] = D3D12CalcSubresource(0, i, 0, 1, surface_references);
+    }
+    input_arguments.ReferenceFrames.ppTexture2Ds = references;
+    input_arguments.ReferenceFrames.pSubresources = subresources;
+
+    /* docs are unclear as to whether or not we need to pass in an array of heaps, so here we go */
+    ID3D12VideoDecoderHeap *heaps[kMaxDecodeReferences];
+    for (int i = 0; i < surface_references; ++i) {
+        heaps[i] = decoder_heap;
+    }
+    input_arguments.ReferenceFrames.ppHeaps = heaps;
+
+    /* the reference array is reference only, so the decoder writes the
+     * slot and a copy of it to nv12_texture, without a change of format or
+     * colour space, for Map() and the video processor */
+    D3D12_VIDEO_DECODE_OUTPUT_STREAM_ARGUMENTS output_arguments = {};
+    output_arguments.pOutputTexture2D = nv12_texture;
+    output_arguments.ConversionArguments.Enable = TRUE;
+    output_arguments.ConversionArguments.pReferenceTexture2D = reference_texture;
+    output_arguments.ConversionArguments.ReferenceSubresource = subresources[slot];
+    output_arguments.ConversionArguments.OutputColorSpace = DXGI_COLOR_SPACE_YCBCR_STUDIO_G22_LEFT_P709;
+    output_arguments.ConversionArguments.DecodeColorSpace = DXGI_COLOR_SPACE_YCBCR_STUDIO_G22_LEFT_P709;
+
+    decode_start = TraceNow();
+    hr = video_command_allocator->Reset();
+    CHECK(hr);
+
+    hr = video_command_list->Reset(video_command_allocator);
+    CHECK(hr);
+
+    video_barrier(bitstream_buffer, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_VIDEO_DECODE_READ);
+
+    reference_barrier(slot, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_VIDEO_DECODE_WRITE);
+    for (int i = 0; i < surface_references; ++i) {
+        if (ref_slots & (1u << i)) {
+            reference_barrier(i, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_VIDEO_DECODE_READ);
+        }
+    }
+
+    video_barrier(nv12_texture, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_VIDEO_DECODE_WRITE);
+    if (timestamp_heap) {
+        video_command_list->EndQuery(timestamp_heap, D3D12_QUERY_TYPE_TIMESTAMP, 0);
+    }
+    video_command_list->DecodeFrame(video_decoder, &output_arguments, &input_arguments);
+    if (timestamp_heap) {
+        video_command_list->EndQuery(timestamp_heap, D3D12_QUERY_TYPE_TIMESTAMP, 1);
+        video_command_list->ResolveQueryData(timestamp_heap, D3D12_QUERY_TYPE_TIMESTAMP, 0, 2, timestamp_readback, 0);
+    }
+    video_barrier(bitstream_buffer, D3D12_RESOURCE_STATE_VIDEO_DECODE_READ, D3D12_RESOURCE_STATE_COMMON);
+    video_barrier(nv12_texture, D3D12_RESOURCE_STATE_VIDEO_DECODE_WRITE, D3D12_RESOURCE_STATE_COMMON);
+
+    reference_barrier(slot, D3D12_RESOURCE_STATE_VIDEO_DECODE_WRITE, D3D12_RESOURCE_STATE_COMMON);
+    for (int i = 0; i < surface_references; ++i) {
+        if (ref_slots & (1u << i)) {
+            reference_barrier(i, D3D12_RESOURCE_STATE_VIDEO_DECODE_READ, D3D12_RESOURCE_STATE_COMMON);
+        }
+    }
+
+    hr = video_command_list->Close();
+    CHECK(hr);
+
+    auto video_command_queue = dev->video_queues[queue % dev->video_queues.size()];
+    ID3D12CommandList *pcl[] = { video_command_list };
+    video_command_queue->ExecuteCommandLists(1, pcl);
+    auto ticket = ++video_fencevalue;
+    hr = video_command_queue->Signal(video_fence, ticket);
+    CHECK(hr);
+    return ticket;
+}
+
+/* bookkeeping for a ticket that is known to have completed */
+void D3D12DecodeSession::retire(uint64_t ticket) {
+    HRESULT hr;
+    if (ticket <= completed) {
+        return;
+    }
+    completed = ticket;
+    pipeline_latency.Record(kStageDecode, TraceNow() - decode_start);
+
+    if (timestamp_heap) {
+        UINT64 *ts = nullptr;
+        D3D12_RANGE range = { 0, 2 * sizeof(UINT64) };
+        hr = timestamp_readback->Map(0, &range, (void **) &ts);
+        CHECK(hr);
+        if (ts[1] > ts[0]) {
+            pipeline_latency.Record(kStageGpuDecode, (uint64_t) ((ts[1] - ts[0]) * 1e9 / timestamp_frequency));
+        }
+        D3D12_RANGE none = {};
+        timestamp_readback->Unmap(0, &none);
+    }
+}
+
+bool D3D12DecodeSession::Poll(uint64_t ticket) {
+    if (video_fence->GetCompletedValue() < ticket) {
+        return false;
+    }
+    retire(ticket);
+    return true;
+}
+
+void D3D12DecodeSession::Wait(uint64_t ticket) {
+    TRACE_EVENT(2, "video_wait");
+    HRESULT hr;
+    if (video_fence->GetCompletedValue() < ticket) {
+        hr = video_fence->SetEventOnCompletion(ticket, video_event);
+        CHECK(hr);
+        if (WaitForSingleObject(video_event, INFINITE) != WAIT_OBJECT_0) {
+            errx(1, "WaitForSingleObject failed");
+        }
+    }
+    retire(ticket);
+}
+
+bool D3D12DecodeSession::Map(uint64_t ticket, MappedPicture *picture) {
+    if (ticket != video_fencevalue || !nv12_texture) {
+        return false;
+    }
+    Wait(ticket);
+    Unmap();
+
+    D3D12_RESOURCE_DESC desc = nv12_texture->GetDesc();
+    D3D12_PLACED_SUBRESOURCE_FOOTPRINT layout[2];
+    UINT64 size;
+    device->GetCopyableFootprints(&desc, 0, 2, 0, layout, nullptr, nullptr, &size);
+
+    mapped = copy_queue.readback_pool.Acquire(size);
+    if (!mapped) {
+        return false;
+    }
+
+    copy_queue.reset();
+    copy_queue.barrier(nv12_texture, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_SOURCE);
+    for (UINT plane = 0; plane < 2; ++plane) {
+        CD3DX12_TEXTURE_COPY_LOCATION dst((ID3D12Resource *) mapped->resource, layout[plane]);
+        CD3DX12_TEXTURE_COPY_LOCATION src(nv12_texture, plane);
+        copy_queue.list->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+    }
+    copy_queue.barrier(nv12_texture, D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_COMMON);
+    /* only this copy is waited for, readbacks recorded before it on other
+     * command allocators carry on */
+    copy_queue.wait_for(copy_queue.execute());
+
+    picture->y = mapped->mapped + layout[0].Offset;
+    picture->y_stride = layout[0].Footprint.RowPitch;
+    picture->uv = mapped->mapped + layout[1].Offset;
+    picture->uv_stride = layout[1].Footprint.RowPitch;
+    picture->width = (int) desc.Width;
+    picture->height = (int) desc.Height;
+    return true;
+}
+
+void D3D12DecodeSession::Unmap() {
+    if (mapped) {
+        copy_queue.readback_pool.Release(mapped);
+        mapped = nullptr;
+    }
+}
+
+void D3D12DecodeSession::GetStats(DecodeBackendStats *stats) {
+    SurfaceCache::Stats surface_stats;
+    surface_cache.GetStats(&surface_stats);
+    ReadbackPool::Stats readback_stats;
+    copy_queue.readback_pool.GetStats(&readback_stats);
+    stats->surface_bytes = surface_stats.bytes;
+    stats->staging_bytes = readback_stats.bytes + 2 * bitstream_capacity;
+    stats->surface_sets = surface_stats.entries;
+    stats->num_references = surface_references;
+    stats->submitted = video_fencevalue;
+    stats->completed = completed;
+}
+
+int D3D12DecodeSession::Prewarm(const Resolution *resolutions, int count) {
+    TRACE_EVENT(1, "Prewarm", count);
+    return surface_cache.Prewarm(resolutions, count, num_references ? num_references : prewarm_references);
+}
+
+void D3D12DecodeSession::SetSurfaceBudget(size_t bytes) {
+    surface_cache.SetBudget(bytes);
+}
+
+void D3D12DecodeSession::GetSurfaceStats(SurfaceCache::Stats *stats) {
+    surface_cache.GetStats(stats);
+}
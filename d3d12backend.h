@@ -0,0 +1,267 @@
+#ifndef __D3D12BACKEND_H__
+#define __D3D12BACKEND_H__
+
+#include <d3d12video.h>
+#include <d3dx12.h>
+#include <windows.h>
+
+#include <err.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "commandring.h"
+#include "decodebackend.h"
+#include "readbackpool.h"
+#include "surfacecache.h"
+
+#define CHECK(_hr) \
+    if (FAILED(_hr)) { \
+        const char *msg = nullptr; \
+        switch (_hr) { \
+            case E_FAIL: \
+                msg = "E_FAIL"; \
+                break; \
+            case E_OUTOFMEMORY: \
+                msg = "E_OUTOFMEMORY"; \
+                break; \
+            case E_INVALIDARG: \
+                msg = "E_INVALIDARG"; \
+                break; \
+            case DXGI_ERROR_DEVICE_REMOVED: \
+                msg = "DXGI_ERROR_DEVICE_REMOVED"; \
+                warnx("device removed %s line %d, hr=%x : %s\n", __FUNCTION__, __LINE__, (uint32_t) hr, msg); \
+                break; \
+            case DXGI_ERROR_INVALID_CALL: \
+                msg = "DXGI_ERROR_INVALID_CALL"; \
+                break; \
+            default: \
+                msg = "unknown error"; \
+                break; \
+        } \
+        errx(1, "failed %s line %d, hr=%x : %s\n", __FUNCTION__, __LINE__, (uint32_t) hr, msg); \
+    }
+
+/* a direct command queue used for uploads, readbacks and copies around
+ * decoding. Commands are recorded on a ring of command allocators, so that
+ * starting a readback does not wait for the ones still in flight. */
+class D3D12CopyQueue {
+
+    struct D3D12CommandContext {
+        ID3D12CommandAllocator *allocator;
+        ID3D12GraphicsCommandList *list;
+    };
+
+    /* a command allocator and a direct command list recorded with it */
+    class D3D12CommandContextAllocator : public CommandContextAllocator {
+        D3D12CopyQueue *queue;
+
+    public:
+        D3D12CommandContextAllocator(D3D12CopyQueue *queue)
+            : queue(queue) {
+        }
+
+        void *Create();
+        void Destroy(void *context);
+        void Reset(void *context);
+        uint64_t CompletedValue();
+        void WaitFor(uint64_t fence_value);
+    };
+
+    /* readback buffers are created on the READBACK heap, mapped once, and
+     * retire against the queue fence */
+    class D3D12ReadbackAllocator : public ReadbackAllocator {
+        D3D12CopyQueue *queue;
+
+    public:
+        D3D12ReadbackAllocator(D3D12CopyQueue *queue)
+            : queue(queue) {
+        }
+
+        void *Create(size_t size, uint8_t **mapped);
+        void Destroy(void *resource);
+        uint64_t CompletedValue();
+    };
+
+    ID3D12Device *device;
+    ID3D12CommandQueue *queue;
+    HANDLE event;
+    ID3D12Fence *fence;
+    UINT64 fence_value = 0;
+    D3D12ReadbackAllocator readback_allocator{ this };
+    D3D12CommandContextAllocator context_allocator{ this };
+    CommandRing command_ring{ &context_allocator };
+
+public:
+    /* the list being recorded, between reset() and execute() */
+    ID3D12GraphicsCommandList *list = nullptr;
+    ReadbackPool readback_pool{ &readback_allocator };
+
+    D3D12CopyQueue(ID3D12Device *device);
+    ~D3D12CopyQueue();
+
+    UINT64 signal();
+    void wait_for(UINT64 val);
+    /* wait for everything executed so far */
+    void wait() {
+        wait_for(fence_value);
+    }
+
+    /* start recording into list, on a command allocator whose commands have
+     * completed. Only waits if the whole ring is in flight. */
+    void reset();
+    /* close the command list and execute it, returns the fence value that
+     * signals its completion */
+    UINT64 execute();
+
+    inline void barrier(ID3D12Resource *resource, D3D12_RESOURCE_STATES from, D3D12_RESOURCE_STATES to) {
+        auto b = CD3DX12_RESOURCE_BARRIER::Transition(resource, from, to);
+        list->ResourceBarrier(1, &b);
+    }
+
+    /* copy a buffer resource back to the host without waiting for it, cb
+     * runs from readback_pool.Poll() once the copy has landed. */
+    void copy_to_host_async(ID3D12Resource *resource, size_t size, ReadbackPool::readback_callback_t cb, void *opaque);
+    void copy_to_host(void *dst, ID3D12Resource *resource, size_t size);
+    void copy_texture(ID3D12Resource *dst, ID3D12Resource *src);
+};
+
+class D3D12DecodeSession;
+
+/* the D3D12 video device and the video decode queues shared by all sessions
+ * opened on it */
+class D3D12DecodeDevice : public DecodeDevice {
+    friend class D3D12DecodeSession;
+
+    ID3D12Device *device;
+    ID3D12VideoDevice3 *video_device = nullptr;
+    std::vector<ID3D12CommandQueue *> video_queues;
+
+    bool check_decode_support(const D3D12_VIDEO_DECODE_CONFIGURATION &config);
+
+public:
+    D3D12DecodeDevice(ID3D12Device *device, int num_queues = 1);
+    ~D3D12DecodeDevice();
+
+    int NumQueues() {
+        return (int) video_queues.size();
+    }
+
+    DecodeBackend *OpenSession(VideoCodec codec);
+
+    ID3D12VideoDevice3 *VideoDevice() {
+        return video_device;
+    }
+};
+
+class D3D12DecodeSession : public DecodeBackend {
+
+    /* creates the decoder heap, output texture and reference texture array
+     * for one coded size, charging the cache for all three */
+    class D3D12SurfaceAllocator : public SurfaceAllocator {
+        D3D12DecodeSession *session;
+
+    public:
+        D3D12SurfaceAllocator(D3D12DecodeSession *session)
+            : session(session) {
+        }
+
+        bool Create(int w, int h, int num_references, DecodeSurfaces *s);
+        void Destroy(DecodeSurfaces *s);
+    };
+
+    D3D12DecodeDevice *dev;
+    ID3D12Device *device;
+    D3D12_VIDEO_DECODE_CONFIGURATION decode_config;
+    D3D12CopyQueue copy_queue;
+
+    ID3D12VideoDecoder *video_decoder = nullptr;
+    ID3D12CommandAllocator *video_command_allocator = nullptr;
+    ID3D12VideoDecodeCommandList2 *video_command_list = nullptr;
+    HANDLE video_event;
+    ID3D12Fence *video_fence = nullptr;
+    UINT64 video_fencevalue = 0;
+
+    /* GPU timestamps taken around DecodeFrame, if the video queue supports
+     * them, resolved into a two-entry readback buffer. */
+    ID3D12QueryHeap *timestamp_heap = nullptr;
+    ID3D12Resource *timestamp_readback = nullptr;
+    UINT64 timestamp_frequency = 0;
+
+    /* the reference texture array holds as many pictures as the SPS asks
+     * for, and only ever grows, so switching between streams of one ladder
+     * does not reallocate. Until an SPS is seen surfaces are prewarmed with
+     * prewarm_references, which covers typical streams. */
+    static const int prewarm_references = 8;
+    int num_references = 0;
+    int surface_references = 0;
+    int heap_width = 0;
+    int heap_height = 0;
+    ID3D12VideoDecoderHeap *decoder_heap = nullptr;
+    ID3D12Resource *reference_texture = nullptr;
+    ID3D12Resource *nv12_texture = nullptr;
+
+    /* decoding waits for the previous picture before reusing the command
+     * allocator, so surfaces evicted from the cache are never still in use
+     * by the GPU */
+    D3D12SurfaceAllocator surface_allocator{ this };
+    SurfaceCache surface_cache{ &surface_allocator };
+
+    /* the bitstream is staged in an upload buffer and copied into a default
+     * heap buffer for the decoder, both grown as needed and reused */
+    ID3D12Resource *bitstream_upload = nullptr;
+    ID3D12Resource *bitstream_buffer = nullptr;
+    size_t bitstream_capacity = 0;
+
+    ReadbackPool::Buffer *mapped = nullptr;
+    uint64_t decode_start = 0;
+    uint64_t completed = 0;
+
+    inline void video_barrier(ID3D12Resource *resource, D3D12_RESOURCE_STATES from, D3D12_RESOURCE_STATES to) {
+        auto b = CD3DX12_RESOURCE_BARRIER::Transition(resource, from, to);
+        video_command_list->ResourceBarrier(1, &b);
+    }
+
+    /* both planes of one slice of the reference texture array, i.e. one
+     * DPB slot */
+    inline void reference_barrier(int slot, D3D12_RESOURCE_STATES from, D3D12_RESOURCE_STATES to) {
+        D3D12_RESOURCE_BARRIER b[2];
+        for (UINT plane = 0; plane < 2; ++plane) {
+            b[plane] = CD3DX12_RESOURCE_BARRIER::Transition(reference_texture, from, to,
+                D3D12CalcSubresource(0, slot, plane, 1, surface_references));
+        }
+        video_command_list->ResourceBarrier(2, b);
+    }
+
+    /* returns the number of bytes uploaded */
+    size_t upload_bitstream(const DecodePicture *picture);
+    void select_surfaces(int w, int h, int needed_references);
+    void retire(uint64_t ticket);
+
+public:
+    D3D12DecodeSession(D3D12DecodeDevice *dev, const D3D12_VIDEO_DECODE_CONFIGURATION &decode_config);
+    ~D3D12DecodeSession();
+
+    uint64_t Submit(int queue, const DecodePicture *picture);
+    bool Poll(uint64_t ticket);
+    void Wait(uint64_t ticket);
+    bool Map(uint64_t ticket, MappedPicture *picture);
+    void Unmap();
+    void GetStats(DecodeBackendStats *stats);
+
+    /* output of the most recently submitted picture, for conversion on the
+     * GPU. Transitioned back to D3D12_RESOURCE_STATE_COMMON after decoding. */
+    ID3D12Resource *OutputTexture() {
+        return nv12_texture;
+    }
+
+    D3D12CopyQueue *CopyQueue() {
+        return &copy_queue;
+    }
+
+    int Prewarm(const Resolution *resolutions, int count);
+    void SetSurfaceBudget(size_t bytes);
+    void GetSurfaceStats(SurfaceCache::Stats *stats);
+};
+
+#endif /* __D3D12BACKEND_H__ */
@@ -0,0 +1,116 @@
+#ifndef __DECODEBACKEND_H__
+#define __DECODEBACKEND_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* what the pipeline needs from a hardware decoder, independent of the API
+ * behind it. A DecodeDevice owns the device and its queues, and opens one
+ * DecodeBackend per stream. Pictures are submitted to a queue and complete
+ * asynchronously, tracked by the ticket Submit() returns, which increases
+ * with every submission to a session.
+ *
+ * d3d12backend.h implements this on D3D12 video decode, simbackend.h models
+ * it on the CPU so the pipeline can be run and benchmarked without a GPU. */
+
+static const int kMaxDecodeReferences = 16;
+
+struct Resolution; // surfacecache.h
+
+/* the codec a session decodes, which decides the layout of the parameter
+ * buffers in DecodePicture */
+enum VideoCodec {
+    kCodecUnknown,
+    kCodecH264,
+    kCodecHEVC,
+};
+
+/* one picture, parsed and ready for the device */
+struct DecodePicture {
+    int width, height; // coded size
+    int num_references; // pictures the DPB must hold, including this one
+    bool is_key;
+
+    /* parameter buffers, in the layout the device API expects (DXVA) for
+     * the codec the session was opened with */
+    const void *pic_params;
+    size_t pic_params_size;
+    const void *qmatrix;
+    size_t qmatrix_size;
+    const void *slice_control;
+    size_t slice_control_size;
+
+    /* Annex-B slice data, start code included, unless add_start_code is
+     * set, in which case bitstream is a bare NAL unit and the backend writes
+     * a 0,0,1 start code in front of it as it uploads it */
+    const uint8_t *bitstream;
+    size_t bitstream_size;
+    bool add_start_code;
+
+    /* DPB slots this picture is decoded into and predicts from */
+    int output_slot;
+    int num_refs;
+    int refs[kMaxDecodeReferences];
+};
+
+/* host view of a decoded 4:2:0 picture */
+struct MappedPicture {
+    const uint8_t *y;
+    size_t y_stride;
+    const uint8_t *uv;
+    size_t uv_stride;
+    int width, height;
+};
+
+struct DecodeBackendStats {
+    size_t surface_bytes; // decoder state, output and reference pictures
+    size_t staging_bytes; // bitstream upload and readback buffers
+    size_t surface_sets; // coded sizes surfaces are held for
+    int num_references;
+    uint64_t submitted;
+    uint64_t completed;
+};
+
+class DecodeBackend {
+public:
+    virtual ~DecodeBackend() {
+    }
+
+    /* queue pictures for decoding, in decode order. picture need only stay
+     * valid for the duration of the call. Returns 0 on failure. */
+    virtual uint64_t Submit(int queue, const DecodePicture *picture) = 0;
+
+    /* true once the picture for ticket, and all before it, has decoded */
+    virtual bool Poll(uint64_t ticket) = 0;
+    virtual void Wait(uint64_t ticket) = 0;
+
+    /* waits for ticket and maps its output, which must be the most recently
+     * submitted picture. Valid until Unmap() or the next Submit(). */
+    virtual bool Map(uint64_t ticket, MappedPicture *picture) = 0;
+    virtual void Unmap() = 0;
+
+    virtual void GetStats(DecodeBackendStats *stats) = 0;
+
+    /* create surfaces ahead of time for the coded sizes a stream may switch
+     * between, returns how many were created. Backends that create them on
+     * first use create none. */
+    virtual int Prewarm(const Resolution *, int) {
+        return 0;
+    }
+    /* device memory cached surfaces may use, 0 for no limit */
+    virtual void SetSurfaceBudget(size_t) {
+    }
+};
+
+class DecodeDevice {
+public:
+    virtual ~DecodeDevice() {
+    }
+
+    /* number of queues pictures can be decoded on concurrently */
+    virtual int NumQueues() = 0;
+    /* returns nullptr if the device cannot decode codec */
+    virtual DecodeBackend *OpenSession(VideoCodec codec) = 0;
+};
+
+#endif /* __DECODEBACKEND_H__ */
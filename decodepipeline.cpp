@@ -0,0 +1,377 @@
+#include <err.h>
+#include <stdio.h>
+
+#include <algorithm>
+
+#include "avcparser.h"
+#include "avcpicture.h"
+#include "decodepipeline.h"
+#include "hevcdump.h"
+#include "hevcparser.h"
+#include "hevcpicture.h"
+#include "latency.h"
+#include "picturehash.h"
+#include "trace.h"
+
+DecodePipeline::DecodePipeline(DecodeDevice *device, picture_callback_t picture_cb, void *opaque)
+    : device(device), picture_cb(picture_cb), opaque(opaque) {
+}
+
+DecodePipeline::~DecodePipeline() {
+    delete verifier;
+    delete session;
+    delete hevc_picture;
+    delete avc_picture;
+    delete hevc_parser;
+    delete avc_parser;
+}
+
+uint64_t DecodePipeline::decode(const DecodePicture *picture) {
+    TRACE_EVENT(2, "Decode", picture->is_key);
+
+    uint64_t ticket = session->Submit(0, picture);
+    if (!ticket) {
+        errx(1, "%s: submit failed", __PRETTY_FUNCTION__);
+    }
+    session->Wait(ticket);
+    ++decoded;
+    if (picture_cb) {
+        picture_cb(session, ticket, opaque);
+    }
+    return ticket;
+}
+
+/* reads back the last picture decoded, which the session still has mapped
+ * for as no other has been submitted since, and hands it to the verifier */
+void DecodePipeline::verify() {
+    if (!unverified_ticket) {
+        return;
+    }
+    MappedPicture mapped;
+    if (session->Map(unverified_ticket, &mapped)) {
+        verifier->Submit(0, unverified_number, mapped);
+        session->Unmap();
+    }
+    unverified_ticket = 0;
+}
+
+/* called by the parser after the slices of the picture the hash is for */
+void DecodePipeline::on_picture_hash(const PictureHash *hash, void *opaque) {
+    auto p = (DecodePipeline *) opaque;
+    if (p->verify_pictures) {
+        p->verifier->SetExpected(0, p->verify_pictures - 1, *hash);
+    }
+}
+
+
+void DecodePipeline::decode_hevc(const uint8_t *bytes, size_t size, void *opaque) {
+    auto p = (DecodePipeline *) opaque;
+    /* the first bit after the NALU header is first_slice_segment_in_pic_flag.
+     * Pictures past the frame limit are counted too, so that their hash is
+     * not taken for that of the last one decoded. */
+    bool first_slice = size > 2 && (bytes[2] & 0x80);
+    p->verify_pictures += first_slice;
+    if (p->Done()) {
+        return;
+    }
+    pipeline_latency.Record(kStageParse, TraceNow() - p->parse_start);
+    ++p->pictures;
+
+    /* pictures are submitted before we return, so the slice data need not
+     * be copied */
+    p->hevc_picture->BuildInPlace(p->hevc_parser, bytes, size);
+    if (p->param_dump) {
+        DumpDXVAPicParams(p->param_dump, (const DXVA_PicParams_HEVC *) p->hevc_picture->Get()->pic_params);
+    } else {
+        if (p->verifier && first_slice) {
+            p->verify();
+        }
+        uint64_t ticket = p->decode(p->hevc_picture->Get());
+        if (p->verifier) {
+            p->unverified_ticket = ticket;
+            p->unverified_number = p->verify_pictures - 1;
+        }
+    }
+    /* whatever the parser does from here until the next picture counts
+     * towards that picture's parse time */
+    p->parse_start = TraceNow();
+}
+
+void DecodePipeline::decode_avc(const uint8_t *bytes, size_t size, void *opaque) {
+    auto p = (DecodePipeline *) opaque;
+    if (p->Done()) {
+        return;
+    }
+    pipeline_latency.Record(kStageParse, TraceNow() - p->parse_start);
+    ++p->pictures;
+
+    /* hevcdump.h only knows the HEVC parameter layouts, so H.264 pictures
+     * are built but not dumped */
+    p->avc_picture->BuildInPlace(p->avc_parser, bytes, size);
+    if (!p->param_dump) {
+        p->decode(p->avc_picture->Get());
+    }
+    p->parse_start = TraceNow();
+}
+
+void DecodePipeline::open_session(VideoCodec codec) {
+    session = device->OpenSession(codec);
+    if (!session) {
+        errx(1, "%s: unable to open a decode session for codec %d", __PRETTY_FUNCTION__, codec);
+    }
+    if (surface_budget) {
+        session->SetSurfaceBudget(surface_budget);
+    }
+    if (!prewarm_resolutions.empty()) {
+        int n = session->Prewarm(prewarm_resolutions.data(), (int) prewarm_resolutions.size());
+        DVLOG(1) << "prewarmed " << n << " decoder surfaces";
+        prewarm_resolutions.clear();
+    }
+
+    if (codec == kCodecHEVC) {
+        hevc_parser = new HEVCParser();
+        hevc_parser->SetHoldPictures(hold_pictures);
+        hevc_parser->SetIrapOnly(keyframes_only);
+        hevc_parser->SetMaxTemporalId(max_temporal_id);
+        if (verifier) {
+            hevc_parser->SetPictureHashCallback(on_picture_hash, this);
+        }
+        hevc_picture = new HEVCPicture();
+    } else {
+        avc_parser = new AVCParser();
+        avc_picture = new AVCPicture();
+        if (keyframes_only || max_temporal_id < 6) {
+            warnx("%s: keyframes only and sub-layer dropping are HEVC only, decoding every picture", __PRETTY_FUNCTION__);
+        }
+        if (verifier) {
+            warnx("%s: picture hash verification is HEVC only, not verifying", __PRETTY_FUNCTION__);
+        }
+    }
+    this->codec = codec;
+}
+
+bool DecodePipeline::parse(const uint8_t *bytes, size_t size) {
+    parse_start = TraceNow();
+    if (hevc_parser) {
+        return hevc_parser->Parse(bytes, size, decode_hevc, this);
+    } else {
+        return avc_parser->Parse(bytes, size, decode_avc, this);
+    }
+}
+
+/* buffer the start of the stream until the probe can tell which codec it is,
+ * then replay it into the parser for that codec. A chunk larger than the
+ * probe buffer is probed in place. */
+bool DecodePipeline::probe_codec(const uint8_t *bytes, size_t size) {
+    CodecProbeResult result;
+    bool buffered = probe.Append(bytes, size);
+    if (buffered || probe.Size()) {
+        probe.Probe(&result);
+    } else {
+        ProbeCodec(bytes, std::min(size, CodecProbe::kMaxProbeSize), &result);
+    }
+    probe_ns += result.ns;
+
+    if (result.codec == kCodecUnknown) {
+        if (buffered) {
+            return false;
+        }
+        warnx("%s: unable to identify the codec of the stream, assuming HEVC", __PRETTY_FUNCTION__);
+        result.codec = kCodecHEVC;
+    }
+    DVLOG(1) << "codec " << result.codec << " after " << result.bytes_examined << " bytes, "
+             << result.nalus << " NALUs, " << probe_ns / 1000 << "us";
+    pipeline_latency.Record(kStageProbe, probe_ns);
+    open_session(result.codec);
+
+    bool have_frame = false;
+    if (probe.Size()) {
+        have_frame = parse(probe.Bytes(), probe.Size());
+        probe.Reset();
+    }
+    if (!buffered) {
+        have_frame |= parse(bytes, size);
+    }
+    return have_frame;
+}
+
+/* for a codec known from outside the stream, opens the session if not done
+ * yet, or returns false if the stream so far is another codec */
+bool DecodePipeline::set_codec(VideoCodec codec) {
+    if (codec != kCodecHEVC && codec != kCodecH264) {
+        return false;
+    }
+    if (this->codec == kCodecUnknown) {
+        probe.Reset();
+        open_session(codec);
+    }
+    return this->codec == codec;
+}
+
+bool DecodePipeline::SetCodecConfig(VideoCodec codec, const uint8_t *config, size_t size) {
+    if (!set_codec(codec)) {
+        return false;
+    }
+    if (codec == kCodecHEVC) {
+        return hevc_parser->ParseHvcC(config, size);
+    } else {
+        return avc_parser->ParseAvcC(config, size);
+    }
+}
+
+int DecodePipeline::Prewarm(const Resolution *resolutions, int count) {
+    if (!session) {
+        prewarm_resolutions.insert(prewarm_resolutions.end(), resolutions, resolutions + count);
+        return 0;
+    }
+    return session->Prewarm(resolutions, count);
+}
+
+void DecodePipeline::SetSurfaceBudget(size_t bytes) {
+    surface_budget = bytes;
+    if (session) {
+        session->SetSurfaceBudget(bytes);
+    }
+}
+
+void DecodePipeline::GetErrorStats(DecoderErrorStats *stats) {
+    *stats = {};
+    if (hevc_parser) {
+        HEVCParser::ErrorStats errors;
+        hevc_parser->GetErrorStats(&errors);
+        *stats = { errors.errors, errors.resyncs, errors.nals_dropped, errors.bytes_skipped };
+    } else if (avc_parser) {
+        AVCParser::ErrorStats errors;
+        avc_parser->GetErrorStats(&errors);
+        *stats = { errors.errors, errors.resyncs, errors.nals_dropped, errors.bytes_skipped };
+    }
+}
+
+void DecodePipeline::GetMemoryStats(DecoderMemoryStats *stats) {
+    *stats = {};
+    if (!session) {
+        return;
+    }
+    DecodeBackendStats backend_stats;
+    session->GetStats(&backend_stats);
+    stats->surface_bytes = backend_stats.surface_bytes;
+    stats->surface_sets = backend_stats.surface_sets;
+    stats->readback_bytes = backend_stats.staging_bytes;
+    stats->num_references = backend_stats.num_references;
+}
+
+void DecodePipeline::SetKeyframesOnly(bool enable) {
+    keyframes_only = enable;
+    if (hevc_parser) {
+        hevc_parser->SetIrapOnly(enable);
+    }
+}
+
+void DecodePipeline::SetHoldPictures(bool enable) {
+    hold_pictures = enable;
+    if (hevc_parser) {
+        hevc_parser->SetHoldPictures(enable);
+    }
+}
+
+void DecodePipeline::SetVerification(bool enable) {
+    if (enable && !verifier && codec == kCodecUnknown) {
+        verifier = new PictureVerifier(nullptr, nullptr);
+    }
+}
+
+void DecodePipeline::GetVerifyStats(DecoderVerifyStats *stats) {
+    *stats = {};
+    if (verifier) {
+        PictureVerifier::Stats verify_stats;
+        verifier->GetStats(&verify_stats);
+        *stats = { verify_stats.verified, verify_stats.mismatches, verify_stats.unhashed, verify_stats.unsupported,
+            verify_stats.dropped };
+    }
+}
+
+void DecodePipeline::SetMaxTemporalId(int temporal_id) {
+    max_temporal_id = temporal_id;
+    if (hevc_parser) {
+        hevc_parser->SetMaxTemporalId(temporal_id);
+    }
+}
+
+void DecodePipeline::GetCropRect(int *x, int *y, int *width, int *height) {
+    if (hevc_parser) {
+        hevc_parser->GetCropRect(x, y, width, height);
+    } else if (avc_parser) {
+        avc_parser->GetCropRect(x, y, width, height);
+    } else {
+        *x = *y = *width = *height = 0;
+    }
+}
+
+void DecodePipeline::GetUnpaddedDimensions(int *width, int *height) {
+    if (hevc_parser) {
+        hevc_parser->GetUnpaddedDimensions(width, height);
+    } else if (avc_parser) {
+        avc_parser->GetUnpaddedDimensions(width, height);
+    } else {
+        *width = *height = 0;
+    }
+}
+
+void DecodePipeline::GetColorSpace(ColorMatrix *matrix, ColorRange *range) {
+    int matrix_coefficients = 2;
+    bool full_range = false;
+    int width = 0, height = 0;
+    if (hevc_parser) {
+        hevc_parser->GetColorDescription(&matrix_coefficients, &full_range);
+    } else if (avc_parser) {
+        avc_parser->GetColorDescription(&matrix_coefficients, &full_range);
+    }
+    if (hevc_parser || avc_parser) {
+        GetUnpaddedDimensions(&width, &height);
+    }
+    ColorSpaceFromVUI(matrix_coefficients, full_range, height, matrix, range);
+}
+
+bool DecodePipeline::ReceiveBytes(const uint8_t *bytes, size_t size) {
+    if (codec == kCodecUnknown) {
+        return probe_codec(bytes, size);
+    }
+    return parse(bytes, size);
+}
+
+bool DecodePipeline::ReceiveNALU(VideoCodec codec, const uint8_t *nalu, size_t size) {
+    if (!set_codec(codec)) {
+        return false;
+    }
+    parse_start = TraceNow();
+    if (hevc_parser) {
+        return hevc_parser->PushNALU(nalu, size, decode_hevc, this);
+    } else {
+        return avc_parser->PushNALU(nalu, size, decode_avc, this);
+    }
+}
+
+bool DecodePipeline::Flush() {
+    bool have_frame = false;
+    if (codec == kCodecUnknown) {
+        if (!probe.Size()) {
+            return false;
+        }
+        /* the whole stream fit in the probe buffer */
+        warnx("%s: unable to identify the codec of the stream, assuming HEVC", __PRETTY_FUNCTION__);
+        open_session(kCodecHEVC);
+        have_frame = parse(probe.Bytes(), probe.Size());
+        probe.Reset();
+    }
+    parse_start = TraceNow();
+    if (hevc_parser) {
+        have_frame |= hevc_parser->Flush(decode_hevc, this);
+        if (verifier) {
+            verify();
+            verifier->Flush(0);
+        }
+    } else {
+        have_frame |= avc_parser->Flush(decode_avc, this);
+    }
+    return have_frame;
+}
@@ -0,0 +1,167 @@
+#ifndef __DECODEPIPELINE_H__
+#define __DECODEPIPELINE_H__
+
+#include <stdio.h>
+
+#include <vector>
+
+#include "codecprobe.h"
+#include "colorconvert.h"
+#include "decodebackend.h"
+#include "surfacecache.h"
+
+class AVCParser;
+class AVCPicture;
+class HEVCParser;
+class HEVCPicture;
+class PictureVerifier;
+struct PictureHash;
+
+/* device memory held by one decoding session */
+struct DecoderMemoryStats {
+    size_t surface_bytes; // decoder heaps, output and reference textures
+    size_t surface_sets; // cached resolutions
+    size_t readback_bytes;
+    int num_references; // reference texture array slices in use
+};
+
+/* stream errors the parser recovered from, see HEVCParser::ErrorStats */
+struct DecoderErrorStats {
+    size_t errors; // NALUs or pictures that failed to parse
+    size_t resyncs;
+    size_t nals_dropped;
+    size_t bytes_skipped;
+};
+
+/* decoded pictures checked against the picture hash SEI of the stream, see
+ * PictureVerifier::Stats */
+struct DecoderVerifyStats {
+    uint64_t verified; // matching or not
+    uint64_t mismatches;
+    uint64_t unhashed; // decoded without a hash SEI
+    uint64_t unsupported; // not 8-bit 4:2:0 or monochrome
+    uint64_t dropped; // verification too far behind, or not decoded
+};
+
+/* the part of a decoding layer that does not depend on the platform: the
+ * codec of the stream is probed for, the stream parsed by the parser for it,
+ * and each picture built and decoded on a session opened on a DecodeDevice,
+ * one at a time. Win32DecodingLayer runs this on D3D12DecodeDevice, amdtest1
+ * on SimulatedDevice where there is no D3D12. What becomes of a decoded
+ * picture is up to the picture callback. */
+
+class DecodePipeline {
+public:
+    /* called once the picture for ticket has decoded, before the next one is
+     * submitted, so that session->Map(ticket, ...) maps it */
+    typedef void (*picture_callback_t)(DecodeBackend *session, uint64_t ticket, void *opaque);
+
+private:
+    DecodeDevice *device;
+    picture_callback_t picture_cb;
+    void *opaque;
+
+    /* the stream is buffered in probe until its codec is known, and then
+     * only the parser for that codec is created */
+    CodecProbe probe;
+    uint64_t probe_ns = 0;
+    VideoCodec codec = kCodecUnknown;
+    HEVCParser *hevc_parser = nullptr;
+    AVCParser *avc_parser = nullptr;
+    HEVCPicture *hevc_picture = nullptr;
+    AVCPicture *avc_picture = nullptr;
+
+    /* surface budget and prewarm requests made before the session is
+     * opened are applied when it is */
+    DecodeBackend *session = nullptr;
+    size_t surface_budget = 0;
+    std::vector<Resolution> prewarm_resolutions;
+
+    /* start of the parse time attributed to the next decoded picture */
+    uint64_t parse_start = 0;
+
+    FILE *param_dump = nullptr;
+    bool keyframes_only = false;
+    bool hold_pictures = false;
+    int max_temporal_id = 6;
+    uint64_t pictures = 0; // passed on by the parser
+    uint64_t decoded = 0;
+    uint64_t frame_limit = 0;
+
+    /* each HEVC picture is read back once all its slices have decoded, that
+     * is before the first slice of the next one is submitted, and handed to
+     * verifier with its number in decode order */
+    PictureVerifier *verifier = nullptr;
+    uint64_t verify_pictures = 0; // first slices passed on by the parser
+    uint64_t unverified_ticket = 0;
+    uint64_t unverified_number = 0;
+
+    uint64_t decode(const DecodePicture *picture);
+    static void decode_hevc(const uint8_t *bytes, size_t size, void *opaque);
+    static void decode_avc(const uint8_t *bytes, size_t size, void *opaque);
+    void open_session(VideoCodec codec);
+    bool parse(const uint8_t *bytes, size_t size);
+    bool probe_codec(const uint8_t *bytes, size_t size);
+    bool set_codec(VideoCodec codec);
+    void verify();
+    static void on_picture_hash(const PictureHash *hash, void *opaque);
+
+public:
+    DecodePipeline(DecodeDevice *device, picture_callback_t picture_cb = nullptr, void *opaque = nullptr);
+    ~DecodePipeline();
+    DecodePipeline(const DecodePipeline &) = delete;
+    DecodePipeline &operator=(const DecodePipeline &) = delete;
+
+    /* as for Win32DecodingLayer, which forwards these here */
+    bool ReceiveBytes(const uint8_t *bytes, size_t size);
+    bool ReceiveNALU(VideoCodec codec, const uint8_t *nalu, size_t size);
+    bool Flush();
+    bool SetCodecConfig(VideoCodec codec, const uint8_t *config, size_t size);
+    int Prewarm(const Resolution *resolutions, int count);
+    void SetSurfaceBudget(size_t bytes);
+    void GetMemoryStats(DecoderMemoryStats *stats);
+    void GetErrorStats(DecoderErrorStats *stats);
+    void SetParamDump(FILE *f) {
+        param_dump = f;
+    }
+    void SetKeyframesOnly(bool enable);
+    /* drop HEVC pictures with a broken slice as a whole, see
+     * HEVCParser::SetHoldPictures(), e.g. for untrusted input. Off by
+     * default, as it costs a copy of every picture. */
+    void SetHoldPictures(bool enable);
+    /* check each decoded picture against the decoded picture hash SEI of
+     * the stream, if it has one, warning about those that differ, see
+     * PictureVerifier. HEVC only, set before the first ReceiveBytes(). */
+    void SetVerification(bool enable);
+    void GetVerifyStats(DecoderVerifyStats *stats);
+    void SetMaxTemporalId(int temporal_id);
+    uint64_t GetPictureCount() const {
+        return pictures;
+    }
+    /* stop after decoding frames pictures, 0 for no limit. Pictures parsed
+     * after that are dropped, so the caller can stop feeding input once
+     * Done() says so and carry on as after the end of the stream. */
+    void SetFrameLimit(uint64_t frames) {
+        frame_limit = frames;
+    }
+    bool Done() const {
+        return frame_limit && decoded >= frame_limit;
+    }
+
+    /* kCodecUnknown until the codec has been identified */
+    VideoCodec GetCodec() const {
+        return codec;
+    }
+    /* of the most recently parsed picture */
+    void GetCropRect(int *x, int *y, int *width, int *height);
+    void GetUnpaddedDimensions(int *width, int *height);
+    /* how the decoded pictures are to be converted to RGB, from the VUI of
+     * the stream, see ColorSpaceFromVUI() */
+    void GetColorSpace(ColorMatrix *matrix, ColorRange *range);
+    /* nullptr until the codec has been identified */
+    DecodeBackend *Session() {
+        return session;
+    }
+};
+
+#endif /* __DECODEPIPELINE_H__ */
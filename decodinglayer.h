@@ -3,6 +3,7 @@
 
 #include "buffer.h"
 #include "condition.h"
+#include "decodebackend.h"
 
 class Device;
 class ImageBuffer;
@@ -14,7 +15,8 @@ protected:
 
     Device *device;
     int width = 0, height = 0;
-    bool is_hevc = false;
+    /* identified from the first bytes of the stream, see codecprobe.h */
+    VideoCodec codec = kCodecUnknown;
 
     ConditionVariable<ImageBuffer *> current_frame;
 
@@ -27,6 +29,10 @@ public:
     virtual ~DecodingLayer();
     virtual bool ReceiveBytes(const uint8_t *bytes, size_t compressed_size) = 0;
     ImageBuffer *GetFrame();
+    /* kCodecUnknown until ReceiveBytes() has seen enough of the stream */
+    VideoCodec GetCodec() const {
+        return codec;
+    }
 
     static DecodingLayer *Create(Device *device);
 };
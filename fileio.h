@@ -0,0 +1,37 @@
+#ifndef __FILEIO_H__
+#define __FILEIO_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#ifndef _WIN32
+#include <sys/types.h>
+#endif
+
+/* files may well be larger than a long, so seeking and telling go through
+ * these rather than fseek() and ftell() */
+
+static inline int seek64(FILE *f, uint64_t offset, int whence = SEEK_SET) {
+#ifdef _WIN32
+    return _fseeki64(f, (__int64) offset, whence);
+#else
+    return fseeko(f, (off_t) offset, whence);
+#endif
+}
+
+static inline uint64_t tell64(FILE *f) {
+#ifdef _WIN32
+    return (uint64_t) _ftelli64(f);
+#else
+    return (uint64_t) ftello(f);
+#endif
+}
+
+/* leaves f at its end */
+static inline uint64_t file_size64(FILE *f) {
+    if (seek64(f, 0, SEEK_END)) {
+        return 0;
+    }
+    return tell64(f);
+}
+
+#endif /* __FILEIO_H__ */
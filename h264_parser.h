@@ -11,8 +11,6 @@
 #include <stdint.h>
 #include <sys/types.h>
 
-#include <map>
-#include <memory>
 #include <vector>
 
 #if 0
@@ -36,9 +34,7 @@ struct ColorVolumeMetadata;
 struct HDRMetadata;
 }  // namespace gfx
 
-namespace media {
-
-struct SubsampleEntry;
+//namespace media {
 
 // For explanations of each struct and its members, see H.264 specification
 // at http://www.itu.int/rec/T-REC-H.264.
@@ -438,181 +434,6 @@ struct MEDIA_EXPORT H264SEI {
   std::vector<H264SEIMessage> msgs;
 };
 
-// Class to parse an Annex-B H.264 stream,
-// as specified in chapters 7 and Annex B of the H.264 spec.
-class MEDIA_EXPORT H264Parser {
- public:
-  enum Result {
-    kOk,
-    kInvalidStream,      // error in stream
-    kUnsupportedStream,  // stream not supported by the parser
-    kEOStream,           // end of stream
-  };
-
-  // Find offset from start of data to next NALU start code
-  // and size of found start code (3 or 4 bytes).
-  // If no start code is found, offset is pointing to the first unprocessed byte
-  // (i.e. the first byte that was not considered as a possible start of a start
-  // code) and |*start_code_size| is set to 0.
-  // Preconditions:
-  // - |data_size| >= 0
-  // Postconditions:
-  // - |*offset| is between 0 and |data_size| included.
-  //   It is strictly less than |data_size| if |data_size| > 0.
-  // - |*start_code_size| is either 0, 3 or 4.
-  static bool FindStartCode(const uint8_t* data,
-                            off_t data_size,
-                            off_t* offset,
-                            off_t* start_code_size);
-
-  // Wrapper for FindStartCode() that skips over start codes that
-  // may appear inside of |encrypted_ranges_|.
-  // Returns true if a start code was found. Otherwise returns false.
-#if 0
-  static bool FindStartCodeInClearRanges(const uint8_t* data,
-                                         off_t data_size,
-                                         const Ranges<const uint8_t*>& ranges,
-                                         off_t* offset,
-                                         off_t* start_code_size);
-#endif
-
-  static VideoCodecProfile ProfileIDCToVideoCodecProfile(int profile_idc);
-
-  // Parses the input stream and returns all the NALUs through |nalus|. Returns
-  // false if the stream is invalid.
-  static bool ParseNALUs(const uint8_t* stream,
-                         size_t stream_size,
-                         std::vector<H264NALU>* nalus);
-
-  H264Parser();
-
-  H264Parser(const H264Parser&) = delete;
-  H264Parser& operator=(const H264Parser&) = delete;
-
-  ~H264Parser();
-
-  void Reset();
-  // Set current stream pointer to |stream| of |stream_size| in bytes,
-  // |stream| owned by caller.
-  // |subsamples| contains information about what parts of |stream| are
-  // encrypted.
-  void SetStream(const uint8_t* stream, off_t stream_size);
-  void SetEncryptedStream(const uint8_t* stream,
-                          off_t stream_size,
-                          const std::vector<SubsampleEntry>& subsamples);
-
-  // Read the stream to find the next NALU, identify it and return
-  // that information in |*nalu|. This advances the stream to the beginning
-  // of this NALU, but not past it, so subsequent calls to NALU-specific
-  // parsing functions (ParseSPS, etc.)  will parse this NALU.
-  // If the caller wishes to skip the current NALU, it can call this function
-  // again, instead of any NALU-type specific parse functions below.
-  Result AdvanceToNextNALU(H264NALU* nalu);
-
-  // NALU-specific parsing functions.
-  // These should be called after AdvanceToNextNALU().
-
-  // SPSes and PPSes are owned by the parser class and the memory for their
-  // structures is managed here, not by the caller, as they are reused
-  // across NALUs.
-  //
-  // Parse an SPS/PPS NALU and save their data in the parser, returning id
-  // of the parsed structure in |*pps_id|/|*sps_id|.
-  // To get a pointer to a given SPS/PPS structure, use GetSPS()/GetPPS(),
-  // passing the returned |*sps_id|/|*pps_id| as parameter.
-  // TODO(posciak,fischman): consider replacing returning Result from Parse*()
-  // methods with a scoped_ptr and adding an AtEOS() function to check for EOS
-  // if Parse*() return NULL.
-  Result ParseSPS(int* sps_id);
-  Result ParsePPS(int* pps_id);
-
-  // Parses the SPS ID from the SPSExt, but otherwise does nothing.
-  Result ParseSPSExt(int* sps_id);
-
-  // Return a pointer to SPS/PPS with given |sps_id|/|pps_id| or NULL if not
-  // present.
-  const H264SPS* GetSPS(int sps_id) const;
-  const H264PPS* GetPPS(int pps_id) const;
-
-  // Slice headers and SEI messages are not used across NALUs by the parser
-  // and can be discarded after current NALU, so the parser does not store
-  // them, nor does it manage their memory.
-  // The caller has to provide and manage it instead.
-
-  // Parse a slice header, returning it in |*shdr|. |*nalu| must be set to
-  // the NALU returned from AdvanceToNextNALU() and corresponding to |*shdr|.
-  Result ParseSliceHeader(const H264NALU& nalu, H264SliceHeader* shdr);
-
-  // Parse a SEI, returning it in |*sei|, provided and managed by the caller.
-  Result ParseSEI(H264SEI* sei);
-
-  // The return value of this method changes for every successful call to
-  // AdvanceToNextNALU().
-  // This returns the subsample information for the last NALU that was output
-  // from AdvanceToNextNALU().
-  std::vector<SubsampleEntry> GetCurrentSubsamples();
-
- private:
-  // Move the stream pointer to the beginning of the next NALU,
-  // i.e. pointing at the next start code.
-  // Return true if a NALU has been found.
-  // If a NALU is found:
-  // - its size in bytes is returned in |*nalu_size| and includes
-  //   the start code as well as the trailing zero bits.
-  // - the size in bytes of the start code is returned in |*start_code_size|.
-  bool LocateNALU(off_t* nalu_size, off_t* start_code_size);
-
-  // Parse scaling lists (see spec).
-  Result ParseScalingList(int size, uint8_t* scaling_list, bool* use_default);
-  Result ParseSPSScalingLists(H264SPS* sps);
-  Result ParsePPSScalingLists(const H264SPS& sps, H264PPS* pps);
-
-  // Parse optional VUI parameters in SPS (see spec).
-  Result ParseVUIParameters(H264SPS* sps);
-  // Set |hrd_parameters_present| to true only if they are present.
-  Result ParseAndIgnoreHRDParameters(bool* hrd_parameters_present);
-
-  // Parse reference picture lists' modifications (see spec).
-  Result ParseRefPicListModifications(H264SliceHeader* shdr);
-  Result ParseRefPicListModification(int num_ref_idx_active_minus1,
-                                     H264ModificationOfPicNum* ref_list_mods);
-
-  // Parse prediction weight table (see spec).
-  Result ParsePredWeightTable(const H264SPS& sps, H264SliceHeader* shdr);
-
-  // Parse weighting factors (see spec).
-  Result ParseWeightingFactors(int num_ref_idx_active_minus1,
-                               int chroma_array_type,
-                               int luma_log2_weight_denom,
-                               int chroma_log2_weight_denom,
-                               H264WeightingFactors* w_facts);
-
-  // Parse decoded reference picture marking information (see spec).
-  Result ParseDecRefPicMarking(H264SliceHeader* shdr);
-
-  // Pointer to the current NALU in the stream.
-  const uint8_t* stream_;
-
-  // Bytes left in the stream after the current NALU.
-  off_t bytes_left_;
-
-  H264BitReader br_;
-
-  // PPSes and SPSes stored for future reference.
-  std::map<int, std::unique_ptr<H264SPS>> active_SPSes_;
-  std::map<int, std::unique_ptr<H264PPS>> active_PPSes_;
-
-#if 0
-  // Ranges of encrypted bytes in the buffer passed to
-  // SetEncryptedStream().
-  Ranges<const uint8_t*> encrypted_ranges_;
-
-  // This contains the range of the previous NALU found in
-  // AdvanceToNextNalu(). Holds exactly one range.
-  Ranges<const uint8_t*> previous_nalu_range_;
-#endif
-};
-
-}  // namespace media
+//}  // namespace media
 
 #endif  // MEDIA_VIDEO_H264_PARSER_H_
@@ -0,0 +1,248 @@
+#include <string.h>
+
+#include <algorithm>
+
+#include "hevcanalyzer.h"
+#include "trace.h"
+
+/* NALU types, see H265NALU */
+enum {
+    kRASL_N = 8,
+    kRASL_R = 9,
+    kIDR_N_LP = 20,
+    kCRA = 21,
+    kVPS = 32,
+    kPPS = 34,
+    kEOS = 36,
+};
+
+/* segments per thread, so a slow one does not hold up the rest */
+static const int kSegmentsPerThread = 4;
+
+static bool is_irap(int type) {
+    return type >= 16 && type <= 21;
+}
+
+/* the index of the NALU after the first start code at or after i, or size */
+static size_t find_nalu(const uint8_t *bytes, size_t size, size_t i) {
+    while (i + 2 < size) {
+        auto one = (const uint8_t *) memchr(bytes + i + 2, 1, size - i - 2);
+        if (!one) {
+            break;
+        }
+        size_t j = one - bytes;
+        if (!bytes[j - 1] && !bytes[j - 2]) {
+            return j + 1;
+        }
+        i = j - 1;
+    }
+    return size;
+}
+
+/* the next NALU from *pos on, without its start code and trailing zeros,
+ * moving *pos past it. Returns false at size. */
+static bool next_nalu(const uint8_t *bytes, size_t size, size_t *pos, const uint8_t **nalu, size_t *nalu_size) {
+    size_t start = find_nalu(bytes, size, *pos);
+    if (start >= size) {
+        *pos = size;
+        return false;
+    }
+    size_t next = find_nalu(bytes, size, start);
+    size_t end = next == size ? size : next - 3;
+    *pos = end;
+    while (end > start && !bytes[end - 1]) {
+        --end;
+    }
+    *nalu = bytes + start;
+    *nalu_size = end - start;
+    return true;
+}
+
+/* cut at the random access points closest to every size / segments bytes */
+void HEVCAnalyzer::split() {
+    segments.clear();
+    size_t target = size / (pool.NumThreads() * kSegmentsPerThread) + 1;
+    size_t start = 0;
+    for (size_t i = 0; i < index->NumPoints(); ++i) {
+        size_t offset = (size_t) index->GetPoint(i).offset;
+        if (offset > start && offset < size && offset - start >= target) {
+            segments.emplace_back(start, offset);
+            start = offset;
+        }
+    }
+    segments.emplace_back(start, size);
+}
+
+void HEVCAnalyzer::OnSlice(const uint8_t *bytes, size_t size, void *opaque) {
+    auto w = (Worker *) opaque;
+    int type = (bytes[0] >> 1) & 0x3f;
+    if (w->rasl_only && type != kRASL_N && type != kRASL_R) {
+        return;
+    }
+    auto &shdr = w->parser->GetSliceHeader();
+    if (shdr.first_slice_segment_in_pic_flag || w->pictures->empty()) {
+        HEVCPictureInfo info = {};
+        info.offset = bytes - w->bytes;
+        info.poc = w->parser->GetPictureOrderCount();
+        info.nal_unit_type = (uint8_t) type;
+        info.temporal_id = (uint8_t) ((bytes[1] & 7) - 1);
+        info.slice_type = (uint8_t) shdr.slice_type;
+        info.pps_id = (uint8_t) shdr.slice_pic_parameter_set_id;
+        info.slice_qp_delta = (int8_t) shdr.slice_qp_delta;
+        if (!shdr.IsISlice()) {
+            info.num_ref_idx_active[0] = (uint8_t) (shdr.num_ref_idx_l0_active_minus1 + 1);
+        }
+        if (shdr.IsBSlice()) {
+            info.num_ref_idx_active[1] = (uint8_t) (shdr.num_ref_idx_l1_active_minus1 + 1);
+        }
+        w->pictures->push_back(info);
+    }
+    auto &info = w->pictures->back();
+    info.size += (uint32_t) size;
+    info.slice_segments = (uint8_t) std::min(info.slice_segments + 1, 255);
+}
+
+void HEVCAnalyzer::ParseTask(int task, void *opaque) {
+    auto a = (HEVCAnalyzer *) opaque;
+    auto &seg = a->segments[task];
+    TRACE_EVENT(2, "HEVCAnalyzer::ParseTask", task);
+    auto parser = new HEVCParser();
+    Worker w = { parser, a->bytes, &seg.pictures, false };
+
+    /* the last of each type and id sent before the segment, in VPS, SPS,
+     * PPS order */
+    const HEVCIndex::ParamSet *latest[3][64] = {};
+    for (size_t i = 0; i < a->index->NumParamSets(); ++i) {
+        auto &ps = a->index->GetParamSet(i);
+        if (ps.offset >= seg.start) {
+            break;
+        }
+        if (ps.nal_unit_type >= kVPS && ps.nal_unit_type <= kPPS && ps.id < 64) {
+            latest[ps.nal_unit_type - kVPS][ps.id] = &ps;
+        }
+    }
+    for (auto &type : latest) {
+        for (auto ps : type) {
+            if (ps && ps->offset + ps->size <= a->size) {
+                parser->PushNALU(a->bytes + ps->offset, ps->size, OnSlice, &w);
+            }
+        }
+    }
+
+    seg.reset_at = kNoReset;
+    bool eos = false;
+    size_t pos = seg.start;
+    const uint8_t *nalu;
+    size_t nalu_size;
+    while (next_nalu(a->bytes, seg.end, &pos, &nalu, &nalu_size)) {
+        int type = (nalu[0] >> 1) & 0x3f;
+        if (nalu_size > 2 && is_irap(type) && (nalu[2] & 0x80)) {
+            if ((type <= kIDR_N_LP || eos) && !seg.pictures.empty() && seg.reset_at == kNoReset) {
+                seg.reset_at = seg.pictures.size();
+            }
+            eos = false;
+        }
+        eos = eos || type == kEOS;
+        parser->PushNALU(nalu, nalu_size, OnSlice, &w);
+    }
+    parser->GetErrorStats(&seg.errors);
+
+    /* on through the CRA picture starting the next segment and its leading
+     * pictures, which end at the first trailing picture */
+    seg.next_is_cra = false;
+    w.pictures = &seg.rasl;
+    w.rasl_only = true;
+    while (seg.end < a->size && next_nalu(a->bytes, a->size, &pos, &nalu, &nalu_size)) {
+        int type = (nalu[0] >> 1) & 0x3f;
+        bool first_slice = type < kVPS && nalu_size > 2 && (nalu[2] & 0x80);
+        if (first_slice && !seg.next_is_cra) {
+            if (type != kCRA) {
+                break;
+            }
+            seg.next_is_cra = true;
+            seg.next_resets = eos;
+        } else if (first_slice && (type < 6 || type > kRASL_R)) {
+            break;
+        }
+        eos = eos || type == kEOS;
+        parser->PushNALU(nalu, nalu_size, OnSlice, &w);
+        if (first_slice && type == kCRA) {
+            seg.next_poc = parser->GetPictureOrderCount();
+        }
+    }
+    delete parser;
+}
+
+/* puts the segments back together in decode order, with the POCs shifted
+ * to those of parsing in one go */
+void HEVCAnalyzer::merge() {
+    pictures.clear();
+    stats = {};
+    stats.segments = (int) segments.size();
+    auto &errors = stats.errors;
+    size_t rasl_nalus = 0, rasl_bytes = 0;
+    int32_t delta = 0; // to add to the POCs of the segment, up to reset_at
+    for (size_t k = 0; k < segments.size(); ++k) {
+        auto &seg = segments[k];
+        for (size_t i = 0; i < seg.pictures.size(); ++i) {
+            auto info = seg.pictures[i];
+            if (i < seg.reset_at) {
+                info.poc += delta;
+            }
+            pictures.push_back(info);
+        }
+
+        int32_t end_delta = seg.reset_at == kNoReset ? delta : 0;
+        int32_t next_delta = 0;
+        if (seg.next_is_cra) {
+            for (auto info : seg.rasl) {
+                info.poc += end_delta;
+                pictures.push_back(info);
+                rasl_nalus += info.slice_segments;
+                rasl_bytes += info.size;
+            }
+            auto &next = segments[k + 1].pictures;
+            if (!seg.next_resets && !next.empty() && next[0].nal_unit_type == kCRA) {
+                next_delta = seg.next_poc + end_delta - next[0].poc;
+            }
+        }
+        delta = next_delta;
+
+        errors.errors += seg.errors.errors;
+        errors.resyncs += seg.errors.resyncs;
+        errors.nals_dropped += seg.errors.nals_dropped;
+        errors.bytes_skipped += seg.errors.bytes_skipped;
+        errors.missing_references += seg.errors.missing_references;
+        if (seg.errors.last_error != HEVCParser::kOk) {
+            errors.last_error = seg.errors.last_error;
+        }
+    }
+    /* the RASL pictures the parsers starting at CRA pictures dropped */
+    errors.nals_dropped -= std::min(errors.nals_dropped, rasl_nalus);
+    errors.bytes_skipped -= std::min(errors.bytes_skipped, rasl_bytes);
+
+    /* the RASL pictures may come after RADL ones */
+    std::stable_sort(pictures.begin(), pictures.end(),
+        [](const HEVCPictureInfo &a, const HEVCPictureInfo &b) { return a.offset < b.offset; });
+    for (auto &info : pictures) {
+        ++stats.pictures;
+        stats.slice_bytes += info.size;
+        stats.irap_pictures += is_irap(info.nal_unit_type);
+        if (info.slice_type < 3) {
+            ++stats.slice_types[info.slice_type];
+        }
+    }
+}
+
+void HEVCAnalyzer::Analyze(const uint8_t *bytes, size_t size, const HEVCIndex &index) {
+    TRACE_EVENT(1, "HEVCAnalyzer::Analyze");
+    uint64_t start = TraceNow();
+    this->bytes = bytes;
+    this->size = size;
+    this->index = &index;
+    split();
+    pool.Run((int) segments.size(), ParseTask, this);
+    merge();
+    segments.clear();
+    stats.elapsed_ns = TraceNow() - start;
+}
@@ -0,0 +1,127 @@
+#ifndef __HEVCANALYZER_H__
+#define __HEVCANALYZER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "hevcindex.h"
+#include "hevcparser.h"
+#include "workerpool.h"
+
+/* parses a whole raw Annex-B HEVC stream on many threads for offline
+ * analysis, giving the same per-picture results as parsing it in one go.
+ *
+ * The stream is split at the random access points of its HEVCIndex into
+ * segments of about equal size, a few per thread so they balance out, and
+ * each segment is parsed by its own HEVCParser on a WorkerPool. A parser is
+ * first given the last parameter set of each type and id sent before its
+ * segment, as it would have seen them parsing from the start.
+ *
+ * Segments starting at IDR and BLA pictures parse exactly as they would in
+ * sequence, but a CRA picture is only the start of a coded video sequence
+ * for the parser starting there. The parser of the segment before it
+ * therefore reads on past its end, through the CRA picture and its leading
+ * pictures, for the POC the CRA picture really has and for the RASL
+ * pictures, which the parser starting at the CRA picture cannot decode.
+ * Merging the segments in order then shifts the POCs of each by the
+ * difference. */
+
+struct HEVCPictureInfo {
+    uint64_t offset; // of its first slice segment NALU, after the start code
+    uint32_t size; // of all its slice segment NALUs
+    int32_t poc;
+    uint8_t nal_unit_type;
+    uint8_t temporal_id;
+    uint8_t slice_segments;
+    /* of the first slice segment */
+    uint8_t slice_type; // 0 B, 1 P, 2 I
+    uint8_t pps_id;
+    int8_t slice_qp_delta;
+    uint8_t num_ref_idx_active[2];
+};
+
+class HEVCAnalyzer {
+public:
+    struct Stats {
+        uint64_t pictures;
+        uint64_t slice_bytes;
+        uint64_t irap_pictures;
+        uint64_t slice_types[3]; // pictures by the type of their first slice
+        int segments;
+        uint64_t elapsed_ns;
+        /* as parsing in one go would count them, except for RPS entries of
+         * pictures after a CRA picture that refer to pictures before it,
+         * which are missing references for the parser starting there */
+        HEVCParser::ErrorStats errors;
+    };
+
+private:
+    static constexpr size_t kNoReset = ~(size_t) 0;
+
+    struct Segment {
+        size_t start, end;
+        std::vector<HEVCPictureInfo> pictures;
+        /* the first picture starting a coded video sequence after the
+         * segment's own start, from which on its POCs are right as they are,
+         * or kNoReset */
+        size_t reset_at = kNoReset;
+        /* read past the end when the next segment starts at a CRA picture */
+        bool next_is_cra = false;
+        bool next_resets = false; // after an end of sequence NALU
+        int32_t next_poc = 0; // of that CRA picture
+        std::vector<HEVCPictureInfo> rasl; // of that CRA picture
+        HEVCParser::ErrorStats errors = {}; // up to the end
+
+        Segment(size_t start, size_t end)
+            : start(start), end(end) {
+        }
+    };
+
+    /* state of one parser while it runs */
+    struct Worker {
+        HEVCParser *parser;
+        const uint8_t *bytes;
+        std::vector<HEVCPictureInfo> *pictures;
+        bool rasl_only; // past the end of the segment
+    };
+
+    WorkerPool pool;
+    const uint8_t *bytes = nullptr;
+    size_t size = 0;
+    const HEVCIndex *index = nullptr;
+    std::vector<Segment> segments;
+    std::vector<HEVCPictureInfo> pictures;
+    Stats stats = {};
+
+    void split();
+    void merge();
+    static void ParseTask(int task, void *opaque);
+    static void OnSlice(const uint8_t *bytes, size_t size, void *opaque);
+
+public:
+    /* threads is the size of the pool, 0 for one per hardware thread */
+    HEVCAnalyzer(int threads = 0) : pool(threads) {
+    }
+    HEVCAnalyzer(const HEVCAnalyzer &) = delete;
+    HEVCAnalyzer &operator=(const HEVCAnalyzer &) = delete;
+
+    int NumThreads() const {
+        return pool.NumThreads();
+    }
+
+    /* parses the stream in bytes, with index built for it. bytes need only
+     * stay valid for the duration of the call. */
+    void Analyze(const uint8_t *bytes, size_t size, const HEVCIndex &index);
+
+    /* of the last Analyze(), in decode order */
+    const std::vector<HEVCPictureInfo> &GetPictures() const {
+        return pictures;
+    }
+    void GetStats(Stats *out) const {
+        *out = stats;
+    }
+};
+
+#endif /* __HEVCANALYZER_H__ */
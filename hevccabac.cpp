@@ -0,0 +1,1137 @@
+#include <string.h>
+
+#include <algorithm>
+
+#include "hevccabac.h"
+#include "trace.h"
+
+/* Table 9-52 */
+const uint8_t CabacDecoder::kRangeTabLps[64][4] = {
+    { 128, 176, 208, 240 }, { 128, 167, 197, 227 }, { 128, 158, 187, 216 }, { 123, 150, 178, 205 },
+    { 116, 142, 169, 195 }, { 111, 135, 160, 185 }, { 105, 128, 152, 175 }, { 100, 122, 144, 166 },
+    { 95, 116, 137, 158 }, { 90, 110, 130, 150 }, { 85, 104, 123, 142 }, { 81, 99, 117, 135 },
+    { 77, 94, 111, 128 }, { 73, 89, 105, 122 }, { 69, 85, 100, 116 }, { 66, 80, 95, 110 },
+    { 62, 76, 90, 104 }, { 59, 72, 86, 99 }, { 56, 69, 81, 94 }, { 53, 65, 77, 89 },
+    { 51, 62, 73, 85 }, { 48, 59, 69, 80 }, { 46, 56, 66, 76 }, { 43, 53, 63, 72 },
+    { 41, 50, 59, 69 }, { 39, 48, 56, 65 }, { 37, 45, 54, 62 }, { 35, 43, 51, 59 },
+    { 33, 41, 48, 56 }, { 32, 39, 46, 53 }, { 30, 37, 43, 50 }, { 29, 35, 41, 48 },
+    { 27, 33, 39, 45 }, { 26, 31, 37, 43 }, { 24, 30, 35, 41 }, { 23, 28, 33, 39 },
+    { 22, 27, 32, 37 }, { 21, 26, 30, 35 }, { 20, 24, 29, 33 }, { 19, 23, 27, 31 },
+    { 18, 22, 26, 30 }, { 17, 21, 25, 28 }, { 16, 20, 23, 27 }, { 15, 19, 22, 25 },
+    { 14, 18, 21, 24 }, { 14, 17, 20, 23 }, { 13, 16, 19, 22 }, { 12, 15, 18, 21 },
+    { 12, 14, 17, 20 }, { 11, 14, 16, 19 }, { 11, 13, 15, 18 }, { 10, 12, 15, 17 },
+    { 10, 12, 14, 16 }, { 9, 11, 13, 15 }, { 9, 11, 12, 14 }, { 8, 10, 12, 14 },
+    { 8, 9, 11, 13 }, { 7, 9, 11, 12 }, { 7, 9, 10, 12 }, { 7, 8, 10, 11 },
+    { 6, 8, 9, 11 }, { 6, 7, 9, 10 }, { 6, 7, 8, 9 }, { 2, 2, 2, 2 },
+};
+
+/* Table 9-53, with valMps in the low bit */
+#define MPS(s) ((s) < 62 ? (s) + 1 : (s)) * 2, ((s) < 62 ? (s) + 1 : (s)) * 2 + 1
+const uint8_t CabacDecoder::kNextStateMps[128] = {
+    MPS(0), MPS(1), MPS(2), MPS(3), MPS(4), MPS(5), MPS(6), MPS(7),
+    MPS(8), MPS(9), MPS(10), MPS(11), MPS(12), MPS(13), MPS(14), MPS(15),
+    MPS(16), MPS(17), MPS(18), MPS(19), MPS(20), MPS(21), MPS(22), MPS(23),
+    MPS(24), MPS(25), MPS(26), MPS(27), MPS(28), MPS(29), MPS(30), MPS(31),
+    MPS(32), MPS(33), MPS(34), MPS(35), MPS(36), MPS(37), MPS(38), MPS(39),
+    MPS(40), MPS(41), MPS(42), MPS(43), MPS(44), MPS(45), MPS(46), MPS(47),
+    MPS(48), MPS(49), MPS(50), MPS(51), MPS(52), MPS(53), MPS(54), MPS(55),
+    MPS(56), MPS(57), MPS(58), MPS(59), MPS(60), MPS(61), MPS(62), MPS(63),
+};
+#undef MPS
+
+/* the LPS flips valMps at pStateIdx 0 */
+#define LPS(s, t) (t) * 2 + ((s) == 0), (t) * 2 + ((s) != 0)
+const uint8_t CabacDecoder::kNextStateLps[128] = {
+    LPS(0, 0), LPS(1, 0), LPS(2, 1), LPS(3, 2), LPS(4, 2), LPS(5, 4), LPS(6, 4), LPS(7, 5),
+    LPS(8, 6), LPS(9, 7), LPS(10, 8), LPS(11, 9), LPS(12, 9), LPS(13, 11), LPS(14, 11), LPS(15, 12),
+    LPS(16, 13), LPS(17, 13), LPS(18, 15), LPS(19, 15), LPS(20, 16), LPS(21, 16), LPS(22, 18), LPS(23, 18),
+    LPS(24, 19), LPS(25, 19), LPS(26, 21), LPS(27, 21), LPS(28, 22), LPS(29, 22), LPS(30, 23), LPS(31, 24),
+    LPS(32, 24), LPS(33, 25), LPS(34, 26), LPS(35, 26), LPS(36, 27), LPS(37, 27), LPS(38, 28), LPS(39, 29),
+    LPS(40, 29), LPS(41, 30), LPS(42, 30), LPS(43, 30), LPS(44, 31), LPS(45, 32), LPS(46, 32), LPS(47, 33),
+    LPS(48, 33), LPS(49, 33), LPS(50, 34), LPS(51, 34), LPS(52, 35), LPS(53, 35), LPS(54, 35), LPS(55, 36),
+    LPS(56, 36), LPS(57, 36), LPS(58, 37), LPS(59, 37), LPS(60, 37), LPS(61, 38), LPS(62, 38), LPS(63, 63),
+};
+#undef LPS
+
+/* shifts bringing a range of 6 to 511 back to 256 or above, by range >> 3 */
+const uint8_t CabacDecoder::kRenormShift[64] = {
+    6, 5, 4, 4, 3, 3, 3, 3, 2, 2, 2, 2, 2, 2, 2, 2,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+/* 9.3.2.2 */
+uint8_t CabacDecoder::InitContext(int init_value, int slice_qp) {
+    int m = (init_value >> 4) * 5 - 45;
+    int n = ((init_value & 15) << 3) - 16;
+    int pre = std::min(std::max(((m * std::min(std::max(slice_qp, 0), 51)) >> 4) + n, 1), 126);
+    return pre <= 63 ? (uint8_t) ((63 - pre) << 1) : (uint8_t) (((pre - 64) << 1) | 1);
+}
+
+/* offsets of the contexts of each syntax element */
+enum {
+    kSaoMergeFlag = 0,
+    kSaoTypeIdx = 1,
+    kSplitCuFlag = 2, // 3
+    kCuTransquantBypassFlag = 5,
+    kCuSkipFlag = 6, // 3
+    kPredModeFlag = 9,
+    kPartMode = 10, // 4
+    kPrevIntraLumaPredFlag = 14,
+    kIntraChromaPredMode = 15,
+    kRqtRootCbf = 16,
+    kMergeFlag = 17,
+    kMergeIdx = 18,
+    kInterPredIdc = 19, // 5
+    kRefIdx = 24, // 2
+    kMvpFlag = 26,
+    kSplitTransformFlag = 27, // 3
+    kCbfLuma = 30, // 2
+    kCbfChroma = 32, // 4
+    kAbsMvdGreater0Flag = 36,
+    kAbsMvdGreater1Flag = 37,
+    kCuQpDeltaAbs = 38, // 2
+    kTransformSkipFlag = 40, // 2
+    kLastSigCoeffXPrefix = 42, // 18
+    kLastSigCoeffYPrefix = 60, // 18
+    kCodedSubBlockFlag = 78, // 4
+    kSigCoeffFlag = 82, // 42
+    kCoeffAbsLevelGreater1Flag = 124, // 24
+    kCoeffAbsLevelGreater2Flag = 148, // 6
+    kEndOfContexts = 154,
+};
+static_assert(kEndOfContexts == HEVCCabacParser::kNumContexts, "context count");
+
+/* initValue of each context by initType, Tables 9-5 to 9-37. 154 is used
+ * for contexts not in use with the initType. */
+static const uint8_t kInitValues[3][kEndOfContexts] = {
+    {
+        153, // sao_merge_left_flag, sao_merge_up_flag
+        200, // sao_type_idx_luma, sao_type_idx_chroma
+        139, 141, 157, // split_cu_flag
+        154, // cu_transquant_bypass_flag
+        154, 154, 154, // cu_skip_flag
+        154, // pred_mode_flag
+        184, 154, 154, 154, // part_mode
+        184, // prev_intra_luma_pred_flag
+        63, // intra_chroma_pred_mode
+        154, // rqt_root_cbf
+        154, // merge_flag
+        154, // merge_idx
+        154, 154, 154, 154, 154, // inter_pred_idc
+        154, 154, // ref_idx_l0, ref_idx_l1
+        154, // mvp_l0_flag, mvp_l1_flag
+        153, 138, 138, // split_transform_flag
+        111, 141, // cbf_luma
+        94, 138, 182, 154, // cbf_cb, cbf_cr
+        154, // abs_mvd_greater0_flag
+        154, // abs_mvd_greater1_flag
+        154, 154, // cu_qp_delta_abs
+        139, 139, // transform_skip_flag
+        110, 110, 124, 125, 140, 153, 125, 127, 140, 109, 111, 143, 127, 111, 79, 108, 123, 63, // last_sig_coeff_x_prefix
+        110, 110, 124, 125, 140, 153, 125, 127, 140, 109, 111, 143, 127, 111, 79, 108, 123, 63, // last_sig_coeff_y_prefix
+        91, 171, 134, 141, // coded_sub_block_flag
+        111, 111, 125, 110, 110, 94, 124, 108, 124, 107, 125, 141, 179, 153, // sig_coeff_flag
+        125, 107, 125, 141, 179, 153, 125, 107, 125, 141, 179, 153, 125, 140,
+        139, 182, 182, 152, 136, 152, 136, 153, 136, 139, 111, 136, 139, 111,
+        140, 92, 137, 138, 140, 152, 138, 139, 153, 74, 149, 92, // coeff_abs_level_greater1_flag
+        139, 107, 122, 152, 140, 179, 166, 182, 140, 227, 122, 197,
+        138, 153, 136, 167, 152, 152, // coeff_abs_level_greater2_flag
+    },
+    {
+        153, // sao_merge_left_flag, sao_merge_up_flag
+        185, // sao_type_idx_luma, sao_type_idx_chroma
+        107, 139, 126, // split_cu_flag
+        154, // cu_transquant_bypass_flag
+        197, 185, 201, // cu_skip_flag
+        149, // pred_mode_flag
+        154, 139, 154, 154, // part_mode
+        154, // prev_intra_luma_pred_flag
+        152, // intra_chroma_pred_mode
+        79, // rqt_root_cbf
+        110, // merge_flag
+        122, // merge_idx
+        95, 79, 63, 31, 31, // inter_pred_idc
+        153, 153, // ref_idx_l0, ref_idx_l1
+        168, // mvp_l0_flag, mvp_l1_flag
+        124, 138, 94, // split_transform_flag
+        153, 111, // cbf_luma
+        149, 107, 167, 154, // cbf_cb, cbf_cr
+        140, // abs_mvd_greater0_flag
+        198, // abs_mvd_greater1_flag
+        154, 154, // cu_qp_delta_abs
+        139, 139, // transform_skip_flag
+        125, 110, 94, 110, 95, 79, 125, 111, 110, 78, 110, 111, 111, 95, 94, 108, 123, 108, // last_sig_coeff_x_prefix
+        125, 110, 94, 110, 95, 79, 125, 111, 110, 78, 110, 111, 111, 95, 94, 108, 123, 108, // last_sig_coeff_y_prefix
+        121, 140, 61, 154, // coded_sub_block_flag
+        155, 154, 139, 153, 139, 123, 123, 63, 153, 166, 183, 140, 136, 153, // sig_coeff_flag
+        154, 166, 183, 140, 136, 153, 154, 166, 183, 140, 136, 153, 154, 170,
+        153, 123, 123, 107, 121, 107, 121, 167, 151, 183, 140, 151, 183, 140,
+        154, 196, 196, 167, 154, 152, 167, 182, 182, 134, 149, 136, // coeff_abs_level_greater1_flag
+        153, 121, 136, 137, 169, 194, 166, 167, 154, 167, 137, 182,
+        107, 167, 91, 122, 107, 167, // coeff_abs_level_greater2_flag
+    },
+    {
+        153, // sao_merge_left_flag, sao_merge_up_flag
+        160, // sao_type_idx_luma, sao_type_idx_chroma
+        107, 139, 126, // split_cu_flag
+        154, // cu_transquant_bypass_flag
+        197, 185, 201, // cu_skip_flag
+        134, // pred_mode_flag
+        154, 139, 154, 154, // part_mode
+        183, // prev_intra_luma_pred_flag
+        152, // intra_chroma_pred_mode
+        79, // rqt_root_cbf
+        154, // merge_flag
+        137, // merge_idx
+        95, 79, 63, 31, 31, // inter_pred_idc
+        153, 153, // ref_idx_l0, ref_idx_l1
+        168, // mvp_l0_flag, mvp_l1_flag
+        224, 167, 122, // split_transform_flag
+        153, 111, // cbf_luma
+        149, 92, 167, 154, // cbf_cb, cbf_cr
+        169, // abs_mvd_greater0_flag
+        198, // abs_mvd_greater1_flag
+        154, 154, // cu_qp_delta_abs
+        139, 139, // transform_skip_flag
+        125, 110, 124, 110, 95, 94, 125, 111, 111, 79, 125, 126, 111, 111, 79, 108, 123, 93, // last_sig_coeff_x_prefix
+        125, 110, 124, 110, 95, 94, 125, 111, 111, 79, 125, 126, 111, 111, 79, 108, 123, 93, // last_sig_coeff_y_prefix
+        121, 140, 61, 154, // coded_sub_block_flag
+        170, 154, 139, 153, 139, 123, 123, 63, 124, 166, 183, 140, 136, 153, // sig_coeff_flag
+        154, 166, 183, 140, 136, 153, 154, 166, 183, 140, 136, 153, 154, 170,
+        153, 138, 138, 122, 121, 122, 121, 167, 151, 183, 140, 151, 183, 140,
+        154, 196, 167, 167, 154, 152, 167, 182, 182, 134, 149, 136, // coeff_abs_level_greater1_flag
+        153, 121, 136, 122, 169, 208, 166, 167, 154, 152, 167, 182,
+        107, 167, 91, 107, 107, 167, // coeff_abs_level_greater2_flag
+    },
+};
+
+enum {
+    kPart2Nx2N,
+    kPart2NxN,
+    kPartNx2N,
+    kPartNxN,
+    kPart2NxnU,
+    kPart2NxnD,
+    kPartnLx2N,
+    kPartnRx2N,
+};
+
+enum {
+    kPredL0,
+    kPredL1,
+    kPredBi,
+};
+
+enum {
+    kIntraPlanar = 0,
+    kIntraDC = 1,
+    kIntraVertical = 26,
+};
+
+/* 6.5.3 to 6.5.5: up-right diagonal, horizontal and vertical scans of
+ * blocks of 1x1 to 8x8, as x, y, and the scan position of each x, y */
+struct ScanOrder {
+    uint8_t pos[4][3][64][2];
+    uint8_t inv[4][3][64]; // by y << log2 size | x
+    uint8_t pos4x4[3][16]; // as y << 2 | x
+
+    ScanOrder() {
+        for (int log2 = 0; log2 < 4; ++log2) {
+            int size = 1 << log2;
+            int i = 0;
+            for (int x = 0, y = 0; i < size * size;) {
+                for (; y >= 0; --y, ++x) {
+                    if (x < size && y < size) {
+                        pos[log2][0][i][0] = (uint8_t) x;
+                        pos[log2][0][i][1] = (uint8_t) y;
+                        ++i;
+                    }
+                }
+                y = x;
+                x = 0;
+            }
+            for (i = 0; i < size * size; ++i) {
+                pos[log2][1][i][0] = (uint8_t) (i & (size - 1));
+                pos[log2][1][i][1] = (uint8_t) (i >> log2);
+                pos[log2][2][i][0] = (uint8_t) (i >> log2);
+                pos[log2][2][i][1] = (uint8_t) (i & (size - 1));
+            }
+            for (int scan = 0; scan < 3; ++scan) {
+                for (i = 0; i < size * size; ++i) {
+                    inv[log2][scan][pos[log2][scan][i][1] << log2 | pos[log2][scan][i][0]] = (uint8_t) i;
+                    if (log2 == 2) {
+                        pos4x4[scan][i] = (uint8_t) (pos[log2][scan][i][1] << 2 | pos[log2][scan][i][0]);
+                    }
+                }
+            }
+        }
+    }
+};
+
+static const ScanOrder &scan_order() {
+    static const ScanOrder scan;
+    return scan;
+}
+
+/* 9.3.4.2.5, sigCtx of 4x4 blocks by yC << 2 | xC */
+static const uint8_t kCtxIdxMap[16] = { 0, 1, 4, 5, 2, 3, 4, 5, 6, 6, 8, 8, 7, 7, 8, 8 };
+
+/* and of the subblocks of larger ones by yP << 2 | xP, by whether the
+ * subblocks right (1) and below (2) of it are coded */
+static const uint8_t kSigCtxByNeighbours[4][16] = {
+    { 2, 1, 1, 0, 1, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0 },
+    { 2, 2, 2, 2, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0 },
+    { 2, 1, 0, 0, 2, 1, 0, 0, 2, 1, 0, 0, 2, 1, 0, 0 },
+    { 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2 },
+};
+
+bool HEVCCabacParser::supported() const {
+    return sps->chroma_format_idc == 1 && !sps->separate_colour_plane_flag && !sps->implicit_rdpcm_enabled_flag
+        && !sps->explicit_rdpcm_enabled_flag && !sps->extended_precision_processing_flag
+        && !sps->transform_skip_context_enabled_flag && !sps->persistent_rice_adaptation_enabled_flag
+        && !sps->cabac_bypass_alignment_enabled_flag && !pps->cross_component_prediction_enabled_flag
+        && !pps->chroma_qp_offset_list_enabled_flag && !pps->log2_max_transform_skip_block_size_minus2;
+}
+
+/* 6.5.1, and the sizes of the block maps */
+void HEVCCabacParser::setup_picture() {
+    pic_width = sps->pic_width_in_luma_samples;
+    pic_height = sps->pic_height_in_luma_samples;
+    ctb_log2_size = sps->ctb_log2_size_y;
+    pic_width_in_ctbs = sps->pic_width_in_ctbs_y;
+    pic_size_in_ctbs = sps->pic_size_in_ctbs_y;
+    min_cb_log2_size = sps->log2_min_luma_coding_block_size_minus3 + 3;
+    min_tb_log2_size = sps->log2_min_luma_transform_block_size_minus2 + 2;
+    max_tb_log2_size = min_tb_log2_size + sps->log2_diff_max_min_luma_transform_block_size;
+    log2_min_cu_qp_delta_size = ctb_log2_size - pps->diff_cu_qp_delta_depth;
+
+    int pic_height_in_ctbs = sps->pic_height_in_ctbs_y;
+    int num_cols = pps->tiles_enabled_flag ? pps->num_tile_columns_minus1 + 1 : 1;
+    int num_rows = pps->tiles_enabled_flag ? pps->num_tile_rows_minus1 + 1 : 1;
+    int col_bd[H265PPS::kMaxNumTileColumnWidth + 1] = {};
+    int row_bd[H265PPS::kMaxNumTileRowHeight + 1] = {};
+    for (int i = 0; i < num_cols; ++i) {
+        int width;
+        if (pps->uniform_spacing_flag || i == num_cols - 1) {
+            width = pps->uniform_spacing_flag
+                ? ((i + 1) * pic_width_in_ctbs) / num_cols - (i * pic_width_in_ctbs) / num_cols
+                : pic_width_in_ctbs - col_bd[i];
+        } else {
+            width = pps->column_width_minus1[i] + 1;
+        }
+        col_bd[i + 1] = col_bd[i] + width;
+    }
+    for (int i = 0; i < num_rows; ++i) {
+        int height;
+        if (pps->uniform_spacing_flag || i == num_rows - 1) {
+            height = pps->uniform_spacing_flag
+                ? ((i + 1) * pic_height_in_ctbs) / num_rows - (i * pic_height_in_ctbs) / num_rows
+                : pic_height_in_ctbs - row_bd[i];
+        } else {
+            height = pps->row_height_minus1[i] + 1;
+        }
+        row_bd[i + 1] = row_bd[i] + height;
+    }
+
+    ctb_addr_rs_to_ts.resize(pic_size_in_ctbs);
+    ctb_addr_ts_to_rs.resize(pic_size_in_ctbs);
+    tile_id.resize(pic_size_in_ctbs);
+    for (int rs = 0; rs < pic_size_in_ctbs; ++rs) {
+        int x = rs % pic_width_in_ctbs, y = rs / pic_width_in_ctbs;
+        int tile_x = 0, tile_y = 0;
+        while (tile_x + 1 < num_cols && x >= col_bd[tile_x + 1]) {
+            ++tile_x;
+        }
+        while (tile_y + 1 < num_rows && y >= row_bd[tile_y + 1]) {
+            ++tile_y;
+        }
+        int ts = row_bd[tile_y] * pic_width_in_ctbs + col_bd[tile_x] * (row_bd[tile_y + 1] - row_bd[tile_y]);
+        ts += (y - row_bd[tile_y]) * (col_bd[tile_x + 1] - col_bd[tile_x]) + x - col_bd[tile_x];
+        ctb_addr_rs_to_ts[rs] = ts;
+        ctb_addr_ts_to_rs[ts] = rs;
+        tile_id[ts] = tile_y * num_cols + tile_x;
+    }
+
+    map_stride = pic_width >> 2;
+    size_t map_size = (size_t) map_stride * (pic_height >> 2);
+    ct_depth.resize(map_size);
+    skip_flag.resize(map_size);
+    intra_mode.resize(map_size);
+}
+
+void HEVCCabacParser::init_contexts() {
+    for (int i = 0; i < kNumContexts; ++i) {
+        contexts[i] = CabacDecoder::InitContext(kInitValues[init_type][i], slice_qp);
+    }
+}
+
+/* 9.3.1, at the start of a slice segment or of a tile or CTU row within it */
+void HEVCCabacParser::start_contexts(bool slice_start) {
+    bool tile_start = ctb_addr_ts == 0 || tile_id[ctb_addr_ts] != tile_id[ctb_addr_ts - 1];
+    int ctb_x = ctb_addr_rs % pic_width_in_ctbs;
+    bool row_start = ctb_x == 0 || tile_id[ctb_addr_ts] != tile_id[ctb_addr_rs_to_ts[ctb_addr_rs - 1]];
+    if (tile_start) {
+        init_contexts();
+    } else if (pps->entropy_coding_sync_enabled_flag && row_start) {
+        int x0 = ctb_x << ctb_log2_size;
+        int y0 = (ctb_addr_rs / pic_width_in_ctbs) << ctb_log2_size;
+        int ctb_size = 1 << ctb_log2_size;
+        if (available(x0, y0, x0 + ctb_size, y0 - ctb_size)) {
+            memcpy(contexts, wpp_contexts, sizeof(contexts));
+        } else {
+            init_contexts();
+        }
+    } else if (slice_start && shdr->dependent_slice_segment_flag) {
+        memcpy(contexts, ds_contexts, sizeof(contexts));
+    } else if (slice_start) {
+        init_contexts();
+    }
+}
+
+/* 6.4.1 for the left and above neighbours of the block at x, y, which in
+ * the same CTU always come first in z-scan order */
+bool HEVCCabacParser::available(int x, int y, int x_nb, int y_nb) const {
+    if (x_nb < 0 || y_nb < 0 || x_nb >= pic_width || y_nb >= pic_height) {
+        return false;
+    }
+    if ((x_nb >> ctb_log2_size) == (x >> ctb_log2_size) && (y_nb >> ctb_log2_size) == (y >> ctb_log2_size)) {
+        return true;
+    }
+    int ts = ctb_addr_rs_to_ts[(y_nb >> ctb_log2_size) * pic_width_in_ctbs + (x_nb >> ctb_log2_size)];
+    return ts >= slice_addr_ts && ts < ctb_addr_ts && tile_id[ts] == tile_id[ctb_addr_ts];
+}
+
+void HEVCCabacParser::fill_map(std::vector<uint8_t> &map, int x0, int y0, int size_x, int size_y, uint8_t v) {
+    uint8_t *p = &map[(y0 >> 2) * map_stride + (x0 >> 2)];
+    for (int y = 0; y < size_y; y += 4, p += map_stride) {
+        memset(p, v, size_x >> 2);
+    }
+}
+
+bool HEVCCabacParser::Parse(const HEVCParser &parser, const uint8_t *bytes, size_t size) {
+    TRACE_EVENT(3, "HEVCCabacParser::Parse");
+    uint64_t start = TraceNow();
+    sps = parser.GetSPS();
+    pps = parser.GetPPS();
+    shdr = &parser.GetSliceHeader();
+    if (!sps || !pps || !supported()) {
+        ++stats.unsupported;
+        return false;
+    }
+    if (shdr->first_slice_segment_in_pic_flag || pic_width != sps->pic_width_in_luma_samples
+        || pic_height != sps->pic_height_in_luma_samples || ctb_log2_size != sps->ctb_log2_size_y) {
+        setup_picture();
+    }
+
+    /* the slice data starts at the byte after the slice header */
+    size_t offset = shdr->header_size + shdr->header_emulation_prevention_bytes;
+    if (offset >= size) {
+        ++stats.errors;
+        return false;
+    }
+    rbsp.resize(size - offset);
+    size_t n = 0;
+    int zeros = 0;
+    for (size_t i = offset; i < size; ++i) {
+        uint8_t b = bytes[i];
+        if (zeros >= 2 && b == 3) {
+            zeros = 0;
+            continue;
+        }
+        zeros = b ? 0 : zeros + 1;
+        rbsp[n++] = b;
+    }
+    rbsp.resize(n);
+
+    cabac.context_bins = cabac.bypass_bins = cabac.terminate_bins = 0;
+    cus = coefficients = 0;
+    error = false;
+    bool ok = parse_slice_data();
+    if (ok) {
+        ++stats.slices;
+    } else {
+        ++stats.errors;
+    }
+    stats.cus += cus;
+    stats.coefficients += coefficients;
+    stats.bytes += size - offset;
+    stats.context_bins += cabac.context_bins;
+    stats.bypass_bins += cabac.bypass_bins;
+    stats.terminate_bins += cabac.terminate_bins;
+    stats.elapsed_ns += TraceNow() - start;
+    return ok;
+}
+
+/* 7.3.8.1 */
+bool HEVCCabacParser::parse_slice_data() {
+    if (!shdr->dependent_slice_segment_flag) {
+        slice_addr_rs = shdr->slice_segment_address;
+    }
+    ctb_addr_rs = shdr->slice_segment_address;
+    ctb_addr_ts = ctb_addr_rs_to_ts[ctb_addr_rs];
+    slice_addr_ts = ctb_addr_rs_to_ts[slice_addr_rs];
+    slice_qp = 26 + pps->init_qp_minus26 + shdr->slice_qp_delta;
+    if (shdr->IsISlice()) {
+        init_type = 0;
+    } else if (shdr->IsPSlice()) {
+        init_type = shdr->cabac_init_flag ? 2 : 1;
+    } else {
+        init_type = shdr->cabac_init_flag ? 1 : 2;
+    }
+
+    cabac.Start(rbsp.data(), rbsp.size(), 0);
+    start_contexts(true);
+    for (;;) {
+        int ctb_x = ctb_addr_rs % pic_width_in_ctbs;
+        int ctb_y = ctb_addr_rs / pic_width_in_ctbs;
+        if (shdr->slice_sao_luma_flag || shdr->slice_sao_chroma_flag) {
+            parse_sao(ctb_x, ctb_y);
+        }
+        if (!parse_coding_quadtree(ctb_x << ctb_log2_size, ctb_y << ctb_log2_size, ctb_log2_size, 0) || error
+            || cabac.Overrun()) {
+            return false;
+        }
+        ++stats.ctus;
+        /* 9.3.2.3, for the CTU row below */
+        if (pps->entropy_coding_sync_enabled_flag
+            && (ctb_x == 1
+                || (ctb_addr_rs > 1 && tile_id[ctb_addr_ts] != tile_id[ctb_addr_rs_to_ts[ctb_addr_rs - 2]]))) {
+            memcpy(wpp_contexts, contexts, sizeof(contexts));
+        }
+
+        bool end_of_slice_segment = cabac.DecodeTerminate();
+        ++ctb_addr_ts;
+        if (end_of_slice_segment) {
+            break;
+        }
+        if (ctb_addr_ts >= pic_size_in_ctbs) {
+            return false;
+        }
+        ctb_addr_rs = ctb_addr_ts_to_rs[ctb_addr_ts];
+        bool tile_start = pps->tiles_enabled_flag && tile_id[ctb_addr_ts] != tile_id[ctb_addr_ts - 1];
+        bool row_start = pps->entropy_coding_sync_enabled_flag
+            && (ctb_addr_rs % pic_width_in_ctbs == 0
+                || tile_id[ctb_addr_ts] != tile_id[ctb_addr_rs_to_ts[ctb_addr_rs - 1]]);
+        if (tile_start || row_start) {
+            /* end_of_subset_one_bit and byte_alignment() */
+            if (!cabac.DecodeTerminate()) {
+                return false;
+            }
+            cabac.Start(rbsp.data(), rbsp.size(), cabac.AlignedPosition());
+            start_contexts(false);
+        }
+    }
+    if (pps->dependent_slice_segments_enabled_flag) {
+        memcpy(ds_contexts, contexts, sizeof(contexts));
+    }
+
+    /* the arithmetic code ends with the rbsp_stop_one_bit, followed by zero
+     * bits only, those of the alignment and any cabac_zero_words */
+    uint64_t stop = cabac.BitPosition() - 1;
+    if (stop >= rbsp.size() * 8 || !(rbsp[stop / 8] & (0x80 >> (stop % 8)))
+        || (rbsp[stop / 8] & (0xff >> (stop % 8) >> 1))) {
+        return false;
+    }
+    for (size_t i = stop / 8 + 1; i < rbsp.size(); ++i) {
+        if (rbsp[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* 7.3.8.3 */
+void HEVCCabacParser::parse_sao(int rx, int ry) {
+    bool merge = false;
+    if (rx > 0 && ctb_addr_rs > slice_addr_rs
+        && tile_id[ctb_addr_ts] == tile_id[ctb_addr_rs_to_ts[ctb_addr_rs - 1]]) {
+        merge = cabac.DecodeBin(&contexts[kSaoMergeFlag]);
+    }
+    if (ry > 0 && !merge && ctb_addr_rs - pic_width_in_ctbs >= slice_addr_rs
+        && tile_id[ctb_addr_ts] == tile_id[ctb_addr_rs_to_ts[ctb_addr_rs - pic_width_in_ctbs]]) {
+        merge = cabac.DecodeBin(&contexts[kSaoMergeFlag]);
+    }
+    if (merge) {
+        return;
+    }
+    int type = 0;
+    for (int c = 0; c < 3; ++c) {
+        if (!(c ? shdr->slice_sao_chroma_flag : shdr->slice_sao_luma_flag)) {
+            continue;
+        }
+        /* Cr shares the type and class of Cb */
+        if (c < 2) {
+            type = !cabac.DecodeBin(&contexts[kSaoTypeIdx]) ? 0 : cabac.DecodeBypass() ? 2 : 1;
+        }
+        if (!type) {
+            continue;
+        }
+        int bit_depth = c ? sps->bit_depth_c : sps->bit_depth_y;
+        int max_offset = (1 << (std::min(bit_depth, 10) - 5)) - 1;
+        int offsets[4];
+        for (auto &offset : offsets) {
+            offset = 0;
+            while (offset < max_offset && cabac.DecodeBypass()) {
+                ++offset;
+            }
+        }
+        if (type == 1) {
+            for (auto offset : offsets) {
+                if (offset) {
+                    cabac.DecodeBypass(); // sao_offset_sign
+                }
+            }
+            cabac.DecodeBypassBins(5); // sao_band_position
+        } else if (c < 2) {
+            cabac.DecodeBypassBins(2); // sao_eo_class
+        }
+    }
+}
+
+/* 7.3.8.4 */
+bool HEVCCabacParser::parse_coding_quadtree(int x0, int y0, int log2_size, int depth) {
+    int size = 1 << log2_size;
+    bool split = log2_size > min_cb_log2_size;
+    if (x0 + size <= pic_width && y0 + size <= pic_height && split) {
+        int inc = (available(x0, y0, x0 - 1, y0) && ct_depth[(y0 >> 2) * map_stride + ((x0 - 1) >> 2)] > depth)
+            + (available(x0, y0, x0, y0 - 1) && ct_depth[((y0 - 1) >> 2) * map_stride + (x0 >> 2)] > depth);
+        split = cabac.DecodeBin(&contexts[kSplitCuFlag + inc]);
+    }
+    if (pps->cu_qp_delta_enabled_flag && log2_size >= log2_min_cu_qp_delta_size) {
+        is_cu_qp_delta_coded = false;
+    }
+    if (!split) {
+        return parse_coding_unit(x0, y0, log2_size, depth);
+    }
+    int x1 = x0 + size / 2, y1 = y0 + size / 2;
+    return parse_coding_quadtree(x0, y0, log2_size - 1, depth + 1)
+        && (x1 >= pic_width || parse_coding_quadtree(x1, y0, log2_size - 1, depth + 1))
+        && (y1 >= pic_height || parse_coding_quadtree(x0, y1, log2_size - 1, depth + 1))
+        && (x1 >= pic_width || y1 >= pic_height || parse_coding_quadtree(x1, y1, log2_size - 1, depth + 1));
+}
+
+/* 7.3.8.5 */
+bool HEVCCabacParser::parse_coding_unit(int x0, int y0, int log2_size, int depth) {
+    ++cus;
+    int size = 1 << log2_size;
+    cu_transquant_bypass = pps->transquant_bypass_enabled_flag && cabac.DecodeBin(&contexts[kCuTransquantBypassFlag]);
+    bool skip = false;
+    if (!shdr->IsISlice()) {
+        int inc = (available(x0, y0, x0 - 1, y0) && skip_flag[(y0 >> 2) * map_stride + ((x0 - 1) >> 2)])
+            + (available(x0, y0, x0, y0 - 1) && skip_flag[((y0 - 1) >> 2) * map_stride + (x0 >> 2)]);
+        skip = cabac.DecodeBin(&contexts[kCuSkipFlag + inc]);
+    }
+    fill_map(ct_depth, x0, y0, size, size, (uint8_t) depth);
+    fill_map(skip_flag, x0, y0, size, size, skip);
+    if (skip) {
+        fill_map(intra_mode, x0, y0, size, size, kIntraDC);
+        parse_merge_idx();
+        return true;
+    }
+
+    cu_intra = shdr->IsISlice() || cabac.DecodeBin(&contexts[kPredModeFlag]);
+    part_mode = kPart2Nx2N;
+    if (!cu_intra || log2_size == min_cb_log2_size) {
+        part_mode = parse_part_mode(log2_size);
+    }
+    bool merge = false;
+    if (cu_intra) {
+        if (part_mode == kPart2Nx2N && sps->pcm_enabled_flag
+            && log2_size >= sps->log2_min_pcm_luma_coding_block_size_minus3 + 3
+            && log2_size <= sps->log2_min_pcm_luma_coding_block_size_minus3 + 3
+                    + sps->log2_diff_max_min_pcm_luma_coding_block_size
+            && cabac.DecodeTerminate()) {
+            fill_map(intra_mode, x0, y0, size, size, kIntraDC);
+            return parse_pcm(log2_size);
+        }
+        parse_intra_modes(x0, y0, log2_size);
+    } else {
+        fill_map(intra_mode, x0, y0, size, size, kIntraDC);
+        int half = size / 2, quarter = size / 4;
+        switch (part_mode) {
+        case kPart2Nx2N:
+            merge = parse_prediction_unit(size, size, depth);
+            break;
+        case kPart2NxN:
+            parse_prediction_unit(size, half, depth);
+            parse_prediction_unit(size, half, depth);
+            break;
+        case kPartNx2N:
+            parse_prediction_unit(half, size, depth);
+            parse_prediction_unit(half, size, depth);
+            break;
+        case kPart2NxnU:
+            parse_prediction_unit(size, quarter, depth);
+            parse_prediction_unit(size, size - quarter, depth);
+            break;
+        case kPart2NxnD:
+            parse_prediction_unit(size, size - quarter, depth);
+            parse_prediction_unit(size, quarter, depth);
+            break;
+        case kPartnLx2N:
+            parse_prediction_unit(quarter, size, depth);
+            parse_prediction_unit(size - quarter, size, depth);
+            break;
+        case kPartnRx2N:
+            parse_prediction_unit(size - quarter, size, depth);
+            parse_prediction_unit(quarter, size, depth);
+            break;
+        default:
+            parse_prediction_unit(half, half, depth);
+            parse_prediction_unit(half, half, depth);
+            parse_prediction_unit(half, half, depth);
+            parse_prediction_unit(half, half, depth);
+            break;
+        }
+    }
+
+    if (!cu_intra && !(part_mode == kPart2Nx2N && merge) && !cabac.DecodeBin(&contexts[kRqtRootCbf])) {
+        return true;
+    }
+    intra_split = cu_intra && part_mode == kPartNxN;
+    max_trafo_depth = cu_intra ? sps->max_transform_hierarchy_depth_intra + intra_split
+                               : sps->max_transform_hierarchy_depth_inter;
+    return parse_transform_tree(x0, y0, x0, y0, log2_size, 0, 0, 0);
+}
+
+/* Table 9-43 */
+int HEVCCabacParser::parse_part_mode(int log2_size) {
+    if (cabac.DecodeBin(&contexts[kPartMode])) {
+        return kPart2Nx2N;
+    }
+    if (cu_intra) {
+        return kPartNxN;
+    }
+    if (log2_size == min_cb_log2_size) {
+        if (cabac.DecodeBin(&contexts[kPartMode + 1])) {
+            return kPart2NxN;
+        }
+        if (log2_size == 3) {
+            return kPartNx2N;
+        }
+        return cabac.DecodeBin(&contexts[kPartMode + 2]) ? kPartNx2N : kPartNxN;
+    }
+    if (!sps->amp_enabled_flag) {
+        return cabac.DecodeBin(&contexts[kPartMode + 1]) ? kPart2NxN : kPartNx2N;
+    }
+    if (cabac.DecodeBin(&contexts[kPartMode + 1])) {
+        if (cabac.DecodeBin(&contexts[kPartMode + 3])) {
+            return kPart2NxN;
+        }
+        return cabac.DecodeBypass() ? kPart2NxnD : kPart2NxnU;
+    }
+    if (cabac.DecodeBin(&contexts[kPartMode + 3])) {
+        return kPartNx2N;
+    }
+    return cabac.DecodeBypass() ? kPartnRx2N : kPartnLx2N;
+}
+
+/* pcm_sample() after pcm_alignment_zero_bits, then starts the arithmetic
+ * decoder again past them (9.3.2.6) */
+bool HEVCCabacParser::parse_pcm(int log2_size) {
+    size_t samples = (size_t) 1 << (2 * log2_size);
+    size_t bits = samples * (sps->pcm_sample_bit_depth_luma_minus1 + 1)
+        + samples / 2 * (sps->pcm_sample_bit_depth_chroma_minus1 + 1);
+    size_t pos = cabac.AlignedPosition() + (bits + 7) / 8;
+    if (pos > rbsp.size()) {
+        return false;
+    }
+    cabac.Start(rbsp.data(), rbsp.size(), pos);
+    return true;
+}
+
+/* 7.3.8.5 and 8.4.2, 8.4.3 for the luma and chroma modes, of which the
+ * scan order of residual coefficients depends */
+void HEVCCabacParser::parse_intra_modes(int x0, int y0, int log2_size) {
+    int parts = part_mode == kPartNxN ? 4 : 1;
+    int pb_size = part_mode == kPartNxN ? 1 << (log2_size - 1) : 1 << log2_size;
+    bool prev_intra_luma_pred[4];
+    for (int i = 0; i < parts; ++i) {
+        prev_intra_luma_pred[i] = cabac.DecodeBin(&contexts[kPrevIntraLumaPredFlag]);
+    }
+    int first_mode = kIntraDC;
+    for (int i = 0; i < parts; ++i) {
+        int x = x0 + (i & 1) * pb_size, y = y0 + (i >> 1) * pb_size;
+        int a = available(x, y, x - 1, y) ? intra_mode[(y >> 2) * map_stride + ((x - 1) >> 2)] : (int) kIntraDC;
+        int b = kIntraDC;
+        if (((y - 1) >> ctb_log2_size) == (y >> ctb_log2_size) && available(x, y, x, y - 1)) {
+            b = intra_mode[((y - 1) >> 2) * map_stride + (x >> 2)];
+        }
+        int mpm[3];
+        if (a == b) {
+            if (a < 2) {
+                mpm[0] = kIntraPlanar;
+                mpm[1] = kIntraDC;
+                mpm[2] = kIntraVertical;
+            } else {
+                mpm[0] = a;
+                mpm[1] = 2 + ((a + 29) % 32);
+                mpm[2] = 2 + ((a - 2 + 1) % 32);
+            }
+        } else {
+            mpm[0] = a;
+            mpm[1] = b;
+            mpm[2] = a != kIntraPlanar && b != kIntraPlanar ? kIntraPlanar
+                : a != kIntraDC && b != kIntraDC            ? kIntraDC
+                                                            : kIntraVertical;
+        }
+        int mode;
+        if (prev_intra_luma_pred[i]) {
+            int idx = !cabac.DecodeBypass() ? 0 : !cabac.DecodeBypass() ? 1 : 2;
+            mode = mpm[idx];
+        } else {
+            mode = (int) cabac.DecodeBypassBins(5);
+            std::sort(mpm, mpm + 3);
+            for (int m : mpm) {
+                mode += mode >= m;
+            }
+        }
+        fill_map(intra_mode, x, y, pb_size, pb_size, (uint8_t) mode);
+        if (!i) {
+            first_mode = mode;
+        }
+    }
+
+    int chroma = !cabac.DecodeBin(&contexts[kIntraChromaPredMode]) ? 4 : (int) cabac.DecodeBypassBins(2);
+    static const int kChromaModes[4] = { kIntraPlanar, kIntraVertical, 10, kIntraDC };
+    intra_mode_c = chroma == 4 ? first_mode : kChromaModes[chroma] == first_mode ? 34 : kChromaModes[chroma];
+}
+
+/* 7.3.8.6, returns merge_flag */
+bool HEVCCabacParser::parse_prediction_unit(int width, int height, int depth) {
+    if (cabac.DecodeBin(&contexts[kMergeFlag])) {
+        parse_merge_idx();
+        return true;
+    }
+    int pred = kPredL0;
+    if (shdr->IsBSlice()) {
+        if (width + height != 12 && cabac.DecodeBin(&contexts[kInterPredIdc + depth])) {
+            pred = kPredBi;
+        } else {
+            pred = cabac.DecodeBin(&contexts[kInterPredIdc + 4]) ? kPredL1 : kPredL0;
+        }
+    }
+    if (pred != kPredL1) {
+        parse_ref_idx(shdr->num_ref_idx_l0_active_minus1);
+        parse_mvd();
+        cabac.DecodeBin(&contexts[kMvpFlag]);
+    }
+    if (pred != kPredL0) {
+        parse_ref_idx(shdr->num_ref_idx_l1_active_minus1);
+        if (!(shdr->mvd_l1_zero_flag && pred == kPredBi)) {
+            parse_mvd();
+        }
+        cabac.DecodeBin(&contexts[kMvpFlag]);
+    }
+    return false;
+}
+
+void HEVCCabacParser::parse_merge_idx() {
+    int max_idx = 4 - shdr->five_minus_max_num_merge_cand;
+    if (max_idx > 0 && cabac.DecodeBin(&contexts[kMergeIdx])) {
+        for (int i = 1; i < max_idx && cabac.DecodeBypass(); ++i) {
+        }
+    }
+}
+
+void HEVCCabacParser::parse_ref_idx(int num_ref_idx_active_minus1) {
+    for (int i = 0; i < num_ref_idx_active_minus1; ++i) {
+        if (!(i < 2 ? cabac.DecodeBin(&contexts[kRefIdx + i]) : cabac.DecodeBypass())) {
+            break;
+        }
+    }
+}
+
+/* 7.3.8.9 */
+void HEVCCabacParser::parse_mvd() {
+    bool greater0[2], greater1[2] = {};
+    for (auto &g : greater0) {
+        g = cabac.DecodeBin(&contexts[kAbsMvdGreater0Flag]);
+    }
+    for (int i = 0; i < 2; ++i) {
+        if (greater0[i]) {
+            greater1[i] = cabac.DecodeBin(&contexts[kAbsMvdGreater1Flag]);
+        }
+    }
+    for (int i = 0; i < 2; ++i) {
+        if (greater0[i]) {
+            if (greater1[i]) {
+                decode_exp_golomb(1); // abs_mvd_minus2
+            }
+            cabac.DecodeBypass(); // mvd_sign_flag
+        }
+    }
+}
+
+/* 9.3.3.3, k-th order Exp-Golomb in bypass bins */
+uint32_t HEVCCabacParser::decode_exp_golomb(int k) {
+    uint32_t value = 0;
+    while (cabac.DecodeBypass()) {
+        value += 1u << k;
+        if (++k > 31) {
+            error = true;
+            return 0;
+        }
+    }
+    return value + cabac.DecodeBypassBins(k);
+}
+
+/* 7.3.8.8 */
+bool HEVCCabacParser::parse_transform_tree(int x0, int y0, int x_base, int y_base, int log2_size, int depth,
+    int blk_idx, int parent_cbf_c) {
+    bool split;
+    if (log2_size <= max_tb_log2_size && log2_size > min_tb_log2_size && depth < max_trafo_depth
+        && !(intra_split && depth == 0)) {
+        split = cabac.DecodeBin(&contexts[kSplitTransformFlag + 5 - log2_size]);
+    } else {
+        bool inter_split = sps->max_transform_hierarchy_depth_inter == 0 && !cu_intra && part_mode != kPart2Nx2N
+            && depth == 0;
+        split = log2_size > max_tb_log2_size || (intra_split && depth == 0) || inter_split;
+    }
+
+    /* cbf_cb in bit 0 and cbf_cr in bit 1. 4x4 luma blocks have their
+     * chroma coded with the last of them, by the flags of their parent. */
+    int cbf_c = 0;
+    if (log2_size > 2) {
+        if (depth == 0 || (parent_cbf_c & 1)) {
+            cbf_c |= cabac.DecodeBin(&contexts[kCbfChroma + depth]);
+        }
+        if (depth == 0 || (parent_cbf_c & 2)) {
+            cbf_c |= cabac.DecodeBin(&contexts[kCbfChroma + depth]) << 1;
+        }
+    }
+
+    if (split) {
+        int half = 1 << (log2_size - 1);
+        for (int i = 0; i < 4; ++i) {
+            if (!parse_transform_tree(x0 + (i & 1) * half, y0 + (i >> 1) * half, x0, y0, log2_size - 1, depth + 1,
+                    i, cbf_c)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool cbf_luma = true;
+    if (cu_intra || depth != 0 || cbf_c) {
+        cbf_luma = cabac.DecodeBin(&contexts[kCbfLuma + (depth == 0)]);
+    }
+    /* 7.3.8.10 */
+    if (log2_size == 2) {
+        cbf_c = parent_cbf_c;
+    }
+    if (!cbf_luma && !cbf_c) {
+        return true;
+    }
+    if (pps->cu_qp_delta_enabled_flag && !is_cu_qp_delta_coded) {
+        parse_cu_qp_delta();
+        is_cu_qp_delta_coded = true;
+    }
+    if (cbf_luma) {
+        parse_residual_coding(x0, y0, log2_size, 0);
+    }
+    if (log2_size > 2) {
+        for (int c = 1; c < 3; ++c) {
+            if (cbf_c & c) {
+                parse_residual_coding(x0, y0, log2_size - 1, c);
+            }
+        }
+    } else if (blk_idx == 3) {
+        for (int c = 1; c < 3; ++c) {
+            if (cbf_c & c) {
+                parse_residual_coding(x_base, y_base, 2, c);
+            }
+        }
+    }
+    return !error;
+}
+
+void HEVCCabacParser::parse_cu_qp_delta() {
+    int prefix = 0;
+    while (prefix < 5 && cabac.DecodeBin(&contexts[kCuQpDeltaAbs + (prefix > 0)])) {
+        ++prefix;
+    }
+    uint32_t abs = prefix;
+    if (prefix == 5) {
+        abs += decode_exp_golomb(0);
+    }
+    if (abs) {
+        cabac.DecodeBypass(); // cu_qp_delta_sign_flag
+    }
+}
+
+/* 9.3.3.11 */
+uint32_t HEVCCabacParser::decode_abs_level_remaining(int rice) {
+    int prefix = 0;
+    while (prefix < 32 && cabac.DecodeBypass()) {
+        ++prefix;
+    }
+    if (prefix < 4) {
+        return ((uint32_t) prefix << rice) + cabac.DecodeBypassBins(rice);
+    }
+    if (prefix - 3 + rice > 31) {
+        error = true;
+        return 0;
+    }
+    return (((1u << (prefix - 3)) + 2) << rice) + cabac.DecodeBypassBins(prefix - 3 + rice);
+}
+
+/* 7.3.8.11 */
+void HEVCCabacParser::parse_residual_coding(int x0, int y0, int log2_size, int c_idx) {
+    if (pps->transform_skip_enabled_flag && !cu_transquant_bypass && log2_size == 2) {
+        cabac.DecodeBin(&contexts[kTransformSkipFlag + (c_idx > 0)]);
+    }
+
+    int max_prefix = (log2_size << 1) - 1;
+    int ctx_offset = c_idx ? 15 : 3 * (log2_size - 2) + ((log2_size - 1) >> 2);
+    int ctx_shift = c_idx ? log2_size - 2 : (log2_size + 1) >> 2;
+    int prefix_x = 0, prefix_y = 0;
+    while (prefix_x < max_prefix
+        && cabac.DecodeBin(&contexts[kLastSigCoeffXPrefix + ctx_offset + (prefix_x >> ctx_shift)])) {
+        ++prefix_x;
+    }
+    while (prefix_y < max_prefix
+        && cabac.DecodeBin(&contexts[kLastSigCoeffYPrefix + ctx_offset + (prefix_y >> ctx_shift)])) {
+        ++prefix_y;
+    }
+    int last_x = prefix_x, last_y = prefix_y;
+    if (prefix_x > 3) {
+        int n = (prefix_x >> 1) - 1;
+        last_x = (1 << n) * (2 + (prefix_x & 1)) + (int) cabac.DecodeBypassBins(n);
+    }
+    if (prefix_y > 3) {
+        int n = (prefix_y >> 1) - 1;
+        last_y = (1 << n) * (2 + (prefix_y & 1)) + (int) cabac.DecodeBypassBins(n);
+    }
+
+    /* 7.4.9.11, the scan follows the intra prediction direction of 4x4 and
+     * 8x8 luma and 4x4 chroma blocks */
+    int scan_idx = 0;
+    if (cu_intra && (log2_size == 2 || (log2_size == 3 && c_idx == 0))) {
+        int mode = c_idx ? intra_mode_c : intra_mode[(y0 >> 2) * map_stride + (x0 >> 2)];
+        if (mode >= 6 && mode <= 14) {
+            scan_idx = 2;
+        } else if (mode >= 22 && mode <= 30) {
+            scan_idx = 1;
+        }
+    }
+    if (scan_idx == 2) {
+        std::swap(last_x, last_y);
+    }
+
+    auto &scan = scan_order();
+    int log2_sb = log2_size - 2;
+    int sb_width = 1 << log2_sb;
+    auto sb_pos = scan.pos[log2_sb][scan_idx];
+    auto pos = scan.pos4x4[scan_idx];
+    int last_sb = scan.inv[log2_sb][scan_idx][(last_y >> 2) << log2_sb | (last_x >> 2)];
+    int last_pos = scan.inv[2][scan_idx][(last_y & 3) << 2 | (last_x & 3)];
+    uint8_t *sig_contexts = &contexts[kSigCoeffFlag + (c_idx ? 27 : 0)];
+    uint8_t *greater1_contexts = &contexts[kCoeffAbsLevelGreater1Flag + (c_idx ? 16 : 0)];
+    uint8_t *greater2_contexts = &contexts[kCoeffAbsLevelGreater2Flag + (c_idx ? 4 : 0)];
+
+    uint64_t coded_sub_blocks = 0; // by ys << 3 | xs
+    int greater1_ctx = 1;
+    for (int i = last_sb; i >= 0; --i) {
+        int xs = sb_pos[i][0], ys = sb_pos[i][1];
+        int right = xs < sb_width - 1 && (coded_sub_blocks >> (ys << 3 | (xs + 1)) & 1);
+        int below = ys < sb_width - 1 && (coded_sub_blocks >> ((ys + 1) << 3 | xs) & 1);
+        bool infer_dc = false;
+        if (i < last_sb && i > 0) {
+            if (!cabac.DecodeBin(&contexts[kCodedSubBlockFlag + (c_idx ? 2 : 0) + (right | below)])) {
+                continue;
+            }
+            infer_dc = true;
+        }
+        coded_sub_blocks |= (uint64_t) 1 << (ys << 3 | xs);
+
+        /* sig_coeff_flag, by scan position */
+        unsigned sig = 0;
+        int n = 15;
+        if (i == last_sb) {
+            sig = 1u << last_pos;
+            n = last_pos - 1;
+        }
+        /* sigCtx by position in the subblock, plus an offset for all of it.
+         * The DC coefficient of the block has a context of its own. */
+        const uint8_t *sig_map = kCtxIdxMap;
+        int sig_offset = 0;
+        if (log2_size > 2) {
+            sig_map = kSigCtxByNeighbours[right | below << 1];
+            if (c_idx) {
+                sig_offset = log2_size == 3 ? 9 : 12;
+            } else {
+                sig_offset = (i > 0 ? 3 : 0) + (log2_size == 3 ? (scan_idx == 0 ? 9 : 15) : 21);
+            }
+        }
+        for (; n >= 0; --n) {
+            if (n == 0 && infer_dc) {
+                sig |= 1;
+                break;
+            }
+            int sig_ctx = n == 0 && i == 0 && log2_size > 2 ? 0 : sig_map[pos[n]] + sig_offset;
+            if (cabac.DecodeBin(&sig_contexts[sig_ctx])) {
+                sig |= 1u << n;
+                infer_dc = false;
+            }
+        }
+        if (!sig) {
+            continue;
+        }
+
+        /* coeff_abs_level_greater1_flag for the first 8, in the context set
+         * of the subblock, and greater2 for the first of them set */
+        int ctx_set = i == 0 || c_idx > 0 ? 0 : 2;
+        if (i != last_sb && greater1_ctx == 0) {
+            ++ctx_set;
+        }
+        greater1_ctx = 1;
+        unsigned greater1 = 0;
+        int last_greater1_pos = -1, first_sig_pos = 16, last_sig_pos = -1, num_sig = 0;
+        for (n = 15; n >= 0; --n) {
+            if (!(sig >> n & 1)) {
+                continue;
+            }
+            if (num_sig < 8) {
+                if (cabac.DecodeBin(&greater1_contexts[ctx_set * 4 + greater1_ctx])) {
+                    greater1 |= 1u << n;
+                    greater1_ctx = 0;
+                    if (last_greater1_pos < 0) {
+                        last_greater1_pos = n;
+                    }
+                } else if (greater1_ctx > 0 && greater1_ctx < 3) {
+                    ++greater1_ctx;
+                }
+            }
+            if (last_sig_pos < 0) {
+                last_sig_pos = n;
+            }
+            first_sig_pos = n;
+            ++num_sig;
+        }
+        bool greater2 = last_greater1_pos >= 0 && cabac.DecodeBin(&greater2_contexts[ctx_set]);
+
+        bool sign_hidden = pps->sign_data_hiding_enabled_flag && !cu_transquant_bypass
+            && last_sig_pos - first_sig_pos > 3;
+        cabac.DecodeBypassBins(num_sig - sign_hidden); // coeff_sign_flag
+
+        /* coeff_abs_level_remaining past the levels the flags cover */
+        int rice = 0, num_sig_coeff = 0;
+        for (n = 15; n >= 0; --n) {
+            if (!(sig >> n & 1)) {
+                continue;
+            }
+            int base = 1 + (greater1 >> n & 1) + (n == last_greater1_pos && greater2);
+            if (base == (num_sig_coeff < 8 ? (n == last_greater1_pos ? 3 : 2) : 1)) {
+                uint32_t level = base + decode_abs_level_remaining(rice);
+                if (level > 3u * (1u << rice)) {
+                    rice = std::min(rice + 1, 4);
+                }
+            }
+            ++num_sig_coeff;
+        }
+        coefficients += num_sig;
+    }
+}
@@ -0,0 +1,275 @@
+#ifndef __HEVCCABAC_H__
+#define __HEVCCABAC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "hevcparser.h"
+
+/* the CABAC arithmetic decoding engine of 9.3.4.3, reading the RBSP of one
+ * slice segment.
+ *
+ * ivlOffset is kept in bits 53..61 of a 64-bit window, with up to 53 bits of
+ * the stream read ahead below it. Renormalizing is then a single shift by an
+ * amount looked up from the range, rather than a bit at a time, and the
+ * window is only refilled, several bytes at once, when the bits read ahead
+ * run out, about once every 48 bits of stream. Bypass bins compare against
+ * the range shifted into place the same way. Reading past the end of the
+ * RBSP gives zero bits, which Overrun() tells apart. */
+
+class CabacDecoder {
+    static constexpr int kOffsetShift = 53;
+
+    static const uint8_t kRangeTabLps[64][4];
+    static const uint8_t kNextStateMps[128];
+    static const uint8_t kNextStateLps[128];
+    static const uint8_t kRenormShift[64];
+
+    uint64_t value = 0;
+    uint32_t range = 510;
+    int bits = 0; // read ahead below ivlOffset, may drop below 0 until refill()
+    const uint8_t *bytes = nullptr;
+    size_t size = 0;
+    size_t pos = 0; // of the next byte to read into value
+
+    void refill() {
+        while (bits <= kOffsetShift - 8) {
+            uint64_t byte = pos < size ? bytes[pos] : 0;
+            ++pos;
+            value |= byte << (kOffsetShift - 8 - bits);
+            bits += 8;
+        }
+    }
+
+public:
+    /* bins decoded, by kind */
+    uint64_t context_bins = 0;
+    uint64_t bypass_bins = 0;
+    uint64_t terminate_bins = 0;
+
+    /* contexts are (pStateIdx << 1) | valMps */
+    static uint8_t InitContext(int init_value, int slice_qp);
+
+    /* initializes the engine at offset bytes into the RBSP (9.3.2.5) */
+    void Start(const uint8_t *bytes, size_t size, size_t offset) {
+        this->bytes = bytes;
+        this->size = size;
+        pos = offset;
+        value = 0;
+        range = 510;
+        bits = -9;
+        refill();
+    }
+
+    int DecodeBin(uint8_t *ctx) {
+        unsigned state = *ctx;
+        uint32_t lps = kRangeTabLps[state >> 1][(range >> 6) & 3];
+        range -= lps;
+        uint64_t scaled = (uint64_t) range << kOffsetShift;
+        int bin;
+        if (value < scaled) {
+            bin = state & 1;
+            *ctx = kNextStateMps[state];
+        } else {
+            value -= scaled;
+            range = lps;
+            bin = !(state & 1);
+            *ctx = kNextStateLps[state];
+        }
+        int shift = kRenormShift[range >> 3];
+        range <<= shift;
+        value <<= shift;
+        bits -= shift;
+        if (bits < 0) {
+            refill();
+        }
+        ++context_bins;
+        return bin;
+    }
+
+    int DecodeBypass() {
+        value <<= 1;
+        if (--bits < 0) {
+            refill();
+        }
+        ++bypass_bins;
+        uint64_t scaled = (uint64_t) range << kOffsetShift;
+        if (value >= scaled) {
+            value -= scaled;
+            return 1;
+        }
+        return 0;
+    }
+
+    /* n bypass bins, up to 32, most significant first */
+    uint32_t DecodeBypassBins(int n) {
+        if (bits < n) {
+            refill();
+        }
+        uint64_t scaled = (uint64_t) range << kOffsetShift;
+        uint32_t result = 0;
+        for (int i = 0; i < n; ++i) {
+            value <<= 1;
+            result <<= 1;
+            if (value >= scaled) {
+                value -= scaled;
+                result |= 1;
+            }
+        }
+        bits -= n;
+        bypass_bins += n;
+        return result;
+    }
+
+    int DecodeTerminate() {
+        range -= 2;
+        ++terminate_bins;
+        if (value >= (uint64_t) range << kOffsetShift) {
+            return 1;
+        }
+        if (range < 256) {
+            range <<= 1;
+            value <<= 1;
+            if (--bits < 0) {
+                refill();
+            }
+        }
+        return 0;
+    }
+
+    /* bits of the RBSP read so far. After a terminate bin of 1, the last of
+     * them is the final bit of the arithmetic code, followed by alignment
+     * bits up to the next byte. */
+    uint64_t BitPosition() const {
+        return pos * 8 - bits;
+    }
+    /* the byte after those alignment bits, where PCM samples or the next
+     * substream start */
+    size_t AlignedPosition() const {
+        return (size_t) ((BitPosition() + 7) / 8);
+    }
+    bool Overrun() const {
+        return BitPosition() > size * 8;
+    }
+};
+
+/* parses the slice segment data of HEVC slices in software (7.3.8), as a
+ * CPU fallback that needs no GPU: SAO parameters, the coding quadtree,
+ * coding units with their prediction units and the transform tree down to
+ * the residual coefficients, keeping the neighbour state that context
+ * selection depends on. It stops short of reconstructing samples, so it
+ * counts what is coded rather than decoding pictures, and tells whether a
+ * slice parses cleanly up to its end_of_slice_segment_flag.
+ *
+ * Contexts are initialized from the slice QP and cabac_init_flag (9.3.2.2),
+ * and synchronized across CTU rows with wavefront parallel processing, at
+ * tile starts and for dependent slice segments as in 9.3.1. Streams using
+ * range extension coding tools or other than 4:2:0 chroma are not
+ * supported. */
+
+class HEVCCabacParser {
+public:
+    struct Stats {
+        uint64_t slices; // parsed to the end without error
+        uint64_t errors;
+        uint64_t unsupported; // slices of streams using tools not supported
+        uint64_t ctus;
+        uint64_t cus;
+        uint64_t coefficients; // nonzero
+        uint64_t bytes; // of slice data
+        uint64_t context_bins;
+        uint64_t bypass_bins;
+        uint64_t terminate_bins;
+        uint64_t elapsed_ns;
+    };
+
+    static constexpr int kNumContexts = 154;
+
+private:
+    CabacDecoder cabac;
+    uint8_t contexts[kNumContexts];
+    uint8_t wpp_contexts[kNumContexts]; // after the second CTU of the row above
+    uint8_t ds_contexts[kNumContexts]; // at the end of the last slice segment
+
+    const H265SPS *sps = nullptr;
+    const H265PPS *pps = nullptr;
+    const H265SliceHeader *shdr = nullptr;
+    std::vector<uint8_t> rbsp; // slice data without emulation prevention bytes
+
+    /* of the picture, from the SPS and PPS */
+    int pic_width = 0, pic_height = 0;
+    int pic_width_in_ctbs = 0, pic_size_in_ctbs = 0;
+    int ctb_log2_size = 0, min_cb_log2_size = 0;
+    int min_tb_log2_size = 0, max_tb_log2_size = 0;
+    int log2_min_cu_qp_delta_size = 0;
+    int slice_qp = 0, init_type = 0;
+    std::vector<int> ctb_addr_rs_to_ts;
+    std::vector<int> ctb_addr_ts_to_rs;
+    std::vector<int> tile_id; // by address in tile scan
+
+    /* per 4x4 block of the picture, left as they are between pictures as
+     * neighbours are only used once available in the current slice */
+    int map_stride = 0;
+    std::vector<uint8_t> ct_depth;
+    std::vector<uint8_t> skip_flag;
+    std::vector<uint8_t> intra_mode; // INTRA_DC for inter and PCM coding units
+
+    /* of the slice segment and coding unit being parsed */
+    int slice_addr_rs = 0, slice_addr_ts = 0;
+    int ctb_addr_rs = 0, ctb_addr_ts = 0;
+    bool is_cu_qp_delta_coded = false;
+    bool cu_transquant_bypass = false;
+    bool cu_intra = false;
+    bool intra_split = false;
+    int part_mode = 0;
+    int max_trafo_depth = 0;
+    int intra_mode_c = 0;
+    bool error = false;
+    uint64_t cus = 0, coefficients = 0;
+
+    Stats stats = {};
+
+    bool supported() const;
+    void setup_picture();
+    void init_contexts();
+    void start_contexts(bool slice_start);
+    bool available(int x, int y, int x_nb, int y_nb) const;
+    void fill_map(std::vector<uint8_t> &map, int x0, int y0, int size_x, int size_y, uint8_t v);
+    bool parse_slice_data();
+    void parse_sao(int rx, int ry);
+    bool parse_coding_quadtree(int x0, int y0, int log2_size, int depth);
+    bool parse_coding_unit(int x0, int y0, int log2_size, int depth);
+    int parse_part_mode(int log2_size);
+    bool parse_pcm(int log2_size);
+    void parse_intra_modes(int x0, int y0, int log2_size);
+    bool parse_prediction_unit(int width, int height, int depth);
+    void parse_merge_idx();
+    void parse_ref_idx(int num_ref_idx_active_minus1);
+    void parse_mvd();
+    bool parse_transform_tree(int x0, int y0, int x_base, int y_base, int log2_size, int depth, int blk_idx,
+        int parent_cbf_c);
+    void parse_cu_qp_delta();
+    void parse_residual_coding(int x0, int y0, int log2_size, int c_idx);
+    uint32_t decode_exp_golomb(int k);
+    uint32_t decode_abs_level_remaining(int rice);
+
+public:
+    HEVCCabacParser() {
+    }
+    HEVCCabacParser(const HEVCCabacParser &) = delete;
+    HEVCCabacParser &operator=(const HEVCCabacParser &) = delete;
+
+    /* parses the slice data of the slice segment NALU just passed to the
+     * decode callback of parser, bytes and size as passed to it. Slice
+     * segments of a picture must be parsed in order. Returns false if the
+     * slice data is in error or not supported. */
+    bool Parse(const HEVCParser &parser, const uint8_t *bytes, size_t size);
+
+    void GetStats(Stats *out) const {
+        *out = stats;
+    }
+};
+
+#endif /* __HEVCCABAC_H__ */
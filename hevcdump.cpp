@@ -0,0 +1,163 @@
+#include <stddef.h>
+
+#include <iterator>
+
+#include "hevcdump.h"
+
+#include <windows.h>
+#include <dxva.h>
+#ifdef USE_LIBVA
+#include <va/va.h>
+#endif
+
+#define DUMP(a) fprintf(f, "%s %d\n", #a, (int) pp->a)
+#define DUMP_HEX(a) fprintf(f, "%s 0x%x\n", #a, (unsigned) pp->a)
+
+template <class T, size_t N>
+static void dump_array(FILE *f, const char *name, const T (&a)[N]) {
+    fprintf(f, "%s", name);
+    for (size_t i = 0; i < N; ++i) {
+        fprintf(f, " %d", (int) a[i]);
+    }
+    fprintf(f, "\n");
+}
+
+/* Cb,Cr pairs */
+template <class T, size_t N>
+static void dump_pairs(FILE *f, const char *name, const T (&a)[N][2]) {
+    fprintf(f, "%s", name);
+    for (size_t i = 0; i < N; ++i) {
+        fprintf(f, " %d,%d", (int) a[i][0], (int) a[i][1]);
+    }
+    fprintf(f, "\n");
+}
+
+#define DUMP_ARRAY(a) dump_array(f, #a, pp->a)
+#define DUMP_PAIRS(a) dump_pairs(f, #a, pp->a)
+
+void DumpDXVAPicParams(FILE *f, const DXVA_PicParams_HEVC *pp) {
+    DUMP(PicWidthInMinCbsY);
+    DUMP(PicHeightInMinCbsY);
+    DUMP_HEX(wFormatAndSequenceInfoFlags);
+    DUMP(CurrPic.bPicEntry);
+    DUMP(sps_max_dec_pic_buffering_minus1);
+    DUMP(log2_min_luma_coding_block_size_minus3);
+    DUMP(log2_diff_max_min_luma_coding_block_size);
+    DUMP(log2_min_transform_block_size_minus2);
+    DUMP(log2_diff_max_min_transform_block_size);
+    DUMP(max_transform_hierarchy_depth_inter);
+    DUMP(max_transform_hierarchy_depth_intra);
+    DUMP(num_short_term_ref_pic_sets);
+    DUMP(num_long_term_ref_pics_sps);
+    DUMP(num_ref_idx_l0_default_active_minus1);
+    DUMP(num_ref_idx_l1_default_active_minus1);
+    DUMP(init_qp_minus26);
+    DUMP(ucNumDeltaPocsOfRefRpsIdx);
+    DUMP(wNumBitsForShortTermRPSInSlice);
+    DUMP_HEX(dwCodingParamToolFlags);
+    DUMP_HEX(dwCodingSettingPicturePropertyFlags);
+    DUMP(pps_cb_qp_offset);
+    DUMP(pps_cr_qp_offset);
+    DUMP(num_tile_columns_minus1);
+    DUMP(num_tile_rows_minus1);
+    DUMP_ARRAY(column_width_minus1);
+    DUMP_ARRAY(row_height_minus1);
+    DUMP(diff_cu_qp_delta_depth);
+    DUMP(pps_beta_offset_div2);
+    DUMP(pps_tc_offset_div2);
+    DUMP(log2_parallel_merge_level_minus2);
+    DUMP(CurrPicOrderCntVal);
+    fprintf(f, "RefPicList");
+    for (auto &entry : pp->RefPicList) {
+        fprintf(f, " %d", entry.bPicEntry);
+    }
+    fprintf(f, "\n");
+    DUMP_ARRAY(PicOrderCntValList);
+    DUMP_ARRAY(RefPicSetStCurrBefore);
+    DUMP_ARRAY(RefPicSetStCurrAfter);
+    DUMP_ARRAY(RefPicSetLtCurr);
+    DUMP(StatusReportFeedbackNumber);
+    fprintf(f, "\n");
+}
+
+#ifdef USE_LIBVA
+static void dump_va_picture(FILE *f, const char *name, const VAPictureHEVC *pic) {
+    fprintf(f, "%s %u %d 0x%x\n", name, pic->picture_id, pic->pic_order_cnt, pic->flags);
+}
+
+void DumpVAPicParams(FILE *f, const VAPictureParameterBufferHEVC *pp) {
+    char name[32];
+    dump_va_picture(f, "CurrPic", &pp->CurrPic);
+    for (size_t i = 0; i < std::size(pp->ReferenceFrames); ++i) {
+        snprintf(name, sizeof(name), "ReferenceFrames[%zu]", i);
+        dump_va_picture(f, name, &pp->ReferenceFrames[i]);
+    }
+    DUMP(pic_width_in_luma_samples);
+    DUMP(pic_height_in_luma_samples);
+    DUMP_HEX(pic_fields.value);
+    DUMP(sps_max_dec_pic_buffering_minus1);
+    DUMP(bit_depth_luma_minus8);
+    DUMP(bit_depth_chroma_minus8);
+    DUMP(pcm_sample_bit_depth_luma_minus1);
+    DUMP(pcm_sample_bit_depth_chroma_minus1);
+    DUMP(log2_min_luma_coding_block_size_minus3);
+    DUMP(log2_diff_max_min_luma_coding_block_size);
+    DUMP(log2_min_transform_block_size_minus2);
+    DUMP(log2_diff_max_min_transform_block_size);
+    DUMP(log2_min_pcm_luma_coding_block_size_minus3);
+    DUMP(log2_diff_max_min_pcm_luma_coding_block_size);
+    DUMP(max_transform_hierarchy_depth_intra);
+    DUMP(max_transform_hierarchy_depth_inter);
+    DUMP(init_qp_minus26);
+    DUMP(diff_cu_qp_delta_depth);
+    DUMP(pps_cb_qp_offset);
+    DUMP(pps_cr_qp_offset);
+    DUMP(log2_parallel_merge_level_minus2);
+    DUMP(num_tile_columns_minus1);
+    DUMP(num_tile_rows_minus1);
+    DUMP_ARRAY(column_width_minus1);
+    DUMP_ARRAY(row_height_minus1);
+    DUMP_HEX(slice_parsing_fields.value);
+    DUMP(log2_max_pic_order_cnt_lsb_minus4);
+    DUMP(num_short_term_ref_pic_sets);
+    DUMP(num_long_term_ref_pic_sps);
+    DUMP(num_ref_idx_l0_default_active_minus1);
+    DUMP(num_ref_idx_l1_default_active_minus1);
+    DUMP(pps_beta_offset_div2);
+    DUMP(pps_tc_offset_div2);
+    DUMP(num_extra_slice_header_bits);
+    DUMP(st_rps_bits);
+    fprintf(f, "\n");
+}
+
+void DumpVASliceParams(FILE *f, const VASliceParameterBufferHEVC *pp) {
+    DUMP(slice_data_size);
+    DUMP(slice_data_offset);
+    DUMP(slice_data_flag);
+    DUMP(slice_data_byte_offset);
+    DUMP(slice_segment_address);
+    DUMP_ARRAY(RefPicList[0]);
+    DUMP_ARRAY(RefPicList[1]);
+    DUMP_HEX(LongSliceFlags.value);
+    DUMP(collocated_ref_idx);
+    DUMP(num_ref_idx_l0_active_minus1);
+    DUMP(num_ref_idx_l1_active_minus1);
+    DUMP(slice_qp_delta);
+    DUMP(slice_cb_qp_offset);
+    DUMP(slice_cr_qp_offset);
+    DUMP(slice_beta_offset_div2);
+    DUMP(slice_tc_offset_div2);
+    DUMP(luma_log2_weight_denom);
+    DUMP(delta_chroma_log2_weight_denom);
+    DUMP_ARRAY(delta_luma_weight_l0);
+    DUMP_ARRAY(luma_offset_l0);
+    DUMP_ARRAY(delta_luma_weight_l1);
+    DUMP_ARRAY(luma_offset_l1);
+    DUMP_PAIRS(delta_chroma_weight_l0);
+    DUMP_PAIRS(ChromaOffsetL0);
+    DUMP_PAIRS(delta_chroma_weight_l1);
+    DUMP_PAIRS(ChromaOffsetL1);
+    DUMP(five_minus_max_num_merge_cand);
+    fprintf(f, "\n");
+}
+#endif
@@ -0,0 +1,19 @@
+#ifndef __HEVCDUMP_H__
+#define __HEVCDUMP_H__
+
+#include <stdio.h>
+
+/* write decoder parameter buffers as text, one "name value" line per field
+ * and a blank line after each picture, so that the parameters built for a
+ * stream can be diffed against a known good dump. Flag words are written
+ * whole, in hex. */
+
+struct _DXVA_PicParams_HEVC;
+struct _VAPictureParameterBufferHEVC;
+struct _VASliceParameterBufferHEVC;
+
+void DumpDXVAPicParams(FILE *f, const _DXVA_PicParams_HEVC *pp);
+void DumpVAPicParams(FILE *f, const _VAPictureParameterBufferHEVC *pp);
+void DumpVASliceParams(FILE *f, const _VASliceParameterBufferHEVC *sp);
+
+#endif /* __HEVCDUMP_H__ */
@@ -0,0 +1,367 @@
+#include <err.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "h264_bit_reader.h"
+#include "hevcindex.h"
+#include "trace.h"
+
+static const char kMagic[8] = { 'H', 'E', 'V', 'C', 'I', 'D', 'X', 0 };
+static const uint32_t kVersion = 1;
+
+/* NALU types, see H265NALU */
+enum {
+    kIDR_W_RADL = 19,
+    kIDR_N_LP = 20,
+    kVPS = 32,
+    kSPS = 33,
+    kPPS = 34,
+    kAUD = 35,
+    kPrefixSEI = 39,
+};
+
+static bool is_irap(int type) {
+    return type >= 16 && type <= 21;
+}
+
+/* 7.4.2.4.4: the first of these after a VCL NALU starts a new access unit */
+static bool starts_access_unit(int type) {
+    return (type >= kVPS && type <= kAUD) || type == kPrefixSEI || (type >= 41 && type <= 44) || (type >= 48 && type <= 55);
+}
+
+static bool skip_bits(H264BitReader *br, int n) {
+    int discard;
+    for (; n > 0; n -= 16) {
+        if (!br->ReadBits(n > 16 ? 16 : n, &discard)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* ue(v), 9.2 */
+static bool read_ue(H264BitReader *br, int *v) {
+    int bit, zeros = 0;
+    for (;;) {
+        if (!br->ReadBits(1, &bit)) {
+            return false;
+        }
+        if (bit) {
+            break;
+        }
+        if (++zeros > 31) {
+            return false;
+        }
+    }
+    int rest = 0;
+    if (zeros && !br->ReadBits(zeros, &rest)) {
+        return false;
+    }
+    *v = (int) ((1u << zeros) - 1 + rest);
+    return *v >= 0;
+}
+
+/* only as far as log2_max_pic_order_cnt_lsb_minus4, past profile_tier_level
+ * (7.3.3) which is 96 bits plus what the sub-layers add */
+int HEVCIndex::parse_sps(Builder *b, const uint8_t *bytes, size_t size, uint32_t entry) {
+    H264BitReader br;
+    if (!br.Initialize(bytes, size) || !skip_bits(&br, 16)) {
+        return -1;
+    }
+    int vps_id, max_sub_layers_minus1;
+    if (!br.ReadBits(4, &vps_id) || !br.ReadBits(3, &max_sub_layers_minus1) || !skip_bits(&br, 1 + 96)) {
+        return -1;
+    }
+    int profile_present[8], level_present[8];
+    for (int i = 0; i < max_sub_layers_minus1; ++i) {
+        if (!br.ReadBits(1, &profile_present[i]) || !br.ReadBits(1, &level_present[i])) {
+            return -1;
+        }
+    }
+    if (max_sub_layers_minus1 && !skip_bits(&br, 2 * (8 - max_sub_layers_minus1))) {
+        return -1;
+    }
+    for (int i = 0; i < max_sub_layers_minus1; ++i) {
+        if (!skip_bits(&br, (profile_present[i] ? 88 : 0) + (level_present[i] ? 8 : 0))) {
+            return -1;
+        }
+    }
+
+    int sps_id, chroma_format_idc, separate_colour_plane = 0, v, conformance_window;
+    if (!read_ue(&br, &sps_id) || sps_id >= 16 || !read_ue(&br, &chroma_format_idc)) {
+        return -1;
+    }
+    if (chroma_format_idc == 3 && !br.ReadBits(1, &separate_colour_plane)) {
+        return -1;
+    }
+    if (!read_ue(&br, &v) || !read_ue(&br, &v) || !br.ReadBits(1, &conformance_window)) {
+        return -1;
+    }
+    for (int i = 0; conformance_window && i < 4; ++i) {
+        if (!read_ue(&br, &v)) {
+            return -1;
+        }
+    }
+    int log2_max_poc_lsb_minus4;
+    if (!read_ue(&br, &v) || !read_ue(&br, &v) || !read_ue(&br, &log2_max_poc_lsb_minus4) || log2_max_poc_lsb_minus4 > 12) {
+        return -1;
+    }
+    b->sps[sps_id] = { entry, (uint8_t) vps_id, (uint8_t) (log2_max_poc_lsb_minus4 + 4), separate_colour_plane != 0 };
+    return sps_id;
+}
+
+int HEVCIndex::parse_pps(Builder *b, const uint8_t *bytes, size_t size, uint32_t entry) {
+    H264BitReader br;
+    int pps_id, sps_id, dependent_slice_segments, output_flag_present, extra_bits;
+    if (!br.Initialize(bytes, size) || !skip_bits(&br, 16) || !read_ue(&br, &pps_id) || pps_id >= 64
+        || !read_ue(&br, &sps_id) || sps_id >= 16 || !br.ReadBits(1, &dependent_slice_segments)
+        || !br.ReadBits(1, &output_flag_present) || !br.ReadBits(3, &extra_bits)) {
+        return -1;
+    }
+    b->pps[pps_id] = { entry, (uint8_t) sps_id, (uint8_t) extra_bits, output_flag_present != 0 };
+    return pps_id;
+}
+
+/* the first slice segment header of an IRAP picture up to
+ * slice_pic_order_cnt_lsb, 7.3.6.1 */
+bool HEVCIndex::parse_irap(Builder *b, const uint8_t *bytes, size_t size, int type, RandomAccessPoint *point) {
+    H264BitReader br;
+    int pps_id;
+    if (!br.Initialize(bytes, size) || !skip_bits(&br, 16 + 2) || !read_ue(&br, &pps_id) || pps_id >= 64) {
+        return false;
+    }
+    const PPSInfo &pps = b->pps[pps_id];
+    if (pps.entry == kNone) {
+        return false;
+    }
+    const SPSInfo &sps = b->sps[pps.sps_id];
+    if (sps.entry == kNone) {
+        return false;
+    }
+    int v, lsb = 0;
+    if (!skip_bits(&br, pps.num_extra_slice_header_bits) || !read_ue(&br, &v)
+        || !skip_bits(&br, (pps.output_flag_present ? 1 : 0) + (sps.separate_colour_plane ? 2 : 0))) {
+        return false;
+    }
+    if (type != kIDR_W_RADL && type != kIDR_N_LP && !br.ReadBits(sps.log2_max_poc_lsb, &lsb)) {
+        return false;
+    }
+    point->poc = lsb;
+    point->vps = b->vps[sps.vps_id];
+    point->sps = sps.entry;
+    point->pps = pps.entry;
+    return true;
+}
+
+/* bytes holds the first prefix bytes of the NALU, which starts at offset
+ * in the stream, its start code at start_code */
+void HEVCIndex::add_nalu(Builder *b, const uint8_t *bytes, size_t prefix, uint64_t start_code, uint64_t offset, uint64_t size) {
+    if (prefix < 3 || (bytes[0] & 0x80)) {
+        return;
+    }
+    int type = (bytes[0] >> 1) & 0x3f;
+    int layer_id = ((bytes[0] & 1) << 5) | (bytes[1] >> 3);
+    if (layer_id) {
+        return;
+    }
+
+    if (type < kVPS) {
+        bool first_slice_segment = bytes[2] & 0x80;
+        if (first_slice_segment) {
+            if (!b->au_open) {
+                b->au_start = start_code;
+            }
+            RandomAccessPoint point = {};
+            if (is_irap(type) && parse_irap(b, bytes, prefix, type, &point)) {
+                point.offset = b->au_start;
+                point.picture = b->num_pictures;
+                point.nal_unit_type = (uint8_t) type;
+                b->points.push_back(point);
+            }
+            ++b->num_pictures;
+        }
+        b->au_open = false;
+        return;
+    }
+
+    if (starts_access_unit(type) && !b->au_open) {
+        b->au_start = start_code;
+        b->au_open = true;
+    }
+    if (type < kVPS || type > kPPS || size > UINT32_MAX) {
+        return;
+    }
+    uint32_t entry = (uint32_t) b->param_sets.size();
+    ParamSet ps = { offset, (uint32_t) size, (uint8_t) type, 0, {} };
+    int id;
+    if (type == kVPS) {
+        id = bytes[2] >> 4;
+        b->vps[id] = entry;
+    } else if (type == kSPS) {
+        id = parse_sps(b, bytes, prefix, entry);
+    } else {
+        id = parse_pps(b, bytes, prefix, entry);
+    }
+    if (id < 0) {
+        return;
+    }
+    ps.id = (uint8_t) id;
+    b->param_sets.push_back(ps);
+}
+
+bool HEVCIndex::Build(FILE *f) {
+    TRACE_EVENT(1, "HEVCIndex::Build");
+    auto b = new Builder();
+    std::fill(b->vps, b->vps + 16, kNone);
+    for (auto &s : b->sps) {
+        s.entry = kNone;
+    }
+    for (auto &p : b->pps) {
+        p.entry = kNone;
+    }
+
+    const size_t chunk = 0x200000;
+    auto buffer = new uint8_t[chunk];
+    uint8_t prefix[kMaxHeaderBytes];
+    size_t prefix_size = 0;
+    bool in_nalu = false;
+    uint64_t start_code = 0, offset = 0;
+    uint64_t pos = 0; // of buffer[i]
+    size_t zeros = 0;
+
+    fseek(f, 0, SEEK_SET);
+    for (;;) {
+        size_t n = fread(buffer, 1, chunk, f);
+        if (!n) {
+            break;
+        }
+        for (size_t i = 0; i < n;) {
+            /* once we have all we want of a NALU, skip to the next 0x01 that
+             * could end a start code */
+            if (!in_nalu || prefix_size == kMaxHeaderBytes) {
+                auto one = (const uint8_t *) memchr(buffer + i, 1, n - i);
+                size_t j = one ? one - buffer : n;
+                if (j > i) {
+                    size_t z = 0;
+                    while (z < j - i && buffer[j - 1 - z] == 0) {
+                        ++z;
+                    }
+                    zeros = z == j - i ? zeros + z : z;
+                    pos += j - i;
+                    i = j;
+                    if (i == n) {
+                        break;
+                    }
+                }
+            }
+            uint8_t c = buffer[i++];
+            if (zeros >= 2 && c == 1) {
+                if (in_nalu) {
+                    uint64_t size = pos - zeros - offset;
+                    add_nalu(b, prefix, std::min<uint64_t>(prefix_size, size), start_code, offset, size);
+                }
+                start_code = pos - std::min<size_t>(zeros, 3);
+                offset = pos + 1;
+                in_nalu = true;
+                prefix_size = 0;
+                zeros = 0;
+            } else {
+                if (in_nalu && prefix_size < kMaxHeaderBytes) {
+                    prefix[prefix_size++] = c;
+                }
+                zeros = c ? 0 : zeros + 1;
+            }
+            ++pos;
+        }
+    }
+    if (in_nalu) {
+        uint64_t size = pos - zeros - offset;
+        add_nalu(b, prefix, std::min<uint64_t>(prefix_size, size), start_code, offset, size);
+    }
+    delete[] buffer;
+
+    /* lay the index out as the sidecar, so there is only one form of it */
+    size_t ps_bytes = b->param_sets.size() * sizeof(ParamSet);
+    size_t point_bytes = b->points.size() * sizeof(RandomAccessPoint);
+    storage.resize(sizeof(Header) + ps_bytes + point_bytes);
+    Header h = {};
+    memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.version = kVersion;
+    h.num_param_sets = (uint32_t) b->param_sets.size();
+    h.num_points = (uint32_t) b->points.size();
+    h.num_pictures = b->num_pictures;
+    h.stream_size = pos;
+    memcpy(storage.data(), &h, sizeof(h));
+    /* either table may be empty, and data() null */
+    if (ps_bytes) {
+        memcpy(storage.data() + sizeof(h), b->param_sets.data(), ps_bytes);
+    }
+    if (point_bytes) {
+        memcpy(storage.data() + sizeof(h) + ps_bytes, b->points.data(), point_bytes);
+    }
+    delete b;
+    return Map(storage.data(), storage.size(), pos) && NumPoints();
+}
+
+bool HEVCIndex::Save(FILE *f) const {
+    if (!header) {
+        return false;
+    }
+    size_t size = sizeof(Header) + header->num_param_sets * sizeof(ParamSet) + header->num_points * sizeof(RandomAccessPoint);
+    return fwrite(header, 1, size, f) == size;
+}
+
+bool HEVCIndex::Load(FILE *f, uint64_t stream_size) {
+    storage.clear();
+    uint8_t chunk[0x10000];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f))) {
+        storage.insert(storage.end(), chunk, chunk + n);
+    }
+    return Map(storage.data(), storage.size(), stream_size);
+}
+
+bool HEVCIndex::Map(const uint8_t *bytes, size_t size, uint64_t stream_size) {
+    header = nullptr;
+    auto h = (const Header *) bytes;
+    if (size < sizeof(Header) || ((uintptr_t) bytes & 7) || memcmp(h->magic, kMagic, sizeof(kMagic))
+        || h->version != kVersion || h->stream_size != stream_size) {
+        return false;
+    }
+    if (size != sizeof(Header) + (uint64_t) h->num_param_sets * sizeof(ParamSet) + (uint64_t) h->num_points * sizeof(RandomAccessPoint)) {
+        return false;
+    }
+    auto ps = (const ParamSet *) (bytes + sizeof(Header));
+    auto p = (const RandomAccessPoint *) (ps + h->num_param_sets);
+    for (uint32_t i = 0; i < h->num_points; ++i) {
+        for (uint32_t e : { p[i].vps, p[i].sps, p[i].pps }) {
+            if (e != kNone && e >= h->num_param_sets) {
+                return false;
+            }
+        }
+        if (i && p[i].picture <= p[i - 1].picture) {
+            return false;
+        }
+    }
+    header = h;
+    param_sets = ps;
+    points = p;
+    return true;
+}
+
+const HEVCIndex::RandomAccessPoint *HEVCIndex::Find(uint32_t picture) const {
+    auto end = points + NumPoints();
+    auto it = std::upper_bound(points, end, picture, [](uint32_t pic, const RandomAccessPoint &p) { return pic < p.picture; });
+    return it == points ? nullptr : it - 1;
+}
+
+int HEVCIndex::GetResumeParamSets(const RandomAccessPoint &point, const ParamSet **out) const {
+    int n = 0;
+    for (uint32_t e : { point.vps, point.sps, point.pps }) {
+        if (e != kNone && param_sets[e].offset < point.offset) {
+            out[n++] = &param_sets[e];
+        }
+    }
+    return n;
+}
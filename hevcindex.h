@@ -0,0 +1,151 @@
+#ifndef __HEVCINDEX_H__
+#define __HEVCINDEX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+/* random access index of a raw Annex-B HEVC stream, so decoding can start
+ * near any picture without parsing everything before it.
+ *
+ * Build() makes one pass over the file, splitting it at start codes and
+ * looking at NALU headers only, apart from the few fields at the start of
+ * parameter sets and IRAP slice headers that give their ids and POC. Every
+ * VPS, SPS and PPS is recorded, and every IRAP picture with the offset of
+ * its access unit and the parameter sets it refers to, so Find() can pick
+ * the random access point at or before a picture with a binary search.
+ *
+ * Save() writes the index as a sidecar file of a fixed header followed by
+ * the two tables, all little-endian and naturally aligned, so Map() can use
+ * a memory mapped copy in place. Load() reads one into memory instead. */
+
+class HEVCIndex {
+public:
+    struct ParamSet {
+        uint64_t offset; // of the NALU, after its start code
+        uint32_t size;
+        uint8_t nal_unit_type; // VPS_NUT, SPS_NUT or PPS_NUT
+        uint8_t id;
+        uint8_t reserved[2];
+    };
+
+    struct RandomAccessPoint {
+        uint64_t offset; // of the start code of the first NALU of the AU
+        uint32_t picture; // in decode order, counting from 0
+        int32_t poc; // when decoding starts here, i.e. without POC msb
+        uint32_t vps; // indices into the parameter set table
+        uint32_t sps;
+        uint32_t pps;
+        uint8_t nal_unit_type;
+        uint8_t reserved[3];
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t num_param_sets;
+        uint32_t num_points;
+        uint32_t num_pictures;
+        uint64_t stream_size; // to tell a stale sidecar
+    };
+
+    static_assert(sizeof(ParamSet) == 16, "sidecar layout");
+    static_assert(sizeof(RandomAccessPoint) == 32, "sidecar layout");
+    static_assert(sizeof(Header) == 32, "sidecar layout");
+
+    static constexpr uint32_t kNone = ~0u; // no parameter set with that id seen
+
+private:
+    std::vector<uint8_t> storage; // the sidecar image, unless mapped
+    const Header *header = nullptr;
+    const ParamSet *param_sets = nullptr;
+    const RandomAccessPoint *points = nullptr;
+
+    /* state of Build() */
+    struct SPSInfo {
+        uint32_t entry;
+        uint8_t vps_id;
+        uint8_t log2_max_poc_lsb;
+        bool separate_colour_plane;
+    };
+
+    struct PPSInfo {
+        uint32_t entry;
+        uint8_t sps_id;
+        uint8_t num_extra_slice_header_bits;
+        bool output_flag_present;
+    };
+
+    struct Builder {
+        std::vector<ParamSet> param_sets;
+        std::vector<RandomAccessPoint> points;
+        uint32_t num_pictures = 0;
+        uint32_t vps[16];
+        SPSInfo sps[16];
+        PPSInfo pps[64];
+        uint64_t au_start = 0;
+        bool au_open = false; // a NALU since the last VCL NALU started an AU
+    };
+
+    static const size_t kMaxHeaderBytes = 256;
+
+    static void add_nalu(Builder *b, const uint8_t *bytes, size_t prefix, uint64_t start_code, uint64_t offset, uint64_t size);
+    /* return the id of the parameter set, or -1 */
+    static int parse_sps(Builder *b, const uint8_t *bytes, size_t size, uint32_t entry);
+    static int parse_pps(Builder *b, const uint8_t *bytes, size_t size, uint32_t entry);
+    static bool parse_irap(Builder *b, const uint8_t *bytes, size_t size, int type, RandomAccessPoint *point);
+
+public:
+    HEVCIndex() {
+    }
+    HEVCIndex(const HEVCIndex &) = delete;
+    HEVCIndex &operator=(const HEVCIndex &) = delete;
+
+    /* indexes f from its start. Returns false if it has no IRAP picture. */
+    bool Build(FILE *f);
+
+    bool Save(FILE *f) const;
+    /* false if the sidecar is malformed or was made for a stream of
+     * another size */
+    bool Load(FILE *f, uint64_t stream_size);
+    /* uses bytes in place, they must stay valid and 8-byte aligned */
+    bool Map(const uint8_t *bytes, size_t size, uint64_t stream_size);
+
+    size_t NumParamSets() const {
+        return header ? header->num_param_sets : 0;
+    }
+
+    size_t NumPoints() const {
+        return header ? header->num_points : 0;
+    }
+
+    uint32_t NumPictures() const {
+        return header ? header->num_pictures : 0;
+    }
+
+    uint64_t StreamSize() const {
+        return header ? header->stream_size : 0;
+    }
+
+    const ParamSet &GetParamSet(size_t i) const {
+        return param_sets[i];
+    }
+
+    const RandomAccessPoint &GetPoint(size_t i) const {
+        return points[i];
+    }
+
+    /* the last random access point at or before picture, in decode order,
+     * or nullptr if there is none. For a fixed frame rate, picture is the
+     * time times the frame rate. */
+    const RandomAccessPoint *Find(uint32_t picture) const;
+
+    /* the parameter sets to feed the decoder before starting at point, those
+     * it refers to that are not already part of its access unit. Returns
+     * how many were stored in out, in VPS, SPS, PPS order. */
+    int GetResumeParamSets(const RandomAccessPoint &point, const ParamSet **out) const;
+};
+
+#endif /* __HEVCINDEX_H__ */
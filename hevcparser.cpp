@@ -10,12 +10,17 @@
 // The code that does not overlap with Chromium is Copyright 2023 Jamscape ApS.
 
 #undef NDEBUG
+#include <stdlib.h>
+
 #include <algorithm>
 
 #include "hevcparser.h"
 
 #include <windows.h>
 #include <dxva.h>
+#ifdef USE_LIBVA
+#include <va/va.h>
+#endif
 
 H265NALU::H265NALU() {
     memset(this, 0, sizeof(*this));
@@ -134,7 +139,17 @@ void HEVCParser::GetDimensions(int *pw, int *ph) {
     *ph = sps->pic_height_in_luma_samples;
 }
 
-void HEVCParser::GetUnpaddedDimensions(int *pw, int *ph) {
+/* number of pictures the decoder needs to hold for the active SPS, including
+ * the current one, never more than the level limit of Equation A-2 */
+int HEVCParser::GetMaxDecPicBuffering() {
+    if (!sps) {
+        errx(1, "%s: no SPS", __PRETTY_FUNCTION__);
+    }
+    int n = sps->sps_max_dec_pic_buffering_minus1[sps->sps_max_sub_layers_minus1] + 1;
+    return std::min(n, (int) sps->max_dpb_size);
+}
+
+void HEVCParser::GetCropRect(int *px, int *py, int *pw, int *ph) {
     if (!sps) {
         errx(1, "%s: no SPS", __PRETTY_FUNCTION__);
     }
@@ -146,19 +161,258 @@ void HEVCParser::GetUnpaddedDimensions(int *pw, int *ph) {
         sps->conf_win_bottom_offset);
 #endif
 
-    int width_crop = sps->conf_win_left_offset + sps->conf_win_right_offset;
-    width_crop += sps->vui_parameters.def_disp_win_left_offset;
-    width_crop += sps->vui_parameters.def_disp_win_right_offset;
-    width_crop *= sps->sub_width_c;
+    /* offsets are in units of chroma samples, so the crop rectangle of a
+     * 4:2:0 picture always starts on an even luma row and column */
+    int left = sps->conf_win_left_offset + sps->vui_parameters.def_disp_win_left_offset;
+    int right = sps->conf_win_right_offset + sps->vui_parameters.def_disp_win_right_offset;
+    int top = sps->conf_win_top_offset + sps->vui_parameters.def_disp_win_top_offset;
+    int bottom = sps->conf_win_bottom_offset + sps->vui_parameters.def_disp_win_bottom_offset;
 
     // base::CheckedNumeric<int>
-    int height_crop = sps->conf_win_top_offset + sps->conf_win_bottom_offset;
-    height_crop += sps->vui_parameters.def_disp_win_top_offset;
-    height_crop += sps->vui_parameters.def_disp_win_bottom_offset;
-    height_crop *= sps->sub_height_c;
+    *px = left * sps->sub_width_c;
+    *py = top * sps->sub_height_c;
+    *pw = sps->pic_width_in_luma_samples - (left + right) * sps->sub_width_c;
+    *ph = sps->pic_height_in_luma_samples - (top + bottom) * sps->sub_height_c;
+}
+
+void HEVCParser::GetUnpaddedDimensions(int *pw, int *ph) {
+    int x, y;
+    GetCropRect(&x, &y, pw, ph);
+}
 
-    *pw = sps->pic_width_in_luma_samples - width_crop;
-    *ph = sps->pic_height_in_luma_samples - height_crop;
+void HEVCParser::GetColorDescription(int *matrix_coefficients, bool *full_range) {
+    if (!sps) {
+        errx(1, "%s: no SPS", __PRETTY_FUNCTION__);
+    }
+    const H265VUIParameters &vui = sps->vui_parameters;
+    *matrix_coefficients = vui.colour_description_present_flag ? vui.matrix_coeffs : 2;
+    *full_range = vui.video_full_range_flag;
+}
+
+
+/* index into dpb of the picture with the given POC, compared under mask so
+ * long-term pictures signalled by their LSBs alone can be found, or -1 */
+int HEVCParser::FindReference(int poc, int mask, bool long_term) {
+    for (int i = 0; i < dpb_size; ++i) {
+        if ((dpb[i].poc & mask) == (poc & mask) && (long_term || !dpb[i].long_term)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* stands in for a reference the RPS of the current picture uses but the DPB
+ * lacks, with the picture closest to it in output order, so the lists still
+ * index real surfaces. -1 if the DPB is empty. */
+int HEVCParser::SubstituteReference(int poc) {
+    int best = -1;
+    for (int i = 0; i < dpb_size; ++i) {
+        if (best < 0 || abs(dpb[i].poc - poc) < abs(dpb[best].poc - poc)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+/* the references of the current picture cannot be worked out, from a
+ * malformed or corrupt RPS. The picture is dropped, and everything up to
+ * the next IRAP picture, which starts over from an empty DPB. */
+bool HEVCParser::DropReferences() {
+    CountError(kInvalidStream);
+    dpb_size = 0;
+    have_curr = false;
+    first_after_eos = true;
+    return false;
+}
+
+/* called on the first slice segment of each picture, returns false if the
+ * picture cannot be decoded and must be dropped */
+bool HEVCParser::UpdateReferences() {
+    auto slice_hdr = &shdr1;
+    int type = slice_hdr->nal_unit_type;
+    int max_lsb = sps->max_pic_order_cnt_lsb;
+    bool idr = type == H265NALU::IDR_W_RADL || type == H265NALU::IDR_N_LP;
+
+    if (have_curr) {
+        if (dpb_size == kMaxDpbSize) {
+            DVLOG(1) << "DPB overflow";
+            return DropReferences();
+        }
+        dpb[dpb_size++] = curr;
+        have_curr = false;
+    }
+
+    if (slice_hdr->irap_pic) {
+        no_rasl_output = idr || type <= H265NALU::BLA_N_LP || first_after_eos || irap_only;
+        first_after_eos = false;
+    }
+    /* 8.1.3: RASL pictures of an IRAP that starts a coded video sequence
+     * refer to pictures we never had */
+    if ((type == H265NALU::RASL_N || type == H265NALU::RASL_R) && no_rasl_output) {
+        return false;
+    }
+
+    // 8.3.1 Decoding process for picture order count
+    int lsb = slice_hdr->slice_pic_order_cnt_lsb;
+    int poc_msb = 0;
+    if (!slice_hdr->irap_pic || !no_rasl_output) {
+        int prev_lsb = prev_tid0_poc & (max_lsb - 1);
+        int prev_msb = prev_tid0_poc - prev_lsb;
+        if (lsb < prev_lsb && prev_lsb - lsb >= max_lsb / 2) {
+            poc_msb = prev_msb + max_lsb;
+        } else if (lsb > prev_lsb && lsb - prev_lsb > max_lsb / 2) {
+            poc_msb = prev_msb - max_lsb;
+        } else {
+            poc_msb = prev_msb;
+        }
+    }
+    int poc = poc_msb + lsb;
+
+    bool sub_layer_non_ref = type <= H265NALU::RSV_VCL_N14 && type % 2 == 0;
+    bool leading = type >= H265NALU::RADL_N && type <= H265NALU::RASL_R;
+    if (nalu.nuh_temporal_id_plus1 == 1 && !leading && !sub_layer_non_ref) {
+        prev_tid0_poc = poc;
+    }
+
+    // 8.3.2 Decoding process for reference picture set
+    if (slice_hdr->irap_pic && no_rasl_output) {
+        dpb_size = 0;
+    }
+    num_st_curr_before = num_st_curr_after = num_lt_curr = 0;
+
+    bool keep[kMaxDpbSize] = {};
+    if (!idr) {
+        for (int i = 0; i < slice_hdr->num_long_term_sps + slice_hdr->num_long_term_pics; ++i) {
+            int poc_lt = slice_hdr->poc_lsb_lt[i];
+            int mask = max_lsb - 1;
+            if (slice_hdr->delta_poc_msb_present_flag[i]) {
+                poc_lt += poc - slice_hdr->delta_poc_msb_cycle_lt[i] * max_lsb - (poc & (max_lsb - 1));
+                mask = -1;
+            }
+            int j = FindReference(poc_lt, mask, true);
+            if (j >= 0) {
+                dpb[j].long_term = true;
+            } else {
+                ++error_stats.missing_references;
+                if (!slice_hdr->used_by_curr_pic_lt[i]) {
+                    continue;
+                }
+                j = SubstituteReference(poc_lt);
+                if (j < 0) {
+                    return DropReferences();
+                }
+            }
+            keep[j] = true;
+            if (slice_hdr->used_by_curr_pic_lt[i]) {
+                lt_curr[num_lt_curr++] = j;
+            }
+        }
+
+        auto &st = slice_hdr->GetStRefPicSet(sps);
+        for (int i = 0; i < st.num_negative_pics + st.num_positive_pics; ++i) {
+            bool before = i < st.num_negative_pics;
+            int delta = before ? st.delta_poc_s0[i] : st.delta_poc_s1[i - st.num_negative_pics];
+            bool used = before ? st.used_by_curr_pic_s0[i] : st.used_by_curr_pic_s1[i - st.num_negative_pics];
+            int j = FindReference(poc + delta, -1, false);
+            if (j < 0) {
+                ++error_stats.missing_references;
+                if (!used) {
+                    continue;
+                }
+                j = SubstituteReference(poc + delta);
+                if (j < 0) {
+                    return DropReferences();
+                }
+            }
+            keep[j] = true;
+            if (used && before) {
+                st_curr_before[num_st_curr_before++] = j;
+            } else if (used) {
+                st_curr_after[num_st_curr_after++] = j;
+            }
+        }
+    }
+
+    /* pictures not in the RPS leave the DPB, renumber the lists to match */
+    int remap[kMaxDpbSize];
+    int n = 0;
+    for (int i = 0; i < dpb_size; ++i) {
+        remap[i] = n;
+        if (keep[i]) {
+            dpb[n++] = dpb[i];
+        }
+    }
+    dpb_size = n;
+    for (int i = 0; i < num_st_curr_before; ++i) {
+        st_curr_before[i] = remap[st_curr_before[i]];
+    }
+    for (int i = 0; i < num_st_curr_after; ++i) {
+        st_curr_after[i] = remap[st_curr_after[i]];
+    }
+    for (int i = 0; i < num_lt_curr; ++i) {
+        lt_curr[i] = remap[lt_curr[i]];
+    }
+
+    bool taken[kMaxDpbSize] = {};
+    for (int i = 0; i < dpb_size; ++i) {
+        taken[dpb[i].slot] = true;
+    }
+    int slot = 0;
+    while (slot < kMaxDpbSize && taken[slot]) {
+        ++slot;
+    }
+    if (slot == kMaxDpbSize) {
+        DVLOG(1) << "no free DPB slot";
+        return DropReferences();
+    }
+    curr = { poc, slot, false };
+    have_curr = true;
+    return true;
+}
+
+/* 8.3.4 Decoding process for reference picture lists construction, for the
+ * current P or B slice. Returns the number of entries, which are indices
+ * into dpb, or -1 if there are no references to build it from or the list
+ * modification points past them. */
+int HEVCParser::BuildRefPicList(int list, int *entries) {
+    auto slice_hdr = &shdr1;
+    int num_active = 1 + (list ? slice_hdr->num_ref_idx_l1_active_minus1 : slice_hdr->num_ref_idx_l0_active_minus1);
+    int num_total = num_st_curr_before + num_st_curr_after + num_lt_curr;
+    if (!num_total) {
+        return -1;
+    }
+
+    const int *first = list ? st_curr_after : st_curr_before;
+    const int *second = list ? st_curr_before : st_curr_after;
+    int num_first = list ? num_st_curr_after : num_st_curr_before;
+    int num_second = list ? num_st_curr_before : num_st_curr_after;
+
+    int temp[2 * kMaxDpbSize];
+    int num_temp = std::max(num_active, num_total);
+    int r = 0;
+    while (r < num_temp) {
+        for (int i = 0; i < num_first && r < num_temp; ++i) {
+            temp[r++] = first[i];
+        }
+        for (int i = 0; i < num_second && r < num_temp; ++i) {
+            temp[r++] = second[i];
+        }
+        for (int i = 0; i < num_lt_curr && r < num_temp; ++i) {
+            temp[r++] = lt_curr[i];
+        }
+    }
+
+    auto &mod = slice_hdr->ref_pic_lists_modification;
+    bool modified = list ? mod.ref_pic_list_modification_flag_l1 : mod.ref_pic_list_modification_flag_l0;
+    const int *list_entry = list ? mod.list_entry_l1 : mod.list_entry_l0;
+    for (int i = 0; i < num_active; ++i) {
+        int e = modified ? list_entry[i] : i;
+        if (e >= num_temp) {
+            return -1;
+        }
+        entries[i] = temp[e];
+    }
+    return num_active;
 }
 
 
@@ -353,73 +607,36 @@ void HEVCParser::FillDXVA(DXVA_PicParams_HEVC *pp, DXVA_Qmatrix_HEVC *pim) {
         pim->ucScalingListDCCoefSizeID3[1] = scaling_lists->scaling_list_dc_coef_32x32[3];
     }
 
-    uint32_t pic_order_count = shdr1.slice_pic_order_cnt_lsb;
-
-    pp->CurrPicOrderCntVal = pic_order_count;
-    pp->CurrPic.Index7Bits = pic_order_count;
+    pp->CurrPicOrderCntVal = curr.poc;
+    pp->CurrPic.Index7Bits = curr.slot;
     pp->CurrPic.AssociatedFlag = 0;
-    pp->PicOrderCntValList[0] = pic_order_count;
 
     memset(pp->RefPicSetStCurrBefore, 0xff, sizeof(pp->RefPicSetStCurrBefore));
     memset(pp->RefPicSetStCurrAfter, 0xff, sizeof(pp->RefPicSetStCurrAfter));
     memset(pp->RefPicSetLtCurr, 0xff, sizeof(pp->RefPicSetLtCurr));
     memset(pp->RefPicList, 0xff, sizeof(pp->RefPicList));
 
-#if 0
-    //printf("num_short_term_ref_pic_sets=%d\n", sps->num_short_term_ref_pic_sets);
-    for (int i = 0; i < sps->num_short_term_ref_pic_sets; ++i) {
-        auto st_ref_pic_set = &sps->st_ref_pic_set[i];
-        for (int j = 0; j < st_ref_pic_set->num_negative_pics; ++j) {
-            printf("sps i=%d negative pic %d\n", i, st_ref_pic_set->delta_poc_s0[j]);
-        }
+    /* RefPicList holds the whole RPS, in dpb order, and the RefPicSet*
+     * lists index into it */
+    int n = std::min(dpb_size, (int) std::size(pp->RefPicList));
+    for (int i = 0; i < n; ++i) {
+        pp->RefPicList[i].Index7Bits = dpb[i].slot;
+        pp->RefPicList[i].AssociatedFlag = dpb[i].long_term;
+        pp->PicOrderCntValList[i] = dpb[i].poc;
     }
-#endif
-
-#if 0
-    auto st_ref_pic_set = &shdr1.st_ref_pic_set;
-    for (int i = 0; i < st_ref_pic_set->num_negative_pics; ++i) {
-        //printf("slice negative pic %d\n", st_ref_pic_set->delta_poc_s0[i]);
-         pp->RefPicList[i].Index7Bits = i;
-         pp->RefPicList[i].AssociatedFlag = 0;
-         pp->PicOrderCntValList[i] = pic_order_count + st_ref_pic_set->delta_poc_s0[i];
+    for (int i = 0; i < num_st_curr_before && i < (int) std::size(pp->RefPicSetStCurrBefore); ++i) {
+        pp->RefPicSetStCurrBefore[i] = st_curr_before[i];
     }
-#endif
-
-    if (pic_order_count > 0) {
-        pp->RefPicSetStCurrBefore[0] = 0;
-         pp->RefPicList[0].Index7Bits = 0;
-         pp->RefPicList[0].AssociatedFlag = 0;
-         pp->PicOrderCntValList[0] = pic_order_count - 1;
+    for (int i = 0; i < num_st_curr_after && i < (int) std::size(pp->RefPicSetStCurrAfter); ++i) {
+        pp->RefPicSetStCurrAfter[i] = st_curr_after[i];
     }
-
-#if 0
-    if (pic_order_count > 2) {
-        pp->RefPicList[0].Index7Bits = pic_order_count - 2;
+    for (int i = 0; i < num_lt_curr && i < (int) std::size(pp->RefPicSetLtCurr); ++i) {
+        pp->RefPicSetLtCurr[i] = lt_curr[i];
     }
-
-
-
-    //p.PicOrderCntValList[i] = i;
-
-    pp->RefPicList[0].Index7Bits = 0;//pic_order_count;
-    pp->RefPicList[0].AssociatedFlag = 0;
-    pp->PicOrderCntValList[0] = 0;
-
-    pp->RefPicSetStCurrBefore[0] = pic_order_count > 0 ? pic_order_count - 2 : 0;
-#endif
-
-#if 0
-    uint32_t pic_order_count = shdr1.slice_pic_order_cnt_lsb / 2;
-    printf("pic_order_count=%u\n", pic_order_count);
-
-    pp->RefPicList[i].Index7Bits = i;
-    pp->RefPicList[i].AssociatedFlag = 0;
-    pp->PicOrderCntValList[i] = i;
-#endif
 }
 
 #ifdef USE_LIBVA
-void HEVCParser::FillVA(_VAPictureParameterBufferHEVC *pp, _VAIQMatrixBufferHEVC *pim) {
+void HEVCParser::FillVA(_VAPictureParameterBufferHEVC *pp, _VAIQMatrixBufferHEVC *pim, const uint32_t *surface_ids) {
     auto slice_hdr = &shdr1;
 
     int highest_tid = sps->sps_max_sub_layers_minus1;
@@ -531,16 +748,32 @@ void HEVCParser::FillVA(_VAPictureParameterBufferHEVC *pp, _VAIQMatrixBufferHEVC
         pp->st_rps_bits = slice_hdr->st_rps_bits;
     }
 
-    InitVAPicture(&pp->CurrPic);
-    //XXX FillVAPicture(&pp->CurrPic, std::move(pic));
+    pp->CurrPic.picture_id = surface_ids ? surface_ids[curr.slot] : curr.slot;
+    pp->CurrPic.pic_order_cnt = curr.poc;
+    pp->CurrPic.flags = 0;
 
     // Init reference pictures' array.
     for (size_t i = 0; i < std::size(pp->ReferenceFrames); ++i) {
         InitVAPicture(&pp->ReferenceFrames[i]);
     }
 
-    // And fill it with picture info from DPB.
-    //FillVARefFramesFromRefList(ref_pic_list, pp->ReferenceFrames);
+    // And fill it with picture info from DPB, in the same order as FillDXVA.
+    int n = std::min(dpb_size, (int) std::size(pp->ReferenceFrames));
+    for (int i = 0; i < n; ++i) {
+        auto va_pic = &pp->ReferenceFrames[i];
+        va_pic->picture_id = surface_ids ? surface_ids[dpb[i].slot] : dpb[i].slot;
+        va_pic->pic_order_cnt = dpb[i].poc;
+        va_pic->flags = dpb[i].long_term ? VA_PICTURE_HEVC_LONG_TERM_REFERENCE : 0;
+    }
+    for (int i = 0; i < num_st_curr_before; ++i) {
+        pp->ReferenceFrames[st_curr_before[i]].flags |= VA_PICTURE_HEVC_RPS_ST_CURR_BEFORE;
+    }
+    for (int i = 0; i < num_st_curr_after; ++i) {
+        pp->ReferenceFrames[st_curr_after[i]].flags |= VA_PICTURE_HEVC_RPS_ST_CURR_AFTER;
+    }
+    for (int i = 0; i < num_lt_curr; ++i) {
+        pp->ReferenceFrames[lt_curr[i]].flags |= VA_PICTURE_HEVC_RPS_LT_CURR;
+    }
 
     if (sps->scaling_list_enabled_flag) {
         memset(pim, 0, sizeof(*pim));
@@ -570,6 +803,82 @@ void HEVCParser::FillVA(_VAPictureParameterBufferHEVC *pp, _VAIQMatrixBufferHEVC
         pim->ScalingListDC32x32[1] = scaling_list.scaling_list_dc_coef_32x32[3];
     }
 }
+
+void HEVCParser::FillVASlice(_VASliceParameterBufferHEVC *sp, bool last_slice_of_pic) {
+    auto slice_hdr = &shdr1;
+    memset(sp, 0, sizeof(*sp));
+
+    sp->slice_data_size = (uint32_t) slice_hdr->nalu_size;
+    sp->slice_data_offset = 0;
+    sp->slice_data_flag = VA_SLICE_DATA_FLAG_ALL;
+    sp->slice_data_byte_offset = (uint32_t) (slice_hdr->header_size + slice_hdr->header_emulation_prevention_bytes);
+    sp->slice_segment_address = slice_hdr->slice_segment_address;
+
+    /* entries index ReferenceFrames, which FillVA() fills in dpb order */
+    memset(sp->RefPicList, 0xff, sizeof(sp->RefPicList));
+    int entries[kMaxRefIdxActive];
+    if (!slice_hdr->IsISlice()) {
+        int n = BuildRefPicList(0, entries);
+        for (int i = 0; i < n; ++i) {
+            sp->RefPicList[0][i] = entries[i];
+        }
+    }
+    if (slice_hdr->IsBSlice()) {
+        int n = BuildRefPicList(1, entries);
+        for (int i = 0; i < n; ++i) {
+            sp->RefPicList[1][i] = entries[i];
+        }
+    }
+
+#define SHDR_TO_SP(a) sp->a = slice_hdr->a
+#define SHDR_TO_SP_LSF(a) sp->LongSliceFlags.fields.a = slice_hdr->a
+    sp->LongSliceFlags.fields.LastSliceOfPic = last_slice_of_pic;
+    SHDR_TO_SP_LSF(dependent_slice_segment_flag);
+    SHDR_TO_SP_LSF(slice_type);
+    sp->LongSliceFlags.fields.color_plane_id = slice_hdr->colour_plane_id;
+    SHDR_TO_SP_LSF(slice_sao_luma_flag);
+    SHDR_TO_SP_LSF(slice_sao_chroma_flag);
+    SHDR_TO_SP_LSF(mvd_l1_zero_flag);
+    SHDR_TO_SP_LSF(cabac_init_flag);
+    SHDR_TO_SP_LSF(slice_temporal_mvp_enabled_flag);
+    SHDR_TO_SP_LSF(slice_deblocking_filter_disabled_flag);
+    SHDR_TO_SP_LSF(collocated_from_l0_flag);
+    SHDR_TO_SP_LSF(slice_loop_filter_across_slices_enabled_flag);
+
+    SHDR_TO_SP(collocated_ref_idx);
+    SHDR_TO_SP(num_ref_idx_l0_active_minus1);
+    SHDR_TO_SP(num_ref_idx_l1_active_minus1);
+    SHDR_TO_SP(slice_qp_delta);
+    SHDR_TO_SP(slice_cb_qp_offset);
+    SHDR_TO_SP(slice_cr_qp_offset);
+    SHDR_TO_SP(slice_beta_offset_div2);
+    SHDR_TO_SP(slice_tc_offset_div2);
+    SHDR_TO_SP(five_minus_max_num_merge_cand);
+#undef SHDR_TO_SP
+#undef SHDR_TO_SP_LSF
+
+    if ((pps->weighted_pred_flag && slice_hdr->IsPSlice()) || (pps->weighted_bipred_flag && slice_hdr->IsBSlice())) {
+        auto &pwt = slice_hdr->pred_weight_table;
+        sp->luma_log2_weight_denom = pwt.luma_log2_weight_denom;
+        sp->delta_chroma_log2_weight_denom = pwt.delta_chroma_log2_weight_denom;
+        /* VA wants ChromaOffset (7-56), not the delta coded in the stream */
+        int half = sps->wp_offset_half_range_c;
+        for (int i = 0; i < kMaxRefIdxActive; ++i) {
+            sp->delta_luma_weight_l0[i] = pwt.delta_luma_weight_l0[i];
+            sp->luma_offset_l0[i] = pwt.luma_offset_l0[i];
+            sp->delta_luma_weight_l1[i] = pwt.delta_luma_weight_l1[i];
+            sp->luma_offset_l1[i] = pwt.luma_offset_l1[i];
+            for (int j = 0; j < 2; ++j) {
+                int weight_l0 = (1 << pwt.chroma_log2_weight_denom) + pwt.delta_chroma_weight_l0[i][j];
+                int weight_l1 = (1 << pwt.chroma_log2_weight_denom) + pwt.delta_chroma_weight_l1[i][j];
+                sp->delta_chroma_weight_l0[i][j] = pwt.delta_chroma_weight_l0[i][j];
+                sp->delta_chroma_weight_l1[i][j] = pwt.delta_chroma_weight_l1[i][j];
+                sp->ChromaOffsetL0[i][j] = std::clamp(half + pwt.delta_chroma_offset_l0[i][j] - ((half * weight_l0) >> pwt.chroma_log2_weight_denom), -half, half - 1);
+                sp->ChromaOffsetL1[i][j] = std::clamp(half + pwt.delta_chroma_offset_l1[i][j] - ((half * weight_l1) >> pwt.chroma_log2_weight_denom), -half, half - 1);
+            }
+        }
+    }
+}
 #endif
 
 HEVCParser::Result HEVCParser::ParseStRefPicSet(int st_rps_idx, const H265SPS &sps, H265StRefPicSet *st_ref_pic_set, bool is_slice_hdr) {
@@ -678,7 +987,6 @@ HEVCParser::Result HEVCParser::ParseStRefPicSet(int st_rps_idx, const H265SPS &s
             READ_BOOL_OR_RETURN(&st_ref_pic_set->used_by_curr_pic_s0[i]);
         }
         for (int i = 0; i < st_ref_pic_set->num_positive_pics; ++i) {
-            printf("positive pic %d\n", i);
             int delta_poc_s1_minus1;
             READ_UE_OR_RETURN(&delta_poc_s1_minus1);
             IN_RANGE_OR_RETURN(delta_poc_s1_minus1, 0, 0x7FFF);
@@ -696,7 +1004,7 @@ HEVCParser::Result HEVCParser::ParseStRefPicSet(int st_rps_idx, const H265SPS &s
 }
 
 
-HEVCParser::Result HEVCParser::ParseSPS(H265SPS **psps) {
+HEVCParser::Result HEVCParser::ParseSPS(H265SPS *sps) {
     // 7.4.3.2
     DVLOG(4) << "Parsing SPS\n";
     Result res = kOk;
@@ -704,9 +1012,6 @@ HEVCParser::Result HEVCParser::ParseSPS(H265SPS **psps) {
     // DCHECK(sps_id);
     //*sps_id = -1;
 
-    auto sps = new H265SPS();
-    *psps = sps;
-
     READ_BITS_OR_RETURN(4, &sps->sps_video_parameter_set_id);
     IN_RANGE_OR_RETURN(sps->sps_video_parameter_set_id, 0, 15);
     READ_BITS_OR_RETURN(3, &sps->sps_max_sub_layers_minus1);
@@ -716,7 +1021,6 @@ HEVCParser::Result HEVCParser::ParseSPS(H265SPS **psps) {
     res = ParseProfileTierLevel(true, sps->sps_max_sub_layers_minus1,
         &sps->profile_tier_level);
     if (res != kOk) {
-        errx(1, "failed parsing profile");
         return res;
     }
 
@@ -1043,15 +1347,13 @@ active_sps_[*sps_id] = std::move(sps);
     return res;
 }
 
-HEVCParser::Result HEVCParser::ParsePPS(H265SPS *sps, H265PPS **ppps) {
+HEVCParser::Result HEVCParser::ParsePPS(H265PPS *pps) {
     // 7.4.3.3
     DVLOG(4) << "Parsing PPS\n";
     Result res = kOk;
 
     // DCHECK(pps_id);
     //*pps_id = -1;
-    auto pps = new H265PPS();
-    *ppps = pps;
 
     pps->temporal_id = 0; // XXX nalu.nuh_temporal_id_plus1 - 1;
 
@@ -1063,10 +1365,11 @@ HEVCParser::Result HEVCParser::ParsePPS(H265SPS *sps, H265PPS **ppps) {
     IN_RANGE_OR_RETURN(pps->pps_pic_parameter_set_id, 0, 63);
     READ_UE_OR_RETURN(&pps->pps_seq_parameter_set_id);
     IN_RANGE_OR_RETURN(pps->pps_seq_parameter_set_id, 0, 15);
-    if (!sps) {
+    if (!sps_slots[pps->pps_seq_parameter_set_id]) {
         DVLOG(1) << "missing sps";
         return kMissingParameterSet;
     }
+    const H265SPS *sps = &sps_slots[pps->pps_seq_parameter_set_id]->ps;
     READ_BOOL_OR_RETURN(&pps->dependent_slice_segments_enabled_flag);
     READ_BOOL_OR_RETURN(&pps->output_flag_present_flag);
     READ_BITS_OR_RETURN(3, &pps->num_extra_slice_header_bits);
@@ -1252,12 +1555,19 @@ HEVCParser::Result HEVCParser::ParseSliceHeader(const H265NALU &nalu, H265SliceH
     }
     READ_UE_OR_RETURN(&shdr->slice_pic_parameter_set_id);
     IN_RANGE_OR_RETURN(shdr->slice_pic_parameter_set_id, 0, 63);
-    // pps = GetPPS(shdr->slice_pic_parameter_set_id);
-    if (!pps) {
+    // Activate the parameter sets referenced by this slice.
+    auto pps_slot = pps_slots[shdr->slice_pic_parameter_set_id];
+    if (!pps_slot) {
+        return kMissingParameterSet;
+    }
+    auto sps_slot = sps_slots[pps_slot->ps.pps_seq_parameter_set_id];
+    if (!sps_slot) {
         return kMissingParameterSet;
     }
-    // sps = GetSPS(pps->pps_seq_parameter_set_id);
-    DCHECK(sps); // We already validated this when we parsed the PPS.
+    pps = &pps_slot->ps;
+    sps = &sps_slot->ps;
+    auto vps_slot = vps_slots[sps->sps_video_parameter_set_id];
+    vps = vps_slot ? &vps_slot->ps : nullptr;
 
     if (!shdr->first_slice_segment_in_pic_flag) {
         if (pps->dependent_slice_segments_enabled_flag) {
@@ -2062,13 +2372,10 @@ HEVCParser::Result HEVCParser::ParseVuiParameters(const H265SPS &sps, H265VUIPar
 }
 
 
-HEVCParser::Result HEVCParser::ParseVPS(H265VPS **pvps) {
+HEVCParser::Result HEVCParser::ParseVPS(H265VPS *vps) {
     DVLOG(4) << "Parsing VPS";
     Result res = kOk;
 
-    auto vps = new H265VPS();
-    *pvps = vps;
-
     READ_BITS_OR_RETURN(4, &vps->vps_video_parameter_set_id);
     IN_RANGE_OR_RETURN(vps->vps_video_parameter_set_id, 0, 16);
     READ_BOOL_OR_RETURN(&vps->vps_base_layer_internal_flag);
@@ -2125,125 +2432,499 @@ HEVCParser::Result HEVCParser::ParseVPS(H265VPS **pvps) {
 
 // Code below is Copyright 2023 Jamscape ApS. All rights reserved.
 
-bool HEVCParser::Parse(const uint8_t *bytes, size_t compressed_size, decode_callback_t cb, void *opaque) {
+HEVCParser::HEVCParser()
+    : ps_arena(0x100000), au_arena(0x40000),
+      /* the NALU buffer comes out of the long-lived arena once and for all,
+       * so Parse() itself never allocates. */
+      scanner((uint8_t *) ps_arena.Alloc(max_buffer), max_buffer), held_arena(0x100000) {
+}
 
-#if 0
-    for (size_t i = 0; i < compressed_size; ++i) {
-        printf("%02x,", bytes[i]);
+void HEVCParser::GetAllocationStats(AllocationStats *stats) const {
+    stats->param_sets = ps_arena.GetStats();
+    stats->access_unit = au_arena.GetStats();
+    stats->held = held_arena.GetStats();
+}
+
+template <class T, size_t N>
+bool HEVCParser::IsCachedParamSet(ParamSetSlot<T> *(&slots)[N], const uint8_t *bytes, size_t size) {
+    for (auto slot : slots) {
+        if (slot && slot->raw_size == size && !memcmp(slot->raw, bytes, size)) {
+            return true;
+        }
     }
-    printf("\n");
-#endif
+    return false;
+}
 
-    const size_t max_buffer = 0x200000;
-    auto buffer = new uint8_t[max_buffer]();
-    if (compressed_size > max_buffer) {
-        printf("%s buffer full, dropping %zu bytes of input\n",
-            __PRETTY_FUNCTION__, compressed_size);
-        return false;
+template <class T>
+T *HEVCParser::StoreParamSet(ParamSetSlot<T> **pslot, const T *ps, const uint8_t *bytes, size_t size) {
+    auto slot = *pslot;
+    if (!slot) {
+        slot = *pslot = ps_arena.New<ParamSetSlot<T>>();
+    }
+    slot->ps = *ps;
+    if (size <= kMaxCachedParamSetSize) {
+        memcpy(slot->raw, bytes, size);
+        slot->raw_size = size;
+    } else {
+        slot->raw_size = 0;
     }
+    return &slot->ps;
+}
 
-    /* we no longer support streaming in NALUs, so keep the state
-     * variable here instead of in the class definition. */
-    static size_t buffer_size = 0;
-    static size_t nalu_start_len = 0;
-    static size_t nalu_zeros = 0;
+void HEVCParser::StartAccessUnit(const uint8_t *bytes, size_t size, unsigned type) {
+    /* 7.4.2.4.4: the first slice of a picture, or any parameter set, AUD or
+     * prefix SEI following a VCL NALU, starts a new access unit. */
+    bool is_vcl = type < H265NALU::VPS_NUT;
+    bool starts_au;
+    if (is_vcl) {
+        starts_au = size > 2 && (bytes[2] & 0x80); // first_slice_segment_in_pic_flag
+    } else {
+        starts_au = au_has_vcl && type <= H265NALU::PREFIX_SEI_NUT && type != H265NALU::EOS_NUT && type != H265NALU::EOB_NUT && type != H265NALU::FD_NUT;
+    }
+    if (starts_au) {
+        EndAccessUnit();
+        au_arena.Reset();
+        au_has_vcl = false;
+    }
+    au_has_vcl |= is_vcl;
+}
 
-    auto p = buffer;
-    // uint8_t *enc_buffer = new uint8_t[max_buffer]();
-    // size_t enc_size = 0;
-    bool have_frame = false;
+void HEVCParser::SetHoldPictures(bool enable) {
+    hold_pictures = enable;
+}
 
-    for (size_t i = 0; i < compressed_size + 5; ++i) {
-        int c;
-        if (i < compressed_size) {
-            c = bytes[i];
-        } else {
-            /* add fake NALU header at end to trigger decode of last unit */
-            if (i == compressed_size + 3) {
-                c = 1;
-            } else {
-                c = 0;
+void HEVCParser::HoldNALU(const uint8_t *bytes, size_t size) {
+    auto h = (HeldNALU *) held_arena.Alloc(sizeof(HeldNALU) + size);
+    h->next = nullptr;
+    h->size = size;
+    memcpy(h->data(), bytes, size);
+    *held_tail = h;
+    held_tail = &h->next;
+}
+
+/* parses the header of every held slice that would be passed on, without
+ * acting on it, so that the access unit can be dropped as a whole before
+ * any of it reaches the decoder. Nothing else in the access unit can change
+ * the parameter sets the slices refer to. */
+HEVCParser::Result HEVCParser::CheckHeldSlices() {
+    auto scratch = au_arena.New<H265SliceHeader>();
+    for (auto h = held; h; h = h->next) {
+        Result res = ParseNALUHeader(h->data(), h->size);
+        unsigned type = nalu.nal_unit_type;
+        if (res != kOk && h->size > 0 && ((h->data()[0] >> 1) & 0x3f) < H265NALU::VPS_NUT) {
+            return res;
+        }
+        bool is_slice = type <= H265NALU::RASL_R || (type >= H265NALU::BLA_W_LP && type <= H265NALU::CRA_NUT);
+        bool is_irap = type >= H265NALU::BLA_W_LP && type <= H265NALU::RSV_IRAP_VCL23;
+        if (res == kOk && is_slice && (!resync || is_irap)) {
+            res = ParseSliceHeader(nalu, scratch, nullptr);
+            if (res != kOk) {
+                return res;
+            }
+        }
+    }
+    return kOk;
+}
+
+/* the held access unit is complete: its NALUs are parsed for real, in
+ * order, unless one of its slices is broken, or drop says the access unit
+ * lost a NALU, in which case none of them is */
+void HEVCParser::EndAccessUnit(bool drop) {
+    if (!held) {
+        return;
+    }
+    Result res = drop ? kInvalidStream : CheckHeldSlices();
+    if (res == kOk) {
+        for (auto h = held; h; h = h->next) {
+            Result nalu_res = ParseNALU(h->data(), h->size);
+            if (nalu_res != kOk) {
+                DropNALU(nalu_res, h->size);
+            }
+        }
+    } else {
+        DVLOG(1) << "dropping access unit, error " << res;
+        TRACE_INSTANT(1, "drop", res);
+        ++error_stats.errors;
+        error_stats.last_error = res;
+        for (auto h = held; h; h = h->next) {
+            ++error_stats.nals_dropped;
+            error_stats.bytes_skipped += h->size;
+        }
+        if (!resync) {
+            ++error_stats.resyncs;
+            resync = true;
+        }
+        picture_passed = false;
+    }
+    held = nullptr;
+    held_tail = &held;
+    held_arena.Reset();
+}
+
+void HEVCParser::DropNALU(Result res, size_t size) {
+    DVLOG(1) << "dropping NALU of " << size << " bytes, error " << res;
+    TRACE_INSTANT(1, "drop", res);
+    ++error_stats.nals_dropped;
+    error_stats.bytes_skipped += size;
+    CountError(res);
+}
+
+/* counts an error, after which VCL NALUs are dropped until the next IRAP
+ * picture or parameter set */
+void HEVCParser::CountError(Result res) {
+    ++error_stats.errors;
+    error_stats.last_error = res;
+    if (!resync) {
+        ++error_stats.resyncs;
+        resync = true;
+    }
+}
+
+/* 7.3.5, the SEI messages of a suffix SEI NALU, of which only the decoded
+ * picture hash is looked at */
+HEVCParser::Result HEVCParser::ParseSuffixSEI() {
+    const int kDecodedPictureHash = 132;
+    do {
+        int payload_type = 0, payload_size = 0, byte;
+        do {
+            READ_BITS_OR_RETURN(8, &byte);
+            payload_type += byte;
+        } while (byte == 0xff);
+        do {
+            READ_BITS_OR_RETURN(8, &byte);
+            payload_size += byte;
+        } while (byte == 0xff);
+        TRUE_OR_RETURN(payload_size * 8 <= br_.NumBitsLeft());
+
+        if (payload_type == kDecodedPictureHash && sps) {
+            PictureHash hash;
+            Result res = ParseDecodedPictureHash(&hash);
+            if (res != kOk) {
+                return res;
             }
+            int used = 1 + hash.num_components * (int) PictureHashSize(hash.hash_type);
+            TRUE_OR_RETURN(used <= payload_size);
+            hash_cb(&hash, hash_opaque);
+            SKIP_BITS_OR_RETURN((payload_size - used) * 8);
+        } else {
+            SKIP_BITS_OR_RETURN(payload_size * 8);
         }
+    } while (br_.HasMoreRBSPData());
+    return kOk;
+}
 
-        if (nalu_start_len) {
-            if (buffer_size > nalu_start_len) {
-                size_t size = buffer_size - nalu_start_len;
+/* the decoded picture hash SEI message, payload type 132, of the picture
+ * just passed on */
+HEVCParser::Result HEVCParser::ParseDecodedPictureHash(PictureHash *hash) {
+    *hash = {};
+    READ_BITS_OR_RETURN(8, &hash->hash_type);
+    size_t n = PictureHashSize(hash->hash_type);
+    TRUE_OR_RETURN(n);
+    hash->num_components = sps->chroma_format_idc ? 3 : 1;
+    for (int c = 0; c < hash->num_components; ++c) {
+        for (size_t i = 0; i < n; ++i) {
+            int byte;
+            READ_BITS_OR_RETURN(8, &byte);
+            hash->value[c][i] = (uint8_t) byte;
+        }
+    }
+    hash->width = sps->pic_width_in_luma_samples;
+    hash->height = sps->pic_height_in_luma_samples;
+    hash->chroma_format_idc = sps->chroma_format_idc;
+    hash->bit_depth_luma = sps->bit_depth_luma_minus8 + 8;
+    hash->bit_depth_chroma = sps->bit_depth_chroma_minus8 + 8;
+    return kOk;
+}
 
-                // Initialize bit reader at the start of found NALU.
-                br_.Initialize(p, size);
+HEVCParser::Result HEVCParser::ParseNALUHeader(const uint8_t *p, size_t size) {
 
-                // Read NALU header, skip the forbidden_zero_bit, but check for it.
-                int data;
-                READ_BITS_OR_RETURN(1, &data);
-                TRUE_OR_RETURN(data == 0);
+    // Initialize bit reader at the start of found NALU.
+    br_.Initialize(p, size);
 
-                READ_BITS_OR_RETURN(6, &nalu.nal_unit_type);
-                READ_BITS_OR_RETURN(6, &nalu.nuh_layer_id);
-                READ_BITS_OR_RETURN(3, &nalu.nuh_temporal_id_plus1);
+    // Read NALU header, skip the forbidden_zero_bit, but check for it.
+    int data;
+    READ_BITS_OR_RETURN(1, &data);
+    TRUE_OR_RETURN(data == 0);
+
+    READ_BITS_OR_RETURN(6, &nalu.nal_unit_type);
+    READ_BITS_OR_RETURN(6, &nalu.nuh_layer_id);
+    READ_BITS_OR_RETURN(3, &nalu.nuh_temporal_id_plus1);
+    TRUE_OR_RETURN(nalu.nuh_temporal_id_plus1 != 0);
+    nalu.data = p;
+    nalu.size = size;
+    return kOk;
+}
 
-                unsigned hevc_type = nalu.nal_unit_type;
-                unsigned avc_type = p[0] & 0x1f;
+HEVCParser::Result HEVCParser::ParseNALU(const uint8_t *p, size_t size) {
+    Result res = ParseNALUHeader(p, size);
+    if (res != kOk) {
+        return res;
+    }
 
-                if (hevc_type == NAL_UNIT_H265_VPS) {
-                    is_hevc = true;
-                    if (ParseVPS(&vps)) {
-                        errx(1, "ParseVPS failed");
-                    }
-                } else if (hevc_type == NAL_UNIT_H265_SPS) {
-                    is_hevc = true;
-                    if (ParseSPS(&sps)) {
-                        errx(1, "ParseSPS failed");
-                    }
-                } else if (hevc_type == NAL_UNIT_H265_PPS) {
-                    is_hevc = true;
-                    if (ParsePPS(sps, &pps)) {
-                        errx(1, "ParsePPS failed");
-                    }
-                } else if (hevc_type == H265NALU::Type::IDR_N_LP ||
-                    hevc_type == H265NALU::Type::TRAIL_N ||
-                    hevc_type == H265NALU::Type::TRAIL_R ||
-                    hevc_type == H265NALU::Type::IDR_W_RADL ||
-                    hevc_type == H265NALU::Type::CRA_NUT //||
-                    //hevc_type == H265NALU::Type::PREFIX_SEI_NUT
-                        ) {
-                    if (vps && sps && pps) {
-                        printf("coded slice type=%u sz=%zu nalu_start_len=%zu\n", hevc_type, size, nalu_start_len);
-                        is_hevc = true;
-                        if (ParseSliceHeader(nalu, &shdr1, nullptr)) {
-                            errx(1, "ParsePPS failed");
-                        }
-                        have_frame = true;
-                        cb(p, size, opaque);
-                    }
-                } else if (hevc_type == H265NALU::Type::PREFIX_SEI_NUT) {
-                    printf("%s: PREFIX_SEI_NUT not handled!\n", __PRETTY_FUNCTION__);
-                } else if (!is_hevc && avc_type == NAL_UNIT_H264_SPS) {
-                    errx(1, "%s: unhandled line %d\n", __PRETTY_FUNCTION__, __LINE__);
-                } else if (!is_hevc && avc_type == NAL_UNIT_H264_PPS) {
-                    errx(1, "%s: unhandled line %d\n", __PRETTY_FUNCTION__, __LINE__);
-                } else {
-                    printf("IGNORING nal %u (0x%x) sz=%zu\n", hevc_type, hevc_type, size);
-                    errx(1, "%s: unhandled line %d\n", __PRETTY_FUNCTION__, __LINE__);
+    unsigned hevc_type = nalu.nal_unit_type;
+    bool is_vcl = hevc_type < H265NALU::VPS_NUT;
+    bool is_irap = hevc_type >= H265NALU::BLA_W_LP && hevc_type <= H265NALU::RSV_IRAP_VCL23;
+
+    if (is_vcl) {
+        picture_passed = false;
+    }
+
+    /* after an error, drop everything up to the next IRAP picture or
+     * parameter set, rather than feeding the decoder slices whose references
+     * we may have lost. That includes the rest of an IRAP picture whose
+     * earlier slice failed, so only a first slice ends the resync. */
+    if (resync && is_vcl && !(is_irap && size > 2 && (p[2] & 0x80))) {
+        ++error_stats.nals_dropped;
+        error_stats.bytes_skipped += size;
+        return kOk;
+    }
+
+    /* the first bit after the NALU header is first_slice_segment_in_pic_flag */
+    if (is_vcl && size > 2 && SkipSubLayer(hevc_type, nalu.nuh_temporal_id_plus1 - 1, p[2] & 0x80)) {
+        ++skip_stats.nalus;
+        skip_stats.bytes += size;
+        return kOk;
+    }
+
+    if (hevc_type == NAL_UNIT_H265_VPS) {
+        if (!IsCachedParamSet(vps_slots, p, size)) {
+            auto scratch = au_arena.New<H265VPS>();
+            res = ParseVPS(scratch);
+            if (res != kOk) {
+                return res;
+            }
+            StoreParamSet(&vps_slots[scratch->vps_video_parameter_set_id], scratch, p, size);
+        }
+        resync = false;
+    } else if (hevc_type == NAL_UNIT_H265_SPS) {
+        if (!IsCachedParamSet(sps_slots, p, size)) {
+            auto scratch = au_arena.New<H265SPS>();
+            res = ParseSPS(scratch);
+            if (res != kOk) {
+                return res;
+            }
+            StoreParamSet(&sps_slots[scratch->sps_seq_parameter_set_id], scratch, p, size);
+            /* PPS contents are validated against their SPS, so force a
+             * re-parse of any PPS that refers to the new one. */
+            for (auto slot : pps_slots) {
+                if (slot && slot->ps.pps_seq_parameter_set_id == scratch->sps_seq_parameter_set_id) {
+                    slot->raw_size = 0;
+                }
+            }
+        }
+        resync = false;
+    } else if (hevc_type == NAL_UNIT_H265_PPS) {
+        if (!IsCachedParamSet(pps_slots, p, size)) {
+            auto scratch = au_arena.New<H265PPS>();
+            res = ParsePPS(scratch);
+            if (res != kOk) {
+                return res;
+            }
+            StoreParamSet(&pps_slots[scratch->pps_pic_parameter_set_id], scratch, p, size);
+        }
+        resync = false;
+    } else if (hevc_type <= H265NALU::RASL_R || (hevc_type >= H265NALU::BLA_W_LP && hevc_type <= H265NALU::CRA_NUT)) {
+        TRACE_INSTANT(3, "slice", hevc_type);
+        res = ParseSliceHeader(nalu, &shdr1, nullptr);
+        if (res != kOk) {
+            return res;
+        }
+        if (is_irap) {
+            resync = false;
+        }
+        if (shdr1.first_slice_segment_in_pic_flag) {
+            drop_picture = !UpdateReferences();
+        }
+        if (drop_picture) {
+            ++error_stats.nals_dropped;
+            error_stats.bytes_skipped += size;
+            return kOk;
+        }
+        /* the lists FillVASlice() builds must only index references we have */
+        if (!shdr1.IsISlice()) {
+            int entries[kMaxRefIdxActive];
+            if (BuildRefPicList(0, entries) < 0 || (shdr1.IsBSlice() && BuildRefPicList(1, entries) < 0)) {
+                return kInvalidStream;
+            }
+        }
+        have_frame = true;
+        picture_passed = true;
+        decode_cb(p, size, decode_opaque);
+    } else if (hevc_type == H265NALU::EOS_NUT) {
+        /* the next IRAP starts a new coded video sequence */
+        first_after_eos = true;
+    } else if (hevc_type == H265NALU::SUFFIX_SEI_NUT && hash_cb && picture_passed) {
+        /* SEI is of no use to the decoder, so a malformed one is ignored
+         * rather than treated as a stream error */
+        if (ParseSuffixSEI() != kOk) {
+            DVLOG(1) << "ignoring malformed suffix SEI";
+        }
+    } else {
+        /* SEI, AUD, end of sequence/bitstream, filler data, and reserved or
+         * unspecified NALU types carry nothing the decoder needs. */
 #if 0
-                    uint32_t size_network = std::HToNL(size);
-                    memcpy(buffer, &size_network, sizeof(uint32_t));
-                    memcpy(enc_buffer + enc_size, buffer, sizeof(uint32_t) + size);
-                    enc_size += sizeof(uint32_t) + size;
+        uint32_t size_network = std::HToNL(size);
+        memcpy(buffer, &size_network, sizeof(uint32_t));
+        memcpy(enc_buffer + enc_size, buffer, sizeof(uint32_t) + size);
+        enc_size += sizeof(uint32_t) + size;
 #endif
-                }
+    }
+    return res;
+}
+
+void HEVCParser::OnNALU(const uint8_t *bytes, size_t size, void *opaque) {
+    auto parser = (HEVCParser *) opaque;
+    if (!bytes) {
+        /* NALU larger than our buffer, nothing sensible can be done with it
+         * so drop it and whatever depends on it, including a held picture
+         * it may have been a slice of. */
+        parser->EndAccessUnit(true);
+        parser->DropNALU(kInvalidStream, size);
+        return;
+    }
+    parser->StartAccessUnit(bytes, size, size ? (bytes[0] >> 1) & 0x3f : 0);
+    if (parser->hold_pictures && parser->au_has_vcl) {
+        parser->HoldNALU(bytes, size);
+        return;
+    }
+    auto res = parser->ParseNALU(bytes, size);
+    if (res != kOk) {
+        parser->DropNALU(res, size);
+    }
+}
+
+/* HEVCDecoderConfigurationRecord, ISO/IEC 14496-15 8.3.3.1: 22 bytes of
+ * profile and format information, of which we only need lengthSizeMinusOne,
+ * then arrays of NALUs, each with a 16 bit count and 16 bit NALU lengths. */
+bool HEVCParser::ParseHvcC(const uint8_t *bytes, size_t size) {
+    const size_t header_size = 23;
+    if (size < header_size || bytes[0] != 1) {
+        return false;
+    }
+    int length_size = (bytes[21] & 3) + 1;
+    if (length_size == 3) {
+        return false;
+    }
+
+    int num_arrays = bytes[22];
+    size_t i = header_size;
+    for (int a = 0; a < num_arrays; ++a) {
+        if (size - i < 3) {
+            return false;
+        }
+        /* arrays may also hold SEI, which we have no use for */
+        int type = bytes[i] & 0x3f;
+        bool parameter_sets = type >= NAL_UNIT_H265_VPS && type <= NAL_UNIT_H265_PPS;
+        int num_nalus = (bytes[i + 1] << 8) | bytes[i + 2];
+        i += 3;
+        for (int n = 0; n < num_nalus; ++n) {
+            if (size - i < 2) {
+                return false;
+            }
+            size_t len = (bytes[i] << 8) | bytes[i + 1];
+            i += 2;
+            if (len > size - i) {
+                return false;
             }
-            buffer_size = 0;
+            if (parameter_sets && len) {
+                OnNALU(bytes + i, len, this);
+            }
+            i += len;
         }
-        p[buffer_size++] = c;
-        nalu_start_len = (nalu_zeros >= 2 && c == 1) ? nalu_zeros + 1 : 0;
-        nalu_zeros = c ? 0 : nalu_zeros + 1;
     }
+    scanner.SetLengthSize(length_size);
+    return true;
+}
+
+bool HEVCParser::Parse(const uint8_t *bytes, size_t compressed_size, decode_callback_t cb, void *opaque) {
+
+    TRACE_EVENT(2, "Parse", compressed_size);
+
+    decode_cb = cb;
+    decode_opaque = opaque;
+    have_frame = false;
+    scanner.Scan(bytes, compressed_size, OnNALU, this);
+    return have_frame;
+}
+
+bool HEVCParser::Flush(decode_callback_t cb, void *opaque) {
+
+    TRACE_EVENT(2, "Flush", 0);
+
+    decode_cb = cb;
+    decode_opaque = opaque;
+    have_frame = false;
+    scanner.Flush(OnNALU, this);
+    EndAccessUnit();
+    return have_frame;
+}
+
+bool HEVCParser::PushNALU(const uint8_t *bytes, size_t size, decode_callback_t cb, void *opaque) {
 
-    // if (enc_size) {
-    //  have_frame = impl->HandleEncoding(enc_buffer, enc_size);
-    //}
-    // delete[] enc_buffer;
-    delete[] buffer;
+    TRACE_EVENT(3, "PushNALU", size);
+
+    decode_cb = cb;
+    decode_opaque = opaque;
+    have_frame = false;
+    if (irap_only && size && SkipNonIrap(bytes[0], this)) {
+        ++skip_stats.nalus;
+        skip_stats.bytes += size;
+        return false;
+    }
+    OnNALU(bytes, size, this);
     return have_frame;
 }
+
+bool HEVCParser::SkipNonIrap(uint8_t header, void *opaque) {
+    unsigned type = (header >> 1) & 0x3f;
+    if (type < H265NALU::BLA_W_LP) {
+        /* so its suffix SEI is not taken for that of the last IRAP */
+        ((HEVCParser *) opaque)->picture_passed = false;
+        return true;
+    }
+    return false;
+}
+
+void HEVCParser::SetIrapOnly(bool enable) {
+    irap_only = enable;
+    scanner.SetSkipFilter(enable ? SkipNonIrap : nullptr, this);
+}
+
+void HEVCParser::GetSkipStats(NALScanner::SkipStats *stats) const {
+    scanner.GetSkipStats(stats);
+    stats->nalus += skip_stats.nalus;
+    stats->bytes += skip_stats.bytes;
+}
+
+void HEVCParser::SetMaxTemporalId(int temporal_id) {
+    target_temporal_id = std::clamp(temporal_id, 0, kMaxTemporalId);
+}
+
+int HEVCParser::GetNumSubLayers() const {
+    return sps ? sps->sps_max_sub_layers_minus1 + 1 : 0;
+}
+
+/* whether to drop a VCL NALU of a sub-layer above the one we decode up to.
+ * Pictures of a sub-layer never refer to those of a higher one, so we can go
+ * down anywhere. Going up needs a picture after which nothing refers to what
+ * was dropped before it: an IRAP picture resets everything, a TSA picture
+ * one sub-layer above the limit makes it and every sub-layer above it safe
+ * to decode from there on, an STSA picture only its own sub-layer. */
+bool HEVCParser::SkipSubLayer(unsigned type, int temporal_id, bool first_slice) {
+    if (!first_slice) {
+        return drop_sub_layer;
+    }
+    if (target_temporal_id < temporal_id_limit) {
+        temporal_id_limit = target_temporal_id;
+    } else if (target_temporal_id > temporal_id_limit) {
+        bool irap = type >= H265NALU::BLA_W_LP && type <= H265NALU::RSV_IRAP_VCL23;
+        bool next_up = temporal_id == temporal_id_limit + 1;
+        if (irap || (next_up && (type == H265NALU::TSA_N || type == H265NALU::TSA_R))) {
+            temporal_id_limit = target_temporal_id;
+        } else if (next_up && (type == H265NALU::STSA_N || type == H265NALU::STSA_R)) {
+            temporal_id_limit = temporal_id;
+        }
+    }
+    drop_sub_layer = temporal_id > temporal_id_limit;
+    return drop_sub_layer;
+}
@@ -12,16 +12,15 @@
 #include <cstring>
 #include <iostream>
 
+#include "arena.h"
 #include "bit_reader_macros.h"
 #include "h265_nalu_parser.h"
 #include "h265_parser.h"
+#include "nalscanner.h"
+#include "picturehash.h"
+#include "trace.h"
 
 #define DCHECK assert
-#define DVLOG(_n) \
-    printf("\n@%d:", __LINE__); \
-    std::cout
-
-//#define DVLOG(_n) if (0) std::cout
 
 #define NAL_UNIT_H265_VPS 32
 #define NAL_UNIT_H265_SPS 33
@@ -29,14 +28,11 @@
 #define NAL_UNIT_IDR_N_LP 0x14 // Coded slice segment of an IDR picture - slice_segment_layer_rbsp, VLC
 #define NAL_UNIT_TRAIL_R 1
 
-#define NAL_UNIT_H264_SEI 6
-#define NAL_UNIT_H264_SPS 7
-#define NAL_UNIT_H264_PPS 8
-
 struct _DXVA_PicParams_HEVC;
 struct _DXVA_Qmatrix_HEVC;
 struct _VAPictureParameterBufferHEVC;
 struct _VAIQMatrixBufferHEVC;
+struct _VASliceParameterBufferHEVC;
 
 #if defined(_MSC_VER) && !defined(__clang__)
 #include <intrin.h>
@@ -79,17 +75,50 @@ static inline uint32_t ctzll(uint64_t x) {
 class HEVCParser {
 
     typedef void (*decode_callback_t)(const uint8_t *bytes, size_t compressed_size, void *opaque);
+    typedef void (*hash_callback_t)(const PictureHash *hash, void *opaque);
 
     H264BitReader br_;
     H265NALU nalu;
     H265SliceHeader shdr1;
 
+    /* active parameter sets, pointing into the slot tables below */
     H265VPS *vps = nullptr;
     H265SPS *sps = nullptr;
     H265PPS *pps = nullptr;
 
-    bool is_hevc = true;
+    /* parameter sets are parsed into scratch memory from au_arena, and only
+     * copied into their long-lived slot in ps_arena if they parse without
+     * error. Encoders tend to repeat identical parameter sets in front of
+     * every IRAP, so we keep the raw NAL bytes around and skip re-parsing
+     * when nothing has changed. */
+    static const size_t kMaxCachedParamSetSize = 512;
+
+    template <class T>
+    struct ParamSetSlot {
+        T ps;
+        size_t raw_size;
+        uint8_t raw[kMaxCachedParamSetSize];
+    };
+
+    ParamSetSlot<H265VPS> *vps_slots[16] = {};
+    ParamSetSlot<H265SPS> *sps_slots[16] = {};
+    ParamSetSlot<H265PPS> *pps_slots[64] = {};
+
+    Arena ps_arena; // lives as long as the parser
+    Arena au_arena; // reset at the start of each access unit
+    bool au_has_vcl = false;
+
+    /* NALU scanning state, kept across calls to Parse() */
+    static const size_t max_buffer = 0x200000;
+    NALScanner scanner;
 
+    /* the callback and result of the Parse(), Flush() or PushNALU() call in
+     * progress */
+    decode_callback_t decode_cb = nullptr;
+    void *decode_opaque = nullptr;
+    bool have_frame = false;
+
+public:
     enum Result {
         kOk,
         kInvalidStream, // error in stream
@@ -98,6 +127,84 @@ class HEVCParser {
         kMissingParameterSet,
     };
 
+    struct ErrorStats {
+        size_t errors; // NALUs that failed to parse
+        size_t resyncs; // times we had to wait for an IRAP or parameter set
+        size_t nals_dropped; // NALUs not passed on, including the failed ones
+        size_t bytes_skipped;
+        size_t missing_references; // RPS entries not found in the DPB
+        Result last_error;
+    };
+
+private:
+    /* after an error, VCL NALUs are dropped until the next IRAP picture or
+     * parameter set comes along. */
+    ErrorStats error_stats = {};
+    bool resync = false;
+
+    /* with SetHoldPictures(), the NALUs of the access unit in progress are
+     * copied to held_arena from its first slice on, and only parsed once the
+     * next access unit starts */
+    struct HeldNALU {
+        HeldNALU *next;
+        size_t size;
+        uint8_t *data() {
+            return (uint8_t *) (this + 1);
+        }
+    };
+    bool hold_pictures = false;
+    Arena held_arena;
+    HeldNALU *held = nullptr;
+    HeldNALU **held_tail = &held;
+
+    /* reference picture state, derived once per picture by
+     * UpdateReferences() (8.3.1, 8.3.2) and shared by FillDXVA() and
+     * FillVA(). Every picture is given a DPB slot, the lowest not held by a
+     * picture still in the DPB, which the backend uses to index its
+     * reference texture array or VA surfaces. A picture joins the DPB once
+     * the next one starts, so dpb never holds the current picture. */
+    struct DpbEntry {
+        int poc;
+        int slot;
+        bool long_term;
+    };
+
+    DpbEntry dpb[kMaxDpbSize];
+    int dpb_size = 0;
+    DpbEntry curr = {};
+    bool have_curr = false;
+
+    int prev_tid0_poc = 0;
+    bool no_rasl_output = true; // of the last IRAP picture
+    bool first_after_eos = true;
+    bool drop_picture = false;
+
+    /* IRAP pictures only, see SetIrapOnly() */
+    bool irap_only = false;
+
+    /* temporal sub-layers decoded, see SetMaxTemporalId(). The limit in
+     * effect only moves up to the target at pictures that allow switching
+     * up (7.4.2.2), and drop_sub_layer applies its decision to every slice
+     * of a picture. */
+    static constexpr int kMaxTemporalId = 6;
+    int target_temporal_id = kMaxTemporalId;
+    int temporal_id_limit = kMaxTemporalId;
+    bool drop_sub_layer = false;
+
+    NALScanner::SkipStats skip_stats = {}; // not counted by the scanner
+
+    /* decoded picture hash SEI, see SetPictureHashCallback() */
+    hash_callback_t hash_cb = nullptr;
+    void *hash_opaque = nullptr;
+    bool picture_passed = false; // the last VCL NALU went to decode_cb
+
+    /* RPS of the current picture, as indices into dpb */
+    int st_curr_before[kMaxDpbSize];
+    int st_curr_after[kMaxDpbSize];
+    int lt_curr[kMaxDpbSize];
+    int num_st_curr_before = 0;
+    int num_st_curr_after = 0;
+    int num_lt_curr = 0;
 
     template <typename T, int bits = sizeof(T) * 8>
     inline constexpr
@@ -162,26 +269,133 @@ class HEVCParser {
 
     Result ParseAndIgnoreHrdParameters(bool common_inf_present_flag, int max_num_sub_layers_minus1);
     Result ParseAndIgnoreSubLayerHrdParameters(int cpb_cnt, bool sub_pic_hrd_params_present_flag);
-    Result ParsePPS(H265SPS *sps, H265PPS **ppps);
+    Result ParsePPS(H265PPS *pps);
     Result ParsePredWeightTable(const H265SPS &sps, const H265SliceHeader &shdr, H265PredWeightTable *pred_weight_table);
     Result ParseProfileTierLevel(bool profile_present, int max_num_sub_layers_minus1, H265ProfileTierLevel *profile_tier_level);
     Result ParseRefPicListsModifications(const H265SliceHeader &shdr, H265RefPicListsModifications *rpl_mod);
-    Result ParseSPS(H265SPS **psps);
+    Result ParseSPS(H265SPS *sps);
     Result ParseScalingListData(H265ScalingListData *scaling_list_data);
     Result ParseSliceHeader(const H265NALU &nalu, H265SliceHeader *shdr, H265SliceHeader *prior_shdr);
     Result ParseSliceHeaderForPictureParameterSets(const H265NALU &nalu, int *pps_id);
     Result ParseStRefPicSet(int st_rps_idx, const H265SPS &sps, H265StRefPicSet *st_ref_pic_set, bool is_slice_hdr = false);
-    Result ParseVPS(H265VPS **pvps);
+    Result ParseVPS(H265VPS *vps);
+    Result ParseSuffixSEI();
+    Result ParseDecodedPictureHash(PictureHash *hash);
     Result ParseVuiParameters(const H265SPS &sps, H265VUIParameters *vui);
     void FillInDefaultScalingListData(H265ScalingListData *scaling_list_data, int size_id, int matrix_id);
 
+    template <class T, size_t N>
+    bool IsCachedParamSet(ParamSetSlot<T> *(&slots)[N], const uint8_t *bytes, size_t size);
+    template <class T>
+    T *StoreParamSet(ParamSetSlot<T> **pslot, const T *ps, const uint8_t *bytes, size_t size);
+    void StartAccessUnit(const uint8_t *bytes, size_t size, unsigned type);
+    void HoldNALU(const uint8_t *bytes, size_t size);
+    Result CheckHeldSlices();
+    void EndAccessUnit(bool drop = false);
+    Result ParseNALUHeader(const uint8_t *bytes, size_t size);
+    Result ParseNALU(const uint8_t *bytes, size_t size);
+    static void OnNALU(const uint8_t *bytes, size_t size, void *opaque);
+    static bool SkipNonIrap(uint8_t header, void *opaque);
+    bool SkipSubLayer(unsigned type, int temporal_id, bool first_slice);
+    void DropNALU(Result res, size_t size);
+    void CountError(Result res);
+    bool UpdateReferences();
+    bool DropReferences();
+    int FindReference(int poc, int mask, bool long_term);
+    int SubstituteReference(int poc);
+    int BuildRefPicList(int list, int *entries);
+
 
 public:
+    struct AllocationStats {
+        Arena::Stats param_sets;
+        Arena::Stats access_unit;
+        Arena::Stats held; // pictures held back, see SetHoldPictures()
+    };
+
+    HEVCParser();
+
+    /* switch Parse() from Annex-B to MP4-style length-prefixed input, with
+     * the length size and the VPS, SPS and PPS from an hvcC box. Each
+     * Parse() must then be given whole NALUs, and the decode callback gets
+     * views into the bytes passed in. Returns false if the box is malformed,
+     * in which case the input mode is left alone. */
+    bool ParseHvcC(const uint8_t *bytes, size_t size);
     bool Parse(const uint8_t *bytes, size_t compressed_size, decode_callback_t cb, void *opaque);
+    /* passes on the NALU still held by the scanner at the end of the
+     * stream, Annex-B input can be split anywhere so the last one is only
+     * known to be complete once the stream has ended, and the last picture
+     * with SetHoldPictures() */
+    bool Flush(decode_callback_t cb, void *opaque);
+    /* parses one whole NALU, without start code or length, e.g. from an RTP
+     * depacketizer. The decode callback gets a view into bytes. */
+    bool PushNALU(const uint8_t *bytes, size_t size, decode_callback_t cb, void *opaque);
+    /* pass on IRAP pictures only, e.g. for thumbnails. Other VCL NALUs are
+     * skipped by the scanner on their NALU header, without being gathered or
+     * their slice headers parsed, and each IRAP picture is decoded as if it
+     * started a coded video sequence. */
+    void SetIrapOnly(bool enable);
+    /* hold the slices of each picture until the picture is complete, and
+     * drop it as a whole if any of them fails to parse, rather than passing
+     * on the slices before the failing one. Costs a copy of every picture,
+     * which is passed on once the first NALU of the next one has been seen,
+     * or by Flush(). Off by default, so that the decode callback gets views
+     * into the input, as HEVCAnalyzer relies on. Set before parsing. */
+    void SetHoldPictures(bool enable);
+    /* decode temporal sub-layers up to temporal_id only, e.g. at a lower
+     * frame rate under load. Lowering takes effect at the next picture,
+     * raising at the next IRAP, TSA or STSA picture that allows switching
+     * up to a higher sub-layer. */
+    void SetMaxTemporalId(int temporal_id);
+    /* the highest temporal id decoded right now */
+    int GetTemporalIdLimit() const {
+        return temporal_id_limit;
+    }
+    /* sps_max_sub_layers_minus1 + 1 of the active SPS, 0 before there is
+     * one */
+    int GetNumSubLayers() const;
+    /* cb gets the decoded picture hash SEI of each picture passed
+     * on, after the picture itself, as the SEI follows its slices. Not
+     * called for pictures that are dropped or skipped. */
+    void SetPictureHashCallback(hash_callback_t cb, void *opaque) {
+        hash_cb = cb;
+        hash_opaque = opaque;
+    }
+    /* NALUs skipped in IRAP-only mode or dropped with their sub-layer */
+    void GetSkipStats(NALScanner::SkipStats *stats) const;
     void FillDXVA(_DXVA_PicParams_HEVC *pp, _DXVA_Qmatrix_HEVC *pim);
-    void FillVA(_VAPictureParameterBufferHEVC *pp, _VAIQMatrixBufferHEVC *pim);
+    /* surface_ids maps DPB slots to VA surfaces, if null the slot itself is
+     * passed as picture_id */
+    void FillVA(_VAPictureParameterBufferHEVC *pp, _VAIQMatrixBufferHEVC *pim, const uint32_t *surface_ids = nullptr);
+    /* slice data offsets are relative to the start of the NALU, without
+     * start code */
+    void FillVASlice(_VASliceParameterBufferHEVC *sp, bool last_slice_of_pic);
+    /* the slice segment header and PicOrderCntVal of the slice segment just
+     * passed to the decode callback */
+    const H265SliceHeader &GetSliceHeader() const {
+        return shdr1;
+    }
+    int GetPictureOrderCount() const {
+        return curr.poc;
+    }
+    /* the parameter sets that slice segment refers to */
+    const H265SPS *GetSPS() const {
+        return sps;
+    }
+    const H265PPS *GetPPS() const {
+        return pps;
+    }
     void GetDimensions(int *pw, int *ph);
     void GetUnpaddedDimensions(int *pw, int *ph);
+    void GetCropRect(int *px, int *py, int *pw, int *ph);
+    /* matrix_coefficients and video_full_range_flag from the VUI of the
+     * active SPS, 2 (unspecified) and false where it has none */
+    void GetColorDescription(int *matrix_coefficients, bool *full_range);
+    int GetMaxDecPicBuffering();
+    void GetAllocationStats(AllocationStats *stats) const;
+    void GetErrorStats(ErrorStats *stats) const {
+        *stats = error_stats;
+    }
 
 }; // HEVCParser
 
@@ -0,0 +1,62 @@
+#include <atomic>
+
+#include "hevcpicture.h"
+#include "latency.h"
+
+static const int kInvalidPicEntry = 0xff;
+
+void HEVCPicture::fill(HEVCParser *parser, const uint8_t *bytes, size_t size) {
+    static std::atomic<uint32_t> frame_counter = 0;
+
+    {
+        ScopedLatency latency(kStageFillDXVA);
+        parser->FillDXVA(&pic_params, &qmatrix);
+    }
+    pic_params.StatusReportFeedbackNumber = ++frame_counter;
+
+    /* the slice data goes to the decoder with a 0,0,1 start code */
+    const size_t header_size = 3;
+    slice = {};
+    slice.BSNALunitDataLocation = 0;
+    slice.SliceBytesInBuffer = (UINT) (header_size + size);
+
+    int type = (bytes[0] >> 1) & 0x3f;
+    picture = {};
+    parser->GetDimensions(&picture.width, &picture.height);
+    picture.num_references = parser->GetMaxDecPicBuffering();
+    picture.is_key = type >= H265NALU::BLA_W_LP && type <= H265NALU::RSV_IRAP_VCL23;
+    picture.pic_params = &pic_params;
+    picture.pic_params_size = sizeof(pic_params);
+    picture.qmatrix = &qmatrix;
+    picture.qmatrix_size = sizeof(qmatrix);
+    picture.slice_control = &slice;
+    picture.slice_control_size = sizeof(slice);
+
+    picture.output_slot = pic_params.CurrPic.Index7Bits;
+    for (auto &entry : pic_params.RefPicList) {
+        if (entry.bPicEntry != kInvalidPicEntry && picture.num_refs < kMaxDecodeReferences) {
+            picture.refs[picture.num_refs++] = entry.Index7Bits;
+        }
+    }
+}
+
+void HEVCPicture::Build(HEVCParser *parser, const uint8_t *bytes, size_t size) {
+    fill(parser, bytes, size);
+
+    /* prepend a 0,0,1 start code */
+    const size_t header_size = 3;
+    bitstream.resize(header_size + size);
+    bitstream[0] = 0;
+    bitstream[1] = 0;
+    bitstream[2] = 1;
+    memcpy(bitstream.data() + header_size, bytes, size);
+    picture.bitstream = bitstream.data();
+    picture.bitstream_size = bitstream.size();
+}
+
+void HEVCPicture::BuildInPlace(HEVCParser *parser, const uint8_t *bytes, size_t size) {
+    fill(parser, bytes, size);
+    picture.bitstream = bytes;
+    picture.bitstream_size = size;
+    picture.add_start_code = true;
+}
@@ -0,0 +1,40 @@
+#ifndef __HEVCPICTURE_H__
+#define __HEVCPICTURE_H__
+
+#include <windows.h>
+#include <dxva.h>
+
+#include <vector>
+
+#include "decodebackend.h"
+#include "hevcparser.h"
+
+/* the DXVA parameter buffers and slice data for one HEVC picture, built from
+ * the parser state in its decode callback, so the picture can be submitted
+ * to a DecodeBackend later or from another thread. Reusing an HEVCPicture
+ * reuses its bitstream buffer. BuildInPlace() skips the copy of the slice
+ * data, for pictures submitted before the callback returns. */
+
+class HEVCPicture {
+    DXVA_PicParams_HEVC pic_params;
+    DXVA_Qmatrix_HEVC qmatrix;
+    DXVA_Slice_HEVC_Short slice;
+    std::vector<uint8_t> bitstream;
+    DecodePicture picture;
+
+    void fill(HEVCParser *parser, const uint8_t *bytes, size_t size);
+
+public:
+    /* bytes is one VCL NAL unit without start code, as passed to the
+     * parser's decode callback */
+    void Build(HEVCParser *parser, const uint8_t *bytes, size_t size);
+    /* the picture refers to bytes, which must stay valid until it has
+     * been submitted */
+    void BuildInPlace(HEVCParser *parser, const uint8_t *bytes, size_t size);
+
+    const DecodePicture *Get() const {
+        return &picture;
+    }
+};
+
+#endif /* __HEVCPICTURE_H__ */
@@ -0,0 +1,184 @@
+#include <string.h>
+
+#include <algorithm>
+
+#include "fileio.h"
+#include "hevcsplicer.h"
+#include "trace.h"
+
+/* NALU types, see H265NALU */
+enum {
+    kBLA_W_LP = 16,
+    kCRA = 21,
+    kVPS = 32,
+    kAUD = 35,
+    kPrefixSEI = 39,
+};
+
+static const size_t kChunk = 0x100000;
+
+/* 7.4.2.4.4: the first of these after a VCL NALU starts a new access unit */
+static bool starts_access_unit(int type) {
+    return (type >= kVPS && type <= kAUD) || type == kPrefixSEI || (type >= 41 && type <= 44) || (type >= 48 && type <= 55);
+}
+
+/* the index of the NALU after the first start code at or after i, or size */
+static size_t find_nalu(const uint8_t *bytes, size_t size, size_t i) {
+    while (i + 2 < size) {
+        auto one = (const uint8_t *) memchr(bytes + i + 2, 1, size - i - 2);
+        if (!one) {
+            break;
+        }
+        size_t j = one - bytes;
+        if (!bytes[j - 1] && !bytes[j - 2]) {
+            return j + 1;
+        }
+        i = j - 1;
+    }
+    return size;
+}
+
+static bool read_at(FILE *f, uint64_t offset, uint8_t *bytes, size_t size) {
+    return !seek64(f, offset) && fread(bytes, 1, size, f) == size;
+}
+
+/* writes the parameter sets last sent before offset in the stream of index,
+ * one of each type and id, that differ from the ones the output has */
+bool HEVCSplicer::write_param_sets(FILE *in, const HEVCIndex &index, uint64_t offset) {
+    std::map<int, const HEVCIndex::ParamSet *> latest; // in VPS, SPS, PPS order
+    for (size_t i = 0; i < index.NumParamSets() && index.GetParamSet(i).offset < offset; ++i) {
+        auto &ps = index.GetParamSet(i);
+        latest[ps.nal_unit_type << 8 | ps.id] = &ps;
+    }
+    static const uint8_t start_code[4] = { 0, 0, 0, 1 };
+    for (auto &it : latest) {
+        buffer.resize(it.second->size);
+        if (!read_at(in, it.second->offset, buffer.data(), buffer.size())) {
+            return false;
+        }
+        auto &current = param_sets[it.first];
+        if (current == buffer) {
+            continue;
+        }
+        if (fwrite(start_code, 1, sizeof(start_code), out) != sizeof(start_code)
+            || fwrite(buffer.data(), 1, buffer.size(), out) != buffer.size()) {
+            return false;
+        }
+        current = buffer;
+        ++stats.param_sets_written;
+    }
+    return true;
+}
+
+/* the parameter sets copied along with the bytes from start to end are now
+ * those of the output */
+bool HEVCSplicer::track_param_sets(FILE *in, const HEVCIndex &index, uint64_t start, uint64_t end) {
+    for (size_t i = 0; i < index.NumParamSets(); ++i) {
+        auto &ps = index.GetParamSet(i);
+        if (ps.offset < start || ps.offset >= end) {
+            continue;
+        }
+        auto &current = param_sets[ps.nal_unit_type << 8 | ps.id];
+        current.resize(ps.size);
+        if (!read_at(in, ps.offset, current.data(), current.size())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* copies the access unit of the CRA picture at start with its slices turned
+ * into BLA_W_LP ones, which only differ in nal_unit_type. Reads on until the
+ * first NALU of the next picture to find where it ends, and sets copied to
+ * the offset of what was read. */
+bool HEVCSplicer::copy_first_picture(FILE *in, uint64_t start, uint64_t end, uint64_t *copied) {
+    if (seek64(in, start)) {
+        return false;
+    }
+    buffer.clear();
+    uint64_t pos = start;
+    size_t i = 0;
+    bool seen_vcl = false;
+    for (;;) {
+        /* the three bytes of the NALU header and the first slice segment flag */
+        size_t nalu = find_nalu(buffer.data(), buffer.size(), i);
+        if (nalu + 3 > buffer.size()) {
+            if (pos == end) {
+                break;
+            }
+            size_t n = (size_t) std::min<uint64_t>(kChunk, end - pos);
+            size_t size = buffer.size();
+            buffer.resize(size + n);
+            if (fread(buffer.data() + size, 1, n, in) != n) {
+                return false;
+            }
+            pos += n;
+            continue;
+        }
+        int type = (buffer[nalu] >> 1) & 0x3f;
+        bool is_vcl = type < kVPS;
+        if (seen_vcl && (is_vcl ? (buffer[nalu + 2] & 0x80) != 0 : starts_access_unit(type))) {
+            break;
+        }
+        seen_vcl = seen_vcl || is_vcl;
+        if (type == kCRA) {
+            buffer[nalu] = (uint8_t) ((buffer[nalu] & 0x81) | (kBLA_W_LP << 1));
+            ++stats.cra_rewritten;
+        }
+        i = nalu;
+    }
+    if (fwrite(buffer.data(), 1, buffer.size(), out) != buffer.size()) {
+        return false;
+    }
+    stats.bytes_copied += buffer.size();
+    *copied = pos;
+    return true;
+}
+
+bool HEVCSplicer::copy(FILE *in, uint64_t start, uint64_t end) {
+    if (start < end && seek64(in, start)) {
+        return false;
+    }
+    buffer.resize(kChunk);
+    for (uint64_t pos = start; pos < end;) {
+        size_t n = (size_t) std::min<uint64_t>(kChunk, end - pos);
+        if (fread(buffer.data(), 1, n, in) != n || fwrite(buffer.data(), 1, n, out) != n) {
+            return false;
+        }
+        pos += n;
+        stats.bytes_copied += n;
+    }
+    return true;
+}
+
+bool HEVCSplicer::Append(FILE *in, const HEVCIndex &index, uint32_t first, uint32_t end) {
+    TRACE_EVENT(1, "HEVCSplicer::Append");
+    auto from = index.Find(first);
+    if (!from) {
+        return false;
+    }
+    uint64_t start = from->offset;
+    uint64_t stop = index.StreamSize();
+    if (end < index.NumPictures()) {
+        auto to = index.Find(end);
+        if (to->picture <= from->picture) {
+            return false;
+        }
+        stop = to->offset;
+    }
+
+    if (!write_param_sets(in, index, start)) {
+        return false;
+    }
+    /* a CRA picture starting the output is handled as a BLA one anyway */
+    uint64_t copied = start;
+    if (started && from->nal_unit_type == kCRA && !copy_first_picture(in, start, stop, &copied)) {
+        return false;
+    }
+    if (!copy(in, copied, stop) || !track_param_sets(in, index, start, stop)) {
+        return false;
+    }
+    started = true;
+    ++stats.segments;
+    return true;
+}
@@ -0,0 +1,76 @@
+#ifndef __HEVCSPLICER_H__
+#define __HEVCSPLICER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <map>
+#include <vector>
+
+#include "hevcindex.h"
+
+/* cuts raw Annex-B HEVC streams into segments at IRAP pictures and joins
+ * segments, of the same or different streams, into one stream, without
+ * decoding or parsing the pictures.
+ *
+ * Segments are found through an HEVCIndex of their stream and copied as raw
+ * byte ranges, from the start of the access unit of one random access point
+ * to that of the next. Only two things are added or changed at a joint:
+ *
+ * - the parameter sets in effect at the start of the segment are written in
+ *   front of it, unless the output already has the same ones, as the
+ *   segment may rely on ones sent long before its start
+ * - the slices of a CRA picture that does not start the output are turned
+ *   into BLA ones by rewriting their NALU header, so the decoder drops the
+ *   RASL pictures referring to pictures before the joint rather than decode
+ *   them from the wrong references
+ *
+ * Cutting in decode order at a CRA picture loses those RASL pictures, which
+ * go with the segment the CRA starts but are shown before it. */
+
+class HEVCSplicer {
+public:
+    struct Stats {
+        uint64_t segments;
+        uint64_t bytes_copied; // as raw ranges
+        uint64_t param_sets_written; // ahead of segments
+        uint64_t cra_rewritten; // CRA slices turned into BLA ones
+    };
+
+private:
+    FILE *out;
+    bool started = false; // written a picture
+
+    /* the last parameter set written of each type and id, by
+     * nal_unit_type << 8 | id */
+    std::map<int, std::vector<uint8_t>> param_sets;
+    std::vector<uint8_t> buffer;
+    Stats stats = {};
+
+    bool write_param_sets(FILE *in, const HEVCIndex &index, uint64_t offset);
+    bool track_param_sets(FILE *in, const HEVCIndex &index, uint64_t start, uint64_t end);
+    bool copy_first_picture(FILE *in, uint64_t start, uint64_t end, uint64_t *copied);
+    bool copy(FILE *in, uint64_t start, uint64_t end);
+
+public:
+    /* writes to out, from its current position */
+    HEVCSplicer(FILE *out) : out(out) {
+    }
+    HEVCSplicer(const HEVCSplicer &) = delete;
+    HEVCSplicer &operator=(const HEVCSplicer &) = delete;
+
+    /* appends the pictures of in from first up to end, in decode order and
+     * counting from 0, with index built for in. Both ends are moved back to
+     * the random access point at or before them, so consecutive cuts such as
+     * [0, 300) and [300, ~0u) add up to the whole stream, and an end past
+     * the last picture means the end of the stream. Returns false on I/O
+     * errors and if this leaves no pictures to append. */
+    bool Append(FILE *in, const HEVCIndex &index, uint32_t first, uint32_t end);
+
+    void GetStats(Stats *out) {
+        *out = stats;
+    }
+};
+
+#endif /* __HEVCSPLICER_H__ */
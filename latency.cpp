@@ -0,0 +1,37 @@
+#include "latency.h"
+
+LatencyStats pipeline_latency;
+
+const char *LatencyStats::StageName(LatencyStage stage) {
+    static const char *names[kStageCount] = {
+        "ingest",
+        "depacketize",
+        "probe",
+        "parse",
+        "filldxva",
+        "upload",
+        "decode",
+        "gpu-decode",
+        "convert",
+    };
+    return names[stage];
+}
+
+void LatencyStats::Dump(FILE *f) const {
+    fprintf(f, "%-12s %8s %10s %10s %10s %10s %10s\n",
+        "stage (us)", "count", "mean", "p50", "p99", "p999", "max");
+    for (int i = 0; i < kStageCount; ++i) {
+        auto &h = stages[i];
+        if (!h.Count()) {
+            continue;
+        }
+        fprintf(f, "%-12s %8llu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+            StageName((LatencyStage) i),
+            (unsigned long long) h.Count(),
+            h.Mean() / 1000.0,
+            h.Percentile(0.5) / 1000.0,
+            h.Percentile(0.99) / 1000.0,
+            h.Percentile(0.999) / 1000.0,
+            h.Max() / 1000.0);
+    }
+}
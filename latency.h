@@ -0,0 +1,158 @@
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <bit>
+
+#include "trace.h"
+
+/* log-linear latency histogram in the style of HdrHistogram. Each power of
+ * two is split into 2^sub_bucket_bits linear sub-buckets, so any recorded
+ * value is off by at most 1/32 (~3%) in the reported percentiles, while
+ * covering the full 64-bit range in under 2000 buckets. Record() is a few
+ * relaxed atomic adds so it can be called from any thread. */
+
+class LatencyHistogram {
+
+    static const int sub_bucket_bits = 5;
+    static const uint64_t sub_buckets = 1 << sub_bucket_bits;
+    static const size_t num_buckets = (64 - sub_bucket_bits + 1) * sub_buckets;
+
+    std::atomic<uint64_t> buckets[num_buckets] = {};
+    std::atomic<uint64_t> count = 0;
+    std::atomic<uint64_t> sum = 0;
+    std::atomic<uint64_t> max = 0;
+
+    static size_t Index(uint64_t v) {
+        if (v < sub_buckets) {
+            return (size_t) v;
+        }
+        int shift = std::bit_width(v) - 1 - sub_bucket_bits;
+        return (size_t) ((shift + 1) * sub_buckets + ((v >> shift) & (sub_buckets - 1)));
+    }
+
+    /* midpoint of the range of values that land in bucket i */
+    static uint64_t Value(size_t i) {
+        if (i < sub_buckets) {
+            return i;
+        }
+        int shift = (int) (i / sub_buckets) - 1;
+        uint64_t lo = (sub_buckets + i % sub_buckets) << shift;
+        return lo + ((uint64_t(1) << shift) >> 1);
+    }
+
+public:
+    void Record(uint64_t v) {
+        buckets[Index(v)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(v, std::memory_order_relaxed);
+        uint64_t m = max.load(std::memory_order_relaxed);
+        while (v > m && !max.compare_exchange_weak(m, v, std::memory_order_relaxed)) {
+        }
+    }
+
+    /* q in [0, 1], e.g. 0.99 for p99. Returns 0 if nothing was recorded. */
+    uint64_t Percentile(double q) const {
+        uint64_t n = count.load(std::memory_order_relaxed);
+        if (!n) {
+            return 0;
+        }
+        uint64_t rank = (uint64_t) (q * (n - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < num_buckets; ++i) {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                uint64_t v = Value(i);
+                uint64_t m = Max();
+                return v < m ? v : m;
+            }
+        }
+        return Max();
+    }
+
+    uint64_t Count() const {
+        return count.load(std::memory_order_relaxed);
+    }
+
+    uint64_t Mean() const {
+        uint64_t n = Count();
+        return n ? sum.load(std::memory_order_relaxed) / n : 0;
+    }
+
+    uint64_t Max() const {
+        return max.load(std::memory_order_relaxed);
+    }
+
+    void Reset() {
+        for (auto &b : buckets) {
+            b.store(0, std::memory_order_relaxed);
+        }
+        count = 0;
+        sum = 0;
+        max = 0;
+    }
+};
+
+/* stages of the ingest -> parse -> upload -> decode -> convert pipeline. All
+ * values are in nanoseconds. kStageGpuDecode is measured with GPU timestamps
+ * on the video decode queue, where the device supports them. kStageProbe is
+ * recorded once per stream, for identifying its codec. kStageDepacketize is
+ * from the arrival of the (first) RTP packet of a NALU until it is passed
+ * on, including any wait in the jitter buffer. */
+enum LatencyStage {
+    kStageIngest,
+    kStageDepacketize,
+    kStageProbe,
+    kStageParse,
+    kStageFillDXVA,
+    kStageUpload,
+    kStageDecode,
+    kStageGpuDecode,
+    kStageConvert,
+    kStageCount,
+};
+
+class LatencyStats {
+    LatencyHistogram stages[kStageCount];
+
+public:
+    static const char *StageName(LatencyStage stage);
+
+    void Record(LatencyStage stage, uint64_t ns) {
+        stages[stage].Record(ns);
+    }
+
+    const LatencyHistogram &Get(LatencyStage stage) const {
+        return stages[stage];
+    }
+
+    void Reset() {
+        for (auto &s : stages) {
+            s.Reset();
+        }
+    }
+
+    void Dump(FILE *f) const;
+};
+
+extern LatencyStats pipeline_latency;
+
+class ScopedLatency {
+    LatencyStage stage;
+    uint64_t start;
+
+public:
+    ScopedLatency(LatencyStage stage)
+        : stage(stage), start(TraceNow()) {
+    }
+
+    ~ScopedLatency() {
+        pipeline_latency.Record(stage, TraceNow() - start);
+    }
+};
+
+#endif /* __LATENCY_H__ */
@@ -0,0 +1,464 @@
+#include <err.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "fileio.h"
+#include "mp4demuxer.h"
+#include "trace.h"
+
+#define FOURCC(a, b, c, d) (((uint32_t) (a) << 24) | ((uint32_t) (b) << 16) | ((uint32_t) (c) << 8) | (uint32_t) (d))
+
+static inline uint16_t rb16(const uint8_t *p) {
+    return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t rb32(const uint8_t *p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static inline uint64_t rb64(const uint8_t *p) {
+    return ((uint64_t) rb32(p) << 32) | rb32(p + 4);
+}
+
+/* iterates over the boxes in [p, end), stopping at the first malformed one */
+struct BoxIterator {
+    const uint8_t *p;
+    const uint8_t *end;
+
+    BoxIterator(const uint8_t *bytes, size_t size)
+        : p(bytes), end(bytes + size) {
+    }
+
+    bool Next(uint32_t *type, const uint8_t **body, size_t *body_size) {
+        size_t left = end - p;
+        if (left < 8) {
+            return false;
+        }
+        uint64_t size = rb32(p);
+        size_t header = 8;
+        if (size == 1) {
+            if (left < 16) {
+                return false;
+            }
+            size = rb64(p + 8);
+            header = 16;
+        } else if (size == 0) {
+            size = left;
+        }
+        if (size < header || size > left) {
+            return false;
+        }
+        *type = rb32(p + 4);
+        *body = p + header;
+        *body_size = (size_t) size - header;
+        p += size;
+        return true;
+    }
+};
+
+/* full box tables start with version and flags, then anything in header,
+ * then a 32 bit entry count. Checks that count entries fit in the box. */
+static bool get_table(const uint8_t *body, size_t size, size_t header, size_t entry_size, uint32_t *count, const uint8_t **entries) {
+    header += 8;
+    if (size < header) {
+        return false;
+    }
+    *count = rb32(body + header - 4);
+    *entries = body + header;
+    return *count <= (size - header) / entry_size;
+}
+
+bool MP4Demuxer::Probe(const uint8_t *bytes, size_t size) {
+    if (size < 8) {
+        return false;
+    }
+    switch (rb32(bytes + 4)) {
+        case FOURCC('f', 't', 'y', 'p'):
+        case FOURCC('m', 'o', 'o', 'v'):
+        case FOURCC('m', 'd', 'a', 't'):
+        case FOURCC('w', 'i', 'd', 'e'):
+        case FOURCC('f', 'r', 'e', 'e'):
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool MP4Demuxer::parse_stsd(const uint8_t *bytes, size_t size) {
+    /* VisualSampleEntry, 14496-12 12.1.3: 8 bytes of SampleEntry and 70 of
+     * visual fields, width and height among them, then the child boxes */
+    const size_t visual_size = 78;
+
+    if (size < 8 || rb32(bytes + 4) < 1) {
+        return false;
+    }
+    BoxIterator entries(bytes + 8, size - 8);
+    uint32_t type;
+    const uint8_t *body;
+    size_t body_size;
+    if (!entries.Next(&type, &body, &body_size) || body_size < visual_size) {
+        return false;
+    }
+
+    uint32_t config_type;
+    switch (type) {
+        case FOURCC('h', 'v', 'c', '1'):
+        case FOURCC('h', 'e', 'v', '1'):
+            codec = kCodecHEVC;
+            config_type = FOURCC('h', 'v', 'c', 'C');
+            break;
+        case FOURCC('a', 'v', 'c', '1'):
+        case FOURCC('a', 'v', 'c', '3'):
+            codec = kCodecH264;
+            config_type = FOURCC('a', 'v', 'c', 'C');
+            break;
+        default:
+            warnx("%s: unsupported sample entry %.4s", __PRETTY_FUNCTION__, (const char *) (bytes + 12));
+            return false;
+    }
+    width = rb16(body + 24);
+    height = rb16(body + 26);
+
+    BoxIterator children(body + visual_size, body_size - visual_size);
+    const uint8_t *child;
+    size_t child_size;
+    while (children.Next(&type, &child, &child_size)) {
+        if (type == config_type) {
+            codec_config.assign(child, child + child_size);
+            return true;
+        }
+    }
+    warnx("%s: sample entry has no decoder configuration", __PRETTY_FUNCTION__);
+    return false;
+}
+
+bool MP4Demuxer::parse_stbl(const uint8_t *bytes, size_t size) {
+    const uint8_t *stsd = nullptr, *stsz = nullptr, *stsc = nullptr, *stco = nullptr;
+    const uint8_t *stts = nullptr, *ctts = nullptr, *stss = nullptr;
+    size_t stsd_size = 0, stsz_size = 0, stsc_size = 0, stco_size = 0;
+    size_t stts_size = 0, ctts_size = 0, stss_size = 0;
+    bool co64 = false;
+
+    BoxIterator boxes(bytes, size);
+    uint32_t type;
+    const uint8_t *body;
+    size_t body_size;
+    while (boxes.Next(&type, &body, &body_size)) {
+        switch (type) {
+            case FOURCC('s', 't', 's', 'd'):
+                stsd = body;
+                stsd_size = body_size;
+                break;
+            case FOURCC('s', 't', 's', 'z'):
+                stsz = body;
+                stsz_size = body_size;
+                break;
+            case FOURCC('s', 't', 's', 'c'):
+                stsc = body;
+                stsc_size = body_size;
+                break;
+            case FOURCC('c', 'o', '6', '4'):
+                co64 = true;
+                /* fall through */
+            case FOURCC('s', 't', 'c', 'o'):
+                stco = body;
+                stco_size = body_size;
+                break;
+            case FOURCC('s', 't', 't', 's'):
+                stts = body;
+                stts_size = body_size;
+                break;
+            case FOURCC('c', 't', 't', 's'):
+                ctts = body;
+                ctts_size = body_size;
+                break;
+            case FOURCC('s', 't', 's', 's'):
+                stss = body;
+                stss_size = body_size;
+                break;
+        }
+    }
+    if (!stsd || !stsz || !stsc || !stco) {
+        warnx("%s: incomplete sample table, fragmented files are not supported", __PRETTY_FUNCTION__);
+        return false;
+    }
+    if (!parse_stsd(stsd, stsd_size)) {
+        return false;
+    }
+
+    uint32_t num_samples, num_chunks, num_stsc;
+    const uint8_t *sizes, *chunk_offsets, *stsc_entries;
+    if (stsz_size < 12) {
+        return false;
+    }
+    uint32_t fixed_size = rb32(stsz + 4);
+    if (fixed_size) {
+        /* stsz has no entries then, only the count, and each sample takes
+         * fixed_size bytes of the file */
+        num_samples = rb32(stsz + 8);
+        sizes = nullptr;
+        if (num_samples > file_size / fixed_size) {
+            warnx("%s: %u samples of %u bytes do not fit in the file", __PRETTY_FUNCTION__, num_samples, fixed_size);
+            return false;
+        }
+    } else if (!get_table(stsz, stsz_size, 4, 4, &num_samples, &sizes)) {
+        warnx("%s: malformed sample table", __PRETTY_FUNCTION__);
+        return false;
+    }
+    if (!get_table(stsc, stsc_size, 0, 12, &num_stsc, &stsc_entries)
+        || !get_table(stco, stco_size, 0, co64 ? 8 : 4, &num_chunks, &chunk_offsets)) {
+        warnx("%s: malformed sample table", __PRETTY_FUNCTION__);
+        return false;
+    }
+
+    samples.resize(num_samples);
+    size_t s = 0;
+    for (uint32_t e = 0; e < num_stsc && s < num_samples; ++e) {
+        const uint8_t *entry = stsc_entries + 12 * e;
+        uint32_t first_chunk = rb32(entry);
+        uint32_t last_chunk = e + 1 < num_stsc ? rb32(entry + 12) : num_chunks + 1;
+        uint32_t per_chunk = rb32(entry + 4);
+        if (first_chunk < 1 || last_chunk > num_chunks + 1) {
+            break;
+        }
+        for (uint32_t c = first_chunk; c < last_chunk && s < num_samples; ++c) {
+            uint64_t offset = co64 ? rb64(chunk_offsets + 8 * (c - 1)) : rb32(chunk_offsets + 4 * (c - 1));
+            for (uint32_t i = 0; i < per_chunk && s < num_samples; ++i, ++s) {
+                samples[s].offset = offset;
+                samples[s].size = sizes ? rb32(sizes + 4 * s) : fixed_size;
+                offset += samples[s].size;
+            }
+        }
+    }
+    if (s < num_samples) {
+        warnx("%s: chunks hold only %zu of %u samples", __PRETTY_FUNCTION__, s, num_samples);
+        samples.resize(s);
+    }
+
+    uint32_t count;
+    const uint8_t *entries;
+    if (stts && get_table(stts, stts_size, 0, 8, &count, &entries)) {
+        uint64_t dts = 0;
+        s = 0;
+        for (uint32_t e = 0; e < count && s < samples.size(); ++e) {
+            uint32_t n = rb32(entries + 8 * e);
+            uint32_t delta = rb32(entries + 8 * e + 4);
+            for (uint32_t i = 0; i < n && s < samples.size(); ++i, ++s) {
+                samples[s].dts = dts;
+                dts += delta;
+            }
+        }
+    }
+    if (ctts && get_table(ctts, ctts_size, 0, 8, &count, &entries)) {
+        /* version 0 offsets are unsigned, but no sane file has them above
+         * INT32_MAX, so both versions read the same */
+        s = 0;
+        for (uint32_t e = 0; e < count && s < samples.size(); ++e) {
+            uint32_t n = rb32(entries + 8 * e);
+            int32_t offset = (int32_t) rb32(entries + 8 * e + 4);
+            for (uint32_t i = 0; i < n && s < samples.size(); ++i, ++s) {
+                samples[s].cts_offset = offset;
+            }
+        }
+    }
+    if (stss && get_table(stss, stss_size, 0, 4, &count, &entries)) {
+        sync_samples.reserve(count);
+        for (uint32_t e = 0; e < count; ++e) {
+            uint32_t n = rb32(entries + 4 * e);
+            if (n >= 1 && n <= samples.size() && (sync_samples.empty() || n - 1 > sync_samples.back())) {
+                sync_samples.push_back(n - 1);
+            }
+        }
+    } else {
+        all_sync = true;
+    }
+    return !samples.empty();
+}
+
+bool MP4Demuxer::parse_trak(const uint8_t *bytes, size_t size) {
+    BoxIterator boxes(bytes, size);
+    uint32_t type;
+    const uint8_t *body;
+    size_t body_size;
+    const uint8_t *mdia = nullptr;
+    size_t mdia_size = 0;
+    while (boxes.Next(&type, &body, &body_size)) {
+        if (type == FOURCC('m', 'd', 'i', 'a')) {
+            mdia = body;
+            mdia_size = body_size;
+        }
+    }
+    if (!mdia) {
+        return false;
+    }
+
+    const uint8_t *minf = nullptr;
+    size_t minf_size = 0;
+    bool video = false;
+    BoxIterator mdia_boxes(mdia, mdia_size);
+    while (mdia_boxes.Next(&type, &body, &body_size)) {
+        if (type == FOURCC('h', 'd', 'l', 'r') && body_size >= 12) {
+            video = rb32(body + 8) == FOURCC('v', 'i', 'd', 'e');
+        } else if (type == FOURCC('m', 'd', 'h', 'd') && body_size >= 24) {
+            timescale = body[0] == 1 ? rb32(body + 20) : rb32(body + 12);
+        } else if (type == FOURCC('m', 'i', 'n', 'f')) {
+            minf = body;
+            minf_size = body_size;
+        }
+    }
+    if (!video || !minf) {
+        return false;
+    }
+
+    BoxIterator minf_boxes(minf, minf_size);
+    while (minf_boxes.Next(&type, &body, &body_size)) {
+        if (type == FOURCC('s', 't', 'b', 'l')) {
+            return parse_stbl(body, body_size);
+        }
+    }
+    return false;
+}
+
+bool MP4Demuxer::parse_moov(const uint8_t *bytes, size_t size) {
+    BoxIterator boxes(bytes, size);
+    uint32_t type;
+    const uint8_t *body;
+    size_t body_size;
+    while (boxes.Next(&type, &body, &body_size)) {
+        if (type == FOURCC('t', 'r', 'a', 'k') && parse_trak(body, body_size)) {
+            return true;
+        }
+        /* a track that turned out not to be usable video may have left
+         * some state behind */
+        codec = kCodecUnknown;
+        codec_config.clear();
+        samples.clear();
+        sync_samples.clear();
+        all_sync = false;
+    }
+    warnx("%s: no supported video track", __PRETTY_FUNCTION__);
+    return false;
+}
+
+bool MP4Demuxer::Open(FILE *file) {
+    TRACE_EVENT(1, "MP4Demuxer::Open");
+    f = file;
+    file_size = file_size64(f);
+
+    /* moov may come before or after mdat, which we skip without reading */
+    uint64_t pos = 0;
+    for (;;) {
+        uint8_t header[16];
+        if (seek64(f, pos) || fread(header, 1, 8, f) != 8) {
+            break;
+        }
+        uint64_t size = rb32(header);
+        uint64_t header_size = 8;
+        if (size == 1) {
+            if (fread(header + 8, 1, 8, f) != 8) {
+                break;
+            }
+            size = rb64(header + 8);
+            header_size = 16;
+        }
+        uint32_t type = rb32(header + 4);
+
+        if (type == FOURCC('m', 'o', 'o', 'v')) {
+            if (size < header_size) {
+                /* size 0, moov runs to the end of the file */
+                std::vector<uint8_t> moov;
+                uint8_t tmp[0x10000];
+                size_t n;
+                while ((n = fread(tmp, 1, sizeof(tmp), f)) > 0) {
+                    moov.insert(moov.end(), tmp, tmp + n);
+                }
+                return parse_moov(moov.data(), moov.size());
+            }
+            /* don't trust a corrupt size with the allocation */
+            if (size > file_size - pos) {
+                warnx("%s: moov of %llu bytes runs past the end of the file", __PRETTY_FUNCTION__,
+                    (unsigned long long) size);
+                return false;
+            }
+            std::vector<uint8_t> moov((size_t) (size - header_size));
+            if (fread(moov.data(), 1, moov.size(), f) != moov.size()) {
+                warnx("%s: truncated moov", __PRETTY_FUNCTION__);
+                return false;
+            }
+            return parse_moov(moov.data(), moov.size());
+        }
+        if (size < header_size) {
+            break;
+        }
+        pos += size;
+    }
+    warnx("%s: no moov box found", __PRETTY_FUNCTION__);
+    return false;
+}
+
+bool MP4Demuxer::IsSyncSample(size_t i) const {
+    return all_sync || std::binary_search(sync_samples.begin(), sync_samples.end(), (uint32_t) i);
+}
+
+size_t MP4Demuxer::FindSyncSample(size_t i) const {
+    if (all_sync) {
+        return i;
+    }
+    auto it = std::upper_bound(sync_samples.begin(), sync_samples.end(), (uint32_t) i);
+    if (it == sync_samples.begin()) {
+        return 0;
+    }
+    return *(it - 1);
+}
+
+size_t MP4Demuxer::FindSample(uint64_t dts) const {
+    auto it = std::upper_bound(samples.begin(), samples.end(), dts,
+        [](uint64_t dts, const Sample &s) { return dts < s.dts; });
+    if (it == samples.begin()) {
+        return 0;
+    }
+    return (it - samples.begin()) - 1;
+}
+
+size_t MP4Demuxer::ReadSamples(size_t first, uint8_t *buffer, size_t buffer_size, SampleView *views, size_t max_views) {
+    if (first >= samples.size() || !max_views) {
+        return 0;
+    }
+    if (samples[first].size > buffer_size) {
+        warnx("%s: sample %zu of %u bytes does not fit in the buffer", __PRETTY_FUNCTION__, first, samples[first].size);
+        return 0;
+    }
+
+    /* extend the read for as long as the next sample follows closely and
+     * still fits */
+    uint64_t start = samples[first].offset;
+    uint64_t end = start + samples[first].size;
+    size_t n = 1;
+    while (first + n < samples.size() && n < max_views) {
+        auto &next = samples[first + n];
+        if (next.offset < end || next.offset - end > kMaxReadGap || next.offset + next.size - start > buffer_size) {
+            break;
+        }
+        end = next.offset + next.size;
+        ++n;
+    }
+
+    TRACE_EVENT(2, "ReadSamples", end - start);
+    if (seek64(f, start) || fread(buffer, 1, (size_t) (end - start), f) != end - start) {
+        warnx("%s: short read at offset %llu", __PRETTY_FUNCTION__, (unsigned long long) start);
+        return 0;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        auto &s = samples[first + i];
+        views[i].data = buffer + (s.offset - start);
+        views[i].size = s.size;
+        views[i].index = first + i;
+        stats.sample_bytes += s.size;
+    }
+    ++stats.reads;
+    stats.bytes_read += end - start;
+    stats.samples += n;
+    return n;
+}
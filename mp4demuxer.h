@@ -0,0 +1,131 @@
+#ifndef __MP4DEMUXER_H__
+#define __MP4DEMUXER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include "decodebackend.h"
+
+/* reads the video track of an ISO-BMFF (MP4/MOV) file. Open() walks the top
+ * level boxes, seeking past mdat, and parses moov into a flat per-sample
+ * table from stsz, stsc, stco/co64, stts, ctts and stss, along with the hvcC
+ * or avcC box that configures the parser. Samples are then read straight
+ * from their file offsets, with no further box parsing.
+ *
+ * ReadSamples() reads runs of samples with a single read where they follow
+ * each other in the file, reading through short gaps such as interleaved
+ * audio, and hands out views into the caller's buffer, each one a
+ * length-prefixed access unit ready for HEVCParser or AVCParser.
+ *
+ * Fragmented files (moof) and sample entries other than hvc1, hev1, avc1
+ * and avc3 are not supported. */
+
+class MP4Demuxer {
+public:
+    struct Sample {
+        uint64_t offset;
+        uint32_t size;
+        int32_t cts_offset; // composition minus decode time
+        uint64_t dts; // in timescale units
+    };
+
+    struct SampleView {
+        const uint8_t *data;
+        size_t size;
+        size_t index;
+    };
+
+    struct Stats {
+        uint64_t reads; // fread() calls for sample data
+        uint64_t bytes_read; // including gaps read through
+        uint64_t sample_bytes;
+        uint64_t samples;
+    };
+
+private:
+    FILE *f = nullptr;
+    uint64_t file_size = 0; // box sizes are checked against it
+    VideoCodec codec = kCodecUnknown;
+    std::vector<uint8_t> codec_config;
+    uint32_t timescale = 0;
+    int width = 0, height = 0;
+
+    std::vector<Sample> samples;
+    std::vector<uint32_t> sync_samples; // sample indices, ascending
+    bool all_sync = false; // no stss, every sample is a sync sample
+
+    Stats stats = {};
+
+    /* gaps up to this size between samples are read through rather than
+     * starting a new read */
+    static const size_t kMaxReadGap = 0x10000;
+
+    bool parse_moov(const uint8_t *bytes, size_t size);
+    bool parse_trak(const uint8_t *bytes, size_t size);
+    bool parse_stbl(const uint8_t *bytes, size_t size);
+    bool parse_stsd(const uint8_t *bytes, size_t size);
+
+public:
+    MP4Demuxer() {
+    }
+    MP4Demuxer(const MP4Demuxer &) = delete;
+    MP4Demuxer &operator=(const MP4Demuxer &) = delete;
+
+    /* true if bytes, the start of a file, look like ISO-BMFF */
+    static bool Probe(const uint8_t *bytes, size_t size);
+
+    /* f must stay open for as long as samples are read. Returns false,
+     * after a warning, if the file has no usable video track. */
+    bool Open(FILE *f);
+
+    VideoCodec Codec() const {
+        return codec;
+    }
+
+    /* the hvcC or avcC payload, see Win32DecodingLayer::SetCodecConfig() */
+    const uint8_t *CodecConfig(size_t *size) const {
+        *size = codec_config.size();
+        return codec_config.data();
+    }
+
+    uint32_t Timescale() const {
+        return timescale;
+    }
+
+    void GetDimensions(int *pw, int *ph) const {
+        *pw = width;
+        *ph = height;
+    }
+
+    size_t NumSamples() const {
+        return samples.size();
+    }
+
+    const Sample &GetSample(size_t i) const {
+        return samples[i];
+    }
+
+    bool IsSyncSample(size_t i) const;
+
+    /* the sync sample at or before sample i, to start decoding from when
+     * seeking to i */
+    size_t FindSyncSample(size_t i) const;
+
+    /* the sample with the latest decode time at or before dts */
+    size_t FindSample(uint64_t dts) const;
+
+    /* reads samples from first on into buffer, as many as fit and can be
+     * read in one go, and returns how many were read, or 0 at the end of
+     * the track or on error. A sample larger than buffer_size cannot be
+     * read at all. */
+    size_t ReadSamples(size_t first, uint8_t *buffer, size_t buffer_size, SampleView *views, size_t max_views);
+
+    void GetStats(Stats *out) const {
+        *out = stats;
+    }
+};
+
+#endif /* __MP4DEMUXER_H__ */
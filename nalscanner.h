@@ -0,0 +1,192 @@
+#ifndef __NALSCANNER_H__
+#define __NALSCANNER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* splits an Annex-B byte stream into NALUs, for both H.264 and HEVC. Bytes
+ * are gathered into a buffer supplied by the owner, so scanning never
+ * allocates, and each NALU is handed to the callback without its start code
+ * once the next start code is seen. Scanning state is kept across calls, so
+ * the stream may be cut into Scan() calls anywhere, e.g. at TS packet
+ * payloads, and Flush() passes on the last NALU at the end of the stream.
+ *
+ * A NALU larger than the buffer cannot be passed on, and is reported with a
+ * null bytes pointer and its full size instead.
+ *
+ * With SetLengthSize(), input is MP4-style instead, each NALU preceded by
+ * its size in 1, 2 or 4 big-endian bytes, as configured by an hvcC or avcC
+ * box. There is nothing to scan for then, and NALUs are passed on in place,
+ * pointing into the caller's bytes. Each Scan() must be given whole NALUs,
+ * typically one sample, and a length running past the end of the bytes is
+ * reported like an oversized NALU.
+ *
+ * With SetSkipFilter(), NALUs the filter rejects by their first header byte
+ * are skipped as they are found: their bytes are not gathered, memchr()
+ * jumps to the next 0x01 that could end a start code, and the callback never
+ * sees them. */
+
+class NALScanner {
+
+public:
+    typedef void (*nalu_callback_t)(const uint8_t *bytes, size_t size, void *opaque);
+    /* true to skip the NALU starting with header byte */
+    typedef bool (*skip_callback_t)(uint8_t header, void *opaque);
+
+    struct SkipStats {
+        size_t nalus;
+        uint64_t bytes;
+    };
+
+private:
+    uint8_t *buffer;
+    size_t max_buffer;
+    size_t buffer_size = 0;
+    size_t nalu_start_len = 0;
+    size_t nalu_zeros = 0;
+    size_t nalu_overflow = 0; // bytes of the current NALU that did not fit in buffer
+    int length_size = 0; // 0 for Annex-B
+
+    skip_callback_t skip = nullptr;
+    void *skip_opaque = nullptr;
+    bool skipping = false; // the current NALU, up to the next start code
+    SkipStats skip_stats = {};
+
+    /* while skipping, the index of the 0x01 ending the next start code, or
+     * size if there is none in bytes */
+    size_t find_start_code(const uint8_t *bytes, size_t size, size_t i) {
+        while (i < size) {
+            auto one = (const uint8_t *) memchr(bytes + i, 1, size - i);
+            size_t j = one ? one - bytes : size;
+            size_t zeros = 0;
+            while (zeros < j - i && bytes[j - 1 - zeros] == 0) {
+                ++zeros;
+            }
+            nalu_zeros = zeros == j - i ? nalu_zeros + zeros : zeros;
+            skip_stats.bytes += j - i;
+            if (j == size || nalu_zeros >= 2) {
+                return j;
+            }
+            nalu_zeros = 0;
+            ++skip_stats.bytes;
+            i = j + 1;
+        }
+        return size;
+    }
+
+public:
+    NALScanner(uint8_t *buffer, size_t max_buffer)
+        : buffer(buffer), max_buffer(max_buffer) {
+    }
+
+    /* 1, 2 or 4 for length-prefixed input, 0 for Annex-B */
+    void SetLengthSize(int n) {
+        length_size = n;
+    }
+
+    int LengthSize() const {
+        return length_size;
+    }
+
+    /* pass nullptr to stop skipping */
+    void SetSkipFilter(skip_callback_t cb, void *opaque) {
+        skip = cb;
+        skip_opaque = opaque;
+    }
+
+    void GetSkipStats(SkipStats *stats) const {
+        *stats = skip_stats;
+    }
+
+    void Scan(const uint8_t *bytes, size_t size, nalu_callback_t cb, void *opaque) {
+        if (length_size) {
+            ScanLengthPrefixed(bytes, size, cb, opaque);
+            return;
+        }
+        for (size_t i = 0; i < size; ++i) {
+            if (skipping) {
+                i = find_start_code(bytes, size, i);
+                if (i == size) {
+                    break;
+                }
+                /* bytes[i] ends a start code, the NALU after it is next */
+                skipping = false;
+                nalu_start_len = nalu_zeros + 1;
+                nalu_zeros = 0;
+                continue;
+            }
+            int c = bytes[i];
+            if (nalu_start_len) {
+                if (nalu_overflow) {
+                    cb(nullptr, buffer_size + nalu_overflow, opaque);
+                    nalu_overflow = 0;
+                } else if (buffer_size > nalu_start_len) {
+                    cb(buffer, buffer_size - nalu_start_len, opaque);
+                }
+                buffer_size = 0;
+                if (skip && skip(c, skip_opaque)) {
+                    skipping = true;
+                    ++skip_stats.nalus;
+                    ++skip_stats.bytes;
+                    nalu_start_len = 0;
+                    nalu_zeros = c ? 0 : 1;
+                    continue;
+                }
+            }
+            if (buffer_size < max_buffer) {
+                buffer[buffer_size++] = c;
+            } else {
+                ++nalu_overflow;
+            }
+            nalu_start_len = (nalu_zeros >= 2 && c == 1) ? nalu_zeros + 1 : 0;
+            nalu_zeros = c ? 0 : nalu_zeros + 1;
+        }
+    }
+
+    /* the last NALU of a stream has no start code after it to end it, so
+     * has to be passed on explicitly. Scanning starts afresh after this. */
+    void Flush(nalu_callback_t cb, void *opaque) {
+        if (!length_size && !nalu_start_len && !skipping) {
+            if (nalu_overflow) {
+                cb(nullptr, buffer_size + nalu_overflow, opaque);
+            } else if (buffer_size > nalu_zeros) {
+                /* without trailing_zero_8bits */
+                cb(buffer, buffer_size - nalu_zeros, opaque);
+            }
+        }
+        buffer_size = 0;
+        nalu_start_len = 0;
+        nalu_zeros = 0;
+        nalu_overflow = 0;
+        skipping = false;
+    }
+
+private:
+    void ScanLengthPrefixed(const uint8_t *bytes, size_t size, nalu_callback_t cb, void *opaque) {
+        size_t i = 0;
+        while (i < size) {
+            if (size - i < (size_t) length_size) {
+                cb(nullptr, size - i, opaque);
+                return;
+            }
+            size_t n = 0;
+            for (int j = 0; j < length_size; ++j) {
+                n = (n << 8) | bytes[i++];
+            }
+            if (n > size - i) {
+                cb(nullptr, size - i, opaque);
+                return;
+            }
+            if (n && skip && skip(bytes[i], skip_opaque)) {
+                ++skip_stats.nalus;
+                skip_stats.bytes += n;
+            } else if (n) {
+                cb(bytes + i, n, opaque);
+            }
+            i += n;
+        }
+    }
+};
+
+#endif /* __NALSCANNER_H__ */
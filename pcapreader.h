@@ -0,0 +1,226 @@
+#ifndef __PCAPREADER_H__
+#define __PCAPREADER_H__
+
+#include <err.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+/* reads the UDP datagrams out of a libpcap capture, such as one taken with
+ * tcpdump of an RTP stream, for replaying into RTPDepacketizer. Ethernet
+ * (with VLAN tags), Linux cooked, raw IP and BSD loopback captures of IPv4
+ * and IPv6 are understood. Fragmented IP packets, IPv6 extension headers
+ * and the newer pcapng format are not, and are skipped or rejected. */
+
+class PcapReader {
+public:
+    struct Datagram {
+        const uint8_t *data; // the UDP payload, valid until the next Next()
+        size_t size;
+        uint16_t src_port;
+        uint16_t dst_port;
+        uint64_t ts_ns; // capture time
+    };
+
+private:
+    FILE *f = nullptr;
+    bool swapped = false; // written on a host of the other byte order
+    bool nanoseconds = false;
+    uint32_t link_type = 0;
+    std::vector<uint8_t> record;
+
+    static const uint32_t kMagic = 0xa1b2c3d4;
+    static const uint32_t kMagicNs = 0xa1b23c4d;
+    static const size_t kMaxRecord = 0x40000;
+
+    enum {
+        kLinkNull = 0,
+        kLinkEthernet = 1,
+        kLinkRaw = 101,
+        kLinkLinuxSLL = 113,
+        kLinkLinuxSLL2 = 276,
+    };
+
+    static uint32_t rl32(const uint8_t *p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+    }
+
+    static uint16_t rb16(const uint8_t *p) {
+        return (uint16_t) ((p[0] << 8) | p[1]);
+    }
+
+    static uint32_t rb32(const uint8_t *p) {
+        return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+
+    uint32_t r32(const uint8_t *p) const {
+        return swapped ? rb32(p) : rl32(p);
+    }
+
+    /* the IP packet in a link layer frame, and its ethertype or 0 to go by
+     * the IP version */
+    bool link_payload(const uint8_t *p, size_t size, size_t *offset, int *ethertype) const {
+        size_t o = 0;
+        int type = 0;
+        switch (link_type) {
+            case kLinkNull:
+                o = 4;
+                break;
+            case kLinkEthernet:
+                o = 14;
+                if (size < o) {
+                    return false;
+                }
+                type = rb16(p + 12);
+                while ((type == 0x8100 || type == 0x88a8) && size >= o + 4) {
+                    type = rb16(p + o + 2);
+                    o += 4;
+                }
+                break;
+            case kLinkRaw:
+                break;
+            case kLinkLinuxSLL:
+                o = 16;
+                if (size < o) {
+                    return false;
+                }
+                type = rb16(p + 14);
+                break;
+            case kLinkLinuxSLL2:
+                o = 20;
+                if (size < o) {
+                    return false;
+                }
+                type = rb16(p);
+                break;
+            default:
+                return false;
+        }
+        *offset = o;
+        *ethertype = type;
+        return o <= size;
+    }
+
+    /* the UDP header and payload in an IP packet */
+    static bool ip_payload(const uint8_t *p, size_t size, int ethertype, size_t *offset, size_t *end) {
+        if (size < 1) {
+            return false;
+        }
+        int version = p[0] >> 4;
+        if ((ethertype == 0x0800 || !ethertype) && version == 4) {
+            size_t header = 4 * (p[0] & 0xf);
+            if (size < 20 || header < 20 || header > size || p[9] != 17) {
+                return false;
+            }
+            /* more fragments, or not the first one */
+            if ((p[6] & 0x20) || (rb16(p + 6) & 0x1fff)) {
+                return false;
+            }
+            size_t total = rb16(p + 2);
+            if (total < header || total > size) {
+                return false;
+            }
+            *offset = header;
+            *end = total;
+            return true;
+        }
+        if ((ethertype == 0x86dd || !ethertype) && version == 6) {
+            if (size < 40 || p[6] != 17) {
+                return false;
+            }
+            size_t total = 40 + rb16(p + 4);
+            if (total > size) {
+                return false;
+            }
+            *offset = 40;
+            *end = total;
+            return true;
+        }
+        return false;
+    }
+
+public:
+    /* true if bytes, the start of a file, look like a pcap capture */
+    static bool Probe(const uint8_t *bytes, size_t size) {
+        if (size < 24) {
+            return false;
+        }
+        uint32_t magic = rl32(bytes);
+        uint32_t swapped_magic = rb32(bytes);
+        return magic == kMagic || magic == kMagicNs || swapped_magic == kMagic || swapped_magic == kMagicNs;
+    }
+
+    /* reads the file header from the start of file */
+    bool Open(FILE *file) {
+        f = file;
+        uint8_t header[24];
+        if (fseek(f, 0, SEEK_SET) || fread(header, 1, sizeof(header), f) != sizeof(header)) {
+            return false;
+        }
+        uint32_t magic = rl32(header);
+        swapped = magic != kMagic && magic != kMagicNs;
+        magic = r32(header);
+        if (magic != kMagic && magic != kMagicNs) {
+            return false;
+        }
+        nanoseconds = magic == kMagicNs;
+        link_type = r32(header + 20) & 0xffff;
+        switch (link_type) {
+            case kLinkNull:
+            case kLinkEthernet:
+            case kLinkRaw:
+            case kLinkLinuxSLL:
+            case kLinkLinuxSLL2:
+                return true;
+            default:
+                warnx("%s: unsupported link type %u", __PRETTY_FUNCTION__, link_type);
+                return false;
+        }
+    }
+
+    /* the next UDP datagram in the capture, false at the end of it */
+    bool Next(Datagram *d) {
+        for (;;) {
+            uint8_t header[16];
+            if (fread(header, 1, sizeof(header), f) != sizeof(header)) {
+                return false;
+            }
+            size_t size = r32(header + 8);
+            if (size > kMaxRecord) {
+                warnx("%s: bad record size %zu", __PRETTY_FUNCTION__, size);
+                return false;
+            }
+            record.resize(size);
+            if (fread(record.data(), 1, size, f) != size) {
+                return false;
+            }
+
+            const uint8_t *p = record.data();
+            size_t link_offset, ip_offset, ip_end;
+            int ethertype;
+            if (!link_payload(p, size, &link_offset, &ethertype)) {
+                continue;
+            }
+            p += link_offset;
+            size -= link_offset;
+            if (!ip_payload(p, size, ethertype, &ip_offset, &ip_end) || ip_end - ip_offset < 8) {
+                continue;
+            }
+            const uint8_t *udp = p + ip_offset;
+            size_t udp_size = rb16(udp + 4);
+            if (udp_size < 8 || udp_size > ip_end - ip_offset) {
+                continue;
+            }
+            d->data = udp + 8;
+            d->size = udp_size - 8;
+            d->src_port = rb16(udp);
+            d->dst_port = rb16(udp + 2);
+            d->ts_ns = (uint64_t) r32(header) * 1000000000 + (uint64_t) r32(header + 4) * (nanoseconds ? 1 : 1000);
+            return true;
+        }
+    }
+};
+
+#endif /* __PCAPREADER_H__ */
@@ -0,0 +1,508 @@
+#include <err.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "picturehash.h"
+#include "trace.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PICTUREHASH_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define PICTUREHASH_NEON
+#include <arm_neon.h>
+#endif
+
+size_t PictureHashSize(int hash_type) {
+    switch (hash_type) {
+        case kHashMD5:
+            return 16;
+        case kHashCRC:
+            return 2;
+        case kHashChecksum:
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+/* RFC 1321 */
+struct MD5 {
+    uint32_t h[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+    uint8_t block[64];
+    size_t used = 0;
+    uint64_t length = 0;
+
+    static uint32_t rotl(uint32_t x, int n) {
+        return (x << n) | (x >> (32 - n));
+    }
+
+    void transform(const uint8_t *p) {
+        static const uint32_t k[64] = {
+            0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+            0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+            0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+            0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+            0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+            0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+            0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+            0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+        };
+        static const int r[16] = { 7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21 };
+        uint32_t m[16];
+        for (int i = 0; i < 16; ++i) {
+            m[i] = p[4 * i] | (p[4 * i + 1] << 8) | (p[4 * i + 2] << 16) | ((uint32_t) p[4 * i + 3] << 24);
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t f;
+            int g;
+            switch (i >> 4) {
+                case 0:
+                    f = (b & c) | (~b & d);
+                    g = i;
+                    break;
+                case 1:
+                    f = (d & b) | (~d & c);
+                    g = (5 * i + 1) & 15;
+                    break;
+                case 2:
+                    f = b ^ c ^ d;
+                    g = (3 * i + 5) & 15;
+                    break;
+                default:
+                    f = c ^ (b | ~d);
+                    g = (7 * i) & 15;
+                    break;
+            }
+            uint32_t t = d;
+            d = c;
+            c = b;
+            b += rotl(a + f + k[i] + m[g], r[(i >> 4) * 4 + (i & 3)]);
+            a = t;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+    }
+
+    void update(const uint8_t *p, size_t n) {
+        length += n;
+        if (used) {
+            size_t take = std::min(n, sizeof(block) - used);
+            memcpy(block + used, p, take);
+            used += take;
+            p += take;
+            n -= take;
+            if (used < sizeof(block)) {
+                return;
+            }
+            transform(block);
+            used = 0;
+        }
+        for (; n >= sizeof(block); n -= sizeof(block), p += sizeof(block)) {
+            transform(p);
+        }
+        memcpy(block, p, n);
+        used = n;
+    }
+
+    void final(uint8_t *out) {
+        uint64_t bits = length * 8;
+        uint8_t pad[72] = { 0x80 };
+        size_t n = (used < 56 ? 56 : 120) - used;
+        for (int i = 0; i < 8; ++i) {
+            pad[n + i] = (uint8_t) (bits >> (8 * i));
+        }
+        update(pad, n + 8);
+        for (int i = 0; i < 16; ++i) {
+            out[i] = (uint8_t) (h[i / 4] >> (8 * (i % 4)));
+        }
+    }
+};
+
+/* D.3.19 feeds the samples bit by bit into a CRC-16 with polynomial 0x1021
+ * and initial value 0xffff, followed by 16 zero bits. That is the plain
+ * table driven CRC started from 0xffff shifted through those 16 bits. */
+struct CRC16 {
+    uint16_t table[256];
+    uint16_t init;
+
+    CRC16() {
+        for (int i = 0; i < 256; ++i) {
+            uint16_t c = (uint16_t) (i << 8);
+            for (int bit = 0; bit < 8; ++bit) {
+                c = (uint16_t) ((c << 1) ^ ((c & 0x8000) ? 0x1021 : 0));
+            }
+            table[i] = c;
+        }
+        uint16_t c = 0xffff;
+        for (int bit = 0; bit < 16; ++bit) {
+            c = (uint16_t) ((c << 1) ^ ((c & 0x8000) ? 0x1021 : 0));
+        }
+        init = c;
+    }
+};
+
+static const CRC16 crc16;
+
+static uint32_t checksum_row(const uint8_t *row, int width, int y) {
+    uint32_t y_mask = (y & 0xff) ^ (y >> 8);
+    uint64_t sum = 0;
+    int x = 0;
+    /* within 16 samples starting at a multiple of 16, x >> 8 and the top
+     * nibble of x & 0xff are fixed, so the mask is a constant xor 0..15 */
+#if defined(PICTUREHASH_SSE2)
+    const __m128i ramp = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i acc = _mm_setzero_si128();
+    for (; x + 16 <= width; x += 16) {
+        __m128i mask = _mm_xor_si128(_mm_set1_epi8((char) ((x & 0xf0) ^ (x >> 8) ^ y_mask)), ramp);
+        __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (row + x)), mask);
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(v, _mm_setzero_si128()));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *) lanes, acc);
+    sum = lanes[0] + lanes[1];
+#elif defined(PICTUREHASH_NEON)
+    static const uint8_t ramp_bytes[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+    const uint8x16_t ramp = vld1q_u8(ramp_bytes);
+    uint32x4_t acc = vdupq_n_u32(0);
+    for (; x + 16 <= width; x += 16) {
+        uint8x16_t mask = veorq_u8(vdupq_n_u8((uint8_t) ((x & 0xf0) ^ (x >> 8) ^ y_mask)), ramp);
+        uint8x16_t v = veorq_u8(vld1q_u8(row + x), mask);
+        acc = vpadalq_u16(acc, vpaddlq_u8(v));
+    }
+    sum = vaddlvq_u32(acc);
+#endif
+    for (; x < width; ++x) {
+        sum += row[x] ^ (((x & 0xff) ^ (x >> 8) ^ y_mask) & 0xff);
+    }
+    return (uint32_t) sum;
+}
+
+void HashPlane(int hash_type, const uint8_t *plane, size_t stride, int width, int height, uint8_t *out) {
+    if (hash_type == kHashMD5) {
+        MD5 md5;
+        for (int y = 0; y < height; ++y) {
+            md5.update(plane + y * stride, width);
+        }
+        md5.final(out);
+    } else if (hash_type == kHashCRC) {
+        uint16_t crc = crc16.init;
+        for (int y = 0; y < height; ++y) {
+            const uint8_t *row = plane + y * stride;
+            for (int x = 0; x < width; ++x) {
+                crc = (uint16_t) ((crc << 8) ^ crc16.table[(crc >> 8) ^ row[x]]);
+            }
+        }
+        out[0] = (uint8_t) (crc >> 8);
+        out[1] = (uint8_t) crc;
+    } else if (hash_type == kHashChecksum) {
+        uint32_t sum = 0;
+        for (int y = 0; y < height; ++y) {
+            sum += checksum_row(plane + y * stride, width, y);
+        }
+        out[0] = (uint8_t) (sum >> 24);
+        out[1] = (uint8_t) (sum >> 16);
+        out[2] = (uint8_t) (sum >> 8);
+        out[3] = (uint8_t) sum;
+    }
+}
+
+PictureVerifier::PictureVerifier(result_callback_t cb, void *opaque, int threads)
+    : pool(threads), cb(cb), opaque(opaque) {
+    thread = std::thread(&PictureVerifier::Main, this);
+}
+
+PictureVerifier::~PictureVerifier() {
+    cond.Lock();
+    quit = true;
+    cond.Broadcast();
+    cond.Unlock();
+    thread.join();
+    for (auto e : entries) {
+        delete e;
+    }
+    for (auto e : ready) {
+        delete e;
+    }
+    for (auto e : free_entries) {
+        delete e;
+    }
+}
+
+/* called with cond locked */
+PictureVerifier::Entry *PictureVerifier::find(int stream, uint64_t picture) {
+    for (auto e : entries) {
+        if (e->stream == stream && e->picture == picture) {
+            return e;
+        }
+    }
+    return nullptr;
+}
+
+/* called with cond locked, the number of pictures copied, or being copied,
+ * and not yet hashed */
+size_t PictureVerifier::held() {
+    size_t n = ready.size() + batch.size();
+    for (auto e : entries) {
+        n += e->filling || e->have_pixels;
+    }
+    return n;
+}
+
+/* called with cond locked, returns nullptr if too many hashes wait for
+ * their pictures */
+PictureVerifier::Entry *PictureVerifier::add(int stream, uint64_t picture) {
+    if (entries.size() >= max_entries) {
+        ++stats.dropped;
+        return nullptr;
+    }
+    Entry *e;
+    if (free_entries.empty()) {
+        e = new Entry();
+    } else {
+        e = free_entries.back();
+        free_entries.pop_back();
+    }
+    e->stream = stream;
+    e->picture = picture;
+    e->have_hash = false;
+    e->filling = false;
+    e->have_pixels = false;
+    entries.push_back(e);
+    return e;
+}
+
+/* called with cond locked */
+void PictureVerifier::make_ready(Entry *e) {
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (entries[i] == e) {
+            entries.erase(entries.begin() + i);
+            break;
+        }
+    }
+    const PictureHash &h = e->hash;
+    bool supported = h.bit_depth_luma == 8 && (h.chroma_format_idc == 0 || (h.chroma_format_idc == 1 && h.bit_depth_chroma == 8))
+        && PictureHashSize(h.hash_type) && h.width <= e->width && h.height <= e->height;
+    if (!supported) {
+        ++stats.unsupported;
+        free_entries.push_back(e);
+        return;
+    }
+    ready.push_back(e);
+    cond.Broadcast();
+}
+
+/* called with cond locked. Hashes and pictures each come in decode order, so
+ * a hash for picture means the pictures of stream before it still waiting
+ * for one will not get it, and likewise for the pixels of picture. */
+void PictureVerifier::expire(int stream, uint64_t picture, bool pixels) {
+    for (size_t i = 0; i < entries.size();) {
+        auto e = entries[i];
+        bool missing = pixels ? e->have_hash && !e->have_pixels && !e->filling : e->have_pixels && !e->have_hash;
+        if (e->stream == stream && e->picture < picture && missing) {
+            ++(pixels ? stats.dropped : stats.unhashed);
+            entries.erase(entries.begin() + i);
+            free_entries.push_back(e);
+        } else {
+            ++i;
+        }
+    }
+}
+
+void PictureVerifier::SetExpected(int stream, uint64_t picture, const PictureHash &hash) {
+    cond.Lock();
+    last_hashed[stream] = picture;
+    expire(stream, picture, false);
+    auto e = find(stream, picture);
+    if (!e) {
+        e = add(stream, picture);
+    }
+    if (e) {
+        e->hash = hash;
+        e->have_hash = true;
+        if (e->have_pixels) {
+            make_ready(e);
+        }
+    }
+    cond.Unlock();
+}
+
+void PictureVerifier::Submit(int stream, uint64_t picture, const MappedPicture &mapped) {
+    cond.Lock();
+    expire(stream, picture, true);
+    auto e = find(stream, picture);
+    if (!e) {
+        /* not worth copying unless the stream carries hashes and the one
+         * for this picture may still come */
+        auto last = last_hashed.find(stream);
+        if (last == last_hashed.end() || last->second >= picture) {
+            ++stats.unhashed;
+            cond.Unlock();
+            return;
+        }
+    }
+    if (held() >= max_pictures) {
+        ++stats.dropped;
+        if (e) {
+            entries.erase(std::find(entries.begin(), entries.end(), e));
+            free_entries.push_back(e);
+        }
+        cond.Unlock();
+        return;
+    }
+    if (!e) {
+        e = add(stream, picture);
+        if (!e) {
+            cond.Unlock();
+            return;
+        }
+    }
+    e->filling = true;
+    cond.Unlock();
+
+    /* Y as is, and the interleaved chroma of NV12 split into U and V */
+    int w = mapped.width, h = mapped.height;
+    int cw = w / 2, ch = h / 2;
+    e->planes.resize((size_t) w * h + 2 * (size_t) cw * ch);
+    uint8_t *y = e->planes.data();
+    uint8_t *u = y + (size_t) w * h;
+    uint8_t *v = u + (size_t) cw * ch;
+    for (int row = 0; row < h; ++row) {
+        memcpy(y + (size_t) row * w, mapped.y + row * mapped.y_stride, w);
+    }
+    for (int row = 0; row < ch; ++row) {
+        const uint8_t *src = mapped.uv + row * mapped.uv_stride;
+        for (int x = 0; x < cw; ++x) {
+            u[(size_t) row * cw + x] = src[2 * x];
+            v[(size_t) row * cw + x] = src[2 * x + 1];
+        }
+    }
+    e->width = w;
+    e->height = h;
+
+    cond.Lock();
+    e->filling = false;
+    e->have_pixels = true;
+    if (e->have_hash) {
+        make_ready(e);
+    }
+    cond.Broadcast();
+    cond.Unlock();
+}
+
+/* called with cond locked */
+bool PictureVerifier::busy(int stream) {
+    for (auto e : ready) {
+        if (e->stream == stream) {
+            return true;
+        }
+    }
+    for (auto e : batch) {
+        if (e->stream == stream) {
+            return true;
+        }
+    }
+    for (auto e : entries) {
+        if (e->stream == stream && e->filling) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void PictureVerifier::Flush(int stream) {
+    cond.Lock();
+    while (busy(stream)) {
+        cond.Wait();
+    }
+    for (size_t i = 0; i < entries.size();) {
+        auto e = entries[i];
+        if (e->stream == stream) {
+            stats.unhashed += e->have_pixels;
+            entries.erase(entries.begin() + i);
+            free_entries.push_back(e);
+        } else {
+            ++i;
+        }
+    }
+    last_hashed.erase(stream);
+    cond.Unlock();
+}
+
+void PictureVerifier::GetStats(Stats *out) {
+    cond.Lock();
+    *out = stats;
+    cond.Unlock();
+}
+
+void PictureVerifier::HashTask(int task, void *opaque) {
+    auto verifier = (PictureVerifier *) opaque;
+    auto e = verifier->batch[task / 3];
+    int c = task % 3;
+    const PictureHash &h = e->hash;
+    if (c >= h.num_components) {
+        e->match[c] = true;
+        return;
+    }
+    TRACE_EVENT(3, "HashPlane", c);
+    const uint8_t *plane = e->planes.data();
+    size_t stride = e->width;
+    int width = h.width, height = h.height;
+    if (c) {
+        plane += (size_t) e->width * e->height + (c - 1) * (size_t) (e->width / 2) * (e->height / 2);
+        stride /= 2;
+        width /= 2;
+        height /= 2;
+    }
+    uint8_t value[16];
+    HashPlane(h.hash_type, plane, stride, width, height, value);
+    e->match[c] = !memcmp(value, h.value[c], PictureHashSize(h.hash_type));
+}
+
+/* hashes whatever is ready in one go on the pool, so a picture's three
+ * components, and the pictures of different streams, run in parallel */
+void PictureVerifier::Main() {
+    std::vector<Entry *> done;
+    cond.Lock();
+    while (!quit) {
+        if (ready.empty()) {
+            cond.Wait();
+            continue;
+        }
+        batch.assign(ready.begin(), ready.end());
+        ready.clear();
+        cond.Unlock();
+
+        uint64_t start = TraceNow();
+        pool.Run((int) batch.size() * 3, HashTask, this);
+        uint64_t ns = TraceNow() - start;
+
+        for (auto e : batch) {
+            bool match = e->match[0] && e->match[1] && e->match[2];
+            if (!match) {
+                warnx("%s: stream %d picture %llu does not match its hash SEI (%s%s%s)", __PRETTY_FUNCTION__,
+                    e->stream, (unsigned long long) e->picture, e->match[0] ? "" : "Y", e->match[1] ? "" : "U",
+                    e->match[2] ? "" : "V");
+            }
+            if (cb) {
+                cb(e->stream, e->picture, match, opaque);
+            }
+        }
+
+        cond.Lock();
+        for (auto e : batch) {
+            bool match = e->match[0] && e->match[1] && e->match[2];
+            ++stats.verified;
+            stats.mismatches += !match;
+            free_entries.push_back(e);
+        }
+        stats.hash_ns += ns;
+        batch.clear();
+        cond.Broadcast();
+    }
+    cond.Unlock();
+}
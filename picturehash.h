@@ -0,0 +1,138 @@
+#ifndef __PICTUREHASH_H__
+#define __PICTUREHASH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include "condition.h"
+#include "decodebackend.h"
+#include "workerpool.h"
+
+/* checks decoded pictures against the decoded picture hash SEI (H.265 payload type 132)
+ * an encoder may send with each picture, to catch decoder or driver
+ * corruption at full frame rate.
+ *
+ * HEVCParser hands over the hash of each picture as a PictureHash, and the
+ * decoded output comes from DecodeBackend::Map(), both keyed by stream and
+ * picture number in decode order. The two meet in PictureVerifier in either
+ * order: the hash usually arrives first, as parsing runs ahead of decoding,
+ * but may trail it when the SEI falls into the next chunk of input. Once
+ * both are there the picture is hashed on a pool of worker threads, one
+ * task per colour component, away from the decode path, and the result is
+ * reported through a callback.
+ *
+ * Submit() only copies the planes, and drops pictures rather than block when
+ * verification falls too far behind. Only 8-bit 4:2:0 and monochrome
+ * pictures are checked, as MappedPicture is NV12. */
+
+enum PictureHashType {
+    kHashMD5 = 0,
+    kHashCRC = 1,
+    kHashChecksum = 2,
+};
+
+struct PictureHash {
+    int hash_type;
+    int num_components; // 1 for monochrome, 3 otherwise
+    /* per component, as the bytes of the SEI: 16 for MD5, 2 for CRC and 4
+     * for the checksum */
+    uint8_t value[3][16];
+
+    /* of the picture, from its SPS */
+    int width, height; // in luma samples, before cropping
+    int chroma_format_idc;
+    int bit_depth_luma, bit_depth_chroma;
+};
+
+/* bytes of PictureHash::value used per component, 0 for unknown types */
+size_t PictureHashSize(int hash_type);
+
+/* hashes one colour component of 8-bit samples into out, as laid out in
+ * PictureHash::value. MD5 and CRC are sequential by nature, the checksum
+ * uses SSE2 or NEON. */
+void HashPlane(int hash_type, const uint8_t *plane, size_t stride, int width, int height, uint8_t *out);
+
+class PictureVerifier {
+
+public:
+    typedef void (*result_callback_t)(int stream, uint64_t picture, bool match, void *opaque);
+
+    struct Stats {
+        uint64_t verified;
+        uint64_t mismatches;
+        uint64_t unhashed; // decoded without a hash SEI
+        uint64_t unsupported; // not 8-bit 4:2:0 or monochrome
+        uint64_t dropped; // verification too far behind, or never decoded
+        uint64_t hash_ns; // wall time of the hashing batches
+    };
+
+private:
+    struct Entry {
+        int stream;
+        uint64_t picture;
+        bool have_hash;
+        bool filling; // planes are being copied
+        bool have_pixels;
+        PictureHash hash;
+        /* Y, then U and V de-interleaved, each stride samples wide */
+        std::vector<uint8_t> planes;
+        int width, height;
+        bool match[3];
+    };
+
+    Condition cond;
+    WorkerPool pool;
+    std::thread thread;
+    bool quit = false;
+
+    std::vector<Entry *> entries; // waiting for their hash or pixels
+    std::deque<Entry *> ready; // have both
+    std::vector<Entry *> batch; // being hashed
+    std::vector<Entry *> free_entries;
+    std::map<int, uint64_t> last_hashed; // the latest picture with a hash, per stream
+    Stats stats = {};
+
+    result_callback_t cb;
+    void *opaque;
+
+    /* pictures held at a time, bounding the memory used for copies, and
+     * pictures known by their hash or pixels only */
+    static const size_t max_pictures = 16;
+    static const size_t max_entries = 256;
+
+    Entry *find(int stream, uint64_t picture);
+    size_t held();
+    Entry *add(int stream, uint64_t picture);
+    void make_ready(Entry *e);
+    void expire(int stream, uint64_t picture, bool pixels);
+    bool busy(int stream);
+
+    void Main();
+    static void HashTask(int task, void *opaque);
+
+public:
+    /* threads is the size of the hashing pool, 0 for one per hardware
+     * thread */
+    PictureVerifier(result_callback_t cb, void *opaque, int threads = 0);
+    ~PictureVerifier();
+
+    PictureVerifier(const PictureVerifier &) = delete;
+    PictureVerifier &operator=(const PictureVerifier &) = delete;
+
+    /* the hash SEI of picture, in decode order from 0 */
+    void SetExpected(int stream, uint64_t picture, const PictureHash &hash);
+    /* the decoded output of picture, copied before returning */
+    void Submit(int stream, uint64_t picture, const MappedPicture &mapped);
+    /* at the end of a stream, waits for its pictures being hashed and drops
+     * the ones still missing their hash or pixels */
+    void Flush(int stream);
+
+    void GetStats(Stats *out);
+};
+
+#endif /* __PICTUREHASH_H__ */
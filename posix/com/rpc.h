@@ -0,0 +1 @@
+/* nothing to declare, see windows.h */
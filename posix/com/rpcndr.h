@@ -0,0 +1,7 @@
+#ifndef __POSIX_COM_RPCNDR_H__
+#define __POSIX_COM_RPCNDR_H__
+
+/* the D3D12 headers only check that this is new enough, see windows.h */
+#define __RPCNDR_H_VERSION__ 500
+
+#endif /* __POSIX_COM_RPCNDR_H__ */
@@ -0,0 +1,7 @@
+#ifndef __POSIX_COM_WINAPIFAMILY_H__
+#define __POSIX_COM_WINAPIFAMILY_H__
+
+/* every API partition, see windows.h */
+#define WINAPI_FAMILY_PARTITION(partitions) 1
+
+#endif /* __POSIX_COM_WINAPIFAMILY_H__ */
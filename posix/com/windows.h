@@ -0,0 +1,200 @@
+#ifndef __POSIX_COM_WINDOWS_H__
+#define __POSIX_COM_WINDOWS_H__
+
+/* enough of the Win32 and COM declarations for the D3D12 headers in directx
+ * and the D3D12 backend to compile elsewhere, so that the backend is at
+ * least compile checked where it cannot run. Nothing here is defined, the
+ * objects are never linked. Together with the empty rpc.h, ole2.h, oaidl.h
+ * and ocidl.h next to it, and the DXVA types of ../windows.h. */
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <type_traits>
+
+#include "../windows.h"
+
+typedef int64_t INT64;
+typedef uint64_t UINT64;
+typedef int16_t INT16;
+typedef uint16_t UINT16;
+typedef int8_t INT8;
+typedef uint8_t UINT8;
+typedef uint64_t ULONGLONG;
+typedef int64_t LONGLONG;
+typedef uint64_t ULONG_PTR;
+typedef int64_t LONG_PTR;
+typedef uint64_t SIZE_T;
+typedef float FLOAT;
+typedef double DOUBLE;
+typedef void VOID;
+typedef void *PVOID;
+typedef void *LPVOID;
+typedef const void *LPCVOID;
+typedef void *HANDLE;
+typedef void *HMODULE;
+typedef void *HWND;
+typedef wchar_t WCHAR;
+typedef WCHAR *LPWSTR;
+typedef const WCHAR *LPCWSTR;
+typedef const char *LPCSTR;
+typedef int32_t HRESULT;
+typedef uint8_t boolean;
+typedef void *RPC_IF_HANDLE;
+
+typedef union _LARGE_INTEGER {
+    struct {
+        DWORD LowPart;
+        LONG HighPart;
+    };
+    LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+typedef struct _LUID {
+    DWORD LowPart;
+    LONG HighPart;
+} LUID;
+
+typedef struct tagRECT {
+    LONG left;
+    LONG top;
+    LONG right;
+    LONG bottom;
+} RECT, D3D12_RECT_BASE;
+
+typedef struct tagPOINT {
+    LONG x;
+    LONG y;
+} POINT;
+
+typedef struct _SECURITY_ATTRIBUTES {
+    DWORD nLength;
+    LPVOID lpSecurityDescriptor;
+    BOOL bInheritHandle;
+} SECURITY_ATTRIBUTES;
+
+typedef struct _GUID {
+    uint32_t Data1;
+    uint16_t Data2;
+    uint16_t Data3;
+    uint8_t Data4[8];
+} GUID, IID, CLSID, UUID;
+
+typedef const GUID &REFGUID;
+typedef const IID &REFIID;
+typedef const CLSID &REFCLSID;
+
+inline bool operator==(REFGUID a, REFGUID b) {
+    return !memcmp(&a, &b, sizeof(GUID));
+}
+
+#define TRUE 1
+#define FALSE 0
+#define CONST const
+#define EXTERN_C extern "C"
+#define WINAPI
+#define __stdcall
+#define APIENTRY
+#define STDMETHODCALLTYPE
+#define STDAPI EXTERN_C HRESULT
+#define DECLSPEC_UUID(x)
+#define DECLSPEC_NOVTABLE
+#define DECLSPEC_SELECTANY
+#define BEGIN_INTERFACE
+#define END_INTERFACE
+#define interface struct
+#define MIDL_INTERFACE(x) struct
+#define DECLARE_INTERFACE(x) struct x
+#define STDMETHOD(method) virtual HRESULT STDMETHODCALLTYPE method
+#define STDMETHOD_(type, method) virtual type STDMETHODCALLTYPE method
+#define THIS_
+#define THIS void
+#define PURE = 0
+#define DEFINE_GUID(name, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) EXTERN_C const GUID name
+#define DEFINE_ENUM_FLAG_OPERATORS(T)                                                             \
+    extern "C++" {                                                                                \
+    inline T operator|(T a, T b) { return T((std::underlying_type_t<T>) a | (std::underlying_type_t<T>) b); } \
+    inline T &operator|=(T &a, T b) { return a = a | b; }                                        \
+    inline T operator&(T a, T b) { return T((std::underlying_type_t<T>) a & (std::underlying_type_t<T>) b); } \
+    inline T &operator&=(T &a, T b) { return a = a & b; }                                        \
+    inline T operator~(T a) { return T(~(std::underlying_type_t<T>) a); }                        \
+    inline T operator^(T a, T b) { return T((std::underlying_type_t<T>) a ^ (std::underlying_type_t<T>) b); } \
+    inline T &operator^=(T &a, T b) { return a = a ^ b; }                                        \
+    }
+
+#define S_OK ((HRESULT) 0)
+#define S_FALSE ((HRESULT) 1)
+#define E_FAIL ((HRESULT) 0x80004005)
+#define E_OUTOFMEMORY ((HRESULT) 0x8007000e)
+#define E_INVALIDARG ((HRESULT) 0x80070057)
+#define E_NOINTERFACE ((HRESULT) 0x80004002)
+#define DXGI_ERROR_INVALID_CALL ((HRESULT) 0x887a0001)
+#define DXGI_ERROR_DEVICE_REMOVED ((HRESULT) 0x887a0005)
+#define DXGI_ERROR_UNSUPPORTED ((HRESULT) 0x887a0004)
+#define SUCCEEDED(hr) ((HRESULT) (hr) >= 0)
+#define FAILED(hr) ((HRESULT) (hr) < 0)
+#define HRESULT_FROM_WIN32(x) ((HRESULT) (x) <= 0 ? (HRESULT) (x) : (HRESULT) (((x) & 0xffff) | 0x80070000))
+
+#define INFINITE 0xffffffff
+#define WAIT_OBJECT_0 0
+
+HANDLE CreateEvent(SECURITY_ATTRIBUTES *attributes, BOOL manual_reset, BOOL initial_state, LPCWSTR name);
+DWORD WaitForSingleObject(HANDLE handle, DWORD ms);
+BOOL CloseHandle(HANDLE handle);
+DWORD GetLastError();
+HANDLE GetProcessHeap();
+LPVOID HeapAlloc(HANDLE heap, DWORD flags, SIZE_T size);
+BOOL HeapFree(HANDLE heap, DWORD flags, LPVOID mem);
+
+struct IUnknown {
+    virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **object) = 0;
+    virtual ULONG STDMETHODCALLTYPE AddRef() = 0;
+    virtual ULONG STDMETHODCALLTYPE Release() = 0;
+
+    template <class Q>
+    HRESULT STDMETHODCALLTYPE QueryInterface(Q **pp);
+};
+
+/* the IID of an interface, which the D3D12 headers declare as IID_<name> */
+template <class T>
+const GUID &uuidof();
+#define __uuidof(x) uuidof<std::remove_cv_t<std::remove_reference_t<decltype(x)>>>()
+#define IID_PPV_ARGS(pp) __uuidof(**(pp)), reinterpret_cast<void **>(pp)
+
+/* SAL annotations */
+#define __analysis_assume(x)
+#define _Always_(x)
+#define _COM_Outptr_
+#define _COM_Outptr_opt_
+#define _Field_size_(x)
+#define _Field_size_bytes_full_(x)
+#define _Field_size_bytes_full_opt_(x)
+#define _Field_size_full_(x)
+#define _Field_size_full_opt_(x)
+#define _In_
+#define _In_count_(x)
+#define _In_opt_
+#define _In_opt_count_(x)
+#define _In_range_(lo, hi)
+#define _In_reads_(x)
+#define _In_reads_bytes_(x)
+#define _In_reads_bytes_opt_(x)
+#define _In_reads_opt_(x)
+#define _In_z_
+#define _Inexpressible_(x)
+#define _Inout_
+#define _Inout_opt_
+#define _Inout_updates_bytes_(x)
+#define _Out_
+#define _Out_opt_
+#define _Out_writes_(x)
+#define _Out_writes_bytes_(x)
+#define _Out_writes_bytes_opt_(x)
+#define _Out_writes_opt_(x)
+#define _Outptr_
+#define _Outptr_opt_result_bytebuffer_(x)
+#define _Outptr_opt_result_maybenull_
+
+#endif /* __POSIX_COM_WINDOWS_H__ */
@@ -0,0 +1,52 @@
+#ifndef __POSIX_COM_WRL_CLIENT_H__
+#define __POSIX_COM_WRL_CLIENT_H__
+
+/* the part of Microsoft::WRL::ComPtr that d3dx12_state_object.h uses */
+
+namespace Microsoft {
+namespace WRL {
+
+template <class T>
+class ComPtr {
+public:
+    ComPtr() = default;
+    ComPtr(const ComPtr &o) : ptr(o.ptr) {
+        if (ptr) {
+            ptr->AddRef();
+        }
+    }
+    ~ComPtr() {
+        if (ptr) {
+            ptr->Release();
+        }
+    }
+
+    ComPtr &operator=(T *p) {
+        if (p) {
+            p->AddRef();
+        }
+        if (ptr) {
+            ptr->Release();
+        }
+        ptr = p;
+        return *this;
+    }
+    ComPtr &operator=(const ComPtr &o) {
+        return *this = o.ptr;
+    }
+
+    T *Get() const {
+        return ptr;
+    }
+    T **GetAddressOf() {
+        return &ptr;
+    }
+
+private:
+    T *ptr = nullptr;
+};
+
+} // namespace WRL
+} // namespace Microsoft
+
+#endif /* __POSIX_COM_WRL_CLIENT_H__ */
@@ -0,0 +1,184 @@
+#ifndef __POSIX_LIBVA_VA_H__
+#define __POSIX_LIBVA_VA_H__
+
+/* the HEVC decode parameter buffers of libva (va.h and va_dec_hevc.h), laid
+ * out as libva lays them out, so that FillVA() and FillVASlice() build and
+ * are tested where libva is not installed. Only for the tests, a build with
+ * USE_LIBVA uses the real headers. */
+
+#include <stdint.h>
+
+typedef unsigned int VASurfaceID;
+
+#define VA_INVALID_ID 0xffffffff
+#define VA_INVALID_SURFACE VA_INVALID_ID
+
+#define VA_PADDING_LOW 4
+#define VA_PADDING_MEDIUM 8
+
+#define VA_SLICE_DATA_FLAG_ALL 0x00
+#define VA_SLICE_DATA_FLAG_BEGIN 0x01
+#define VA_SLICE_DATA_FLAG_MIDDLE 0x02
+#define VA_SLICE_DATA_FLAG_END 0x04
+
+#define VA_PICTURE_HEVC_INVALID 0x00000001
+#define VA_PICTURE_HEVC_FIELD_PIC 0x00000002
+#define VA_PICTURE_HEVC_BOTTOM_FIELD 0x00000004
+#define VA_PICTURE_HEVC_LONG_TERM_REFERENCE 0x00000008
+#define VA_PICTURE_HEVC_RPS_ST_CURR_BEFORE 0x00000010
+#define VA_PICTURE_HEVC_RPS_ST_CURR_AFTER 0x00000020
+#define VA_PICTURE_HEVC_RPS_LT_CURR 0x00000040
+
+typedef struct _VAPictureHEVC {
+    VASurfaceID picture_id;
+    int32_t pic_order_cnt;
+    uint32_t flags;
+    uint32_t va_reserved[VA_PADDING_LOW];
+} VAPictureHEVC;
+
+typedef struct _VAPictureParameterBufferHEVC {
+    VAPictureHEVC CurrPic;
+    VAPictureHEVC ReferenceFrames[15];
+    uint16_t pic_width_in_luma_samples;
+    uint16_t pic_height_in_luma_samples;
+    union {
+        struct {
+            uint32_t chroma_format_idc : 2;
+            uint32_t separate_colour_plane_flag : 1;
+            uint32_t pcm_enabled_flag : 1;
+            uint32_t scaling_list_enabled_flag : 1;
+            uint32_t transform_skip_enabled_flag : 1;
+            uint32_t amp_enabled_flag : 1;
+            uint32_t strong_intra_smoothing_enabled_flag : 1;
+            uint32_t sign_data_hiding_enabled_flag : 1;
+            uint32_t constrained_intra_pred_flag : 1;
+            uint32_t cu_qp_delta_enabled_flag : 1;
+            uint32_t weighted_pred_flag : 1;
+            uint32_t weighted_bipred_flag : 1;
+            uint32_t transquant_bypass_enabled_flag : 1;
+            uint32_t tiles_enabled_flag : 1;
+            uint32_t entropy_coding_sync_enabled_flag : 1;
+            uint32_t pps_loop_filter_across_slices_enabled_flag : 1;
+            uint32_t loop_filter_across_tiles_enabled_flag : 1;
+            uint32_t pcm_loop_filter_disabled_flag : 1;
+            uint32_t NoPicReorderingFlag : 1;
+            uint32_t NoBiPredFlag : 1;
+            uint32_t ReservedBits : 11;
+        } bits;
+        uint32_t value;
+    } pic_fields;
+    uint8_t sps_max_dec_pic_buffering_minus1;
+    uint8_t bit_depth_luma_minus8;
+    uint8_t bit_depth_chroma_minus8;
+    uint8_t pcm_sample_bit_depth_luma_minus1;
+    uint8_t pcm_sample_bit_depth_chroma_minus1;
+    uint8_t log2_min_luma_coding_block_size_minus3;
+    uint8_t log2_diff_max_min_luma_coding_block_size;
+    uint8_t log2_min_transform_block_size_minus2;
+    uint8_t log2_diff_max_min_transform_block_size;
+    uint8_t log2_min_pcm_luma_coding_block_size_minus3;
+    uint8_t log2_diff_max_min_pcm_luma_coding_block_size;
+    uint8_t max_transform_hierarchy_depth_intra;
+    uint8_t max_transform_hierarchy_depth_inter;
+    int8_t init_qp_minus26;
+    uint8_t diff_cu_qp_delta_depth;
+    int8_t pps_cb_qp_offset;
+    int8_t pps_cr_qp_offset;
+    uint8_t log2_parallel_merge_level_minus2;
+    uint8_t num_tile_columns_minus1;
+    uint8_t num_tile_rows_minus1;
+    uint16_t column_width_minus1[19];
+    uint16_t row_height_minus1[21];
+    union {
+        struct {
+            uint32_t lists_modification_present_flag : 1;
+            uint32_t long_term_ref_pics_present_flag : 1;
+            uint32_t sps_temporal_mvp_enabled_flag : 1;
+            uint32_t cabac_init_present_flag : 1;
+            uint32_t output_flag_present_flag : 1;
+            uint32_t dependent_slice_segments_enabled_flag : 1;
+            uint32_t pps_slice_chroma_qp_offsets_present_flag : 1;
+            uint32_t sample_adaptive_offset_enabled_flag : 1;
+            uint32_t deblocking_filter_override_enabled_flag : 1;
+            uint32_t pps_disable_deblocking_filter_flag : 1;
+            uint32_t slice_segment_header_extension_present_flag : 1;
+            uint32_t RapPicFlag : 1;
+            uint32_t IdrPicFlag : 1;
+            uint32_t IntraPicFlag : 1;
+            uint32_t ReservedBits : 18;
+        } bits;
+        uint32_t value;
+    } slice_parsing_fields;
+    uint8_t log2_max_pic_order_cnt_lsb_minus4;
+    uint8_t num_short_term_ref_pic_sets;
+    uint8_t num_long_term_ref_pic_sps;
+    uint8_t num_ref_idx_l0_default_active_minus1;
+    uint8_t num_ref_idx_l1_default_active_minus1;
+    int8_t pps_beta_offset_div2;
+    int8_t pps_tc_offset_div2;
+    uint8_t num_extra_slice_header_bits;
+    uint32_t st_rps_bits;
+    uint32_t va_reserved[VA_PADDING_MEDIUM];
+} VAPictureParameterBufferHEVC;
+
+typedef struct _VASliceParameterBufferHEVC {
+    uint32_t slice_data_size;
+    uint32_t slice_data_offset;
+    uint32_t slice_data_flag;
+    uint32_t slice_data_byte_offset;
+    uint32_t slice_segment_address;
+    uint8_t RefPicList[2][15];
+    union {
+        uint32_t value;
+        struct {
+            uint32_t LastSliceOfPic : 1;
+            uint32_t dependent_slice_segment_flag : 1;
+            uint32_t slice_type : 2;
+            uint32_t color_plane_id : 2;
+            uint32_t slice_sao_luma_flag : 1;
+            uint32_t slice_sao_chroma_flag : 1;
+            uint32_t mvd_l1_zero_flag : 1;
+            uint32_t cabac_init_flag : 1;
+            uint32_t slice_temporal_mvp_enabled_flag : 1;
+            uint32_t slice_deblocking_filter_disabled_flag : 1;
+            uint32_t collocated_from_l0_flag : 1;
+            uint32_t slice_loop_filter_across_slices_enabled_flag : 1;
+            uint32_t reserved : 18;
+        } fields;
+    } LongSliceFlags;
+    uint8_t collocated_ref_idx;
+    uint8_t num_ref_idx_l0_active_minus1;
+    uint8_t num_ref_idx_l1_active_minus1;
+    int8_t slice_qp_delta;
+    int8_t slice_cb_qp_offset;
+    int8_t slice_cr_qp_offset;
+    int8_t slice_beta_offset_div2;
+    int8_t slice_tc_offset_div2;
+    uint8_t luma_log2_weight_denom;
+    int8_t delta_chroma_log2_weight_denom;
+    int8_t delta_luma_weight_l0[15];
+    int8_t luma_offset_l0[15];
+    int8_t delta_chroma_weight_l0[15][2];
+    int8_t ChromaOffsetL0[15][2];
+    int8_t delta_luma_weight_l1[15];
+    int8_t luma_offset_l1[15];
+    int8_t delta_chroma_weight_l1[15][2];
+    int8_t ChromaOffsetL1[15][2];
+    uint8_t five_minus_max_num_merge_cand;
+    uint16_t num_entry_point_offsets;
+    uint16_t entry_offset_to_subset_array;
+    uint16_t slice_data_num_emu_prevention_bytes;
+    uint32_t va_reserved[VA_PADDING_LOW - 2];
+} VASliceParameterBufferHEVC;
+
+typedef struct _VAIQMatrixBufferHEVC {
+    uint8_t ScalingList4x4[6][16];
+    uint8_t ScalingList8x8[6][64];
+    uint8_t ScalingList16x16[6][64];
+    uint8_t ScalingList32x32[2][64];
+    uint8_t ScalingListDC16x16[6];
+    uint8_t ScalingListDC32x32[2];
+    uint32_t va_reserved[VA_PADDING_LOW];
+} VAIQMatrixBufferHEVC;
+
+#endif /* __POSIX_LIBVA_VA_H__ */
@@ -0,0 +1,27 @@
+#ifndef __POSIX_WINDOWS_H__
+#define __POSIX_WINDOWS_H__
+
+/* the Win32 integer types the DXVA structures in dxva.h are declared with,
+ * so that the parsers can fill them on platforms without the Windows SDK */
+
+#include <stdint.h>
+
+typedef char CHAR;
+typedef unsigned char UCHAR;
+typedef short SHORT;
+typedef unsigned short USHORT;
+typedef int INT;
+typedef unsigned int UINT;
+typedef int32_t LONG;
+typedef uint32_t ULONG;
+typedef uint32_t UINT32;
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef int BOOL;
+
+#ifndef _countof
+#define _countof(a) (sizeof(a) / sizeof((a)[0]))
+#endif
+
+#endif /* __POSIX_WINDOWS_H__ */
@@ -0,0 +1,209 @@
+#ifndef __READBACKPOOL_H__
+#define __READBACKPOOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <vector>
+
+#include "lock.h"
+
+/* pool of persistently mapped readback buffers, for pulling frames back to
+ * the host without creating a resource per copy or blocking the submitting
+ * thread. Buffers are grouped in power of two size classes. A buffer handed
+ * out by Acquire() has a copy recorded into it by the caller, and is then
+ * Submit()ted along with the fence value signalled after that copy. Poll()
+ * runs the completion callback for every buffer whose fence has passed and
+ * returns the buffer to its free list.
+ *
+ * The pool only talks to the device through ReadbackAllocator, so the
+ * bookkeeping does not depend on D3D12. */
+
+class ReadbackAllocator {
+public:
+    virtual ~ReadbackAllocator() {
+    }
+
+    /* create a buffer of exactly size bytes, and map it for the lifetime of
+     * the buffer. Returns an opaque handle, or nullptr on failure. */
+    virtual void *Create(size_t size, uint8_t **mapped) = 0;
+    virtual void Destroy(void *resource) = 0;
+
+    /* highest fence value known to have completed */
+    virtual uint64_t CompletedValue() = 0;
+};
+
+class ReadbackPool {
+
+public:
+    typedef void (*readback_callback_t)(const uint8_t *data, size_t size, void *opaque);
+
+    struct Buffer {
+        void *resource;
+        uint8_t *mapped;
+        size_t capacity;
+        int size_class;
+
+        /* valid between Submit() and completion */
+        uint64_t fence_value;
+        size_t size;
+        readback_callback_t cb;
+        void *opaque;
+    };
+
+    struct Stats {
+        size_t buffers; // currently owned by the pool, free or not
+        size_t bytes;
+        size_t creates; // ever
+        size_t reuses; // Acquire() calls served from a free list
+        size_t in_flight;
+        size_t max_in_flight;
+        size_t completed;
+    };
+
+private:
+    static const int min_class_bits = 16; // 64KB
+    static const int num_classes = 48 - min_class_bits;
+
+    ReadbackAllocator *allocator;
+    Lock lock;
+    std::vector<Buffer *> free_lists[num_classes];
+    std::deque<Buffer *> in_flight; // in submission order, so in fence order
+    Stats stats = {};
+
+    static int SizeClass(size_t size) {
+        int c = 0;
+        while (((size_t) 1 << (c + min_class_bits)) < size) {
+            ++c;
+        }
+        return c;
+    }
+
+    void DestroyBuffer(Buffer *b) {
+        allocator->Destroy(b->resource);
+        --stats.buffers;
+        stats.bytes -= b->capacity;
+        delete b;
+    }
+
+public:
+    ReadbackPool(ReadbackAllocator *allocator)
+        : allocator(allocator) {
+    }
+
+    ~ReadbackPool() {
+        for (auto b : in_flight) {
+            DestroyBuffer(b);
+        }
+        Trim();
+    }
+
+    ReadbackPool(const ReadbackPool &) = delete;
+    ReadbackPool &operator=(const ReadbackPool &) = delete;
+
+    /* returns a buffer of at least size bytes, or nullptr if the allocator
+     * failed to create one */
+    Buffer *Acquire(size_t size) {
+        int c = SizeClass(size);
+        if (c >= num_classes) {
+            return nullptr;
+        }
+        {
+            ScopedLock l(lock);
+            auto &free_list = free_lists[c];
+            if (!free_list.empty()) {
+                auto b = free_list.back();
+                free_list.pop_back();
+                ++stats.reuses;
+                return b;
+            }
+        }
+
+        auto b = new Buffer();
+        b->capacity = (size_t) 1 << (c + min_class_bits);
+        b->size_class = c;
+        b->resource = allocator->Create(b->capacity, &b->mapped);
+        if (!b->resource) {
+            delete b;
+            return nullptr;
+        }
+        ScopedLock l(lock);
+        ++stats.creates;
+        ++stats.buffers;
+        stats.bytes += b->capacity;
+        return b;
+    }
+
+    /* give back a buffer that was acquired but never submitted */
+    void Release(Buffer *b) {
+        ScopedLock l(lock);
+        free_lists[b->size_class].push_back(b);
+    }
+
+    /* cb(data, size, opaque) will be run from Poll() once fence_value has
+     * completed. Fence values must not decrease between calls. */
+    void Submit(Buffer *b, uint64_t fence_value, size_t size, readback_callback_t cb, void *opaque) {
+        b->fence_value = fence_value;
+        b->size = size;
+        b->cb = cb;
+        b->opaque = opaque;
+        ScopedLock l(lock);
+        in_flight.push_back(b);
+        ++stats.in_flight;
+        if (stats.in_flight > stats.max_in_flight) {
+            stats.max_in_flight = stats.in_flight;
+        }
+    }
+
+    /* run callbacks for completed readbacks, in submission order. Callbacks
+     * are called without the pool lock held, so they may Acquire() and
+     * Submit() themselves. Returns the number of callbacks run. */
+    int Poll() {
+        uint64_t completed = allocator->CompletedValue();
+        int n = 0;
+        for (;;) {
+            Buffer *b;
+            {
+                ScopedLock l(lock);
+                if (in_flight.empty() || in_flight.front()->fence_value > completed) {
+                    break;
+                }
+                b = in_flight.front();
+                in_flight.pop_front();
+                --stats.in_flight;
+                ++stats.completed;
+            }
+            if (b->cb) {
+                b->cb(b->mapped, b->size, b->opaque);
+            }
+            Release(b);
+            ++n;
+        }
+        return n;
+    }
+
+    /* fence value of the oldest readback still in flight, or 0 if none */
+    uint64_t OldestPending() {
+        ScopedLock l(lock);
+        return in_flight.empty() ? 0 : in_flight.front()->fence_value;
+    }
+
+    /* free every buffer not currently in flight */
+    void Trim() {
+        ScopedLock l(lock);
+        for (auto &free_list : free_lists) {
+            for (auto b : free_list) {
+                DestroyBuffer(b);
+            }
+            free_list.clear();
+        }
+    }
+
+    void GetStats(Stats *s) {
+        ScopedLock l(lock);
+        *s = stats;
+    }
+};
+
+#endif /* __READBACKPOOL_H__ */
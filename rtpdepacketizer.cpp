@@ -0,0 +1,275 @@
+#include <algorithm>
+
+#include "latency.h"
+#include "rtpdepacketizer.h"
+#include "trace.h"
+
+/* RFC 7798 4.4, the payload type is the NALU type field of the payload
+ * header, which takes the place of a NALU header */
+enum {
+    kPayloadAP = 48,
+    kPayloadFU = 49,
+};
+
+struct RTPHeader {
+    uint16_t seq;
+    uint32_t timestamp;
+    uint32_t ssrc;
+    size_t offset; // of the payload
+    size_t size; // of the payload, without padding
+};
+
+static inline uint16_t rb16(const uint8_t *p) {
+    return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t rb32(const uint8_t *p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+/* RFC 3550 5.1: fixed header, CSRCs, an optional extension and optional
+ * padding, whose size is in the last byte. RTCP multiplexed on the same port
+ * (RFC 5761) shows up as payload types 72-76 and is rejected. */
+static bool parse_rtp_header(const uint8_t *p, size_t size, RTPHeader *h) {
+    if (size < 12 || (p[0] >> 6) != 2) {
+        return false;
+    }
+    int payload_type = p[1] & 0x7f;
+    if (payload_type >= 72 && payload_type <= 76) {
+        return false;
+    }
+    size_t offset = 12 + 4 * (p[0] & 0xf);
+    if (p[0] & 0x10) {
+        if (size < offset + 4) {
+            return false;
+        }
+        offset += 4 + 4 * (size_t) rb16(p + offset + 2);
+    }
+    if (offset > size) {
+        return false;
+    }
+    size_t end = size;
+    if (p[0] & 0x20) {
+        size_t padding = p[size - 1];
+        if (!padding || padding > size - offset) {
+            return false;
+        }
+        end -= padding;
+    }
+    h->seq = rb16(p + 2);
+    h->timestamp = rb32(p + 4);
+    h->ssrc = rb32(p + 8);
+    h->offset = offset;
+    h->size = end - offset;
+    return true;
+}
+
+RTPDepacketizer::RTPDepacketizer(nalu_callback_t cb, void *opaque)
+    : cb(cb), opaque(opaque) {
+    for (auto &s : slots) {
+        s.used = false;
+    }
+}
+
+void RTPDepacketizer::SetMaxDelay(uint64_t ns, int packets) {
+    max_delay_ns = ns;
+    max_held = std::clamp(packets, 1, kJitterSlots - 1);
+}
+
+void RTPDepacketizer::Push(const uint8_t *packet, size_t size, uint64_t arrival_ns) {
+    ++stats.packets;
+    RTPHeader h;
+    if (!parse_rtp_header(packet, size, &h)) {
+        ++stats.invalid;
+        return;
+    }
+    if (!have_seq) {
+        have_seq = true;
+        ssrc = h.ssrc;
+        next_seq = h.seq;
+    } else if (h.ssrc != ssrc) {
+        ++stats.other_ssrc;
+        return;
+    }
+
+    int16_t ahead = (int16_t) (h.seq - next_seq);
+    if (ahead < 0) {
+        ++stats.late;
+        return;
+    }
+    if (ahead >= kJitterSlots) {
+        /* too far ahead to be reordering, the sender restarted or we lost
+         * a lot, so start over from this packet */
+        Flush();
+        stats.lost += (uint16_t) (h.seq - next_seq);
+        next_seq = h.seq;
+        ahead = 0;
+    }
+    if (ahead == 0) {
+        depacketize(packet, size, arrival_ns);
+        ++next_seq;
+        if (held) {
+            drain(arrival_ns);
+        }
+        return;
+    }
+
+    Slot &s = slots[h.seq % kJitterSlots];
+    if (s.used) {
+        ++stats.duplicates;
+        return;
+    }
+    s.used = true;
+    s.seq = h.seq;
+    s.arrival_ns = arrival_ns;
+    s.bytes.assign(packet, packet + size);
+    ++held;
+    ++stats.reordered;
+    stats.bytes_copied += size;
+    drain(arrival_ns);
+}
+
+void RTPDepacketizer::Flush() {
+    drain(UINT64_MAX);
+    if (in_fu) {
+        in_fu = false;
+        ++stats.fragments_dropped;
+    }
+}
+
+/* passes on held packets from next_seq on, until the next gap. The gap is
+ * given up on if the packet after it has waited too long, or too many are
+ * waiting. */
+void RTPDepacketizer::drain(uint64_t now) {
+    while (held) {
+        Slot &s = slots[next_seq % kJitterSlots];
+        if (s.used) {
+            depacketize(s.bytes.data(), s.bytes.size(), s.arrival_ns);
+            s.used = false;
+            --held;
+            ++next_seq;
+            continue;
+        }
+        uint64_t oldest = now;
+        for (int i = 1; i < kJitterSlots; ++i) {
+            const Slot &t = slots[(uint16_t) (next_seq + i) % kJitterSlots];
+            if (t.used) {
+                oldest = t.arrival_ns;
+                break;
+            }
+        }
+        if (held <= max_held && now - oldest < max_delay_ns) {
+            break;
+        }
+        skip();
+    }
+}
+
+void RTPDepacketizer::skip() {
+    ++stats.lost;
+    ++next_seq;
+    /* the rest of the FU will not make a whole NALU */
+    if (in_fu) {
+        in_fu = false;
+        ++stats.fragments_dropped;
+    }
+}
+
+void RTPDepacketizer::emit(const uint8_t *bytes, size_t size, uint32_t timestamp, uint64_t arrival_ns) {
+    ++stats.nalus;
+    pipeline_latency.Record(kStageDepacketize, TraceNow() - arrival_ns);
+    cb(bytes, size, timestamp, opaque);
+}
+
+void RTPDepacketizer::depacketize(const uint8_t *packet, size_t size, uint64_t arrival_ns) {
+    RTPHeader h;
+    parse_rtp_header(packet, size, &h);
+    const uint8_t *p = packet + h.offset;
+    size_t n = h.size;
+    if (n < 3 || (p[0] & 0x80)) {
+        ++stats.invalid;
+        return;
+    }
+    int type = (p[0] >> 1) & 0x3f;
+
+    /* the fragments of a NALU are sent back to back, anything else in
+     * between means the rest of it is not coming */
+    if (in_fu && type != kPayloadFU) {
+        in_fu = false;
+        ++stats.fragments_dropped;
+    }
+
+    if (type < kPayloadAP) {
+        if (!donl) {
+            emit(p, n, h.timestamp, arrival_ns);
+            return;
+        }
+        /* DONL sits between the NALU header and payload */
+        if (n < 5) {
+            ++stats.invalid;
+            return;
+        }
+        fu.assign(p, p + 2);
+        fu.insert(fu.end(), p + 4, p + n);
+        stats.bytes_copied += n - 2;
+        emit(fu.data(), fu.size(), h.timestamp, arrival_ns);
+    } else if (type == kPayloadAP) {
+        /* payload header, DONL for the first NALU and DOND for the ones
+         * after it, then each NALU with a 16 bit size in front */
+        size_t i = 2 + (donl ? 2 : 0);
+        for (bool first = true; i < n; first = false) {
+            i += !first && donl;
+            if (i + 2 > n) {
+                ++stats.invalid;
+                return;
+            }
+            size_t len = rb16(p + i);
+            i += 2;
+            if (!len || len > n - i) {
+                ++stats.invalid;
+                return;
+            }
+            emit(p + i, len, h.timestamp, arrival_ns);
+            i += len;
+        }
+    } else if (type == kPayloadFU) {
+        /* payload header, FU header with start and end bits and the NALU
+         * type, DONL in the first fragment, then the fragment itself */
+        bool start = p[2] & 0x80;
+        bool end = p[2] & 0x40;
+        int nalu_type = p[2] & 0x3f;
+        size_t i = 3;
+        if (start) {
+            if (in_fu) {
+                ++stats.fragments_dropped;
+            }
+            i += donl ? 2 : 0;
+            if (i > n) {
+                in_fu = false;
+                ++stats.invalid;
+                return;
+            }
+            fu.clear();
+            fu.push_back((uint8_t) ((p[0] & 0x81) | (nalu_type << 1)));
+            fu.push_back(p[1]);
+            in_fu = true;
+            fu_arrival_ns = arrival_ns;
+        } else if (!in_fu) {
+            return; // counted when the fragment before it went missing
+        }
+        if (fu.size() + (n - i) > kMaxNALUSize) {
+            in_fu = false;
+            ++stats.fragments_dropped;
+            return;
+        }
+        fu.insert(fu.end(), p + i, p + n);
+        stats.bytes_copied += n - i;
+        if (end) {
+            in_fu = false;
+            emit(fu.data(), fu.size(), h.timestamp, fu_arrival_ns);
+        }
+    } else {
+        /* PACI and reserved types */
+        ++stats.invalid;
+    }
+}
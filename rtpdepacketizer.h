@@ -0,0 +1,108 @@
+#ifndef __RTPDEPACKETIZER_H__
+#define __RTPDEPACKETIZER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+/* turns an RTP stream carrying HEVC as of RFC 7798 back into NALUs, handing
+ * each one, without start code, to a callback that will usually pass it on
+ * to HEVCParser::PushNALU().
+ *
+ * Packets are put back in sequence number order by a jitter buffer. A packet
+ * arriving in order, with nothing held back, is depacketized in place, so
+ * single NAL unit packets and the NALUs of aggregation packets (type 48)
+ * are passed on as views into the caller's packet. Packets arriving ahead of
+ * a gap are copied into the jitter buffer until the gap is filled, or given
+ * up on once the oldest has waited max_delay_ns or the buffer is full.
+ * Fragmentation units (type 49) are gathered into a buffer of their own, and
+ * one with fragments missing is dropped as a whole.
+ *
+ * Only the first SSRC seen is followed. With sprop-max-don-diff > 0 the
+ * packets carry decoding order numbers, see SetDonl(); NALUs are still
+ * passed on in transmission order, which is all a single decoder needs.
+ * PACI packets (type 50) are not supported. */
+
+class RTPDepacketizer {
+public:
+    /* timestamp is the RTP timestamp of the packet the NALU came in */
+    typedef void (*nalu_callback_t)(const uint8_t *bytes, size_t size, uint32_t timestamp, void *opaque);
+
+    struct Stats {
+        uint64_t packets;
+        uint64_t invalid; // not RTP, unsupported payload or malformed
+        uint64_t other_ssrc;
+        uint64_t reordered; // arrived ahead of a gap and were held back
+        uint64_t duplicates;
+        uint64_t late; // behind the next sequence number, passed on or given up
+        uint64_t lost; // sequence numbers given up on
+        uint64_t nalus;
+        uint64_t fragments_dropped; // FUs missing a fragment
+        uint64_t bytes_copied; // into the jitter and FU buffers
+    };
+
+private:
+    static const int kJitterSlots = 256;
+    static const size_t kMaxNALUSize = 0x200000;
+
+    struct Slot {
+        bool used;
+        uint16_t seq;
+        uint64_t arrival_ns;
+        std::vector<uint8_t> bytes; // keeps its capacity once grown
+    };
+
+    Slot slots[kJitterSlots];
+    int held = 0; // slots in use
+    uint16_t next_seq = 0; // the next sequence number to pass on
+    bool have_seq = false;
+    uint32_t ssrc = 0;
+
+    uint64_t max_delay_ns = 50000000;
+    int max_held = kJitterSlots / 2;
+    bool donl = false;
+
+    /* the FU being gathered, starting with the NALU header it rebuilds */
+    std::vector<uint8_t> fu;
+    bool in_fu = false;
+    uint64_t fu_arrival_ns = 0;
+
+    nalu_callback_t cb;
+    void *opaque;
+
+    Stats stats = {};
+
+    void depacketize(const uint8_t *p, size_t size, uint64_t arrival_ns);
+    void emit(const uint8_t *bytes, size_t size, uint32_t timestamp, uint64_t arrival_ns);
+    void drain(uint64_t now);
+    void skip();
+
+public:
+    RTPDepacketizer(nalu_callback_t cb, void *opaque);
+    RTPDepacketizer(const RTPDepacketizer &) = delete;
+    RTPDepacketizer &operator=(const RTPDepacketizer &) = delete;
+
+    /* packets carry DONL/DOND fields, i.e. sprop-max-don-diff > 0 in the
+     * SDP */
+    void SetDonl(bool enable) {
+        donl = enable;
+    }
+
+    /* how long a packet ahead of a gap is held back waiting for the gap to
+     * be filled, and how many such packets at most */
+    void SetMaxDelay(uint64_t ns, int packets);
+
+    /* arrival_ns is the TraceNow() time the packet was received. The packet
+     * is only read during the call. */
+    void Push(const uint8_t *packet, size_t size, uint64_t arrival_ns);
+
+    /* passes on everything held back, giving up on any gaps */
+    void Flush();
+
+    void GetStats(Stats *out) const {
+        *out = stats;
+    }
+};
+
+#endif /* __RTPDEPACKETIZER_H__ */
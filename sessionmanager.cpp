@@ -0,0 +1,493 @@
+#include "sessionmanager.h"
+
+#include <algorithm>
+
+#include "avcparser.h"
+#include "avcpicture.h"
+#include "hevcparser.h"
+#include "hevcpicture.h"
+#include "trace.h"
+
+SessionManager::SessionManager(DecodeDevice *device, SchedulePolicy policy, int parse_threads)
+    : device(device), policy(policy), parse_pool(parse_threads) {
+    parse_thread = std::thread(&SessionManager::ParseMain, this);
+    int n = device->NumQueues();
+    for (int i = 0; i < n; ++i) {
+        queue_threads.emplace_back(&SessionManager::QueueMain, this, i);
+    }
+}
+
+SessionManager::~SessionManager() {
+    Drain();
+    cond.Lock();
+    quit = true;
+    cond.Broadcast();
+    cond.Unlock();
+    parse_thread.join();
+    for (auto &t : queue_threads) {
+        t.join();
+    }
+    /* before the sessions its callback looks up */
+    delete verifier;
+    for (auto s : sessions) {
+        Destroy(s);
+    }
+}
+
+void SessionManager::Destroy(Session *s) {
+    delete s->backend;
+    delete s->hevc_parser;
+    delete s->avc_parser;
+    delete s;
+}
+
+/* called with cond locked */
+SessionManager::Session *SessionManager::Find(int id) {
+    for (auto s : sessions) {
+        if (s->id == id) {
+            return s;
+        }
+    }
+    return nullptr;
+}
+
+/* called with cond locked */
+bool SessionManager::Idle(Session *s) {
+    return s->input.empty() && !s->parsing && s->jobs.empty() && !s->busy;
+}
+
+/* called with cond locked. A session with this many pictures waiting for a
+ * queue is not parsed any further until some have decoded, which only holds
+ * up that session. */
+bool SessionManager::Throttled(Session *s) {
+    return s->jobs.size() >= max_pending_jobs;
+}
+
+int SessionManager::OpenSession(uint64_t latency_target_ns, VideoCodec codec) {
+    if (codec != kCodecHEVC && codec != kCodecH264) {
+        return -1;
+    }
+    auto s = new Session();
+    s->manager = this;
+    s->latency_target = latency_target_ns;
+    s->codec = codec;
+    if (codec == kCodecHEVC) {
+        s->hevc_parser = new HEVCParser();
+    } else {
+        s->avc_parser = new AVCParser();
+    }
+    s->backend = device->OpenSession(codec);
+    if (!s->backend) {
+        Destroy(s);
+        return -1;
+    }
+    cond.Lock();
+    s->id = next_id++;
+    if (s->hevc_parser) {
+        s->hevc_parser->SetHoldPictures(hold_pictures);
+    }
+    if (verifier && s->hevc_parser) {
+        s->hevc_parser->SetPictureHashCallback(OnPictureHash, s);
+    }
+    sessions.push_back(s);
+    cond.Unlock();
+    return s->id;
+}
+
+void SessionManager::CloseSession(int id) {
+    cond.Lock();
+    auto s = Find(id);
+    if (s) {
+        /* end of stream, so the parser passes on the last NALU */
+        s->input.push_back({ nullptr, 0 });
+        cond.Broadcast();
+    }
+    while (s && !Idle(s)) {
+        cond.Wait();
+    }
+    if (s && verifier) {
+        /* the last picture, still in the session so its result counts */
+        cond.Unlock();
+        Verify(s);
+        verifier->Flush(s->id);
+        cond.Lock();
+    }
+    if (s) {
+        for (size_t i = 0; i < sessions.size(); ++i) {
+            if (sessions[i] == s) {
+                sessions.erase(sessions.begin() + i);
+                break;
+            }
+        }
+    }
+    cond.Unlock();
+    if (s) {
+        Destroy(s);
+    }
+}
+
+void SessionManager::ReceiveBytes(int id, const uint8_t *bytes, size_t size) {
+    Chunk c = { new uint8_t[size], size };
+    memcpy(c.bytes, bytes, size);
+    cond.Lock();
+    auto s = Find(id);
+    while (s && s->input.size() >= max_input_chunks) {
+        cond.Wait();
+    }
+    if (!s) {
+        cond.Unlock();
+        delete[] c.bytes;
+        errx(1, "%s: no session %d", __PRETTY_FUNCTION__, id);
+    }
+    s->input.push_back(c);
+    cond.Broadcast();
+    cond.Unlock();
+}
+
+void SessionManager::SetMaxTemporalId(int id, int temporal_id) {
+    cond.Lock();
+    auto s = Find(id);
+    if (s) {
+        s->max_temporal_id = temporal_id;
+        s->pictures_since_change = 0;
+        s->pictures_on_time = 0;
+    }
+    cond.Unlock();
+}
+
+void SessionManager::SetLoadShedding(bool enable) {
+    cond.Lock();
+    shed_load = enable;
+    cond.Unlock();
+}
+
+void SessionManager::SetVerification(bool enable) {
+    cond.Lock();
+    if (enable && !verifier) {
+        verifier = new PictureVerifier(OnVerified, this);
+    }
+    cond.Unlock();
+    /* sessions already open keep their callback, and the verifier, which
+     * drops pictures it never gets a hash for */
+}
+
+void SessionManager::SetHoldPictures(bool enable) {
+    cond.Lock();
+    hold_pictures = enable;
+    cond.Unlock();
+}
+
+void SessionManager::Drain() {
+    cond.Lock();
+    for (;;) {
+        bool idle = true;
+        for (auto s : sessions) {
+            idle = idle && Idle(s);
+        }
+        if (idle) {
+            break;
+        }
+        cond.Wait();
+    }
+    cond.Unlock();
+}
+
+/* parsing is done in rounds, each round handing every session with input to
+ * the worker pool, so a session is only ever parsed by one worker at a time.
+ * A session slow to parse holds up the start of the next round, which is fine
+ * as long as tasks are whole chunks of a few frames each. Throttled sessions
+ * sit rounds out rather than holding them up, and QueueMain() wakes us once
+ * their pictures have decoded. */
+void SessionManager::ParseMain() {
+    std::vector<Session *> batch;
+    cond.Lock();
+    while (!quit) {
+        batch.clear();
+        for (auto s : sessions) {
+            if (!s->input.empty() && !s->parsing && !Throttled(s)) {
+                s->parsing = true;
+                batch.push_back(s);
+            }
+        }
+        if (batch.empty()) {
+            cond.Wait();
+            continue;
+        }
+        cond.Unlock();
+        parse_pool.Run((int) batch.size(), ParseTask, &batch);
+        cond.Lock();
+        for (auto s : batch) {
+            s->parsing = false;
+        }
+        cond.Broadcast();
+    }
+    cond.Unlock();
+}
+
+void SessionManager::ParseTask(int task, void *opaque) {
+    auto s = (*(std::vector<Session *> *) opaque)[task];
+    auto m = s->manager;
+    TRACE_EVENT(2, "ParseTask", s->id);
+    for (;;) {
+        NALScanner::SkipStats skipped = {};
+        if (s->hevc_parser) {
+            s->hevc_parser->GetSkipStats(&skipped);
+        }
+        m->cond.Lock();
+        if (s->hevc_parser) {
+            s->num_sub_layers = s->hevc_parser->GetNumSubLayers();
+        }
+        s->stats.nalus_dropped = skipped.nalus;
+        /* the rest of the input waits for a later round */
+        if (s->input.empty() || m->Throttled(s)) {
+            m->cond.Unlock();
+            break;
+        }
+        auto c = s->input.front();
+        s->input.pop_front();
+        int max_temporal_id = s->max_temporal_id;
+        m->cond.Broadcast();
+        m->cond.Unlock();
+
+        if (s->hevc_parser) {
+            s->hevc_parser->SetMaxTemporalId(max_temporal_id);
+            if (c.bytes) {
+                s->hevc_parser->Parse(c.bytes, c.size, OnHEVCPicture, s);
+            } else {
+                s->hevc_parser->Flush(OnHEVCPicture, s);
+            }
+        } else {
+            if (c.bytes) {
+                s->avc_parser->Parse(c.bytes, c.size, OnAVCPicture, s);
+            } else {
+                s->avc_parser->Flush(OnAVCPicture, s);
+            }
+        }
+        delete[] c.bytes;
+    }
+}
+
+/* pictures are built here, while the parser still holds the slice header and
+ * parameter sets for bytes, and own a copy of the slice data */
+void SessionManager::OnHEVCPicture(const uint8_t *bytes, size_t size, void *opaque) {
+    auto s = (Session *) opaque;
+    auto job = new Job();
+    job->hevc_picture = new HEVCPicture();
+    job->hevc_picture->Build(s->hevc_parser, bytes, size);
+    job->is_key = job->hevc_picture->Get()->is_key;
+    /* the first bit after the NALU header is first_slice_segment_in_pic_flag */
+    job->first_slice = size > 2 && (bytes[2] & 0x80);
+    s->manager->Enqueue(s, job, size);
+}
+
+void SessionManager::OnAVCPicture(const uint8_t *bytes, size_t size, void *opaque) {
+    auto s = (Session *) opaque;
+    auto job = new Job();
+    job->avc_picture = new AVCPicture();
+    job->avc_picture->Build(s->avc_parser, bytes, size);
+    job->is_key = job->avc_picture->Get()->is_key;
+    /* first_mb_in_slice comes first, and is 0, coded as a single 1 bit, for
+     * the first slice */
+    job->first_slice = size > 1 && (bytes[1] & 0x80);
+    s->manager->Enqueue(s, job, size);
+}
+
+/* called on the parse worker with a job built from a slice of s */
+void SessionManager::Enqueue(Session *s, Job *job, size_t size) {
+    job->session = s;
+    job->size = size;
+    s->pictures_parsed += job->first_slice;
+    job->number = s->pictures_parsed - 1;
+    job->enqueued = TraceNow();
+    job->deadline = job->enqueued + s->latency_target;
+
+    cond.Lock();
+    if (!s->first_enqueued) {
+        s->first_enqueued = job->enqueued;
+    }
+    s->jobs.push_back(job);
+    cond.Broadcast();
+    cond.Unlock();
+}
+
+/* called on the parse worker, after the slices of the picture the hash is for */
+void SessionManager::OnPictureHash(const PictureHash *hash, void *opaque) {
+    auto s = (Session *) opaque;
+    s->manager->verifier->SetExpected(s->id, s->pictures_parsed - 1, *hash);
+}
+
+void SessionManager::OnVerified(int stream, uint64_t, bool match, void *opaque) {
+    auto m = (SessionManager *) opaque;
+    m->cond.Lock();
+    auto s = m->Find(stream);
+    if (s) {
+        ++(match ? s->stats.hashes_verified : s->stats.hash_mismatches);
+    }
+    m->cond.Unlock();
+}
+
+/* reads back the last picture of s and hands it to the verifier, called
+ * without cond locked by whoever owns s, while no job of it is running */
+void SessionManager::Verify(Session *s) {
+    if (!s->unverified_ticket) {
+        return;
+    }
+    MappedPicture mapped;
+    if (s->backend->Map(s->unverified_ticket, &mapped)) {
+        verifier->Submit(s->id, s->unverified_number, mapped);
+        s->backend->Unmap();
+    }
+    s->unverified_ticket = 0;
+}
+
+/* called with cond locked, returns the next job to run and marks its session
+ * busy, or nullptr if no session has a job that can run now */
+SessionManager::Job *SessionManager::Pick() {
+    size_t n = sessions.size();
+    Session *best = nullptr;
+    if (policy == kScheduleRoundRobin) {
+        for (size_t i = 0; i < n; ++i) {
+            size_t j = (round_robin_next + i) % n;
+            auto s = sessions[j];
+            if (!s->busy && !s->jobs.empty()) {
+                best = s;
+                round_robin_next = j + 1;
+                break;
+            }
+        }
+    } else {
+        for (auto s : sessions) {
+            if (!s->busy && !s->jobs.empty()
+                && (!best || s->jobs.front()->deadline < best->jobs.front()->deadline)) {
+                best = s;
+            }
+        }
+    }
+    if (!best) {
+        return nullptr;
+    }
+    auto job = best->jobs.front();
+    best->jobs.pop_front();
+    best->busy = true;
+    return job;
+}
+
+void SessionManager::QueueMain(int queue) {
+    cond.Lock();
+    for (;;) {
+        auto job = Pick();
+        if (!job) {
+            if (quit) {
+                break;
+            }
+            cond.Wait();
+            continue;
+        }
+        auto s = job->session;
+        cond.Broadcast();
+        cond.Unlock();
+
+        uint64_t start = TraceNow();
+        {
+            TRACE_EVENT(2, "QueueDecode", s->id);
+            if (verifier && job->first_slice) {
+                Verify(s);
+            }
+            auto picture = job->hevc_picture ? job->hevc_picture->Get() : job->avc_picture->Get();
+            uint64_t ticket = s->backend->Submit(queue, picture);
+            if (!ticket) {
+                errx(1, "%s: submit failed for session %d", __PRETTY_FUNCTION__, s->id);
+            }
+            s->backend->Wait(ticket);
+            s->unverified_ticket = ticket;
+            s->unverified_number = job->number;
+        }
+        uint64_t end = TraceNow();
+        s->latency.Record(end - job->enqueued);
+
+        cond.Lock();
+        s->busy = false;
+        s->last_done = end;
+        auto &stats = s->stats;
+        ++stats.frames;
+        stats.key_frames += job->is_key;
+        stats.bytes += job->size;
+        stats.decode_ns += end - start;
+        stats.deadline_misses += end > job->deadline;
+        if (shed_load) {
+            ShedLoad(s, end > job->deadline);
+        }
+        delete job->hevc_picture;
+        delete job->avc_picture;
+        delete job;
+        cond.Broadcast();
+    }
+    cond.Unlock();
+}
+
+/* called with cond locked, after each picture of s is decoded. The pictures
+ * already parsed at the old sub-layer are let through before reacting to a
+ * change, as is the time the parser needs to get to a switching point. */
+void SessionManager::ShedLoad(Session *s, bool missed) {
+    int top = std::max(s->num_sub_layers - 1, 0);
+    int current = std::min(s->max_temporal_id, top);
+    ++s->pictures_since_change;
+    if (missed) {
+        s->pictures_on_time = 0;
+        if (current > 0 && s->pictures_since_change > (int) max_pending_jobs) {
+            s->max_temporal_id = current - 1;
+            s->pictures_since_change = 0;
+        }
+    } else if (++s->pictures_on_time >= shed_recovery_pictures && current < top) {
+        s->max_temporal_id = current + 1;
+        s->pictures_since_change = 0;
+        s->pictures_on_time = 0;
+    }
+}
+
+bool SessionManager::GetSessionStats(int id, SessionStats *stats) {
+    cond.Lock();
+    auto s = Find(id);
+    if (s) {
+        *stats = s->stats;
+        stats->elapsed_ns = s->last_done - s->first_enqueued;
+        stats->latency_p50_ns = s->latency.Percentile(0.5);
+        stats->latency_p99_ns = s->latency.Percentile(0.99);
+        stats->latency_max_ns = s->latency.Max();
+        stats->fps = stats->elapsed_ns ? stats->frames * 1e9 / stats->elapsed_ns : 0.0;
+        stats->max_temporal_id = s->max_temporal_id;
+    }
+    cond.Unlock();
+    return s != nullptr;
+}
+
+void SessionManager::DumpStats(FILE *f) {
+    std::vector<int> ids;
+    cond.Lock();
+    for (auto s : sessions) {
+        ids.push_back(s->id);
+    }
+    cond.Unlock();
+
+    fprintf(f, "%-8s %8s %10s %8s %10s %10s %10s %4s %8s %8s %8s\n",
+        "session", "frames", "fps", "missed", "p50 (us)", "p99 (us)", "max (us)", "tid", "dropped",
+        "hash ok", "hash bad");
+    for (auto id : ids) {
+        SessionStats stats;
+        if (!GetSessionStats(id, &stats)) {
+            continue;
+        }
+        fprintf(f, "%-8d %8llu %10.1f %8llu %10.1f %10.1f %10.1f %4d %8llu %8llu %8llu\n",
+            id,
+            (unsigned long long) stats.frames,
+            stats.fps,
+            (unsigned long long) stats.deadline_misses,
+            stats.latency_p50_ns / 1000.0,
+            stats.latency_p99_ns / 1000.0,
+            stats.latency_max_ns / 1000.0,
+            stats.max_temporal_id,
+            (unsigned long long) stats.nalus_dropped,
+            (unsigned long long) stats.hashes_verified,
+            (unsigned long long) stats.hash_mismatches);
+    }
+}
@@ -0,0 +1,207 @@
+#ifndef __SESSIONMANAGER_H__
+#define __SESSIONMANAGER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include "condition.h"
+#include "decodebackend.h"
+#include "latency.h"
+#include "picturehash.h"
+#include "workerpool.h"
+
+class AVCParser;
+class AVCPicture;
+class HEVCParser;
+class HEVCPicture;
+
+/* runs many decode sessions, e.g. one per camera, on one device with a fixed
+ * number of hardware queues. Input for every session is parsed on a shared
+ * pool of CPU workers, each parsed picture becomes a job on its session's
+ * queue, and one submission thread per hardware queue picks the next job
+ * across all sessions, either round robin or earliest deadline first.
+ *
+ * A session has at most one job running at a time, so its pictures decode in
+ * order and its reference state needs no locking, while different sessions
+ * run concurrently on different queues. Throttling is per session: a
+ * session with too many undecoded pictures queued up is left out of parsing
+ * until its queue drains, without holding up the parsing of the others, and
+ * ReceiveBytes() blocks while it has too much unparsed input.
+ *
+ * Sessions are H.264 or HEVC, parsed by AVCParser or HEVCParser as in
+ * DecodePipeline, which only this file's implementation depends on.
+ *
+ * With SetLoadShedding(), an HEVC session missing its deadlines drops its highest
+ * HEVC temporal sub-layer, halving its frame rate with dyadic GOPs, and takes
+ * it back once it keeps up again, see HEVCParser::SetMaxTemporalId().
+ *
+ * With SetVerification(), each decoded picture is read back and checked
+ * against the decoded picture hash SEI of an HEVC stream, if it has one, see
+ * picturehash.h.
+ *
+ * Everything device specific is behind DecodeDevice and DecodeBackend, so
+ * the scheduling can be run against a simulated device, see simbackend.h. */
+
+enum SchedulePolicy {
+    kScheduleRoundRobin,
+    kScheduleDeadline, // earliest deadline first
+};
+
+struct SessionStats {
+    uint64_t frames;
+    uint64_t key_frames;
+    uint64_t bytes;
+    uint64_t deadline_misses;
+    uint64_t decode_ns; // time spent on a queue
+    uint64_t elapsed_ns; // first picture parsed to last one decoded
+    uint64_t latency_p50_ns; // parsed to decoded
+    uint64_t latency_p99_ns;
+    uint64_t latency_max_ns;
+    double fps;
+    int max_temporal_id; // the sub-layers asked for, not yet switched to
+    uint64_t nalus_dropped; // with their sub-layer
+    uint64_t hashes_verified; // matching their picture hash SEI
+    uint64_t hash_mismatches;
+};
+
+class SessionManager {
+
+    struct Chunk {
+        uint8_t *bytes; // nullptr for the end of the stream
+        size_t size;
+    };
+
+    struct Session;
+
+    struct Job {
+        Session *session;
+        /* built from the slice by the session's parser, one of them set */
+        HEVCPicture *hevc_picture;
+        AVCPicture *avc_picture;
+        size_t size;
+        bool is_key;
+        bool first_slice;
+        uint64_t number; // of the picture, in decode order
+        uint64_t enqueued;
+        uint64_t deadline;
+    };
+
+    struct Session {
+        SessionManager *manager;
+        int id;
+        DecodeBackend *backend;
+        uint64_t latency_target;
+        VideoCodec codec;
+        HEVCParser *hevc_parser = nullptr; // as the codec says
+        AVCParser *avc_parser = nullptr;
+
+        std::deque<Chunk> input;
+        bool parsing = false; // owned by a parse worker
+        std::deque<Job *> jobs;
+        bool busy = false; // a job is running on a queue
+
+        /* applied to hevc_parser by the parse worker before each chunk */
+        int max_temporal_id = 6;
+        int num_sub_layers = 0;
+        int pictures_since_change = 0;
+        int pictures_on_time = 0;
+
+        /* the picture is read back for verification once all its slices
+         * have decoded, i.e. when the next one starts or the stream ends */
+        uint64_t pictures_parsed = 0;
+        uint64_t unverified_ticket = 0;
+        uint64_t unverified_number = 0;
+
+        SessionStats stats = {};
+        uint64_t first_enqueued = 0;
+        uint64_t last_done = 0;
+        LatencyHistogram latency;
+    };
+
+    DecodeDevice *device;
+    SchedulePolicy policy;
+    WorkerPool parse_pool;
+
+    Condition cond;
+    std::vector<Session *> sessions;
+    size_t round_robin_next = 0;
+    int next_id = 0;
+    bool quit = false;
+    bool shed_load = false;
+    bool hold_pictures = false;
+    PictureVerifier *verifier = nullptr;
+
+    std::thread parse_thread;
+    std::vector<std::thread> queue_threads;
+
+    static const size_t max_input_chunks = 8;
+    /* checked before each chunk is parsed, so a session can go over it by
+     * the pictures of one chunk */
+    static const size_t max_pending_jobs = 8;
+    /* decoded on time before taking back a sub-layer */
+    static const int shed_recovery_pictures = 120;
+
+    Session *Find(int id);
+    bool Idle(Session *s);
+    bool Throttled(Session *s);
+    static void Destroy(Session *s);
+    Job *Pick();
+    void ShedLoad(Session *s, bool missed);
+    void Verify(Session *s);
+
+    void ParseMain();
+    void QueueMain(int queue);
+    static void ParseTask(int task, void *opaque);
+    static void OnHEVCPicture(const uint8_t *bytes, size_t size, void *opaque);
+    static void OnAVCPicture(const uint8_t *bytes, size_t size, void *opaque);
+    void Enqueue(Session *s, Job *job, size_t size);
+    static void OnPictureHash(const PictureHash *hash, void *opaque);
+    static void OnVerified(int stream, uint64_t picture, bool match, void *opaque);
+
+public:
+    /* parse_threads is the size of the parse worker pool, 0 for one per
+     * hardware thread */
+    SessionManager(DecodeDevice *device, SchedulePolicy policy, int parse_threads = 0);
+    ~SessionManager();
+
+    SessionManager(const SessionManager &) = delete;
+    SessionManager &operator=(const SessionManager &) = delete;
+
+    /* latency_target is how long after being parsed each picture should be
+     * decoded, and sets its deadline. codec is kCodecHEVC or kCodecH264, see
+     * ProbeCodec() for streams it is not known for. Returns the session id,
+     * or -1 if the device has no session for the codec. */
+    int OpenSession(uint64_t latency_target_ns, VideoCodec codec = kCodecHEVC);
+    /* ends the stream and waits for everything the session has received to
+     * be decoded */
+    void CloseSession(int id);
+
+    /* copies bytes, blocking while the session is too far behind */
+    void ReceiveBytes(int id, const uint8_t *bytes, size_t size);
+
+    /* decode the session's temporal sub-layers up to temporal_id only, see
+     * HEVCParser::SetMaxTemporalId(). HEVC sessions only. */
+    void SetMaxTemporalId(int id, int temporal_id);
+    /* lower and raise each session's highest temporal sub-layer by its
+     * deadline misses, overriding SetMaxTemporalId() */
+    void SetLoadShedding(bool enable);
+    /* check decoded pictures against the picture hash SEI of their stream,
+     * for sessions opened from now on. Costs a readback of every picture. */
+    void SetVerification(bool enable);
+    /* drop HEVC pictures with a broken slice as a whole, for sessions
+     * opened from now on, see HEVCParser::SetHoldPictures() */
+    void SetHoldPictures(bool enable);
+
+    /* waits until every session is idle */
+    void Drain();
+
+    bool GetSessionStats(int id, SessionStats *stats);
+    void DumpStats(FILE *f);
+};
+
+#endif /* __SESSIONMANAGER_H__ */
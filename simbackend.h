@@ -0,0 +1,199 @@
+#ifndef __SIMBACKEND_H__
+#define __SIMBACKEND_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "decodebackend.h"
+#include "trace.h"
+
+/* a DecodeDevice with no hardware behind it, for running and benchmarking the
+ * pipeline on machines without a GPU. Each queue decodes one picture at a
+ * time, taking a fixed time per picture plus a time per byte of slice data,
+ * which is enough to model how a queue saturates as sessions are added.
+ *
+ * Memory is modelled the way the D3D12 backend allocates it: every session
+ * holds an NV12 surface per reference picture plus one for output, grown to
+ * the largest DPB seen and reallocated when the coded size changes. With a
+ * budget set, Submit() fails once the device would exceed it. */
+
+class SimulatedSession;
+
+class SimulatedDevice : public DecodeDevice {
+    friend class SimulatedSession;
+
+    uint64_t picture_ns;
+    uint64_t byte_ns;
+
+    std::mutex lock;
+    std::vector<uint64_t> busy_until; // per queue, in TraceNow() time
+    size_t budget = 0;
+    size_t total_bytes = 0;
+    size_t peak_bytes = 0;
+
+    /* returns when a picture of size bytes, submitted now, completes */
+    uint64_t schedule(int queue, size_t size) {
+        std::lock_guard<std::mutex> guard(lock);
+        auto &busy = busy_until[queue % busy_until.size()];
+        uint64_t now = TraceNow();
+        busy = (busy > now ? busy : now) + picture_ns + byte_ns * size;
+        return busy;
+    }
+
+    bool charge(size_t old_bytes, size_t new_bytes) {
+        std::lock_guard<std::mutex> guard(lock);
+        size_t total = total_bytes - old_bytes + new_bytes;
+        if (budget && new_bytes > old_bytes && total > budget) {
+            return false;
+        }
+        total_bytes = total;
+        if (total_bytes > peak_bytes) {
+            peak_bytes = total_bytes;
+        }
+        return true;
+    }
+
+public:
+    SimulatedDevice(int num_queues, uint64_t picture_ns, uint64_t byte_ns = 0)
+        : picture_ns(picture_ns), byte_ns(byte_ns), busy_until(num_queues) {
+    }
+
+    int NumQueues() {
+        return (int) busy_until.size();
+    }
+
+    inline DecodeBackend *OpenSession(VideoCodec codec);
+
+    /* 0 for no limit */
+    void SetBudget(size_t bytes) {
+        std::lock_guard<std::mutex> guard(lock);
+        budget = bytes;
+    }
+
+    size_t TotalBytes() {
+        std::lock_guard<std::mutex> guard(lock);
+        return total_bytes;
+    }
+
+    size_t PeakBytes() {
+        std::lock_guard<std::mutex> guard(lock);
+        return peak_bytes;
+    }
+};
+
+class SimulatedSession : public DecodeBackend {
+    SimulatedDevice *dev;
+
+    int width = 0;
+    int height = 0;
+    int num_references = 0;
+    size_t surface_bytes = 0;
+
+    /* completion times of tickets not yet known to have completed, oldest
+     * first; ticket n is completions[n - completed - 1] */
+    std::deque<uint64_t> completions;
+    uint64_t submitted = 0;
+    uint64_t completed = 0;
+
+    /* pictures referring to DPB slots outside the reference array, which
+     * real hardware would decode garbage from */
+    uint64_t invalid_refs = 0;
+
+    std::vector<uint8_t> output;
+
+    void retire(uint64_t ticket) {
+        uint64_t now = TraceNow();
+        while (completed < ticket && !completions.empty() && completions.front() <= now) {
+            completions.pop_front();
+            ++completed;
+        }
+    }
+
+public:
+    SimulatedSession(SimulatedDevice *dev)
+        : dev(dev) {
+    }
+
+    ~SimulatedSession() {
+        dev->charge(surface_bytes, 0);
+    }
+
+    uint64_t Submit(int queue, const DecodePicture *picture) {
+        int refs = picture->num_references > num_references ? picture->num_references : num_references;
+        if (picture->width != width || picture->height != height || refs != num_references) {
+            size_t bytes = (size_t) picture->width * picture->height * 3 / 2 * (refs + 1);
+            if (!dev->charge(surface_bytes, bytes)) {
+                return 0;
+            }
+            width = picture->width;
+            height = picture->height;
+            num_references = refs;
+            surface_bytes = bytes;
+        }
+        for (int i = 0; i < picture->num_refs; ++i) {
+            invalid_refs += picture->refs[i] < 0 || picture->refs[i] >= num_references;
+        }
+        completions.push_back(dev->schedule(queue, picture->bitstream_size + (picture->add_start_code ? 3 : 0)));
+        return ++submitted;
+    }
+
+    bool Poll(uint64_t ticket) {
+        retire(ticket);
+        return completed >= ticket;
+    }
+
+    void Wait(uint64_t ticket) {
+        while (!Poll(ticket)) {
+            uint64_t due = completions[ticket - completed - 1];
+            uint64_t now = TraceNow();
+            if (due > now) {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(due - now));
+            }
+        }
+    }
+
+    bool Map(uint64_t ticket, MappedPicture *picture) {
+        if (ticket != submitted || !ticket) {
+            return false;
+        }
+        Wait(ticket);
+        output.resize((size_t) width * height * 3 / 2);
+        picture->y = output.data();
+        picture->y_stride = width;
+        picture->uv = output.data() + (size_t) width * height;
+        picture->uv_stride = width;
+        picture->width = width;
+        picture->height = height;
+        return true;
+    }
+
+    void Unmap() {
+    }
+
+    void GetStats(DecodeBackendStats *stats) {
+        stats->surface_bytes = surface_bytes;
+        stats->staging_bytes = output.capacity();
+        stats->surface_sets = surface_bytes ? 1 : 0;
+        stats->num_references = num_references;
+        stats->submitted = submitted;
+        stats->completed = completed;
+    }
+
+    uint64_t InvalidReferences() {
+        return invalid_refs;
+    }
+};
+
+inline DecodeBackend *SimulatedDevice::OpenSession(VideoCodec) {
+    /* the model never looks inside the parameter buffers, so any codec will
+     * do */
+    return new SimulatedSession(this);
+}
+
+#endif /* __SIMBACKEND_H__ */
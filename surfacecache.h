@@ -0,0 +1,194 @@
+#ifndef __SURFACECACHE_H__
+#define __SURFACECACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <list>
+#include <unordered_map>
+
+/* cache of per-resolution decoder state (decoder heap, output texture and
+ * reference texture array), so that a resolution change, as on every ABR
+ * switch, can reuse surfaces created earlier or ahead of time by Prewarm()
+ * instead of stalling the next frame on their creation. Entries are evicted
+ * least recently used first once the cache is over its memory budget, except
+ * for the one most recently handed out by Acquire(), which the decoder may
+ * still be using. An entry serves any request for at most as many reference
+ * pictures as it was created with, and is replaced by a larger one when a
+ * stream needs more.
+ *
+ * Devices are reached through SurfaceAllocator only. The cache does no
+ * locking, callers must serialize access (the decoder only touches it from
+ * the thread calling ReceiveBytes()). */
+
+struct DecodeSurfaces {
+    void *heap;
+    void *output;
+    void *references;
+    int num_references; // slices in the reference texture array
+    size_t bytes; // device memory used by all of the above
+};
+
+struct Resolution {
+    int width, height;
+};
+
+class SurfaceAllocator {
+public:
+    virtual ~SurfaceAllocator() {
+    }
+
+    /* fill in s for the given coded size with room for num_references
+     * reference pictures, returns false on failure */
+    virtual bool Create(int width, int height, int num_references, DecodeSurfaces *s) = 0;
+    virtual void Destroy(DecodeSurfaces *s) = 0;
+};
+
+class SurfaceCache {
+
+public:
+    struct Stats {
+        size_t entries;
+        size_t bytes;
+        size_t hits;
+        size_t misses;
+        size_t prewarmed;
+        size_t evictions;
+    };
+
+private:
+    struct Entry {
+        int width, height;
+        DecodeSurfaces surfaces;
+    };
+
+    typedef std::list<Entry>::iterator entry_iterator;
+
+    SurfaceAllocator *allocator;
+    size_t budget;
+    std::list<Entry> lru; // most recently used first
+    std::unordered_map<uint64_t, entry_iterator> index;
+    Entry *current = nullptr;
+    Stats stats = {};
+
+    static uint64_t Key(int width, int height) {
+        return ((uint64_t) (uint32_t) width << 32) | (uint32_t) height;
+    }
+
+    void Remove(entry_iterator it) {
+        allocator->Destroy(&it->surfaces);
+        stats.bytes -= it->surfaces.bytes;
+        --stats.entries;
+        index.erase(Key(it->width, it->height));
+        lru.erase(it);
+    }
+
+    void Evict() {
+        auto it = lru.end();
+        while (stats.bytes > budget && it != lru.begin()) {
+            --it;
+            if (&*it == current) {
+                continue;
+            }
+            auto victim = it++;
+            Remove(victim);
+            ++stats.evictions;
+        }
+    }
+
+    Entry *Insert(int width, int height, int num_references) {
+        Entry e = { width, height, {} };
+        if (!allocator->Create(width, height, num_references, &e.surfaces)) {
+            return nullptr;
+        }
+        lru.push_front(e);
+        index[Key(width, height)] = lru.begin();
+        stats.bytes += e.surfaces.bytes;
+        ++stats.entries;
+        return &lru.front();
+    }
+
+public:
+    SurfaceCache(SurfaceAllocator *allocator, size_t budget = SIZE_MAX)
+        : allocator(allocator), budget(budget) {
+    }
+
+    ~SurfaceCache() {
+        Clear();
+    }
+
+    SurfaceCache(const SurfaceCache &) = delete;
+    SurfaceCache &operator=(const SurfaceCache &) = delete;
+
+    /* surfaces for the given coded size, creating them on a miss. The result
+     * stays valid until the next call to Acquire(), SetBudget() or Clear().
+     * Returns nullptr if the allocator fails. */
+    const DecodeSurfaces *Acquire(int width, int height, int num_references) {
+        auto i = index.find(Key(width, height));
+        if (i != index.end()) {
+            if (i->second->surfaces.num_references >= num_references) {
+                ++stats.hits;
+                lru.splice(lru.begin(), lru, i->second);
+                current = &lru.front();
+                return &current->surfaces;
+            }
+            if (&*i->second == current) {
+                current = nullptr;
+            }
+            Remove(i->second);
+        }
+        ++stats.misses;
+        auto e = Insert(width, height, num_references);
+        if (!e) {
+            return nullptr;
+        }
+        current = e;
+        Evict();
+        return &current->surfaces;
+    }
+
+    /* create surfaces for every resolution not already cached, in order, so
+     * if they do not all fit in the budget the last ones listed win. Returns
+     * the number of entries created. */
+    int Prewarm(const Resolution *resolutions, int count, int num_references) {
+        int n = 0;
+        for (int i = 0; i < count; ++i) {
+            auto &r = resolutions[i];
+            auto j = index.find(Key(r.width, r.height));
+            if (j != index.end()) {
+                if (j->second->surfaces.num_references >= num_references || &*j->second == current) {
+                    continue;
+                }
+                Remove(j->second);
+            }
+            if (Insert(r.width, r.height, num_references)) {
+                ++stats.prewarmed;
+                ++n;
+                Evict();
+            }
+        }
+        return n;
+    }
+
+    bool Contains(int width, int height) const {
+        return index.count(Key(width, height)) != 0;
+    }
+
+    void SetBudget(size_t bytes) {
+        budget = bytes;
+        Evict();
+    }
+
+    void Clear() {
+        while (!lru.empty()) {
+            Remove(lru.begin());
+        }
+        current = nullptr;
+    }
+
+    void GetStats(Stats *s) const {
+        *s = stats;
+    }
+};
+
+#endif /* __SURFACECACHE_H__ */
@@ -0,0 +1,235 @@
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "codecprobe.h"
+#include "latency.h"
+#include "testutil.h"
+
+/* runs ProbeCodec() over a corpus of probe-sized windows: the start of the
+ * HEVC sample and of a synthetic H.264 stream, both streams joined at points
+ * spread over them, as when tuning in, and noise with and without start
+ * codes. Every window must be identified as its codec or not at all, the
+ * start of each stream and most joins identified. Prints the accuracy and
+ * probe latency. */
+
+static uint8_t random_byte() {
+    return (uint8_t) (next_random() >> 8);
+}
+
+/* RBSP bits, written out as a NALU with emulation prevention */
+class BitWriter {
+    Bytes bytes;
+    int bits = 0;
+
+public:
+    void U(int n, uint32_t value) {
+        for (int i = n - 1; i >= 0; --i) {
+            if (!bits) {
+                bytes.push_back(0);
+            }
+            bytes.back() |= ((value >> i) & 1) << (7 - bits);
+            bits = (bits + 1) & 7;
+        }
+    }
+
+    void UE(uint32_t value) {
+        int n = 0;
+        while ((value + 1) >> (n + 1)) {
+            ++n;
+        }
+        U(n, 0);
+        U(n + 1, value + 1);
+    }
+
+    void SE(int32_t value) {
+        UE(value > 0 ? 2 * value - 1 : -2 * value);
+    }
+
+    /* slice data, which the probe never looks at, without zero bytes */
+    void Filler(size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            U(8, random_byte() | 0x80);
+        }
+    }
+
+    void AppendTo(Bytes *out) {
+        U(1, 1); // rbsp_stop_one_bit
+        bits = 0;
+        out->insert(out->end(), { 0, 0, 0, 1 });
+        int zeros = 0;
+        for (auto b : bytes) {
+            if (zeros >= 2 && b <= 3) {
+                out->push_back(3);
+                zeros = 0;
+            }
+            out->push_back(b);
+            zeros = b ? 0 : zeros + 1;
+        }
+        bytes.clear();
+    }
+};
+
+/* baseline profile 320x240, parameter sets and an IDR picture every 30
+ * pictures and P pictures in between, one slice each */
+static Bytes h264_stream(int pictures) {
+    Bytes out;
+    BitWriter w;
+    int frame_num = 0;
+    for (int i = 0; i < pictures; ++i) {
+        bool idr = i % 30 == 0;
+        if (idr) {
+            w.U(8, 0x67); // nal_ref_idc 3, SPS
+            w.U(8, 66); // profile_idc
+            w.U(8, 0xc0); // constraint flags
+            w.U(8, 30); // level_idc
+            w.UE(0); // seq_parameter_set_id
+            w.UE(0); // log2_max_frame_num_minus4
+            w.UE(2); // pic_order_cnt_type
+            w.UE(1); // max_num_ref_frames
+            w.U(1, 0); // gaps_in_frame_num_value_allowed_flag
+            w.UE(19); // pic_width_in_mbs_minus1
+            w.UE(14); // pic_height_in_map_units_minus1
+            w.U(1, 1); // frame_mbs_only_flag
+            w.U(1, 1); // direct_8x8_inference_flag
+            w.U(1, 0); // frame_cropping_flag
+            w.U(1, 0); // vui_parameters_present_flag
+            w.AppendTo(&out);
+
+            w.U(8, 0x68); // nal_ref_idc 3, PPS
+            w.UE(0); // pic_parameter_set_id
+            w.UE(0); // seq_parameter_set_id
+            w.U(1, 0); // entropy_coding_mode_flag
+            w.U(1, 0); // bottom_field_pic_order_in_frame_present_flag
+            w.UE(0); // num_slice_groups_minus1
+            w.UE(0); // num_ref_idx_l0_default_active_minus1
+            w.UE(0); // num_ref_idx_l1_default_active_minus1
+            w.U(1, 0); // weighted_pred_flag
+            w.U(2, 0); // weighted_bipred_idc
+            w.SE(0); // pic_init_qp_minus26
+            w.SE(0); // pic_init_qs_minus26
+            w.SE(0); // chroma_qp_index_offset
+            w.U(1, 1); // deblocking_filter_control_present_flag
+            w.U(1, 0); // constrained_intra_pred_flag
+            w.U(1, 0); // redundant_pic_cnt_present_flag
+            w.AppendTo(&out);
+            frame_num = 0;
+        }
+        w.U(8, idr ? 0x65 : 0x41); // IDR slice, or non-IDR slice with nal_ref_idc 2
+        w.UE(0); // first_mb_in_slice
+        w.UE(idr ? 7 : 5); // slice_type, all I or all P
+        w.UE(0); // pic_parameter_set_id
+        w.U(4, frame_num);
+        if (idr) {
+            w.UE((i / 30) & 1); // idr_pic_id
+        } else {
+            w.U(1, 0); // num_ref_idx_active_override_flag
+            w.U(1, 0); // ref_pic_list_modification_flag_l0
+        }
+        /* dec_ref_pic_marking() */
+        w.U(1, 0); // no_output_of_prior_pics_flag or adaptive_ref_pic_marking_mode_flag
+        if (idr) {
+            w.U(1, 0); // long_term_reference_flag
+        }
+        w.SE(0); // slice_qp_delta
+        w.UE(1); // disable_deblocking_filter_idc
+        w.Filler(idr ? 4000 : 400 + random_byte() * 4);
+        w.AppendTo(&out);
+        frame_num = (frame_num + 1) % 16;
+    }
+    return out;
+}
+
+static Bytes noise(size_t size, bool start_codes) {
+    Bytes out(size);
+    for (auto &b : out) {
+        b = random_byte();
+    }
+    for (size_t i = 0; start_codes && i + 4 < size; i += 64 + random_byte() * 4) {
+        out[i] = out[i + 1] = 0;
+        out[i + 2] = 1;
+    }
+    return out;
+}
+
+struct Accuracy {
+    const char *name;
+    int windows = 0;
+    int identified = 0;
+    int unknown = 0;
+    int wrong = 0;
+};
+
+static LatencyHistogram latency;
+
+static void probe(Accuracy *a, const uint8_t *bytes, size_t size, VideoCodec expected) {
+    CodecProbeResult result;
+    ProbeCodec(bytes, std::min(size, CodecProbe::kMaxProbeSize), &result);
+    latency.Record(result.ns);
+    ++a->windows;
+    if (result.codec == kCodecUnknown) {
+        ++a->unknown;
+    } else if (result.codec == expected) {
+        ++a->identified;
+    } else {
+        ++a->wrong;
+        warnx("%s: window %d taken for codec %d", a->name, a->windows - 1, result.codec);
+    }
+}
+
+/* the start of stream, which must be identified, then joins at windows
+ * points spread over it */
+static void probe_stream(Accuracy *a, const Bytes &stream, VideoCodec expected, int windows) {
+    probe(a, stream.data(), stream.size(), expected);
+    if (a->identified != 1) {
+        errx(1, "%s: start of stream not identified", a->name);
+    }
+    for (int i = 1; i <= windows; ++i) {
+        size_t offset = stream.size() * i / (windows + 1);
+        probe(a, stream.data() + offset, stream.size() - offset, expected);
+    }
+    /* both streams repeat their parameter sets often enough for most
+     * windows to hold a set and a slice after it */
+    if (a->identified < windows * 3 / 4) {
+        errx(1, "%s: %d of %d joins identified", a->name, a->identified - 1, windows);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        errx(1, "usage: %s hevc-stream", argv[0]);
+    }
+    Bytes hevc = read_file(argv[1]);
+
+    const int windows = 64;
+    Accuracy corpus[4];
+    corpus[0].name = "HEVC";
+    probe_stream(&corpus[0], hevc, kCodecHEVC, windows);
+    corpus[1].name = "H.264";
+    probe_stream(&corpus[1], h264_stream(300), kCodecH264, windows);
+    corpus[2].name = "noise";
+    corpus[3].name = "noise with start codes";
+    for (int i = 0; i < windows; ++i) {
+        for (int start_codes = 0; start_codes < 2; ++start_codes) {
+            Bytes n = noise(CodecProbe::kMaxProbeSize, start_codes);
+            probe(&corpus[2 + start_codes], n.data(), n.size(), kCodecUnknown);
+        }
+    }
+
+    int wrong = 0;
+    for (auto &a : corpus) {
+        printf("%-24s %3d windows, %3d identified, %3d unknown, %d wrong\n", a.name, a.windows, a.identified,
+            a.unknown, a.wrong);
+        wrong += a.wrong;
+    }
+    printf("probe latency: p50 %.1f us, p99 %.1f us, max %.1f us\n", latency.Percentile(0.5) / 1e3,
+        latency.Percentile(0.99) / 1e3, latency.Max() / 1e3);
+    if (wrong) {
+        errx(1, "%d windows taken for the wrong codec", wrong);
+    }
+    printf("ok\n");
+    return 0;
+}
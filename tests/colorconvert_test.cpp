@@ -0,0 +1,171 @@
+#include <err.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "colorconvert.h"
+#include "testutil.h"
+
+/* checks ColorConverter against a floating point conversion, the cropped and
+ * scaled path against the plain one, and that large downscales keep the
+ * brightness of the picture */
+
+static uint8_t next_byte() {
+    return (uint8_t) (next_random() >> 8);
+}
+
+/* NV12, each UV row holding a pair for every two columns, the last one of
+ * an odd width included */
+struct Picture {
+    int width, height, uv_stride;
+    std::vector<uint8_t> y, uv;
+
+    Picture(int width, int height)
+        : width(width), height(height), uv_stride((width + 1) & ~1), y((size_t) width * height),
+          uv((size_t) uv_stride * ((height + 1) / 2)) {
+    }
+};
+
+static uint8_t reference(const Picture &p, int x, int y, int channel, ColorMatrix matrix, ColorRange range) {
+    double kr = matrix == kMatrixBT601 ? 0.299 : matrix == kMatrixBT2020 ? 0.2627 : 0.2126;
+    double kb = matrix == kMatrixBT601 ? 0.114 : matrix == kMatrixBT2020 ? 0.0593 : 0.0722;
+    double kg = 1.0 - kr - kb;
+    double l = p.y[(size_t) y * p.width + x];
+    const uint8_t *c = &p.uv[(size_t) (y / 2) * p.uv_stride + (x & ~1)];
+    double cb = c[0] - 128.0, cr = c[1] - 128.0;
+    if (range == kRangeStudio) {
+        l = (l - 16) * 255 / 219;
+        cb *= 255.0 / 224;
+        cr *= 255.0 / 224;
+    }
+    double rgb[3] = {
+        l + 2 * (1 - kr) * cr,
+        l - 2 * kb * (1 - kb) / kg * cb - 2 * kr * (1 - kr) / kg * cr,
+        l + 2 * (1 - kb) * cb,
+    };
+    double v = floor(rgb[channel] + 0.5);
+    return v < 0 ? 0 : v > 255 ? 255 : (uint8_t) v;
+}
+
+static void check_convert(ColorConverter *converter, ColorMatrix matrix, ColorRange range) {
+    /* odd sizes leave a tail for the scalar code after the SIMD kernels */
+    Picture p(37, 11);
+    for (auto &b : p.y) {
+        b = next_byte();
+    }
+    for (auto &b : p.uv) {
+        b = next_byte();
+    }
+    converter->SetColorSpace(matrix, range);
+    std::vector<uint8_t> rgba((size_t) p.width * p.height * 4);
+    converter->Convert(p.y.data(), p.width, p.uv.data(), p.uv_stride, rgba.data(), p.width * 4, p.width, p.height);
+    for (int y = 0; y < p.height; ++y) {
+        for (int x = 0; x < p.width; ++x) {
+            const uint8_t *px = &rgba[((size_t) y * p.width + x) * 4];
+            for (int ch = 0; ch < 3; ++ch) {
+                int expected = reference(p, x, y, ch, matrix, range);
+                if (abs(px[ch] - expected) > 1) {
+                    errx(1, "matrix %d range %d: pixel %d,%d channel %d is %d, expected %d", matrix, range, x, y, ch,
+                        px[ch], expected);
+                }
+            }
+            if (px[3] != 0xff) {
+                errx(1, "pixel %d,%d is not opaque", x, y);
+            }
+        }
+    }
+}
+
+/* at 1:1 the scaled path only crops, and must agree with Convert() on the
+ * cropped region. Chroma is interpolated rather than repeated there, so it
+ * is flat inside the crop, and far off outside it to catch any that leaks
+ * in. */
+static void check_crop(const ColorConverter &converter) {
+    Picture p(64, 48);
+    CropRect crop = { 8, 4, 40, 30 };
+    for (int y = 0; y < p.height; ++y) {
+        for (int x = 0; x < p.width; ++x) {
+            p.y[(size_t) y * p.width + x] = (uint8_t) (16 + (x * 3 + y * 2) % 200);
+        }
+    }
+    for (int y = 0; y < p.height / 2; ++y) {
+        for (int x = 0; x < p.width; x += 2) {
+            bool inside = x >= crop.x && x < crop.x + crop.width && y >= crop.y / 2 && y < (crop.y + crop.height) / 2;
+            p.uv[(size_t) y * p.width + x] = inside ? 150 : 20;
+            p.uv[(size_t) y * p.width + x + 1] = inside ? 100 : 240;
+        }
+    }
+    std::vector<uint8_t> plain((size_t) crop.width * crop.height * 4), scaled(plain.size());
+    converter.Convert(p.y.data() + crop.y * p.width + crop.x, p.width,
+        p.uv.data() + (crop.y / 2) * p.width + crop.x, p.width,
+        plain.data(), crop.width * 4, crop.width, crop.height);
+    for (ScaleFilter filter : { kScaleBilinear, kScaleLanczos3 }) {
+        converter.ConvertScaled(p.y.data(), p.width, p.uv.data(), p.width, crop,
+            scaled.data(), crop.width * 4, crop.width, crop.height, filter);
+        for (size_t i = 0; i < plain.size(); ++i) {
+            if (abs(plain[i] - scaled[i]) > 1) {
+                errx(1, "filter %d: cropped byte %zu is %d, expected %d", filter, i, scaled[i], plain[i]);
+            }
+        }
+    }
+}
+
+/* a flat picture stays flat however far it is scaled down, which needs
+ * filters with far more than 256 taps at these ratios */
+static void check_flat_downscale(const ColorConverter &converter) {
+    Picture p(4096, 64);
+    for (auto &b : p.y) {
+        b = 180;
+    }
+    for (auto &b : p.uv) {
+        b = 128;
+    }
+    std::vector<uint8_t> expected(4), scaled(16 * 4 * 4);
+    converter.Convert(p.y.data(), p.width, p.uv.data(), p.width, expected.data(), 4, 1, 1);
+    CropRect crop = { 0, 0, p.width, p.height };
+    for (ScaleFilter filter : { kScaleBilinear, kScaleLanczos3 }) {
+        converter.ConvertScaled(p.y.data(), p.width, p.uv.data(), p.width, crop, scaled.data(), 16 * 4, 16, 4, filter);
+        for (size_t i = 0; i < scaled.size(); ++i) {
+            if (abs(scaled[i] - expected[i % 4]) > 1) {
+                errx(1, "filter %d: downscaled byte %zu is %d, expected %d", filter, i, scaled[i], expected[i % 4]);
+            }
+        }
+    }
+}
+
+static void check_vui() {
+    ColorMatrix matrix;
+    ColorRange range;
+    ColorSpaceFromVUI(1, false, 2160, &matrix, &range);
+    if (matrix != kMatrixBT709 || range != kRangeStudio) {
+        errx(1, "BT.709 studio range VUI mapped wrongly");
+    }
+    ColorSpaceFromVUI(9, true, 2160, &matrix, &range);
+    if (matrix != kMatrixBT2020 || range != kRangeFull) {
+        errx(1, "BT.2020 full range VUI mapped wrongly");
+    }
+    ColorSpaceFromVUI(2, false, 480, &matrix, &range);
+    if (matrix != kMatrixBT601) {
+        errx(1, "unspecified matrix at 480 lines is not BT.601");
+    }
+    ColorSpaceFromVUI(2, false, 1080, &matrix, &range);
+    if (matrix != kMatrixBT709) {
+        errx(1, "unspecified matrix at 1080 lines is not BT.709");
+    }
+}
+
+int main() {
+    ColorConverter converter(kPixelNV12, kPixelRGBA, kMatrixBT709, kRangeStudio);
+    check_convert(&converter, kMatrixBT709, kRangeStudio);
+    check_convert(&converter, kMatrixBT601, kRangeFull);
+    check_convert(&converter, kMatrixBT2020, kRangeStudio);
+    converter.SetColorSpace(kMatrixBT709, kRangeStudio);
+    check_crop(converter);
+    check_flat_downscale(converter);
+    check_vui();
+    printf("ok (%s kernels)\n", converter.KernelName());
+    return 0;
+}
@@ -0,0 +1,246 @@
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "fileio.h"
+#include "hevcindex.h"
+#include "hevcparser.h"
+#include "testutil.h"
+
+/* indexes the HEVC sample, as it is and with its parameter sets only at the
+ * start, and checks the random access points against those found by
+ * splitting it here, that the sidecar saves, loads and maps back to the
+ * same index and is turned down once stale, that Find() picks the right
+ * point for every picture, and that decoding resumes without errors from
+ * each point with the parameter sets GetResumeParamSets() gives */
+
+static bool is_vcl(int type) {
+    return type <= H265NALU::RSV_IRAP_VCL23;
+}
+
+static bool is_param_set(int type) {
+    return type >= H265NALU::VPS_NUT && type <= H265NALU::PPS_NUT;
+}
+
+/* a stream of NALUs with 4-byte start codes, and what its index should
+ * hold */
+struct Stream {
+    Bytes bytes;
+    uint32_t pictures = 0;
+    std::vector<uint64_t> point_offsets;
+    std::vector<uint32_t> point_pictures;
+    FILE *file;
+
+    /* with only_first_param_sets, the parameter sets after the first IRAP
+     * picture are left out */
+    Stream(const std::vector<Bytes> &nalus, bool only_first_param_sets) {
+        uint64_t au_start = 0;
+        bool after_vcl = true;
+        for (auto &n : nalus) {
+            int t = hevc_type(n);
+            if (only_first_param_sets && is_param_set(t) && pictures) {
+                continue;
+            }
+            if (after_vcl && !is_vcl(t)) {
+                au_start = bytes.size();
+                after_vcl = false;
+            }
+            if (is_vcl(t)) {
+                if (t >= H265NALU::BLA_W_LP && t <= H265NALU::CRA_NUT) {
+                    point_offsets.push_back(after_vcl ? bytes.size() : au_start);
+                    point_pictures.push_back(pictures);
+                }
+                after_vcl = true;
+                ++pictures;
+            }
+            bytes.insert(bytes.end(), { 0, 0, 0, 1 });
+            bytes.insert(bytes.end(), n.begin(), n.end());
+        }
+        file = tmpfile();
+        if (!file || fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size()) {
+            err(1, "unable to write a temporary file");
+        }
+    }
+
+    ~Stream() {
+        fclose(file);
+    }
+};
+
+static void check_points(const HEVCIndex &index, const Stream &s, const char *name) {
+    if (index.NumPictures() != s.pictures || index.NumPoints() != s.point_offsets.size()
+        || index.StreamSize() != s.bytes.size()) {
+        errx(1, "%s: %u pictures and %zu random access points indexed, expected %u and %zu", name,
+            index.NumPictures(), index.NumPoints(), s.pictures, s.point_offsets.size());
+    }
+    for (size_t i = 0; i < index.NumPoints(); ++i) {
+        auto &p = index.GetPoint(i);
+        if (p.offset != s.point_offsets[i] || p.picture != s.point_pictures[i] || p.poc != 0
+            || p.nal_unit_type != H265NALU::IDR_N_LP) {
+            errx(1, "%s: point %zu at offset %llu, picture %u, POC %d, expected offset %llu, picture %u", name, i,
+                (unsigned long long) p.offset, p.picture, p.poc, (unsigned long long) s.point_offsets[i],
+                s.point_pictures[i]);
+        }
+        uint32_t entries[3] = { p.vps, p.sps, p.pps };
+        for (int j = 0; j < 3; ++j) {
+            if (entries[j] == HEVCIndex::kNone
+                || index.GetParamSet(entries[j]).nal_unit_type != H265NALU::VPS_NUT + j) {
+                errx(1, "%s: point %zu refers to parameter set entry %u", name, i, entries[j]);
+            }
+        }
+    }
+}
+
+static bool same_index(const HEVCIndex &a, const HEVCIndex &b) {
+    if (a.NumParamSets() != b.NumParamSets() || a.NumPoints() != b.NumPoints()
+        || a.NumPictures() != b.NumPictures() || a.StreamSize() != b.StreamSize()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.NumParamSets(); ++i) {
+        if (memcmp(&a.GetParamSet(i), &b.GetParamSet(i), sizeof(HEVCIndex::ParamSet))) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < a.NumPoints(); ++i) {
+        if (memcmp(&a.GetPoint(i), &b.GetPoint(i), sizeof(HEVCIndex::RandomAccessPoint))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void check_sidecar(const HEVCIndex &index) {
+    FILE *f = tmpfile();
+    if (!f) {
+        err(1, "unable to create a temporary file");
+    }
+    if (!index.Save(f)) {
+        errx(1, "unable to save the index");
+    }
+    size_t size = (size_t) file_size64(f);
+
+    rewind(f);
+    HEVCIndex loaded;
+    if (!loaded.Load(f, index.StreamSize()) || !same_index(index, loaded)) {
+        errx(1, "index not the same loaded back");
+    }
+    rewind(f);
+    if (loaded.Load(f, index.StreamSize() + 1)) {
+        errx(1, "sidecar loaded for a stream of another size");
+    }
+
+    /* 8-byte aligned, as a mapping would be */
+    std::vector<uint64_t> image((size + 7) / 8 + 1);
+    rewind(f);
+    if (fread(image.data(), 1, size, f) != size) {
+        errx(1, "unable to read the sidecar back");
+    }
+    fclose(f);
+    HEVCIndex mapped;
+    auto bytes = (const uint8_t *) image.data();
+    if (!mapped.Map(bytes, size, index.StreamSize()) || !same_index(index, mapped)) {
+        errx(1, "index not the same mapped");
+    }
+    if (mapped.Map(bytes, size - 1, index.StreamSize()) || mapped.NumPoints()) {
+        errx(1, "truncated sidecar mapped");
+    }
+    memmove((uint8_t *) image.data() + 4, bytes, size);
+    if (mapped.Map(bytes + 4, size, index.StreamSize())) {
+        errx(1, "misaligned sidecar mapped");
+    }
+}
+
+static void check_find(const HEVCIndex &index) {
+    for (uint32_t picture = 0; picture < index.NumPictures() + 10; ++picture) {
+        size_t expected = 0;
+        while (expected + 1 < index.NumPoints() && index.GetPoint(expected + 1).picture <= picture) {
+            ++expected;
+        }
+        auto p = index.Find(picture);
+        if (p != &index.GetPoint(expected)) {
+            errx(1, "picture %u found at point %d, expected %zu", picture, p ? (int) (p - &index.GetPoint(0)) : -1,
+                expected);
+        }
+    }
+}
+
+static void on_slice(const uint8_t *, size_t, void *opaque) {
+    ++*(uint32_t *) opaque;
+}
+
+/* decodes s from each random access point, after the parameter sets it
+ * needs, expecting resume_param_sets of them from before the point */
+static void check_resume(const HEVCIndex &index, const Stream &s, int resume_param_sets, const char *name) {
+    for (size_t i = 0; i < index.NumPoints(); ++i) {
+        auto &p = index.GetPoint(i);
+        const HEVCIndex::ParamSet *param_sets[3];
+        int n = index.GetResumeParamSets(p, param_sets);
+        int expected = i ? resume_param_sets : 0;
+        if (n != expected) {
+            errx(1, "%s: %d parameter sets to resume at point %zu, expected %d", name, n, i, expected);
+        }
+
+        uint32_t slices = 0;
+        HEVCParser parser;
+        for (int j = 0; j < n; ++j) {
+            if (param_sets[j]->nal_unit_type != H265NALU::VPS_NUT + j) {
+                errx(1, "%s: parameter sets to resume at point %zu out of order", name, i);
+            }
+            parser.PushNALU(s.bytes.data() + param_sets[j]->offset, param_sets[j]->size, on_slice, &slices);
+        }
+        parser.Parse(s.bytes.data() + p.offset, s.bytes.size() - p.offset, on_slice, &slices);
+        parser.Flush(on_slice, &slices);
+        HEVCParser::ErrorStats errors;
+        parser.GetErrorStats(&errors);
+        if (slices != s.pictures - p.picture || errors.errors || errors.nals_dropped) {
+            errx(1, "%s: %u of %u pictures decoded from point %zu, %zu errors, %zu NALUs dropped", name, slices,
+                s.pictures - p.picture, i, errors.errors, errors.nals_dropped);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        errx(1, "usage: %s hevc-stream", argv[0]);
+    }
+    Bytes sample = read_file(argv[1]);
+    auto nalus = split_nalus(sample);
+
+    FILE *f = fopen(argv[1], "rb");
+    if (!f) {
+        err(1, "unable to open %s", argv[1]);
+    }
+    HEVCIndex index;
+    if (!index.Build(f) || index.StreamSize() != sample.size() || index.NumPoints() < 2) {
+        errx(1, "%s: %zu random access points indexed", argv[1], index.NumPoints());
+    }
+    fclose(f);
+
+    Stream full(nalus, false);
+    if (!index.Build(full.file)) {
+        errx(1, "unable to index the sample");
+    }
+    check_points(index, full, "sample");
+    check_sidecar(index);
+    check_find(index);
+    /* each access unit holds its own parameter sets */
+    check_resume(index, full, 0, "sample");
+
+    Stream stripped(nalus, true);
+    if (!index.Build(stripped.file)) {
+        errx(1, "unable to index the sample without repeated parameter sets");
+    }
+    check_points(index, stripped, "without repeated parameter sets");
+    check_resume(index, stripped, 3, "without repeated parameter sets");
+
+    Stream none({ nalus.back() }, false);
+    if (index.Build(none.file) || index.NumPoints()) {
+        errx(1, "random access point indexed in a stream of one non-IRAP slice");
+    }
+    printf("ok (%zu random access points)\n", full.point_offsets.size());
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "hevcparser.h"
+#include "testutil.h"
+
+/* checks HEVCParser's handling of a picture with a broken slice after a
+ * good one: with SetHoldPictures() nothing of it is passed on, and decoding
+ * resumes at the next IRAP picture. Also checks that holding pictures passes
+ * on exactly what the parser does without it for an intact stream, and that
+ * references missing from the DPB are stood in for while there is anything
+ * to stand in, and drop pictures up to the next IRAP picture once not. */
+
+static Bytes stream;
+
+struct Passed {
+    std::vector<Bytes> slices;
+};
+
+static void on_slice(const uint8_t *bytes, size_t size, void *opaque) {
+    ((Passed *) opaque)->slices.emplace_back(bytes, bytes + size);
+}
+
+static void check_broken_slice(bool hold) {
+    auto nalus = split_nalus(stream);
+    HEVCParser parser;
+    parser.SetHoldPictures(hold);
+    Passed passed;
+
+    /* the parameter sets, then the first IRAP picture, with a second slice
+     * whose PPS id is out of range */
+    const Bytes *irap = nullptr;
+    for (auto &n : nalus) {
+        if (hevc_type(n) >= H265NALU::VPS_NUT && hevc_type(n) <= H265NALU::PPS_NUT) {
+            parser.PushNALU(n.data(), n.size(), on_slice, &passed);
+        } else if (hevc_type(n) >= H265NALU::BLA_W_LP && hevc_type(n) <= H265NALU::CRA_NUT && !irap) {
+            irap = &n;
+        }
+    }
+    if (!irap) {
+        errx(1, "no IRAP picture in the stream");
+    }
+    Bytes broken = { (*irap)[0], (*irap)[1], 0x00, 0x00, 0x00, 0x00, 0x80 };
+    parser.PushNALU(irap->data(), irap->size(), on_slice, &passed);
+    parser.PushNALU(broken.data(), broken.size(), on_slice, &passed);
+
+    /* the next picture, a copy of the first, starts a new access unit */
+    parser.PushNALU(irap->data(), irap->size(), on_slice, &passed);
+    parser.Flush(on_slice, &passed);
+
+    HEVCParser::ErrorStats errors;
+    parser.GetErrorStats(&errors);
+    if (hold) {
+        if (passed.slices.size() != 1 || errors.errors != 1 || errors.nals_dropped != 2) {
+            errx(1, "held picture with a broken slice: %zu slices passed on, %zu errors, %zu NALUs dropped",
+                passed.slices.size(), errors.errors, errors.nals_dropped);
+        }
+    } else if (passed.slices.size() != 2 || errors.errors != 1) {
+        errx(1, "%zu slices passed on around a broken one, %zu errors", passed.slices.size(), errors.errors);
+    }
+    if (passed.slices.back() != *irap) {
+        errx(1, "decoding did not resume at the next IRAP picture");
+    }
+}
+
+static Passed parse_all(bool hold) {
+    HEVCParser parser;
+    parser.SetHoldPictures(hold);
+    Passed passed;
+    const size_t chunk = 4096;
+    for (size_t offset = 0; offset < stream.size(); offset += chunk) {
+        parser.Parse(stream.data() + offset, std::min(chunk, stream.size() - offset), on_slice, &passed);
+    }
+    parser.Flush(on_slice, &passed);
+    return passed;
+}
+
+static void check_intact_stream() {
+    auto plain = parse_all(false);
+    auto held = parse_all(true);
+    if (plain.slices.empty() || plain.slices != held.slices) {
+        errx(1, "%zu slices passed on holding pictures, %zu without", held.slices.size(), plain.slices.size());
+    }
+}
+
+/* parses stream without its VCL NALU number lost, counting the pictures
+ * passed on */
+static size_t parse_without(int lost, HEVCParser::ErrorStats *errors, size_t *next_irap) {
+    HEVCParser parser;
+    Passed passed;
+    int vcl = 0;
+    *next_irap = 0;
+    for (auto &n : split_nalus(stream)) {
+        bool is_vcl = hevc_type(n) <= H265NALU::RSV_IRAP_VCL23;
+        if (is_vcl && vcl > lost && !*next_irap && hevc_type(n) >= H265NALU::BLA_W_LP) {
+            *next_irap = (size_t) vcl;
+        }
+        if (!is_vcl || vcl++ != lost) {
+            parser.PushNALU(n.data(), n.size(), on_slice, &passed);
+        }
+    }
+    parser.Flush(on_slice, &passed);
+    parser.GetErrorStats(errors);
+    return passed.slices.size();
+}
+
+static void check_missing_references() {
+    size_t pictures = parse_all(false).slices.size(), next_irap;
+    HEVCParser::ErrorStats errors;
+
+    /* the picture after a lost one refers to it, another stands in */
+    size_t passed = parse_without(5, &errors, &next_irap);
+    if (passed != pictures - 1 || errors.errors || !errors.missing_references) {
+        errx(1, "picture 5 lost: %zu of %zu pictures passed on, %zu errors, %zu missing references", passed,
+            pictures - 1, errors.errors, errors.missing_references);
+    }
+
+    /* without the first IRAP picture nothing can stand in */
+    passed = parse_without(0, &errors, &next_irap);
+    if (passed != pictures - next_irap || errors.errors != 1 || errors.resyncs != 1) {
+        errx(1, "first picture lost: %zu of %zu pictures passed on, %zu errors, %zu resyncs", passed,
+            pictures - next_irap, errors.errors, errors.resyncs);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        errx(1, "usage: %s hevc-stream", argv[0]);
+    }
+    stream = read_file(argv[1]);
+
+    check_broken_slice(false);
+    check_broken_slice(true);
+    check_intact_stream();
+    check_missing_references();
+    printf("ok\n");
+    return 0;
+}
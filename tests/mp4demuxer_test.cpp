@@ -0,0 +1,173 @@
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <initializer_list>
+#include <vector>
+
+#include "mp4demuxer.h"
+
+/* builds small MP4 files in memory and checks what MP4Demuxer makes of
+ * them: sample tables with and without per-sample sizes, and box sizes that
+ * point past the end of the file */
+
+typedef std::vector<uint8_t> Bytes;
+
+static void put32(Bytes *b, uint32_t v) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        b->push_back((uint8_t) (v >> shift));
+    }
+}
+
+static Bytes box(const char *type, std::initializer_list<Bytes> children) {
+    Bytes b;
+    size_t size = 8;
+    for (auto &c : children) {
+        size += c.size();
+    }
+    b.reserve(size);
+    put32(&b, (uint32_t) size);
+    b.insert(b.end(), type, type + 4);
+    for (auto &c : children) {
+        b.insert(b.end(), c.begin(), c.end());
+    }
+    return b;
+}
+
+static Bytes words(std::initializer_list<uint32_t> values) {
+    Bytes b;
+    for (auto v : values) {
+        put32(&b, v);
+    }
+    return b;
+}
+
+static const uint32_t kSamples = 6;
+static const uint32_t kSampleSize = 100;
+static const uint32_t kPerChunk = 3;
+
+/* a video track of kSamples samples in two chunks, starting at mdat_offset,
+ * with all samples kSampleSize bytes, given either in the stsz header or
+ * per sample */
+static Bytes moov(uint32_t mdat_offset, bool fixed_size) {
+    Bytes visual(78);
+    visual[24] = 1280 >> 8;
+    visual[25] = 1280 & 0xff;
+    visual[26] = 720 >> 8;
+    visual[27] = 720 & 0xff;
+    Bytes hvcc = box("hvcC", { Bytes(23) });
+    Bytes hvc1 = box("hvc1", { visual, hvcc });
+
+    Bytes stsz = fixed_size ? words({ 0, kSampleSize, kSamples }) : words({ 0, 0, kSamples });
+    if (!fixed_size) {
+        for (uint32_t i = 0; i < kSamples; ++i) {
+            put32(&stsz, kSampleSize);
+        }
+    }
+    Bytes stbl = box("stbl", {
+        box("stsd", { words({ 0, 1 }), hvc1 }),
+        box("stts", { words({ 0, 1, kSamples, 1000 }) }),
+        box("stsc", { words({ 0, 1, 1, kPerChunk, 1 }) }),
+        box("stsz", { stsz }),
+        box("stco", { words({ 0, 2, mdat_offset, mdat_offset + kPerChunk * kSampleSize }) }),
+    });
+    Bytes hdlr = box("hdlr", { words({ 0, 0 }), Bytes{ 'v', 'i', 'd', 'e' }, Bytes(13) });
+    Bytes mdhd = box("mdhd", { words({ 0, 0, 0, 30000, 0, 0 }) });
+    return box("moov", { box("trak", { box("mdia", { mdhd, hdlr, box("minf", { stbl }) }) }) });
+}
+
+/* ftyp, mdat, then moov */
+static Bytes file(bool fixed_size) {
+    Bytes ftyp = box("ftyp", { Bytes{ 'i', 's', 'o', 'm' }, words({ 0 }) });
+    Bytes data(kSamples * kSampleSize);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = (uint8_t) (i / kSampleSize);
+    }
+    Bytes mdat = box("mdat", { data });
+    Bytes f = ftyp;
+    f.insert(f.end(), mdat.begin(), mdat.end());
+    Bytes m = moov((uint32_t) ftyp.size() + 8, fixed_size);
+    f.insert(f.end(), m.begin(), m.end());
+    return f;
+}
+
+static FILE *open_bytes(const Bytes &bytes) {
+    FILE *f = tmpfile();
+    if (!f || fwrite(bytes.data(), 1, bytes.size(), f) != bytes.size()) {
+        err(1, "unable to write temporary file");
+    }
+    rewind(f);
+    return f;
+}
+
+static void check_samples(bool fixed_size) {
+    FILE *f = open_bytes(file(fixed_size));
+    MP4Demuxer demuxer;
+    if (!demuxer.Open(f)) {
+        errx(1, "%s stsz: unable to open", fixed_size ? "constant" : "per-sample");
+    }
+    if (demuxer.NumSamples() != kSamples) {
+        errx(1, "%s stsz: %zu samples, expected %u", fixed_size ? "constant" : "per-sample", demuxer.NumSamples(),
+            kSamples);
+    }
+
+    uint8_t buffer[4096];
+    MP4Demuxer::SampleView views[16];
+    size_t read = 0;
+    for (size_t n; (n = demuxer.ReadSamples(read, buffer, sizeof(buffer), views, 16)); read += n) {
+        for (size_t i = 0; i < n; ++i) {
+            if (views[i].size != kSampleSize || views[i].data[0] != views[i].index
+                || views[i].data[kSampleSize - 1] != views[i].index) {
+                errx(1, "sample %zu read wrongly", views[i].index);
+            }
+        }
+    }
+    if (read != kSamples) {
+        errx(1, "read %zu samples, expected %u", read, kSamples);
+    }
+    fclose(f);
+}
+
+/* a size larger than the file must be rejected, not allocated */
+static void check_corrupt_moov() {
+    Bytes bytes = file(false);
+    Bytes m = moov(0, false);
+    size_t at = bytes.size() - m.size();
+    bytes[at] = 0;
+    bytes[at + 1] = 0;
+    bytes[at + 2] = 0;
+    bytes[at + 3] = 1; // 64-bit size follows, but there is no room for it
+    Bytes large = { 'm', 'o', 'o', 'v', 0x7f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+    bytes.resize(at + 4);
+    bytes.insert(bytes.end(), large.begin(), large.end());
+    bytes.resize(bytes.size() + 64);
+
+    FILE *f = open_bytes(bytes);
+    MP4Demuxer demuxer;
+    if (demuxer.Open(f)) {
+        errx(1, "moov larger than the file accepted");
+    }
+    fclose(f);
+
+    /* a sample count the file cannot hold */
+    bytes = file(true);
+    Bytes stsz = words({ 0, kSampleSize, kSamples });
+    auto it = std::search(bytes.begin(), bytes.end(), stsz.begin(), stsz.end());
+    it[8] = 0x7f;
+    f = open_bytes(bytes);
+    MP4Demuxer demuxer2;
+    if (demuxer2.Open(f)) {
+        errx(1, "constant size sample count larger than the file accepted");
+    }
+    fclose(f);
+}
+
+int main() {
+    check_samples(false);
+    check_samples(true);
+    check_corrupt_moov();
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "decodepipeline.h"
+#include "simbackend.h"
+#include "testutil.h"
+#ifdef USE_LIBVA
+#include <va/va.h>
+
+#include "hevcdump.h"
+#include "hevcparser.h"
+#endif
+
+/* dumps the DXVA picture parameters built for a stream, as
+ * AMDTEST_DUMP_PARAMS does, and diffs them against a golden dump known to be
+ * good, so that changes to POC, RPS and DPB slot derivation show up as the
+ * first line that differs. Built with USE_LIBVA, it dumps the VA picture and
+ * slice parameters of FillVA() and FillVASlice() instead. */
+
+#ifdef USE_LIBVA
+/* the first line of each picture's parameters */
+static const char kPictureStart[] = "CurrPic ";
+
+/* the picture parameters with the first slice of each picture, and each
+ * slice's once the next shows whether it was the last of its picture */
+struct VADump {
+    FILE *f;
+    HEVCParser parser;
+    VASliceParameterBufferHEVC slice;
+    bool have_slice = false;
+
+    void dump_slice(bool last_slice_of_pic) {
+        if (have_slice) {
+            slice.LongSliceFlags.fields.LastSliceOfPic = last_slice_of_pic;
+            DumpVASliceParams(f, &slice);
+            have_slice = false;
+        }
+    }
+};
+
+static void on_slice(const uint8_t *bytes, size_t size, void *opaque) {
+    auto d = (VADump *) opaque;
+    bool first_slice = size > 2 && (bytes[2] & 0x80);
+    d->dump_slice(first_slice);
+    if (first_slice) {
+        VAPictureParameterBufferHEVC pp;
+        VAIQMatrixBufferHEVC iq;
+        memset(&pp, 0, sizeof(pp));
+        d->parser.FillVA(&pp, &iq);
+        DumpVAPicParams(d->f, &pp);
+    }
+    d->parser.FillVASlice(&d->slice, false);
+    d->have_slice = true;
+}
+
+static void dump_params(const std::vector<uint8_t> &stream, FILE *dump) {
+    VADump d;
+    d.f = dump;
+    d.parser.Parse(stream.data(), stream.size(), on_slice, &d);
+    d.parser.Flush(on_slice, &d);
+    d.dump_slice(true);
+}
+#else
+static const char kPictureStart[] = "PicWidthInMinCbsY ";
+
+static void dump_params(const std::vector<uint8_t> &stream, FILE *dump) {
+    SimulatedDevice device(1, 0);
+    DecodePipeline pipeline(&device);
+    pipeline.SetParamDump(dump);
+    const size_t chunk = 0x10000;
+    for (size_t offset = 0; offset < stream.size(); offset += chunk) {
+        pipeline.ReceiveBytes(stream.data() + offset, std::min(chunk, stream.size() - offset));
+    }
+    pipeline.Flush();
+}
+#endif
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        errx(1, "usage: %s hevc-stream golden-dump", argv[0]);
+    }
+    Bytes stream = read_file(argv[1]);
+
+    FILE *dump = tmpfile();
+    if (!dump) {
+        err(1, "unable to create temporary file");
+    }
+    dump_params(stream, dump);
+    rewind(dump);
+
+    FILE *golden = fopen(argv[2], "r");
+    if (!golden) {
+        err(1, "unable to open %s", argv[2]);
+    }
+    char expected[256], actual[256];
+    int line = 0, pictures = 0;
+    for (;;) {
+        ++line;
+        bool have_expected = fgets(expected, sizeof(expected), golden) != nullptr;
+        bool have_actual = fgets(actual, sizeof(actual), dump) != nullptr;
+        if (!have_expected && !have_actual) {
+            break;
+        }
+        if (have_expected != have_actual || strcmp(expected, actual)) {
+            expected[strcspn(expected, "\n")] = '\0';
+            actual[strcspn(actual, "\n")] = '\0';
+            errx(1, "picture %d, line %d: \"%s\", expected \"%s\"", pictures, line,
+                have_actual ? actual : "end of dump", have_expected ? expected : "end of dump");
+        }
+        if (!strncmp(expected, kPictureStart, sizeof(kPictureStart) - 1)) {
+            ++pictures;
+        }
+    }
+    fclose(golden);
+    fclose(dump);
+    printf("ok (%d pictures)\n", pictures);
+    return 0;
+}
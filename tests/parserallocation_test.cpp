@@ -0,0 +1,100 @@
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <new>
+#include <vector>
+
+#include "hevcparser.h"
+#include "testutil.h"
+
+/* parses the HEVC sample twice with the same HEVCParser, with and without
+ * held pictures, and checks that the second pass neither raises the high
+ * water mark of any of its arenas nor allocates from the heap, arenas or
+ * otherwise: once warmed up, parsing must not allocate at all */
+
+static size_t heap_allocations = 0;
+
+void *operator new(size_t size) {
+    ++heap_allocations;
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+static void on_slice(const uint8_t *, size_t, void *opaque) {
+    ++*(int *) opaque;
+}
+
+static int parse(HEVCParser *parser, const std::vector<uint8_t> &stream) {
+    int pictures = 0;
+    /* in pieces, as read from a file */
+    const size_t chunk = 0x1000;
+    for (size_t offset = 0; offset < stream.size(); offset += chunk) {
+        size_t size = stream.size() - offset < chunk ? stream.size() - offset : chunk;
+        parser->Parse(stream.data() + offset, size, on_slice, &pictures);
+    }
+    parser->Flush(on_slice, &pictures);
+    return pictures;
+}
+
+static void check_arena(const char *name, const Arena::Stats &first, const Arena::Stats &second, bool hold) {
+    if (second.high_water > first.high_water || second.heap_allocations != first.heap_allocations) {
+        errx(1, "%s arena%s: high water %zu and %zu chunks after the first pass, %zu and %zu after the second", name,
+            hold ? " holding pictures" : "", first.high_water, first.heap_allocations, second.high_water,
+            second.heap_allocations);
+    }
+}
+
+static void check_steady_state(const std::vector<uint8_t> &stream, bool hold) {
+    HEVCParser parser;
+    parser.SetHoldPictures(hold);
+    int first_pictures = parse(&parser, stream);
+    HEVCParser::AllocationStats first;
+    parser.GetAllocationStats(&first);
+
+    size_t before = heap_allocations;
+    int second_pictures = parse(&parser, stream);
+    size_t allocated = heap_allocations - before;
+    HEVCParser::AllocationStats second;
+    parser.GetAllocationStats(&second);
+
+    if (!first_pictures || second_pictures != first_pictures) {
+        errx(1, "%d pictures parsed the second time, %d the first", second_pictures, first_pictures);
+    }
+    if (allocated) {
+        errx(1, "%zu heap allocations parsing the stream again%s", allocated, hold ? " holding pictures" : "");
+    }
+    check_arena("parameter set", first.param_sets, second.param_sets, hold);
+    check_arena("access unit", first.access_unit, second.access_unit, hold);
+    check_arena("held picture", first.held, second.held, hold);
+    if (hold != (second.held.allocations > 0)) {
+        errx(1, "%zu allocations from the held picture arena%s", second.held.allocations,
+            hold ? " holding pictures" : "");
+    }
+    printf("%d pictures%s: high water %zu, %zu and %zu bytes\n", second_pictures, hold ? " held" : "",
+        second.param_sets.high_water, second.access_unit.high_water, second.held.high_water);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        errx(1, "usage: %s hevc-stream", argv[0]);
+    }
+    Bytes stream = read_file(argv[1]);
+
+    check_steady_state(stream, false);
+    check_steady_state(stream, true);
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,220 @@
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include "commandring.h"
+#include "readbackpool.h"
+
+/* runs ReadbackPool and CommandRing against a fake device, checking that
+ * buffers and command contexts are only reused once the GPU is done with
+ * them */
+
+/* the fence of the fake device's queue, which only moves when the test says
+ * so, or when something waits for it */
+struct FakeFence {
+    uint64_t completed = 0;
+    uint64_t waited_for = 0;
+};
+
+class FakeReadbackAllocator : public ReadbackAllocator {
+    FakeFence *fence;
+
+public:
+    int buffers = 0;
+
+    FakeReadbackAllocator(FakeFence *fence)
+        : fence(fence) {
+    }
+
+    void *Create(size_t size, uint8_t **mapped) {
+        ++buffers;
+        *mapped = new uint8_t[size];
+        return *mapped;
+    }
+
+    void Destroy(void *resource) {
+        --buffers;
+        delete[] (uint8_t *) resource;
+    }
+
+    uint64_t CompletedValue() {
+        return fence->completed;
+    }
+};
+
+struct FakeContext {
+    uint64_t last_fence; // of the commands last recorded with it
+};
+
+class FakeContextAllocator : public CommandContextAllocator {
+    FakeFence *fence;
+
+public:
+    int contexts = 0;
+
+    FakeContextAllocator(FakeFence *fence)
+        : fence(fence) {
+    }
+
+    void *Create() {
+        ++contexts;
+        return new FakeContext{ 0 };
+    }
+
+    void Destroy(void *context) {
+        --contexts;
+        delete (FakeContext *) context;
+    }
+
+    void Reset(void *context) {
+        auto c = (FakeContext *) context;
+        if (c->last_fence > fence->completed) {
+            errx(1, "context reset while fence %llu is in flight, %llu completed",
+                (unsigned long long) c->last_fence, (unsigned long long) fence->completed);
+        }
+    }
+
+    uint64_t CompletedValue() {
+        return fence->completed;
+    }
+
+    void WaitFor(uint64_t fence_value) {
+        fence->waited_for = fence_value;
+        if (fence->completed < fence_value) {
+            fence->completed = fence_value;
+        }
+    }
+};
+
+static std::vector<int> landed;
+
+static void readback_done(const uint8_t *, size_t, void *opaque) {
+    landed.push_back((int) (intptr_t) opaque);
+}
+
+static void check_pool() {
+    FakeFence fence;
+    FakeReadbackAllocator device(&fence);
+    {
+        ReadbackPool pool(&device);
+        auto small = pool.Acquire(1);
+        auto large = pool.Acquire(65537);
+        if (!small || !large || small->capacity != 65536 || large->capacity != 131072) {
+            errx(1, "readback buffers not rounded up to their size class");
+        }
+
+        /* completions only run once their fence has passed, in order */
+        pool.Submit(small, 1, 1, readback_done, (void *) 1);
+        pool.Submit(large, 2, 65537, readback_done, (void *) 2);
+        if (pool.Poll() != 0 || pool.OldestPending() != 1) {
+            errx(1, "readback completed before its fence");
+        }
+        fence.completed = 1;
+        if (pool.Poll() != 1 || landed.size() != 1 || landed[0] != 1) {
+            errx(1, "first readback did not complete alone");
+        }
+        fence.completed = 2;
+        pool.Poll();
+        if (landed.size() != 2 || landed[1] != 2 || pool.OldestPending() != 0) {
+            errx(1, "second readback did not complete");
+        }
+
+        /* completed and released buffers are reused, not created again */
+        auto again = pool.Acquire(100);
+        auto unused = pool.Acquire(70000);
+        ReadbackPool::Stats stats;
+        pool.GetStats(&stats);
+        if (again != small || unused != large || stats.creates != 2 || stats.reuses != 2) {
+            errx(1, "free buffers not reused");
+        }
+        pool.Release(unused);
+        pool.Submit(again, 3, 100, readback_done, (void *) 3);
+        pool.GetStats(&stats);
+        if (stats.in_flight != 1 || stats.max_in_flight != 2) {
+            errx(1, "%zu readbacks in flight, at most %zu", stats.in_flight, stats.max_in_flight);
+        }
+
+        /* Trim() frees what is not in flight only */
+        pool.Trim();
+        if (device.buffers != 1) {
+            errx(1, "%d buffers left after trimming, expected the one in flight", device.buffers);
+        }
+    }
+    if (device.buffers != 0) {
+        errx(1, "%d buffers leaked", device.buffers);
+    }
+}
+
+/* record a command list and signal a new fence value after it, as
+ * D3D12CopyQueue does */
+static uint64_t fence_value = 0;
+
+static void record(CommandRing *ring) {
+    auto c = (FakeContext *) ring->Begin();
+    if (!c) {
+        errx(1, "no command context");
+    }
+    c->last_fence = ++fence_value;
+    ring->End(fence_value);
+}
+
+static void check_ring() {
+    FakeFence fence;
+    FakeContextAllocator device(&fence);
+    {
+        CommandRing ring(&device, 4);
+        CommandRing::Stats stats;
+
+        /* while the GPU is busy each readback gets a context of its own,
+         * without waiting */
+        for (int i = 0; i < 4; ++i) {
+            record(&ring);
+        }
+        ring.GetStats(&stats);
+        if (stats.contexts != 4 || stats.waits != 0) {
+            errx(1, "%zu contexts and %zu waits for 4 readbacks in flight", stats.contexts, stats.waits);
+        }
+
+        /* with the ring full, the oldest is waited for and reused */
+        record(&ring);
+        ring.GetStats(&stats);
+        if (stats.contexts != 4 || stats.waits != 1 || fence.waited_for != 1) {
+            errx(1, "full ring did not wait for the oldest context");
+        }
+
+        /* once the GPU catches up contexts are reused without waiting, and
+         * no more are created */
+        fence.completed = fence_value;
+        for (int i = 0; i < 10; ++i) {
+            record(&ring);
+            fence.completed = fence_value;
+        }
+        ring.GetStats(&stats);
+        if (stats.contexts != 4 || stats.waits != 1 || stats.resets != 15) {
+            errx(1, "%zu contexts, %zu waits and %zu resets after the GPU caught up", stats.contexts, stats.waits,
+                stats.resets);
+        }
+
+        /* a smaller ring waits as soon as both its contexts are in flight */
+        CommandRing small(&device, 2);
+        record(&small);
+        record(&small);
+        record(&small);
+        small.GetStats(&stats);
+        if (stats.contexts != 2 || stats.waits != 1) {
+            errx(1, "two-context ring created %zu contexts and waited %zu times", stats.contexts, stats.waits);
+        }
+    }
+    if (device.contexts != 0) {
+        errx(1, "%d command contexts leaked", device.contexts);
+    }
+}
+
+int main() {
+    check_pool();
+    check_ring();
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,272 @@
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "hevcparser.h"
+#include "rtpdepacketizer.h"
+#include "testutil.h"
+#include "trace.h"
+
+/* packetizes the NALUs of the HEVC sample as of RFC 7798, with aggregation
+ * packets for the small ones and fragmentation units for the large ones, and
+ * checks that RTPDepacketizer gives back the same NALUs with their
+ * timestamps: in order, reordered, duplicated and with DONL fields, and
+ * without just the NALUs whose packets were lost. In order, only fragments
+ * may be copied. */
+
+static Bytes stream;
+
+struct NALU {
+    Bytes bytes;
+    uint32_t timestamp;
+
+    bool operator==(const NALU &o) const {
+        return bytes == o.bytes && timestamp == o.timestamp;
+    }
+};
+
+/* the NALUs of stream, without start codes, each picture 3000 ticks of the
+ * 90kHz RTP clock after the one before */
+static std::vector<NALU> split() {
+    std::vector<NALU> nalus;
+    uint32_t timestamp = 0;
+    for (auto &b : split_nalus(stream)) {
+        if (hevc_type(b) <= H265NALU::RSV_IRAP_VCL23 && (b[2] & 0x80)) {
+            timestamp += 3000;
+        }
+        nalus.push_back({ b, timestamp });
+    }
+    return nalus;
+}
+
+static const size_t kMTU = 1200;
+static const size_t kSmallNALU = 200; // aggregated with the ones after it
+
+struct Packet {
+    Bytes bytes;
+    int nalu; // the first NALU in it
+    int count; // of NALUs it holds whole, none in a FU
+    bool fragment; // of a FU, not the first or last
+};
+
+struct Packetizer {
+    bool donl;
+    std::vector<Packet> packets;
+    uint16_t seq = 0xfff0; // wraps early on
+    size_t fragment_bytes = 0; // of the NALUs in FUs, as the depacketizer copies them
+
+    /* RTP header, with an extension and padding on every seventh packet */
+    void packet(const Bytes &payload, uint32_t timestamp, int nalu, int count, bool fragment) {
+        bool extra = seq % 7 == 0;
+        Bytes p = { (uint8_t) (0x80 | (extra ? 0x30 : 0)), 96, (uint8_t) (seq >> 8), (uint8_t) seq,
+            (uint8_t) (timestamp >> 24), (uint8_t) (timestamp >> 16), (uint8_t) (timestamp >> 8), (uint8_t) timestamp,
+            0x12, 0x34, 0x56, 0x78 };
+        if (extra) {
+            p.insert(p.end(), { 0xbe, 0xde, 0x00, 0x01, 0x10, 0xaa, 0x00, 0x00 });
+        }
+        p.insert(p.end(), payload.begin(), payload.end());
+        if (extra) {
+            p.insert(p.end(), { 0, 0, 3 });
+        }
+        packets.push_back({ p, nalu, count, fragment });
+        ++seq;
+    }
+
+    void single(const NALU &n, int index) {
+        Bytes payload(n.bytes.begin(), n.bytes.begin() + 2);
+        if (donl) {
+            payload.insert(payload.end(), { (uint8_t) (index >> 8), (uint8_t) index });
+        }
+        payload.insert(payload.end(), n.bytes.begin() + 2, n.bytes.end());
+        packet(payload, n.timestamp, index, 1, false);
+    }
+
+    void aggregate(const std::vector<NALU> &nalus, int first, int count) {
+        Bytes payload = { (uint8_t) (48 << 1), nalus[first].bytes[1] };
+        for (int i = first; i < first + count; ++i) {
+            if (donl) {
+                if (i == first) {
+                    payload.insert(payload.end(), { (uint8_t) (i >> 8), (uint8_t) i });
+                } else {
+                    payload.push_back(0); // DOND, one more than the NALU before
+                }
+            }
+            auto &b = nalus[i].bytes;
+            payload.insert(payload.end(), { (uint8_t) (b.size() >> 8), (uint8_t) b.size() });
+            payload.insert(payload.end(), b.begin(), b.end());
+        }
+        packet(payload, nalus[first].timestamp, first, count, false);
+    }
+
+    void fragment(const NALU &n, int index) {
+        int type = (n.bytes[0] >> 1) & 0x3f;
+        fragment_bytes += n.bytes.size() - 2;
+        for (size_t i = 2; i < n.bytes.size(); i += kMTU) {
+            bool start = i == 2, end = i + kMTU >= n.bytes.size();
+            Bytes payload = { (uint8_t) ((n.bytes[0] & 0x81) | (49 << 1)), n.bytes[1],
+                (uint8_t) ((start ? 0x80 : 0) | (end ? 0x40 : 0) | type) };
+            if (start && donl) {
+                payload.insert(payload.end(), { (uint8_t) (index >> 8), (uint8_t) index });
+            }
+            payload.insert(payload.end(), n.bytes.begin() + i, n.bytes.begin() + std::min(i + kMTU, n.bytes.size()));
+            packet(payload, n.timestamp, index, 0, !start && !end);
+        }
+    }
+
+    Packetizer(const std::vector<NALU> &nalus, bool donl)
+        : donl(donl) {
+        for (int i = 0; i < (int) nalus.size();) {
+            int count = 0;
+            size_t size = 4;
+            while (i + count < (int) nalus.size() && nalus[i + count].bytes.size() < kSmallNALU
+                && nalus[i + count].timestamp == nalus[i].timestamp
+                && size + 3 + nalus[i + count].bytes.size() <= kMTU) {
+                size += 3 + nalus[i + count].bytes.size();
+                ++count;
+            }
+            if (count > 1) {
+                aggregate(nalus, i, count);
+                i += count;
+            } else if (nalus[i].bytes.size() > kMTU) {
+                fragment(nalus[i], i);
+                ++i;
+            } else {
+                single(nalus[i], i);
+                ++i;
+            }
+        }
+    }
+};
+
+struct Received {
+    std::vector<NALU> nalus;
+};
+
+static void on_nalu(const uint8_t *bytes, size_t size, uint32_t timestamp, void *opaque) {
+    ((Received *) opaque)->nalus.push_back({ Bytes(bytes, bytes + size), timestamp });
+}
+
+static void run(const Packetizer &p, const std::vector<int> &order, Received *r, RTPDepacketizer::Stats *stats) {
+    RTPDepacketizer depacketizer(on_nalu, r);
+    depacketizer.SetDonl(p.donl);
+    /* long enough that only the number held back gives up on a gap */
+    depacketizer.SetMaxDelay(60000000000ull, 128);
+    for (int i : order) {
+        depacketizer.Push(p.packets[i].bytes.data(), p.packets[i].bytes.size(), TraceNow());
+    }
+    depacketizer.Flush();
+    depacketizer.GetStats(stats);
+}
+
+static std::vector<int> in_order(const Packetizer &p) {
+    std::vector<int> order(p.packets.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = (int) i;
+    }
+    return order;
+}
+
+static void on_slice(const uint8_t *, size_t, void *opaque) {
+    ++*(int *) opaque;
+}
+
+static void check_in_order(const std::vector<NALU> &nalus, bool donl) {
+    Packetizer p(nalus, donl);
+    Received r;
+    RTPDepacketizer::Stats stats;
+    run(p, in_order(p), &r, &stats);
+    if (r.nalus != nalus || stats.lost || stats.invalid || stats.reordered) {
+        errx(1, "%zu of %zu NALUs back in order%s, %llu lost, %llu invalid", r.nalus.size(), nalus.size(),
+            donl ? " with DONL" : "", (unsigned long long) stats.lost, (unsigned long long) stats.invalid);
+    }
+    /* single NALUs and aggregation packets are passed on in place */
+    if (!donl && stats.bytes_copied != p.fragment_bytes) {
+        errx(1, "%llu bytes copied in order, %zu of them fragments", (unsigned long long) stats.bytes_copied,
+            p.fragment_bytes);
+    }
+
+    int pictures = 0;
+    HEVCParser parser;
+    for (auto &n : r.nalus) {
+        parser.PushNALU(n.bytes.data(), n.bytes.size(), on_slice, &pictures);
+    }
+    parser.Flush(on_slice, &pictures);
+    if (pictures != 155) {
+        errx(1, "%d pictures parsed from the depacketized NALUs", pictures);
+    }
+}
+
+/* every eighth packet delayed by up to 7 others, and two sent twice. The
+ * first goes first, as the depacketizer starts from it. */
+static void check_reordered(const std::vector<NALU> &nalus, bool donl) {
+    Packetizer p(nalus, donl);
+    auto order = in_order(p);
+    for (size_t i = 8; i + 8 < order.size(); i += 8) {
+        std::swap(order[i], order[i + 1 + next_random() % 7]);
+    }
+    order.insert(order.begin() + order.size() / 2, order[order.size() / 2 - 3]);
+    order.insert(order.begin() + 100, order[110]);
+    Received r;
+    RTPDepacketizer::Stats stats;
+    run(p, order, &r, &stats);
+    if (r.nalus != nalus || stats.lost || !stats.reordered || stats.late + stats.duplicates != 2) {
+        errx(1, "%zu of %zu NALUs back reordered%s, %llu lost, %llu reordered, %llu late and %llu duplicates",
+            r.nalus.size(), nalus.size(), donl ? " with DONL" : "", (unsigned long long) stats.lost,
+            (unsigned long long) stats.reordered, (unsigned long long) stats.late,
+            (unsigned long long) stats.duplicates);
+    }
+}
+
+/* a fragment from the middle of a FU and a packet of whole NALUs are lost */
+static void check_loss(const std::vector<NALU> &nalus) {
+    Packetizer p(nalus, false);
+    auto order = in_order(p);
+    int fragment = -1, whole = -1;
+    for (int i = (int) p.packets.size() / 3; i < (int) p.packets.size() && whole < 0; ++i) {
+        if (fragment < 0 && p.packets[i].fragment) {
+            fragment = i;
+        } else if (fragment >= 0 && p.packets[i].count) {
+            whole = i;
+        }
+    }
+    if (whole < 0) {
+        errx(1, "no packet of whole NALUs after a fragment in the last two thirds of %zu packets", p.packets.size());
+    }
+    order.erase(order.begin() + whole);
+    order.erase(order.begin() + fragment);
+
+    auto &w = p.packets[whole];
+    std::vector<NALU> expected;
+    for (int i = 0; i < (int) nalus.size(); ++i) {
+        if (i != p.packets[fragment].nalu && (i < w.nalu || i >= w.nalu + w.count)) {
+            expected.push_back(nalus[i]);
+        }
+    }
+    Received r;
+    RTPDepacketizer::Stats stats;
+    run(p, order, &r, &stats);
+    if (r.nalus != expected || stats.lost != 2 || stats.fragments_dropped != 1) {
+        errx(1, "%zu NALUs back with two packets lost, expected %zu, %llu lost, %llu fragmented NALUs dropped",
+            r.nalus.size(), expected.size(), (unsigned long long) stats.lost,
+            (unsigned long long) stats.fragments_dropped);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        errx(1, "usage: %s hevc-stream", argv[0]);
+    }
+    stream = read_file(argv[1]);
+
+    auto nalus = split();
+    for (bool donl : { false, true }) {
+        check_in_order(nalus, donl);
+        check_reordered(nalus, donl);
+    }
+    check_loss(nalus);
+    printf("ok (%zu NALUs)\n", nalus.size());
+    return 0;
+}
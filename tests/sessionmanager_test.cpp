@@ -0,0 +1,171 @@
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "condition.h"
+#include "sessionmanager.h"
+#include "testutil.h"
+
+/* runs SessionManager against a fake device on which the first session
+ * opened can be stalled, checking that a session whose pictures are not
+ * decoding holds up neither the parsing nor the decoding of the others, and
+ * loses nothing once it is let go */
+
+class FakeDevice;
+
+class FakeSession : public DecodeBackend {
+    FakeDevice *dev;
+    bool stalls;
+    uint64_t submitted = 0;
+
+public:
+    FakeSession(FakeDevice *dev, bool stalls)
+        : dev(dev), stalls(stalls) {
+    }
+
+    ~FakeSession();
+
+    uint64_t Submit(int, const DecodePicture *) {
+        return ++submitted;
+    }
+
+    bool Poll(uint64_t) {
+        return true;
+    }
+
+    inline void Wait(uint64_t ticket);
+
+    bool Map(uint64_t, MappedPicture *) {
+        return false;
+    }
+
+    void Unmap() {
+    }
+
+    void GetStats(DecodeBackendStats *stats) {
+        *stats = {};
+        stats->submitted = stats->completed = submitted;
+    }
+};
+
+class FakeDevice : public DecodeDevice {
+public:
+    Condition cond;
+    bool stalled = true;
+    int sessions = 0;
+    /* pictures submitted by each session, as it closes */
+    std::vector<uint64_t> submitted;
+
+    int NumQueues() {
+        return 2;
+    }
+
+    DecodeBackend *OpenSession(VideoCodec) {
+        return new FakeSession(this, sessions++ == 0);
+    }
+
+    void Release() {
+        cond.Lock();
+        stalled = false;
+        cond.Broadcast();
+        cond.Unlock();
+    }
+};
+
+FakeSession::~FakeSession() {
+    dev->submitted.push_back(submitted);
+}
+
+void FakeSession::Wait(uint64_t) {
+    if (!stalls) {
+        return;
+    }
+    dev->cond.Lock();
+    while (dev->stalled) {
+        dev->cond.Wait();
+    }
+    dev->cond.Unlock();
+}
+
+static std::vector<uint8_t> stream;
+static const size_t kChunk = 0x10000;
+
+static void receive(SessionManager *manager, int id, size_t chunk) {
+    for (size_t offset = 0; offset < stream.size(); offset += chunk) {
+        manager->ReceiveBytes(id, stream.data() + offset, std::min(chunk, stream.size() - offset));
+    }
+}
+
+/* the number of pictures (slices) in the stream, decoded on its own */
+static uint64_t reference() {
+    FakeDevice device;
+    device.stalled = false;
+    {
+        SessionManager manager(&device, kScheduleRoundRobin, 1);
+        int id = manager.OpenSession(1000000);
+        receive(&manager, id, kChunk);
+        manager.CloseSession(id);
+    }
+    if (device.submitted.size() != 1 || !device.submitted[0]) {
+        errx(1, "nothing decoded");
+    }
+    return device.submitted[0];
+}
+
+static void check_stalled_session(uint64_t expected) {
+    FakeDevice device;
+    std::atomic<bool> done(false);
+    std::thread watchdog([&] {
+        for (int i = 0; i < 1000 && !done; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        if (!done) {
+            errx(1, "session held up by a stalled one");
+        }
+    });
+    {
+        /* one parse worker, which a stalled session must not keep */
+        SessionManager manager(&device, kScheduleRoundRobin, 1);
+        int stalled = manager.OpenSession(1000000);
+        int other = manager.OpenSession(1000000);
+
+        /* a few large chunks, each of more pictures than a session may have
+         * queued, and not so many that ReceiveBytes() blocks */
+        receive(&manager, stalled, stream.size() / 4 + 1);
+        receive(&manager, other, kChunk);
+        manager.CloseSession(other);
+        if (device.submitted.size() != 1 || device.submitted[0] != expected) {
+            errx(1, "%llu of %llu pictures decoded next to a stalled session",
+                (unsigned long long) (device.submitted.empty() ? 0 : device.submitted[0]),
+                (unsigned long long) expected);
+        }
+        done = true;
+
+        device.Release();
+        manager.CloseSession(stalled);
+        if (device.submitted.size() != 2 || device.submitted[1] != expected) {
+            errx(1, "stalled session decoded %llu of %llu pictures once released",
+                (unsigned long long) (device.submitted.size() < 2 ? 0 : device.submitted[1]),
+                (unsigned long long) expected);
+        }
+    }
+    watchdog.join();
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        errx(1, "usage: %s hevc-stream", argv[0]);
+    }
+    stream = read_file(argv[1]);
+
+    uint64_t expected = reference();
+    check_stalled_session(expected);
+    printf("ok (%llu pictures per session)\n", (unsigned long long) expected);
+    return 0;
+}
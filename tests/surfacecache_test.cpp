@@ -0,0 +1,117 @@
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "surfacecache.h"
+
+/* runs SurfaceCache against a fake allocator charging one byte per luma
+ * sample and reference, checking hits, prewarming, LRU eviction under the
+ * budget and that the surfaces in use are never evicted */
+
+class FakeSurfaceAllocator : public SurfaceAllocator {
+public:
+    int live = 0;
+    int creates = 0;
+
+    bool Create(int width, int height, int num_references, DecodeSurfaces *s) {
+        s->heap = s->output = s->references = this;
+        s->num_references = num_references;
+        s->bytes = (size_t) width * height * (num_references + 1);
+        ++live;
+        ++creates;
+        return true;
+    }
+
+    void Destroy(DecodeSurfaces *) {
+        --live;
+    }
+};
+
+static size_t bytes(int width, int height, int num_references) {
+    return (size_t) width * height * (num_references + 1);
+}
+
+static void check_hits() {
+    FakeSurfaceAllocator allocator;
+    {
+        SurfaceCache cache(&allocator);
+        SurfaceCache::Stats stats;
+
+        /* sizes seen before are hits, including for fewer references */
+        cache.Acquire(1920, 1088, 6);
+        cache.Acquire(1280, 720, 6);
+        cache.Acquire(1920, 1088, 4);
+        cache.GetStats(&stats);
+        if (stats.hits != 1 || stats.misses != 2 || allocator.creates != 2) {
+            errx(1, "%zu hits and %zu misses switching between two sizes", stats.hits, stats.misses);
+        }
+
+        /* more references than an entry has replaces it */
+        auto s = cache.Acquire(1920, 1088, 8);
+        cache.GetStats(&stats);
+        if (!s || s->num_references != 8 || stats.entries != 2 || allocator.live != 2) {
+            errx(1, "entry not replaced when more references were needed");
+        }
+    }
+    if (allocator.live != 0) {
+        errx(1, "%d entries leaked", allocator.live);
+    }
+}
+
+static void check_prewarm() {
+    FakeSurfaceAllocator allocator;
+    SurfaceCache cache(&allocator);
+    Resolution ladder[] = { { 1920, 1088 }, { 1280, 720 }, { 640, 368 } };
+    if (cache.Prewarm(ladder, 3, 6) != 3 || cache.Prewarm(ladder, 3, 6) != 0) {
+        errx(1, "prewarming did not create each size exactly once");
+    }
+    for (auto &r : ladder) {
+        cache.Acquire(r.width, r.height, 6);
+    }
+    SurfaceCache::Stats stats;
+    cache.GetStats(&stats);
+    if (stats.prewarmed != 3 || stats.hits != 3 || stats.misses != 0) {
+        errx(1, "prewarmed sizes were not hits");
+    }
+}
+
+static void check_eviction() {
+    FakeSurfaceAllocator allocator;
+    /* room for 1080p and 720p, not for 4K as well */
+    SurfaceCache cache(&allocator, bytes(1920, 1088, 6) + bytes(1280, 720, 6));
+    cache.Acquire(1920, 1088, 6);
+    cache.Acquire(1280, 720, 6);
+    cache.Acquire(1920, 1088, 6); // 720p is now the least recently used
+
+    cache.Acquire(640, 368, 6);
+    SurfaceCache::Stats stats;
+    cache.GetStats(&stats);
+    if (cache.Contains(1280, 720) || !cache.Contains(1920, 1088) || !cache.Contains(640, 368)
+        || stats.evictions != 1) {
+        errx(1, "least recently used size not evicted first");
+    }
+
+    /* a size over the budget on its own stays while it is in use */
+    auto s = cache.Acquire(3840, 2160, 6);
+    cache.GetStats(&stats);
+    if (!s || !cache.Contains(3840, 2160) || stats.entries != 1 || stats.bytes != bytes(3840, 2160, 6)) {
+        errx(1, "surfaces in use evicted, or others kept over the budget");
+    }
+
+    cache.SetBudget(0);
+    if (!cache.Contains(3840, 2160)) {
+        errx(1, "surfaces in use evicted by a smaller budget");
+    }
+    cache.Clear();
+    if (allocator.live != 0) {
+        errx(1, "%d entries left after clearing", allocator.live);
+    }
+}
+
+int main() {
+    check_hits();
+    check_prewarm();
+    check_eviction();
+    printf("ok\n");
+    return 0;
+}
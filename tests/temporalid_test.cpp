@@ -0,0 +1,177 @@
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "hevcparser.h"
+#include "testutil.h"
+
+/* relabels the pictures of the HEVC sample into three temporal sub-layers,
+ * some of them TSA or STSA pictures, and runs HEVCParser::SetMaxTemporalId()
+ * over it with the target lowered and raised part way. The pictures passed
+ * on must be those the switching rules of 7.4.2.2 allow: down at the next
+ * picture, up only at an IRAP picture, at a TSA picture one sub-layer up,
+ * or by one sub-layer at an STSA picture. Everything dropped must show in
+ * the skip stats. */
+
+static int temporal_id(const Bytes &nalu) {
+    return (nalu[1] & 7) - 1;
+}
+
+static bool is_vcl(int type) {
+    return type <= H265NALU::RSV_IRAP_VCL23;
+}
+
+static bool is_irap(int type) {
+    return type >= H265NALU::BLA_W_LP && type <= H265NALU::RSV_IRAP_VCL23;
+}
+
+/* every fourth picture in sub-layer 0, those in between in sub-layer 1 and
+ * the rest in 2, as a hierarchical GOP of 4 would have them. Some pictures
+ * of sub-layers 1 and 2 are made TSA or STSA pictures. IRAP pictures stay
+ * as they are. */
+static void relabel(std::vector<Bytes> *nalus) {
+    int picture = 0;
+    for (auto &n : *nalus) {
+        int t = hevc_type(n);
+        if (!is_vcl(t)) {
+            continue;
+        }
+        int p = picture++;
+        if (is_irap(t)) {
+            continue;
+        }
+        int tid = p % 4 == 0 ? 0 : p % 2 == 0 ? 1 : 2;
+        if (tid == 1) {
+            t = p % 8 == 2 ? H265NALU::STSA_R : H265NALU::TRAIL_R;
+        } else if (tid == 2) {
+            t = p % 16 == 1 ? H265NALU::TSA_R : p % 16 == 9 ? H265NALU::STSA_R : H265NALU::TRAIL_R;
+        }
+        n[0] = (uint8_t) ((n[0] & 0x81) | (t << 1));
+        n[1] = (uint8_t) ((n[1] & 0xf8) | (tid + 1));
+    }
+}
+
+/* the target set before a picture */
+struct Change {
+    int picture;
+    int target;
+};
+
+/* what the parser should do, and how often each rule applied */
+struct Model {
+    int target = 6;
+    int limit = 6;
+    int irap_switches = 0;
+    int tsa_switches = 0;
+    int stsa_switches = 0;
+
+    bool passes(int type, int tid) {
+        if (target < limit) {
+            limit = target;
+        } else if (target > limit) {
+            bool next_up = tid == limit + 1;
+            if (is_irap(type)) {
+                limit = target;
+                ++irap_switches;
+            } else if (next_up && (type == H265NALU::TSA_N || type == H265NALU::TSA_R)) {
+                limit = target;
+                ++tsa_switches;
+            } else if (next_up && (type == H265NALU::STSA_N || type == H265NALU::STSA_R)) {
+                limit = tid;
+                ++stsa_switches;
+            }
+        }
+        return tid <= limit;
+    }
+};
+
+static void on_slice(const uint8_t *, size_t, void *opaque) {
+    ++*(int *) opaque;
+}
+
+static Model run(const std::vector<Bytes> &nalus, const std::vector<Change> &changes, const char *name) {
+    HEVCParser parser;
+    Model model;
+    size_t change = 0;
+    int picture = 0, passed = 0, expected_passed = 0;
+    size_t expected_nalus = 0;
+    uint64_t expected_bytes = 0;
+    for (auto &n : nalus) {
+        int t = hevc_type(n);
+        if (is_vcl(t)) {
+            if (change < changes.size() && changes[change].picture == picture) {
+                parser.SetMaxTemporalId(changes[change].target);
+                model.target = changes[change].target;
+                ++change;
+            }
+            int slices = 0;
+            parser.PushNALU(n.data(), n.size(), on_slice, &slices);
+            bool expected = model.passes(t, temporal_id(n));
+            if ((slices == 1) != expected) {
+                errx(1, "%s: picture %d in sub-layer %d (type %d) %s, the limit being %d", name, picture,
+                    temporal_id(n), t, slices ? "passed on" : "dropped", model.limit);
+            }
+            if (parser.GetTemporalIdLimit() != model.limit) {
+                errx(1, "%s: limit %d at picture %d, expected %d", name, parser.GetTemporalIdLimit(), picture,
+                    model.limit);
+            }
+            passed += slices;
+            expected_passed += expected;
+            if (!expected) {
+                ++expected_nalus;
+                expected_bytes += n.size();
+            }
+            ++picture;
+        } else {
+            parser.PushNALU(n.data(), n.size(), on_slice, &passed);
+        }
+    }
+    parser.Flush(on_slice, &passed);
+
+    NALScanner::SkipStats skipped;
+    parser.GetSkipStats(&skipped);
+    HEVCParser::ErrorStats errors;
+    parser.GetErrorStats(&errors);
+    if (passed != expected_passed || skipped.nalus != expected_nalus || skipped.bytes != expected_bytes
+        || errors.errors) {
+        errx(1, "%s: %d pictures passed on, %zu NALUs and %llu bytes skipped, %zu errors, expected %d, %zu and %llu",
+            name, passed, skipped.nalus, (unsigned long long) skipped.bytes, errors.errors, expected_passed,
+            expected_nalus, (unsigned long long) expected_bytes);
+    }
+    printf("%-28s %3d of %3d pictures, %zu NALUs skipped\n", name, passed, picture, skipped.nalus);
+    return model;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        errx(1, "usage: %s hevc-stream", argv[0]);
+    }
+    auto nalus = split_nalus(read_file(argv[1]));
+    relabel(&nalus);
+
+    run(nalus, {}, "all sub-layers");
+    run(nalus, { { 0, 0 } }, "sub-layer 0");
+    run(nalus, { { 0, 1 } }, "sub-layers 0 and 1");
+    /* lowered in steps, raised back, lowered and raised part way */
+    Model m = run(nalus, { { 10, 1 }, { 30, 0 }, { 42, 6 }, { 70, 0 }, { 83, 2 } }, "lowered and raised");
+    if (!m.tsa_switches || !m.stsa_switches) {
+        errx(1, "%d switches up at TSA and %d at STSA pictures, expected some of both", m.tsa_switches,
+            m.stsa_switches);
+    }
+    /* raised with nothing but IRAP pictures to switch at */
+    for (auto &n : nalus) {
+        int t = hevc_type(n);
+        if (t == H265NALU::TSA_R || t == H265NALU::STSA_R) {
+            n[0] = (uint8_t) ((n[0] & 0x81) | (H265NALU::TRAIL_R << 1));
+        }
+    }
+    m = run(nalus, { { 0, 0 }, { 5, 6 } }, "raised at IRAP pictures only");
+    if (m.irap_switches != 1) {
+        errx(1, "%d switches up at IRAP pictures, expected one", m.irap_switches);
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,67 @@
+#ifndef __TESTUTIL_H__
+#define __TESTUTIL_H__
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include "fileio.h"
+
+/* what the tests share: reading the sample, splitting it into NALUs and a
+ * pseudo-random sequence that is the same on every run */
+
+typedef std::vector<uint8_t> Bytes;
+
+/* all of path, exits if it cannot be read */
+static inline Bytes read_file(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        err(1, "unable to open %s", path);
+    }
+    Bytes bytes((size_t) file_size64(f));
+    seek64(f, 0);
+    if (fread(bytes.data(), 1, bytes.size(), f) != bytes.size()) {
+        errx(1, "unable to read %s", path);
+    }
+    fclose(f);
+    return bytes;
+}
+
+/* the NALUs of an Annex-B stream, without start codes */
+static inline std::vector<Bytes> split_nalus(const Bytes &stream) {
+    std::vector<Bytes> nalus;
+    size_t start = 0, zeros = 0;
+    bool in_nalu = false;
+    for (size_t i = 0; i < stream.size(); ++i) {
+        if (zeros >= 2 && stream[i] == 1) {
+            if (in_nalu) {
+                size_t end = i - (zeros > 3 ? 3 : zeros);
+                nalus.emplace_back(stream.begin() + start, stream.begin() + end);
+            }
+            start = i + 1;
+            in_nalu = true;
+        }
+        zeros = stream[i] ? 0 : zeros + 1;
+    }
+    if (in_nalu) {
+        nalus.emplace_back(stream.begin() + start, stream.end());
+    }
+    return nalus;
+}
+
+/* nal_unit_type of an HEVC NALU */
+static inline int hevc_type(const Bytes &nalu) {
+    return (nalu[0] >> 1) & 0x3f;
+}
+
+/* the upper 24 bits of the LCG of the C standard's example rand(), whose
+ * low bits repeat too soon */
+static inline uint32_t next_random() {
+    static uint32_t seed = 1;
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+#endif /* __TESTUTIL_H__ */
@@ -0,0 +1,252 @@
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "hevcparser.h"
+#include "testutil.h"
+#include "tsdemuxer.h"
+
+/* muxes the HEVC sample into a transport stream of two programs carrying it,
+ * and checks that TSDemuxer gives back both elementary streams byte for byte
+ * however the input is cut, that a lost packet only loses the rest of its PES
+ * packet, and that bit flips all over the stream are survived and counted,
+ * with the parser still getting most pictures out of what is passed on */
+
+static Bytes es;
+
+static const size_t kPesSize = 4096; // elementary stream bytes per PES packet
+static const int kPrograms = 2;
+
+static uint32_t crc32_mpeg(const uint8_t *p, size_t size) {
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= (uint32_t) p[i] << 24;
+        for (int j = 0; j < 8; ++j) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+struct Muxer {
+    Bytes ts;
+    uint8_t cc[8192] = {};
+    /* offset into es of the first payload byte of each video packet of
+     * program 1, and where in ts the packet is */
+    std::vector<size_t> es_offsets;
+    std::vector<size_t> ts_offsets;
+
+    /* one packet of pid, the payload padded with adaptation field stuffing */
+    void packet(int pid, bool unit_start, const uint8_t *payload, size_t size) {
+        size_t start = ts.size();
+        ts.insert(ts.end(), { 0x47, (uint8_t) ((unit_start ? 0x40 : 0) | (pid >> 8)), (uint8_t) pid });
+        size_t stuffing = TSDemuxer::kPacketSize - 4 - size;
+        ts.push_back((uint8_t) ((stuffing ? 0x30 : 0x10) | (cc[pid]++ & 0xf)));
+        if (stuffing) {
+            ts.push_back((uint8_t) (stuffing - 1));
+            if (stuffing > 1) {
+                ts.push_back(0); // no flags
+                ts.insert(ts.end(), stuffing - 2, 0xff);
+            }
+        }
+        ts.insert(ts.end(), payload, payload + size);
+        if (ts.size() - start != TSDemuxer::kPacketSize) {
+            errx(1, "muxed a packet of %zu bytes", ts.size() - start);
+        }
+    }
+
+    void section(int pid, Bytes s) {
+        size_t length = s.size() + 4 - 3;
+        s[1] = (uint8_t) (0xb0 | (length >> 8));
+        s[2] = (uint8_t) length;
+        uint32_t crc = crc32_mpeg(s.data(), s.size());
+        s.insert(s.end(), { (uint8_t) (crc >> 24), (uint8_t) (crc >> 16), (uint8_t) (crc >> 8), (uint8_t) crc });
+        s.insert(s.begin(), 0); // pointer_field
+        s.resize(TSDemuxer::kPacketSize - 4, 0xff);
+        packet(pid, true, s.data(), s.size());
+    }
+
+    void psi() {
+        Bytes pat = { 0x00, 0, 0, 0x00, 0x01, 0xc1, 0x00, 0x00 };
+        for (int p = 1; p <= kPrograms; ++p) {
+            pat.insert(pat.end(), { 0x00, (uint8_t) p, (uint8_t) (0xe0 | p), 0x00 });
+        }
+        section(0, pat);
+        for (int p = 1; p <= kPrograms; ++p) {
+            uint8_t pid_hi = (uint8_t) (0xe0 | p);
+            section(p << 8, { 0x02, 0, 0, 0x00, (uint8_t) p, 0xc1, 0x00, 0x00, pid_hi, 0x01, 0xf0, 0x00, 0x24,
+                                pid_hi, 0x01, 0xf0, 0x00 });
+        }
+    }
+
+    /* a PES packet with a PTS for each program, and a null packet */
+    void pes(size_t offset, size_t size, int64_t pts) {
+        for (int p = 1; p <= kPrograms; ++p) {
+            Bytes header = { 0, 0, 1, 0xe0, 0, 0, 0x80, 0x80, 5, (uint8_t) (0x21 | ((pts >> 29) & 0xe)),
+                (uint8_t) (pts >> 22), (uint8_t) (((pts >> 14) & 0xfe) | 1), (uint8_t) (pts >> 7),
+                (uint8_t) (((pts << 1) & 0xfe) | 1) };
+            size_t n = std::min(size, TSDemuxer::kPacketSize - 4 - header.size());
+            header.insert(header.end(), es.begin() + offset, es.begin() + offset + n);
+            int pid = (p << 8) | 1;
+            if (p == 1) {
+                es_offsets.push_back(offset);
+                ts_offsets.push_back(ts.size());
+            }
+            packet(pid, true, header.data(), header.size());
+            for (size_t i = n; i < size; i += TSDemuxer::kPacketSize - 4) {
+                if (p == 1) {
+                    es_offsets.push_back(offset + i);
+                    ts_offsets.push_back(ts.size());
+                }
+                packet(pid, false, es.data() + offset + i, std::min(size - i, TSDemuxer::kPacketSize - 4));
+            }
+        }
+        uint8_t null[TSDemuxer::kPacketSize - 4] = {};
+        packet(0x1fff, false, null, sizeof(null));
+    }
+
+    Muxer() {
+        for (size_t offset = 0, i = 0; offset < es.size(); offset += kPesSize, ++i) {
+            if (i % 16 == 0) {
+                psi();
+            }
+            pes(offset, std::min(kPesSize, es.size() - offset), 3003 * (int64_t) i);
+        }
+    }
+};
+
+struct Demuxed {
+    Bytes streams[kPrograms];
+    int found = 0;
+    int64_t last_pts[kPrograms] = { -1, -1 };
+    bool pts_in_order = true;
+};
+
+static bool on_stream(TSDemuxer::Stream *stream, void *opaque) {
+    auto d = (Demuxed *) opaque;
+    ++d->found;
+    return stream->codec == kCodecHEVC && stream->program >= 1 && stream->program <= kPrograms;
+}
+
+static void on_payload(TSDemuxer::Stream *stream, const uint8_t *bytes, size_t size, bool pes_start, void *opaque) {
+    auto d = (Demuxed *) opaque;
+    int p = stream->program - 1;
+    if (pes_start) {
+        d->pts_in_order &= stream->pts > d->last_pts[p] && stream->dts == stream->pts;
+        d->last_pts[p] = stream->pts;
+    }
+    d->streams[p].insert(d->streams[p].end(), bytes, bytes + size);
+}
+
+static void demux(const Bytes &ts, size_t max_chunk, Demuxed *d, TSDemuxer::Stats *stats) {
+    TSDemuxer demuxer(on_stream, on_payload, d);
+    for (size_t offset = 0; offset < ts.size();) {
+        size_t n = std::min(ts.size() - offset, 1 + next_random() % max_chunk);
+        demuxer.Push(ts.data() + offset, n);
+        offset += n;
+    }
+    demuxer.GetStats(stats);
+}
+
+static void check_clean(const Muxer &mux) {
+    for (size_t max_chunk : { (size_t) 1, (size_t) 200, (size_t) 65536 }) {
+        Demuxed d;
+        TSDemuxer::Stats stats;
+        demux(mux.ts, max_chunk, &d, &stats);
+        if (d.found != kPrograms || stats.packets != mux.ts.size() / TSDemuxer::kPacketSize) {
+            errx(1, "%d streams found, %llu packets", d.found, (unsigned long long) stats.packets);
+        }
+        if (stats.bytes_skipped || stats.cc_errors || stats.pes_errors || stats.psi_errors) {
+            errx(1, "errors demuxing a clean stream in chunks of up to %zu bytes", max_chunk);
+        }
+        for (auto &s : d.streams) {
+            if (s != es) {
+                errx(1, "elementary stream of %zu bytes demuxed as %zu in chunks of up to %zu bytes", es.size(),
+                    s.size(), max_chunk);
+            }
+        }
+        if (!d.pts_in_order) {
+            errx(1, "PTS not demuxed in order");
+        }
+    }
+}
+
+/* drops a video packet of program 1 in the middle of a PES packet */
+static void check_lost_packet(const Muxer &mux) {
+    size_t i = mux.es_offsets.size() / 2;
+    while (mux.es_offsets[i] % kPesSize == 0) {
+        ++i;
+    }
+    size_t lost = mux.es_offsets[i];
+    size_t resume = (lost / kPesSize + 1) * kPesSize;
+    Bytes ts(mux.ts.begin(), mux.ts.begin() + mux.ts_offsets[i]);
+    ts.insert(ts.end(), mux.ts.begin() + mux.ts_offsets[i] + TSDemuxer::kPacketSize, mux.ts.end());
+
+    Demuxed d;
+    TSDemuxer::Stats stats;
+    demux(ts, 65536, &d, &stats);
+    Bytes expected(es.begin(), es.begin() + lost);
+    expected.insert(expected.end(), es.begin() + resume, es.end());
+    if (stats.cc_errors != 1 || d.streams[0] != expected || d.streams[1] != es) {
+        errx(1, "lost packet: %llu continuity errors, %zu and %zu bytes demuxed, expected %zu and %zu",
+            (unsigned long long) stats.cc_errors, d.streams[0].size(), d.streams[1].size(), expected.size(),
+            es.size());
+    }
+}
+
+static void on_slice(const uint8_t *, size_t, void *opaque) {
+    ++*(int *) opaque;
+}
+
+/* flips a bit in every interval bytes or so, sync bytes and headers
+ * included */
+static void check_bit_flips(const Muxer &mux, size_t interval) {
+    Bytes ts = mux.ts;
+    int flipped = 0;
+    for (size_t i = next_random() % interval; i < ts.size(); i += 1 + next_random() % (2 * interval)) {
+        ts[i] ^= (uint8_t) (1 << (next_random() & 7));
+        ++flipped;
+    }
+    Demuxed d;
+    TSDemuxer::Stats stats;
+    demux(ts, 65536, &d, &stats);
+    uint64_t errors = stats.bytes_skipped + stats.cc_errors + stats.pes_errors + stats.psi_errors;
+    /* flips in the payload pass through unnoticed, at this rate some hit
+     * headers too */
+    bool dense = interval <= 1000;
+    if ((dense && !errors) || d.streams[0].size() > es.size() || d.streams[1].size() > es.size()) {
+        errx(1, "%d bits flipped: %llu errors, %zu and %zu bytes demuxed", flipped, (unsigned long long) errors,
+            d.streams[0].size(), d.streams[1].size());
+    }
+
+    int pictures = 0;
+    HEVCParser parser;
+    parser.SetHoldPictures(true);
+    parser.Parse(d.streams[0].data(), d.streams[0].size(), on_slice, &pictures);
+    parser.Flush(on_slice, &pictures);
+    printf("%6d bits flipped: %llu bytes skipped, %llu continuity, %llu PES and %llu PSI errors, %d pictures\n",
+        flipped, (unsigned long long) stats.bytes_skipped, (unsigned long long) stats.cc_errors,
+        (unsigned long long) stats.pes_errors, (unsigned long long) stats.psi_errors, pictures);
+    if (interval >= 100000 && pictures < 155 / 2) {
+        errx(1, "only %d pictures parsed with a bit flipped in every %zu bytes", pictures, interval);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        errx(1, "usage: %s hevc-stream", argv[0]);
+    }
+    es = read_file(argv[1]);
+
+    Muxer mux;
+    check_clean(mux);
+    check_lost_packet(mux);
+    for (size_t interval : { 100000, 10000, 1000, 100 }) {
+        check_bit_flips(mux, interval);
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "decodepipeline.h"
+#include "hevcparser.h"
+#include "picturehash.h"
+#include "simbackend.h"
+#include "testutil.h"
+
+/* adds a decoded picture hash SEI after every picture of a stream, as an
+ * encoder would, hashing the all-zero pictures the simulated device decodes
+ * to, and one of them wrong. Decoding that with DecodePipeline::SetVerification()
+ * must check every picture, with each hash type, and find that one only. */
+
+static Bytes stream;
+static const uint64_t kWrongPicture = 10;
+
+static void on_slice(const uint8_t *, size_t, void *) {
+}
+
+/* appends nalu with a start code */
+static void append(Bytes *out, const Bytes &nalu) {
+    out->insert(out->end(), { 0, 0, 0, 1 });
+    out->insert(out->end(), nalu.begin(), nalu.end());
+}
+
+/* as append(), for a NALU still needing emulation prevention bytes */
+static void append_rbsp(Bytes *out, const Bytes &rbsp) {
+    out->insert(out->end(), { 0, 0, 0, 1 });
+    int zeros = 0;
+    for (size_t i = 0; i < rbsp.size(); ++i) {
+        if (zeros >= 2 && rbsp[i] <= 3) {
+            out->push_back(3);
+            zeros = 0;
+        }
+        out->push_back(rbsp[i]);
+        zeros = rbsp[i] ? 0 : zeros + 1;
+    }
+}
+
+/* suffix SEI with the hash of an all-zero 4:2:0 picture */
+static Bytes hash_sei(int hash_type, int width, int height, bool wrong) {
+    std::vector<uint8_t> zeros((size_t) width * height);
+    size_t n = PictureHashSize(hash_type);
+    Bytes sei = { (uint8_t) (H265NALU::SUFFIX_SEI_NUT << 1), 1, 132, (uint8_t) (1 + 3 * n), (uint8_t) hash_type };
+    for (int c = 0; c < 3; ++c) {
+        uint8_t value[16];
+        HashPlane(hash_type, zeros.data(), width, c ? width / 2 : width, c ? height / 2 : height, value);
+        sei.insert(sei.end(), value, value + n);
+    }
+    if (wrong) {
+        sei[5] ^= 1;
+    }
+    sei.push_back(0x80);
+    return sei;
+}
+
+static Bytes with_hashes() {
+    HEVCParser parser;
+    parser.Parse(stream.data(), stream.size(), on_slice, nullptr);
+    parser.Flush(on_slice, nullptr);
+    int width, height;
+    parser.GetDimensions(&width, &height);
+
+    Bytes out;
+    uint64_t picture = 0;
+    for (auto &n : split_nalus(stream)) {
+        append(&out, n);
+        if (hevc_type(n) <= H265NALU::RSV_IRAP_VCL23) {
+            append_rbsp(&out, hash_sei((int) (picture % 3), width, height, picture == kWrongPicture));
+            ++picture;
+        }
+    }
+    return out;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        errx(1, "usage: %s hevc-stream", argv[0]);
+    }
+    stream = read_file(argv[1]);
+
+    Bytes hashed = with_hashes();
+    DecoderVerifyStats stats;
+    uint64_t pictures;
+    {
+        /* slow enough for the verifier to keep up without dropping any */
+        SimulatedDevice device(1, 2000000);
+        DecodePipeline pipeline(&device);
+        pipeline.SetVerification(true);
+        const size_t chunk = 0x10000;
+        for (size_t offset = 0; offset < hashed.size(); offset += chunk) {
+            pipeline.ReceiveBytes(hashed.data() + offset, std::min(chunk, hashed.size() - offset));
+        }
+        pipeline.Flush();
+        pipeline.GetVerifyStats(&stats);
+        pictures = pipeline.GetPictureCount();
+    }
+    if (stats.verified != pictures || stats.mismatches != 1 || stats.unhashed || stats.dropped) {
+        errx(1, "%llu pictures: %llu verified, %llu mismatches, %llu without a hash, %llu dropped",
+            (unsigned long long) pictures, (unsigned long long) stats.verified,
+            (unsigned long long) stats.mismatches, (unsigned long long) stats.unhashed,
+            (unsigned long long) stats.dropped);
+    }
+    printf("ok (%llu pictures)\n", (unsigned long long) pictures);
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+
+#include "trace.h"
+
+int trace_level = 0;
+
+struct TraceEvent {
+    const char *name;
+    uint64_t ts;
+    uint64_t dur;
+    int64_t arg;
+    char phase;
+};
+
+/* each thread writes only to its own ring, and publishes events by bumping
+ * head. Rings are never freed, so events from threads that have exited can
+ * still be flushed. */
+struct TraceRing {
+    static const size_t size = 0x10000;
+
+    TraceRing *next;
+    uint32_t tid;
+    std::atomic<uint64_t> head;
+    TraceEvent events[size];
+};
+
+static std::atomic<TraceRing *> rings;
+static std::atomic<uint32_t> ring_count;
+static thread_local TraceRing *ring;
+
+static TraceRing *GetRing() {
+    if (!ring) {
+        auto r = new TraceRing();
+        r->tid = ++ring_count;
+        r->head = 0;
+        r->next = rings.load();
+        while (!rings.compare_exchange_weak(r->next, r)) {
+        }
+        ring = r;
+    }
+    return ring;
+}
+
+uint64_t TraceNow() {
+    static const auto epoch = std::chrono::steady_clock::now();
+    auto d = std::chrono::steady_clock::now() - epoch;
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+}
+
+void TraceRecord(char phase, const char *name, uint64_t ts, uint64_t dur, int64_t arg) {
+    auto r = GetRing();
+    uint64_t h = r->head.load(std::memory_order_relaxed);
+    auto e = &r->events[h & (TraceRing::size - 1)];
+    e->name = name;
+    e->ts = ts;
+    e->dur = dur;
+    e->arg = arg;
+    e->phase = phase;
+    r->head.store(h + 1, std::memory_order_release);
+}
+
+bool TraceFlush(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        return false;
+    }
+    fprintf(f, "{\"traceEvents\":[");
+    const char *sep = "\n";
+    for (auto r = rings.load(); r; r = r->next) {
+        uint64_t head = r->head.load(std::memory_order_acquire);
+        uint64_t tail = head > TraceRing::size ? head - TraceRing::size : 0;
+        for (uint64_t i = tail; i < head; ++i) {
+            auto e = &r->events[i & (TraceRing::size - 1)];
+            fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"ts\":%.3f",
+                sep, e->name, e->phase, r->tid, e->ts / 1000.0);
+            if (e->phase == 'X') {
+                fprintf(f, ",\"dur\":%.3f", e->dur / 1000.0);
+            } else if (e->phase == 'i') {
+                fprintf(f, ",\"s\":\"t\"");
+            }
+            fprintf(f, ",\"args\":{\"v\":%lld}}", (long long) e->arg);
+            sep = ",\n";
+        }
+    }
+    fprintf(f, "\n]}\n");
+    return fclose(f) == 0;
+}
@@ -0,0 +1,72 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <iostream>
+
+/* tracing and debug logging. Every log statement and trace event has a level:
+ *
+ *   1  errors and one-off events (device setup, heap creation)
+ *   2  per-frame events
+ *   3  per-NALU events
+ *
+ * Levels above TRACE_MAX_LEVEL are compiled out entirely. The rest are
+ * checked against trace_level at runtime, which defaults to 0 (off).
+ *
+ * Trace events go to a per-thread ring buffer without taking any locks, and
+ * can be written out as Chrome trace-event JSON (chrome://tracing, Perfetto)
+ * with TraceFlush(). When a ring wraps, the oldest events are overwritten. */
+
+#ifndef TRACE_MAX_LEVEL
+#define TRACE_MAX_LEVEL 3
+#endif
+
+extern int trace_level;
+
+#define TRACE_ON(_n) ((_n) <= TRACE_MAX_LEVEL && (_n) <= trace_level)
+
+#ifndef DVLOG
+#define DVLOG(_n) \
+    if (!TRACE_ON(_n)) { \
+    } else \
+        std::cerr << "\n@" << __LINE__ << ":"
+#endif
+
+uint64_t TraceNow(); // nanoseconds since first use
+void TraceRecord(char phase, const char *name, uint64_t ts, uint64_t dur, int64_t arg);
+bool TraceFlush(const char *path);
+
+class TraceScope {
+    const char *name;
+    int64_t arg;
+    uint64_t start;
+
+public:
+    TraceScope(bool on, const char *name, int64_t arg = 0)
+        : name(on ? name : nullptr), arg(arg), start(on ? TraceNow() : 0) {
+    }
+
+    ~TraceScope() {
+        if (name) {
+            TraceRecord('X', name, start, TraceNow() - start, arg);
+        }
+    }
+};
+
+#define TRACE_CONCAT2(_a, _b) _a##_b
+#define TRACE_CONCAT(_a, _b) TRACE_CONCAT2(_a, _b)
+
+/* _name must be a string literal, only the pointer is stored. */
+#define TRACE_EVENT(_n, _name, ...) \
+    TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(TRACE_ON(_n), _name, ##__VA_ARGS__)
+
+#define TRACE_INSTANT(_n, _name, _arg) \
+    do { \
+        if (TRACE_ON(_n)) { \
+            TraceRecord('i', _name, TraceNow(), 0, _arg); \
+        } \
+    } while (0)
+
+#endif /* __TRACE_H__ */
@@ -0,0 +1,306 @@
+#include <err.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "trace.h"
+#include "tsdemuxer.h"
+
+static const uint8_t kSyncByte = 0x47;
+
+/* CRC_32 of Annex A of 13818-1, which comes out as 0 over a whole section
+ * including its CRC. Only run on PAT and PMT sections, so bitwise will do. */
+static uint32_t crc32_mpeg(const uint8_t *p, size_t size) {
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= (uint32_t) p[i] << 24;
+        for (int j = 0; j < 8; ++j) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+/* 33 bit PTS or DTS, split by marker bits over 5 bytes */
+static int64_t read_timestamp(const uint8_t *p) {
+    return ((int64_t) ((p[0] >> 1) & 7) << 30) | ((int64_t) p[1] << 22) | ((int64_t) (p[2] >> 1) << 15) | ((int64_t) p[3] << 7) | (p[4] >> 1);
+}
+
+TSDemuxer::TSDemuxer(stream_callback_t stream_cb, payload_callback_t payload_cb, void *opaque)
+    : stream_cb(stream_cb), payload_cb(payload_cb), opaque(opaque) {
+    for (auto &e : pids) {
+        e = { kPidNone, -1, 0 };
+    }
+    add_psi(0, kPidPAT, 0);
+}
+
+TSDemuxer::~TSDemuxer() {
+    for (auto s : psi) {
+        delete s;
+    }
+    for (auto st : streams) {
+        delete st;
+    }
+}
+
+bool TSDemuxer::Probe(const uint8_t *bytes, size_t size) {
+    return size > kPacketSize && bytes[0] == kSyncByte && bytes[kPacketSize] == kSyncByte;
+}
+
+int TSDemuxer::add_psi(int pid, PidType type, int program) {
+    auto s = new Section();
+    s->program = program;
+    s->version = -1;
+    s->size = 0;
+    s->needed = 0;
+    int index = (int) psi.size();
+    psi.push_back(s);
+    pids[pid] = { type, -1, (uint16_t) index };
+    return index;
+}
+
+void TSDemuxer::Push(const uint8_t *bytes, size_t size) {
+    TRACE_EVENT(2, "TSDemuxer::Push", size);
+    size_t i = 0;
+    if (carry_size) {
+        size_t n = std::min(kPacketSize - carry_size, size);
+        memcpy(carry + carry_size, bytes, n);
+        carry_size += n;
+        i = n;
+        if (carry_size < kPacketSize) {
+            return;
+        }
+        packet(carry);
+        carry_size = 0;
+    }
+    while (i < size) {
+        if (bytes[i] != kSyncByte) {
+            ++stats.bytes_skipped;
+            ++i;
+            continue;
+        }
+        if (size - i < kPacketSize) {
+            carry_size = size - i;
+            memcpy(carry, bytes + i, carry_size);
+            break;
+        }
+        packet(bytes + i);
+        i += kPacketSize;
+    }
+}
+
+void TSDemuxer::packet(const uint8_t *p) {
+    ++stats.packets;
+    int pid = ((p[1] & 0x1f) << 8) | p[2];
+    Pid &e = pids[pid];
+    /* drop anything we do not follow, and packets flagged as corrupt by
+     * the demodulator, whose loss the continuity counter catches */
+    if (e.type == kPidNone || (p[1] & 0x80)) {
+        return;
+    }
+    bool unit_start = p[1] & 0x40;
+    int adaptation_field_control = (p[3] >> 4) & 3;
+    int cc = p[3] & 0xf;
+
+    size_t offset = 4;
+    bool discontinuity = false;
+    if (adaptation_field_control & 2) {
+        size_t length = p[4];
+        if (length > kPacketSize - 5) {
+            return;
+        }
+        discontinuity = length && (p[5] & 0x80);
+        offset += 1 + length;
+    }
+    /* the counter only advances on packets with a payload */
+    if (!(adaptation_field_control & 1) || offset == kPacketSize) {
+        return;
+    }
+    bool lost = false;
+    if (e.cc >= 0 && !discontinuity) {
+        if (cc == e.cc) {
+            return; // duplicate packet
+        }
+        if (cc != ((e.cc + 1) & 0xf)) {
+            ++stats.cc_errors;
+            lost = true;
+        }
+    }
+    e.cc = (int8_t) cc;
+
+    const uint8_t *payload = p + offset;
+    size_t size = kPacketSize - offset;
+    if (e.type == kPidVideo) {
+        auto st = streams[e.index];
+        if (lost) {
+            st->in_pes = false;
+        }
+        pes_data(st, payload, size, unit_start);
+    } else {
+        auto s = psi[e.index];
+        if (lost) {
+            s->size = 0;
+            s->needed = 0;
+        }
+        section_data(s, pid, payload, size, unit_start);
+    }
+}
+
+void TSDemuxer::pes_data(StreamState *st, const uint8_t *p, size_t size, bool unit_start) {
+    Stream *stream = &st->stream;
+    if (unit_start) {
+        /* packet_start_code_prefix, stream_id, PES_packet_length, then the
+         * optional header, starting with its '10' marker bits. Video PES
+         * packets are usually unbounded, so their length is ignored. */
+        st->in_pes = false;
+        if (size < 9 || p[0] || p[1] || p[2] != 1 || (p[6] & 0xc0) != 0x80) {
+            ++stats.pes_errors;
+            return;
+        }
+        size_t header_size = 9 + p[8];
+        int pts_dts_flags = p[7] >> 6;
+        if (header_size > size || (pts_dts_flags == 1)
+            || (pts_dts_flags == 2 && p[8] < 5) || (pts_dts_flags == 3 && p[8] < 10)) {
+            ++stats.pes_errors;
+            return;
+        }
+        stream->pts = pts_dts_flags & 2 ? read_timestamp(p + 9) : -1;
+        stream->dts = pts_dts_flags == 3 ? read_timestamp(p + 14) : stream->pts;
+        st->in_pes = true;
+        ++stats.video_packets;
+        payload_cb(stream, p + header_size, size - header_size, true, opaque);
+    } else if (st->in_pes) {
+        ++stats.video_packets;
+        payload_cb(stream, p, size, false, opaque);
+    }
+}
+
+/* a section may start anywhere in a packet with payload_unit_start_indicator
+ * set, at the offset given by pointer_field, and carry on over the packets
+ * that follow. More sections, or stuffing, may follow the end of one. */
+void TSDemuxer::section_data(Section *s, int pid, const uint8_t *p, size_t size, bool unit_start) {
+    if (unit_start) {
+        size_t pointer = p[0];
+        ++p;
+        --size;
+        if (pointer > size) {
+            ++stats.psi_errors;
+            s->size = 0;
+            s->needed = 0;
+            return;
+        }
+        /* the bytes before the pointer end the section already started */
+        if (s->size) {
+            gather_section(s, pid, p, pointer);
+        }
+        s->size = 0;
+        s->needed = 0;
+        p += pointer;
+        size -= pointer;
+        while (size && p[0] != 0xff) {
+            size_t n = gather_section(s, pid, p, size);
+            p += n;
+            size -= n;
+        }
+    } else if (s->size) {
+        gather_section(s, pid, p, size);
+    }
+}
+
+/* adds up to size bytes to the section, the header up to section_length
+ * first and then the rest, and parses it once complete. Returns how many
+ * bytes were used. */
+size_t TSDemuxer::gather_section(Section *s, int pid, const uint8_t *p, size_t size) {
+    size_t wanted = (s->needed ? s->needed : 3) - s->size;
+    size_t n = std::min(wanted, size);
+    memcpy(s->bytes + s->size, p, n);
+    s->size += n;
+    if (!s->needed && s->size == 3) {
+        s->needed = 3 + (((s->bytes[1] & 0xf) << 8) | s->bytes[2]);
+        if (s->needed > sizeof(s->bytes) || s->needed < 12) {
+            ++stats.psi_errors;
+            s->size = 0;
+            s->needed = 0;
+            return size;
+        }
+    }
+    if (s->size == s->needed) {
+        parse_section(s, pid);
+        s->size = 0;
+        s->needed = 0;
+    }
+    return n;
+}
+
+void TSDemuxer::parse_section(Section *s, int pid) {
+    const uint8_t *p = s->bytes;
+    size_t size = s->needed;
+    /* section_syntax_indicator and current_next_indicator must be set, a
+     * section that is not yet current is sent ahead of a change */
+    if (!(p[1] & 0x80) || crc32_mpeg(p, size) != 0) {
+        ++stats.psi_errors;
+        return;
+    }
+    if (!(p[5] & 1)) {
+        return;
+    }
+    int version = (p[5] >> 1) & 0x1f;
+    bool single = p[6] == 0 && p[7] == 0; // section_number, last_section_number
+    if (single && version == s->version) {
+        return;
+    }
+    int table_id = p[0];
+    if (pid == 0 && table_id == 0x00) {
+        parse_pat(p + 8, size - 12);
+    } else if (pid != 0 && table_id == 0x02) {
+        parse_pmt(s, p + 8, size - 12);
+    } else {
+        return;
+    }
+    s->version = single ? version : -1;
+}
+
+void TSDemuxer::parse_pat(const uint8_t *p, size_t size) {
+    for (size_t i = 0; i + 4 <= size; i += 4) {
+        int program = (p[i] << 8) | p[i + 1];
+        int pid = ((p[i + 2] & 0x1f) << 8) | p[i + 3];
+        /* program 0 points at the network information table */
+        if (program && pids[pid].type == kPidNone) {
+            add_psi(pid, kPidPMT, program);
+        }
+    }
+}
+
+void TSDemuxer::parse_pmt(Section *s, const uint8_t *p, size_t size) {
+    if (size < 4) {
+        ++stats.psi_errors;
+        return;
+    }
+    size_t program_info_length = ((p[2] & 0xf) << 8) | p[3];
+    if (program_info_length > size - 4) {
+        ++stats.psi_errors;
+        return;
+    }
+    /* streams are only ever added, a PMT update dropping one leaves its
+     * PID in place until its packets stop coming */
+    for (size_t i = 4 + program_info_length; i + 5 <= size;) {
+        int stream_type = p[i];
+        int pid = ((p[i + 1] & 0x1f) << 8) | p[i + 2];
+        size_t es_info_length = ((p[i + 3] & 0xf) << 8) | p[i + 4];
+        i += 5 + es_info_length;
+
+        VideoCodec codec = stream_type == 0x24 ? kCodecHEVC : stream_type == 0x1b ? kCodecH264 : kCodecUnknown;
+        if (codec == kCodecUnknown || pids[pid].type != kPidNone) {
+            continue;
+        }
+        auto st = new StreamState();
+        st->stream = { s->program, pid, stream_type, codec, -1, -1, nullptr };
+        st->in_pes = false;
+        if (!stream_cb(&st->stream, opaque)) {
+            delete st;
+            continue;
+        }
+        pids[pid] = { kPidVideo, -1, (uint16_t) streams.size() };
+        streams.push_back(st);
+    }
+}
@@ -0,0 +1,126 @@
+#ifndef __TSDEMUXER_H__
+#define __TSDEMUXER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "decodebackend.h"
+
+/* demuxes the H.264 and HEVC video streams of an MPEG-2 transport stream
+ * (ISO/IEC 13818-1), e.g. from a broadcast or IPTV multicast, any number of
+ * programs at once. PAT and PMT sections are parsed to learn which PIDs
+ * carry video, and every other PID is dropped after a single table lookup.
+ *
+ * PES packets are not reassembled: once its header has been parsed for
+ * PTS/DTS, the payload of each TS packet is handed to the payload callback
+ * as is, pointing into the bytes given to Push(), to be fed straight to the
+ * streaming parser. Only TS packets split across Push() calls are copied,
+ * so the demuxer never holds more than one packet.
+ *
+ * Packets are 188 bytes, sync is regained on 0x47 after garbage, and a
+ * continuity counter gap drops the stream until its next PES packet. The PES
+ * header must fit in the first TS packet of a PES packet, which it does in
+ * any sane stream. */
+
+class TSDemuxer {
+public:
+    static const size_t kPacketSize = 188;
+
+    struct Stream {
+        int program; // program_number
+        int pid;
+        int stream_type; // from the PMT
+        VideoCodec codec;
+        int64_t pts; // of the current PES packet, 90kHz, -1 if absent
+        int64_t dts; // equal to pts if absent from the PES header
+        void *user; // for the caller, see stream_callback_t
+    };
+
+    /* called for each video stream found in a PMT, the stream is only
+     * demuxed if this returns true */
+    typedef bool (*stream_callback_t)(Stream *stream, void *opaque);
+    /* pes_start is set for the first payload of each PES packet */
+    typedef void (*payload_callback_t)(Stream *stream, const uint8_t *bytes, size_t size, bool pes_start, void *opaque);
+
+    struct Stats {
+        uint64_t packets;
+        uint64_t video_packets; // passed on to the payload callback
+        uint64_t bytes_skipped; // while looking for sync
+        uint64_t cc_errors; // continuity counter gaps
+        uint64_t pes_errors; // malformed PES headers
+        uint64_t psi_errors; // malformed or corrupt PAT and PMT sections
+    };
+
+private:
+    enum PidType : uint8_t {
+        kPidNone,
+        kPidPAT,
+        kPidPMT,
+        kPidVideo,
+    };
+
+    /* per PID state, looked up for every packet. index is into psi for PAT
+     * and PMT PIDs and into streams for video PIDs. */
+    struct Pid {
+        PidType type;
+        int8_t cc; // last continuity_counter, -1 before the first packet
+        uint16_t index;
+    };
+
+    /* a PAT or PMT section being gathered from the packets of its PID */
+    struct Section {
+        int program; // for PMT PIDs
+        int version; // of the last section parsed, -1 for none
+        size_t size;
+        size_t needed; // 0 until the section header has been seen
+        uint8_t bytes[1024]; // the maximum for PAT and PMT
+    };
+
+    struct StreamState {
+        Stream stream;
+        bool in_pes; // synced to a PES packet
+    };
+
+    static const int kNumPids = 8192;
+    Pid pids[kNumPids];
+    std::vector<Section *> psi;
+    std::vector<StreamState *> streams;
+
+    stream_callback_t stream_cb;
+    payload_callback_t payload_cb;
+    void *opaque;
+
+    uint8_t carry[kPacketSize]; // a packet split across Push() calls
+    size_t carry_size = 0;
+
+    Stats stats = {};
+
+    int add_psi(int pid, PidType type, int program);
+    void packet(const uint8_t *p);
+    void section_data(Section *s, int pid, const uint8_t *p, size_t size, bool unit_start);
+    size_t gather_section(Section *s, int pid, const uint8_t *p, size_t size);
+    void parse_section(Section *s, int pid);
+    void parse_pat(const uint8_t *p, size_t size);
+    void parse_pmt(Section *s, const uint8_t *p, size_t size);
+    void pes_data(StreamState *st, const uint8_t *p, size_t size, bool unit_start);
+
+public:
+    TSDemuxer(stream_callback_t stream_cb, payload_callback_t payload_cb, void *opaque);
+    ~TSDemuxer();
+    TSDemuxer(const TSDemuxer &) = delete;
+    TSDemuxer &operator=(const TSDemuxer &) = delete;
+
+    /* true if bytes, the start of a file, look like a transport stream */
+    static bool Probe(const uint8_t *bytes, size_t size);
+
+    /* bytes may be cut anywhere */
+    void Push(const uint8_t *bytes, size_t size);
+
+    void GetStats(Stats *out) const {
+        *out = stats;
+    }
+};
+
+#endif /* __TSDEMUXER_H__ */
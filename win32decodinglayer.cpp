@@ -10,48 +10,18 @@
 #include <inttypes.h>
 #include <stdlib.h>
 
+#include <algorithm>
+#include <vector>
+
 #include "device.h"
 //#include "hash.h"
-#include "hevcbitstream.h"
-#include "hevcparser.h"
+#include "colorconvert.h"
+#include "d3d12backend.h"
+#include "decodepipeline.h"
+#include "latency.h"
+#include "trace.h"
 #include "win32decodinglayer.h"
-
-#define CHECK(_hr) \
-    if (FAILED(_hr)) { \
-        const char *msg = nullptr; \
-        switch (_hr) { \
-            case E_FAIL: \
-                msg = "E_FAIL"; \
-                break; \
-            case E_OUTOFMEMORY: \
-                msg = "E_OUTOFMEMORY"; \
-                break; \
-            case E_INVALIDARG: \
-                msg = "E_INVALIDARG"; \
-                break; \
-            case DXGI_ERROR_DEVICE_REMOVED: \
-                msg = "DXGI_ERROR_DEVICE_REMOVED"; \
-                warnx("device removed %s line %d, hr=%x : %s\n", __FUNCTION__, __LINE__, (uint32_t) hr, msg); \
-                break; \
-            case DXGI_ERROR_INVALID_CALL: \
-                msg = "DXGI_ERROR_INVALID_CALL"; \
-                break; \
-            default: \
-                msg = "unknown error"; \
-                break; \
-        } \
-        errx(1, "failed %s line %d, hr=%x : %s\n", __FUNCTION__, __LINE__, (uint32_t) hr, msg); \
-    }
-
-
-
-#define NAL_UNIT_H265_VPS 32
-#define NAL_UNIT_H265_SPS 33
-#define NAL_UNIT_H265_PPS 34
-
-#define NAL_UNIT_H264_SEI 6
-#define NAL_UNIT_H264_SPS 7
-#define NAL_UNIT_H264_PPS 8
+#include "workerpool.h"
 
 #if 0
 #define IS_IDR(s) ((s)->nal_unit_type == HEVC_NAL_IDR_W_RADL || (s)->nal_unit_type == HEVC_NAL_IDR_N_LP)
@@ -202,22 +172,19 @@ d3d12_video_decoder_log_pic_params_hevc(DXVA_PicParams_HEVC *pPicParams)
 class Win32DecoderImpl {
 
     friend class Win32DecodingLayer;
-    HEVCParser hevc_parser;
 
 protected:
     Win32DecodingLayer *dl;
     ID3D12Device *device;
     ID3D12Device4 *device4;
 
-    ID3D12CommandAllocator *direct_command_allocator;
-    ID3D12CommandQueue *direct_command_queue;
-    ID3D12GraphicsCommandList *direct_command_list;
+    /* decoding proper, this layer converts around it */
+    D3D12DecodeDevice *decode_device = nullptr;
+    DecodePipeline *pipeline = nullptr;
+    D3D12DecodeSession *session = nullptr;
+    uint64_t ticket = 0;
 
-    HANDLE fenceEvent;
-    ID3D12Fence *fence;
-    uint32_t direct_fencevalue = 0;
-
-    ID3D12VideoProcessor1 *video_processor;
+    ID3D12VideoProcessor1 *video_processor = nullptr;
     ID3D12CommandAllocator *process_command_allocator;
     ID3D12VideoProcessCommandList1 *process_command_list;
     ID3D12CommandQueue *process_command_queue;
@@ -225,30 +192,22 @@ protected:
     ID3D12Fence *process_fence;
     HANDLE process_fence_event;
 
-    static const int num_reference_textures = 25;
-    ID3D12Resource *reference_texture = nullptr;
-    ID3D12Resource *nv12_texture = nullptr;
-
-    HEVCBitStream *hevc_bitstream = nullptr;
-
-    // d3d12 decoder state
-    ID3D12VideoDevice3 *video_device = nullptr;
-    int heap_width = 0;
-    int heap_height = 0;
-    ID3D12VideoDecoderHeap *decoder_heap = nullptr;
-    ID3D12VideoDecoder *video_decoder = nullptr;
-
-    ID3D12CommandAllocator *video_command_allocator = nullptr;
-    ID3D12VideoDecodeCommandList2 *video_command_list = nullptr;
-    ID3D12CommandQueue *video_command_queue = nullptr;
-
-    HANDLE video_event;
-    ID3D12Fence *video_fence = nullptr;
-    UINT64 video_fencevalue = 0;
-
-    D3D12_VIDEO_DECODE_CONFIGURATION decode_config = {
-        D3D12_VIDEO_DECODE_PROFILE_HEVC_MAIN,
-    };
+    /* used instead of video_processor on adapters that lack one, with the
+     * matrix and range taken from the stream before each picture */
+    ColorConverter cpu_converter{ kPixelNV12, kPixelRGBA, kMatrixBT709, kRangeStudio };
+    WorkerPool *worker_pool = nullptr;
+    bool force_cpu_convert = false;
+    /* its output is staged here, mapped for as long as the buffer lives and
+     * only replaced when a larger picture comes along */
+    ID3D12Resource *upload_buffer = nullptr;
+    UINT64 upload_size = 0;
+    uint8_t *upload_data = nullptr;
+
+    /* decoded pictures are converted into this when convert_output is set,
+     * see Win32DecodingLayer::SetOutputConversion() */
+    bool convert_output = false;
+    ID3D12Resource *rgba_texture = nullptr;
+    int rgba_width = 0, rgba_height = 0;
 
     static LRESULT CALLBACK WindowProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) {
         return DefWindowProc(hwnd, message, wParam, lParam);
@@ -266,97 +225,95 @@ protected:
 
         /************* video decoder *******************************/
 
-        hr = device->QueryInterface(IID_PPV_ARGS(&video_device));
-        CHECK(hr);
-
         hr = device->QueryInterface(IID_PPV_ARGS(&device4));
         CHECK(hr);
 
-        D3D12_VIDEO_DECODER_DESC decoder_desc = { 0, decode_config };
-
-        hr = video_device->CreateVideoDecoder(&decoder_desc, IID_PPV_ARGS(&video_decoder));
-        CHECK(hr);
+        decode_device = new D3D12DecodeDevice(device);
+        pipeline = new DecodePipeline(decode_device, Decode, this);
 
-        D3D12_FEATURE_DATA_VIDEO_DECODE_SUPPORT decode_support = {};
-        decode_support.Configuration = decode_config;
-        decode_support.Width = width;
-        decode_support.Height = height;
-        decode_support.DecodeFormat = DXGI_FORMAT_NV12;
-        decode_support.FrameRate.Numerator = 30;
-        decode_support.FrameRate.Denominator = 1;
-        decode_support.BitRate = 0;
-        hr = video_device->CheckFeatureSupport(D3D12_FEATURE_VIDEO_DECODE_SUPPORT, &decode_support, sizeof(decode_support));
-        CHECK(hr);
-
-        if (decode_support.SupportFlags != D3D12_VIDEO_DECODE_SUPPORT_FLAG_SUPPORTED || decode_support.DecodeTier < D3D12_VIDEO_DECODE_TIER_1) {
-            errx(1, "%s: not supported", __PRETTY_FUNCTION__);
-        }
-
-        auto cf = decode_support.ConfigurationFlags;
-        printf("flags %x\n", cf);
-        switch (cf) {
-            case D3D12_VIDEO_DECODE_CONFIGURATION_FLAG_NONE:
-                break;
-            case D3D12_VIDEO_DECODE_CONFIGURATION_FLAG_HEIGHT_ALIGNMENT_MULTIPLE_32_REQUIRED:
-                printf("32 mult\n");
-                break;
-            case D3D12_VIDEO_DECODE_CONFIGURATION_FLAG_POST_PROCESSING_SUPPORTED:
-                printf("post proc\n");
-                break;
-            case D3D12_VIDEO_DECODE_CONFIGURATION_FLAG_REFERENCE_ONLY_ALLOCATIONS_REQUIRED:
-                printf("reference only\n");
-                break;
-            case D3D12_VIDEO_DECODE_CONFIGURATION_FLAG_ALLOW_RESOLUTION_CHANGE_ON_NON_KEY_FRAME:
-                printf("non key\n");
-                break;
-        }
+        /********** video processor *********************************/
 
-        hr = device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_VIDEO_DECODE, IID_PPV_ARGS(&video_command_allocator));
+        hr = device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_VIDEO_PROCESS, IID_PPV_ARGS(&process_command_allocator));
         CHECK(hr);
 
-        hr = device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_VIDEO_DECODE, video_command_allocator, nullptr, IID_PPV_ARGS(&video_command_list));
+        hr = device4->CreateCommandList1(0, D3D12_COMMAND_LIST_TYPE_VIDEO_PROCESS, D3D12_COMMAND_LIST_FLAG_NONE, IID_PPV_ARGS(&process_command_list));
         CHECK(hr);
 
-        hr = video_command_list->Close();
+        D3D12_COMMAND_QUEUE_DESC process_queue_desc = { D3D12_COMMAND_LIST_TYPE_VIDEO_PROCESS, 0, D3D12_COMMAND_QUEUE_FLAG_NONE };
+        hr = device->CreateCommandQueue(&process_queue_desc, IID_PPV_ARGS(&process_command_queue));
         CHECK(hr);
 
-        D3D12_COMMAND_QUEUE_DESC video_queue_desc = { D3D12_COMMAND_LIST_TYPE_VIDEO_DECODE, 0, D3D12_COMMAND_QUEUE_FLAG_NONE };
-        hr = device->CreateCommandQueue(&video_queue_desc, IID_PPV_ARGS(&video_command_queue));
+        hr = device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&process_fence));
         CHECK(hr);
 
-        video_command_queue->SetName(L"video_command_queue");
+        process_fence_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+        if (process_fence_event == NULL) {
+            errx(1, "err %s on line %d\n", __FUNCTION__, __LINE__);
+        }
 
-        hr = device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&video_fence));
-        CHECK(hr);
-        video_fencevalue = 1;
+        if (!create_video_processor(width, height)) {
+            DVLOG(1) << "VideoProc not supported for conversion DXGI_FORMAT_NV12 to DXGI_FORMAT_R8G8B8A8_UNORM, converting on the CPU";
+        }
+    }
 
-        // Create an event handle to use for frame synchronization.
-        video_event = CreateEvent(nullptr, FALSE, FALSE, nullptr);
-        if (video_event == nullptr) {
-            hr = HRESULT_FROM_WIN32(GetLastError());
-            CHECK(hr);
+    ~Win32DecoderImpl() {
+        if (upload_buffer) {
+            upload_buffer->Release();
+        }
+        if (rgba_texture) {
+            rgba_texture->Release();
         }
+        delete pipeline;
+        delete decode_device;
+        delete worker_pool;
+    }
 
-        /********** video processor *********************************/
+    void dump(const char *label, const uint8_t *bytes, size_t size) {
+#if 0
+        SHA1Hash h(bytes, size);
+        char tmp[64];
+        unsigned type = dl->codec == kCodecHEVC ? (bytes[0] >> 1) & 0x3f : bytes[0] & 0x1f;
+        printf("RECV %s sz=%u: type=%d hash=%s\n", label, (uint32_t) size, type, h.AsText(tmp));
 
-        hr = device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_VIDEO_PROCESS, IID_PPV_ARGS(&process_command_allocator));
-        CHECK(hr);
+        size_t i;
+        for (i = 0; i < size && i < 20; ++i) {
+            printf("0x%02x, ", bytes[i]);
+        }
+        if (i < size) {
+            printf(" (...)");
+        }
+        printf("\n");
+#endif
+    }
 
-        hr = device4->CreateCommandList1(0, D3D12_COMMAND_LIST_TYPE_VIDEO_PROCESS, D3D12_COMMAND_LIST_FLAG_NONE, IID_PPV_ARGS(&process_command_list));
-        CHECK(hr);
+    inline void process_barrier(ID3D12Resource *resource, D3D12_RESOURCE_STATES from, D3D12_RESOURCE_STATES to) {
+        assert(resource);
+        auto b = CD3DX12_RESOURCE_BARRIER::Transition(resource, from, to);
+        process_command_list->ResourceBarrier(1, &b);
+    }
 
-        D3D12_COMMAND_QUEUE_DESC process_queue_desc = { D3D12_COMMAND_LIST_TYPE_VIDEO_PROCESS, 0, D3D12_COMMAND_QUEUE_FLAG_NONE };
-        hr = device->CreateCommandQueue(&process_queue_desc, IID_PPV_ARGS(&process_command_queue));
-        CHECK(hr);
+    void wait_process() {
+        TRACE_EVENT(2, "wait_process");
+        auto val = ++process_signal_value;
 
-        hr = device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&process_fence));
-        CHECK(hr);
+        if (process_fence->SetEventOnCompletion(val, process_fence_event) < 0) {
+            errx(1, "err %s on line %d\n", __FUNCTION__, __LINE__);
+        }
 
-        process_fence_event = CreateEvent(NULL, FALSE, FALSE, NULL);
-        if (process_fence_event == NULL) {
+        if (process_command_queue->Signal(process_fence, val) < 0) {
             errx(1, "err %s on line %d\n", __FUNCTION__, __LINE__);
         }
 
+        while (process_fence->GetCompletedValue() < val) {
+            if (WaitForSingleObject(process_fence_event, INFINITE) != WAIT_OBJECT_0) {
+                errx(1, "WaitForSingleObject failed");
+            }
+        }
+    }
+
+    bool create_video_processor(UINT width, UINT height) {
+        HRESULT hr;
+
         D3D12_FEATURE_DATA_VIDEO_PROCESS_SUPPORT dx12ProcCaps = {
             0, // NodeIndex
             {
@@ -372,16 +329,16 @@ protected:
             { 30, 1 },
         };
 
-        hr = video_device->CheckFeatureSupport(D3D12_FEATURE_VIDEO_PROCESS_SUPPORT, &dx12ProcCaps, sizeof(dx12ProcCaps));
-        if ((dx12ProcCaps.SupportFlags & D3D12_VIDEO_PROCESS_SUPPORT_FLAG_SUPPORTED) == 0) {
-            errx(1, "VideoProc not supported for conversion DXGI_FORMAT_R8G8B8A8_UNORM to DXGI_FORMAT_NV12.");
+        hr = decode_device->VideoDevice()->CheckFeatureSupport(D3D12_FEATURE_VIDEO_PROCESS_SUPPORT, &dx12ProcCaps, sizeof(dx12ProcCaps));
+        if (FAILED(hr) || (dx12ProcCaps.SupportFlags & D3D12_VIDEO_PROCESS_SUPPORT_FLAG_SUPPORTED) == 0) {
+            return false;
         }
 
         DXGI_RATIONAL FrameRate = { 30, 1 };
         DXGI_RATIONAL AspectRatio = { 1, 1 };
 
         D3D12_VIDEO_SIZE_RANGE sr = dx12ProcCaps.ScaleSupport.OutputSizeRange;
-        printf("size range %u %u %u %u\n", sr.MaxWidth, sr.MaxHeight, sr.MinWidth, sr.MinHeight);
+        DVLOG(1) << "size range " << sr.MaxWidth << " " << sr.MaxHeight << " " << sr.MinWidth << " " << sr.MinHeight;
 
         D3D12_VIDEO_PROCESS_INPUT_STREAM_DESC inputStreamDesc = {
             DXGI_FORMAT_NV12, DXGI_COLOR_SPACE_YCBCR_STUDIO_G22_LEFT_P709,
@@ -413,180 +370,82 @@ protected:
             false // EnableStereo
         };
 
-        hr = video_device->CreateVideoProcessor(0,
+        hr = decode_device->VideoDevice()->CreateVideoProcessor(0,
             &outputStreamDesc,
             1, &inputStreamDesc,
             IID_PPV_ARGS(&video_processor));
         CHECK(hr);
-
-
-        /************* EOF video decoder *******************************/
-        hr = device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&direct_command_allocator));
-        CHECK(hr);
-
-        hr = device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, direct_command_allocator, nullptr, IID_PPV_ARGS(&direct_command_list));
-        direct_command_list->SetName(L"direct_command_list");
-        direct_command_list->Close();
-
-        hr = device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&fence));
-        CHECK(hr);
-        //fenceValue = 1;
-
-        // Create an event handle to use for frame synchronization.
-        fenceEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
-        if (fenceEvent == nullptr) {
-            hr = HRESULT_FROM_WIN32(GetLastError());
-            CHECK(hr);
-        }
-
-        // Describe and create the command queue.
-        D3D12_COMMAND_QUEUE_DESC queueDesc = {};
-        queueDesc.Flags = D3D12_COMMAND_QUEUE_FLAG_NONE;
-        queueDesc.Type = D3D12_COMMAND_LIST_TYPE_DIRECT;
-
-        hr = device->CreateCommandQueue(&queueDesc, IID_PPV_ARGS(&direct_command_queue));
-        CHECK(hr);
+        return true;
     }
 
-    void dump(const char *label, const uint8_t *bytes, size_t size) {
-#if 0
-        SHA1Hash h(bytes, size);
-        char tmp[64];
-        unsigned type = dl->is_hevc ? (bytes[0] >> 1) & 0x3f : bytes[0] & 0x1f;
-        printf("RECV %s sz=%u: type=%d hash=%s\n", label, (uint32_t) size, type, h.AsText(tmp));
-
-        size_t i;
-        for (i = 0; i < size && i < 20; ++i) {
-            printf("0x%02x, ", bytes[i]);
-        }
-        if (i < size) {
-            printf(" (...)");
-        }
-        printf("\n");
-#endif
-    }
-
-    inline void barrier(ID3D12Resource *resource, D3D12_RESOURCE_STATES from, D3D12_RESOURCE_STATES to) {
-        auto b = CD3DX12_RESOURCE_BARRIER::Transition(resource, from, to);
-        direct_command_list->ResourceBarrier(1, &b);
-    }
-
-    inline void video_barrier(ID3D12Resource *resource, D3D12_RESOURCE_STATES from, D3D12_RESOURCE_STATES to) {
-        auto b = CD3DX12_RESOURCE_BARRIER::Transition(resource, from, to);
-        video_command_list->ResourceBarrier(1, &b);
-    }
-
-    void direct_wait() {
+    /* map the decoded picture, convert it on the CPU and upload the result
+     * into the RGBA output texture. */
+    void convert_nv12_to_rgba_cpu(ID3D12Resource *output) {
         HRESULT hr;
-        auto val = ++direct_fencevalue;
-        hr = fence->SetEventOnCompletion(val, fenceEvent);
-        CHECK(hr);
-        hr = direct_command_queue->Signal(fence, val);
-        CHECK(hr);
-        if (WaitForSingleObject(fenceEvent, INFINITE) != WAIT_OBJECT_0) {
-            errx(1, "WaitForSingleObject failed");
-        }
-    }
 
-    void video_wait() {
-        HRESULT hr;
-        auto val = ++video_fencevalue;
-        hr = video_fence->SetEventOnCompletion(val, video_event);
-        CHECK(hr);
-        hr = video_command_queue->Signal(video_fence, val);
-        CHECK(hr);
-        if (WaitForSingleObject(video_event, INFINITE) != WAIT_OBJECT_0) {
-            errx(1, "WaitForSingleObject failed");
+        if (!worker_pool) {
+            worker_pool = new WorkerPool();
         }
-    }
-
-    void copy_to_host(void *dst, ID3D12Resource *resource, size_t size) {
-        HRESULT hr;
 
-        auto cl = direct_command_list;
-        hr = direct_command_allocator->Reset();
-        CHECK(hr);
-        hr = cl->Reset(direct_command_allocator, NULL);
-        CHECK(hr);
-
-        ID3D12Resource *read_back_buffer;
-
-        D3D12_RESOURCE_ALLOCATION_INFO info = {
-            .SizeInBytes = size,
-        };
-        CD3DX12_HEAP_PROPERTIES heap_properties(D3D12_HEAP_TYPE_READBACK);
-        const D3D12_RESOURCE_DESC resource_desc = CD3DX12_RESOURCE_DESC::Buffer(info);
-        hr = device->CreateCommittedResource(&heap_properties, D3D12_HEAP_FLAG_NONE, &resource_desc,
-                D3D12_RESOURCE_STATE_COMMON, NULL, IID_PPV_ARGS(&read_back_buffer));
-        CHECK(hr);
-
-        barrier(resource, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_SOURCE);
-        cl->CopyResource(read_back_buffer, resource);
-        barrier(resource, D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_COMMON);
-        hr = direct_command_list->Close();
-        CHECK(hr);
-
-        ID3D12CommandList *pcl[] = { direct_command_list };
-        direct_command_queue->ExecuteCommandLists(1, pcl);
-        direct_wait();
-
-        void *rptr = nullptr;
-        hr = read_back_buffer->Map(0, NULL, &rptr);
-        CHECK(hr);
-        memcpy(dst, rptr, size);
-        read_back_buffer->Unmap(0, nullptr);
-        read_back_buffer->Release();
-    }
-
-    void copy_texture(ID3D12Resource *dst, ID3D12Resource *src) {
-        HRESULT hr;
-
-        auto cl = direct_command_list;
-        hr = direct_command_allocator->Reset();
-        CHECK(hr);
-        hr = cl->Reset(direct_command_allocator, NULL);
-        CHECK(hr);
-
-        barrier(src, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_SOURCE);
-        barrier(dst, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_DEST);
-        cl->CopyResource(dst, src);
-        barrier(src, D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_COMMON);
-        barrier(dst, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COMMON);
-        hr = direct_command_list->Close();
-        CHECK(hr);
-
-        ID3D12CommandList *pcl[] = { direct_command_list };
-        direct_command_queue->ExecuteCommandLists(1, pcl);
-        direct_wait();
-    }
-
-    inline void process_barrier(ID3D12Resource *resource, D3D12_RESOURCE_STATES from, D3D12_RESOURCE_STATES to) {
-        assert(resource);
-        auto b = CD3DX12_RESOURCE_BARRIER::Transition(resource, from, to);
-        process_command_list->ResourceBarrier(1, &b);
-    }
-
-    void wait_process() {
-        auto val = ++process_signal_value;
-
-        if (process_fence->SetEventOnCompletion(val, process_fence_event) < 0) {
-            errx(1, "err %s on line %d\n", __FUNCTION__, __LINE__);
+        MappedPicture input;
+        if (!session->Map(ticket, &input)) {
+            errx(1, "%s: unable to map decoded picture", __PRETTY_FUNCTION__);
         }
 
-        if (process_command_queue->Signal(process_fence, val) < 0) {
-            errx(1, "err %s on line %d\n", __FUNCTION__, __LINE__);
-        }
+        D3D12_RESOURCE_DESC output_desc = output->GetDesc();
+        D3D12_PLACED_SUBRESOURCE_FOOTPRINT output_layout;
+        UINT64 output_size;
+        device->GetCopyableFootprints(&output_desc, 0, 1, 0, &output_layout, nullptr, nullptr, &output_size);
 
-        while (process_fence->GetCompletedValue() < val) {
-            if (WaitForSingleObject(process_fence_event, INFINITE) != WAIT_OBJECT_0) {
-                errx(1, "WaitForSingleObject failed");
+        if (output_size > upload_size) {
+            if (upload_buffer) {
+                upload_buffer->Release();
             }
+            CD3DX12_HEAP_PROPERTIES upload_properties(D3D12_HEAP_TYPE_UPLOAD);
+            const D3D12_RESOURCE_DESC upload_desc = CD3DX12_RESOURCE_DESC::Buffer(output_size);
+            hr = device->CreateCommittedResource(&upload_properties, D3D12_HEAP_FLAG_NONE, &upload_desc,
+                    D3D12_RESOURCE_STATE_GENERIC_READ, NULL, IID_PPV_ARGS(&upload_buffer));
+            CHECK(hr);
+            hr = upload_buffer->Map(0, NULL, (void **) &upload_data);
+            CHECK(hr);
+            upload_size = output_size;
         }
+
+        /* the copy out of the upload buffer below is waited for, so the
+         * previous picture is no longer being read from it */
+        ColorMatrix matrix;
+        ColorRange range;
+        pipeline->GetColorSpace(&matrix, &range);
+        cpu_converter.SetColorSpace(matrix, range);
+        CropRect crop;
+        get_crop_rect(&crop.x, &crop.y, &crop.width, &crop.height);
+        cpu_converter.Convert(
+            input.y + crop.y * input.y_stride + crop.x, input.y_stride,
+            input.uv + (crop.y / 2) * input.uv_stride + crop.x, input.uv_stride,
+            upload_data + output_layout.Offset, output_layout.Footprint.RowPitch,
+            dl->width, dl->height, worker_pool);
+        session->Unmap();
+
+        auto copy_queue = session->CopyQueue();
+        copy_queue->reset();
+        copy_queue->barrier(output, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_DEST);
+        CD3DX12_TEXTURE_COPY_LOCATION copy_dst(output, 0);
+        CD3DX12_TEXTURE_COPY_LOCATION copy_src(upload_buffer, output_layout);
+        copy_queue->list->CopyTextureRegion(&copy_dst, 0, 0, 0, &copy_src, nullptr);
+        copy_queue->barrier(output, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COMMON);
+        copy_queue->execute();
+        copy_queue->wait();
     }
 
     void convert_nv12_to_rgba(ID3D12Resource *input, ID3D12Resource *output) {
+        ScopedLatency latency(kStageConvert);
         HRESULT hr;
 
+        if (!video_processor || force_cpu_convert) {
+            convert_nv12_to_rgba_cpu(output);
+            return;
+        }
+
         hr = process_command_allocator->Reset();
         CHECK(hr);
         hr = process_command_list->Reset(process_command_allocator);
@@ -595,6 +454,9 @@ protected:
         process_barrier(input, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_VIDEO_PROCESS_READ);
         process_barrier(output, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_VIDEO_PROCESS_WRITE);
 
+        int crop_x, crop_y, crop_width, crop_height;
+        get_crop_rect(&crop_x, &crop_y, &crop_width, &crop_height);
+
         D3D12_VIDEO_PROCESS_INPUT_STREAM_ARGUMENTS1 input_args = {
             {
                 {
@@ -603,7 +465,7 @@ protected:
                 { },
             },
             {
-                { 0, 0, dl->width, dl->height },
+                { crop_x, crop_y, crop_x + crop_width, crop_y + crop_height },
                 { 0, 0, dl->width, dl->height },
                 D3D12_VIDEO_PROCESS_ORIENTATION_DEFAULT,
             },
@@ -631,227 +493,43 @@ protected:
         wait_process();
     }
 
-    void Decode(const uint8_t *bytes, size_t compressed_size) {
-
-        HEVCBitStream::NALUType type = (HEVCBitStream::NALUType) ((bytes[0] >> 1) & 0x3f);
-        bool is_irap = type >= HEVCBitStream::NALU_BLA_W_LP && type <= HEVCBitStream::NALU_RSV_IRAP_VCL23;
-        bool is_idr = type == HEVCBitStream::NALU_IDR_W_DLP || type == HEVCBitStream::NALU_IDR_N_LP;
-        bool is_key = is_irap || is_idr;
-        printf("is_key %d\n", is_key);
-
-        HRESULT hr;
-        const size_t header_size = 3;
-
-        //dump("payload", bytes, compressed_size);
-
-        /* upload compressed data */
-        CD3DX12_HEAP_PROPERTIES heap_properties(D3D12_HEAP_TYPE_UPLOAD);
-        D3D12_RESOURCE_ALLOCATION_INFO alloc_info = {
-            .SizeInBytes = header_size + compressed_size,
-        };
-        const D3D12_RESOURCE_DESC resource_desc = CD3DX12_RESOURCE_DESC::Buffer(alloc_info);
-        ID3D12Resource *resource;
-        hr = device->CreateCommittedResource(
-            &heap_properties,
-            D3D12_HEAP_FLAG_NONE,
-            &resource_desc,
-            D3D12_RESOURCE_STATE_COMMON, NULL, IID_PPV_ARGS(&resource));
-        CHECK(hr);
+    void get_crop_rect(int *px, int *py, int *pw, int *ph) {
+        pipeline->GetCropRect(px, py, pw, ph);
+    }
 
-        void *ptr = nullptr;
-        hr = resource->Map(0, NULL, &ptr);
-        CHECK(hr);
-        uint8_t *d = (uint8_t *) ptr;
-        if (header_size) {
-            /* fill in 0,0,1 NAL header */
-            d[0] = 0;
-            d[1] = 0;
-            d[2] = 1;
+    /* the texture to convert the current picture into, recreated when the
+     * picture size changes */
+    ID3D12Resource *rgba_output() {
+        if (rgba_texture && rgba_width == dl->width && rgba_height == dl->height) {
+            return rgba_texture;
         }
-        memcpy(d + header_size, bytes, compressed_size);
-        resource->Unmap(0, nullptr);
-
-        /* copy from upload buffer to compressed resource */
-        CD3DX12_HEAP_PROPERTIES heap_properties2(D3D12_HEAP_TYPE_DEFAULT);
-        const D3D12_RESOURCE_DESC resource_desc2 = CD3DX12_RESOURCE_DESC::Buffer(alloc_info);
-        ID3D12Resource *resource2;
-        hr = device->CreateCommittedResource(
-            &heap_properties2,
-            D3D12_HEAP_FLAG_NONE,
-            &resource_desc2,
-            D3D12_RESOURCE_STATE_COMMON, NULL, IID_PPV_ARGS(&resource2));
-        CHECK(hr);
-
-        hr = direct_command_allocator->Reset();
-        CHECK(hr);
-        hr = direct_command_list->Reset(direct_command_allocator, nullptr);
-        CHECK(hr);
-
-        resource2->SetName(L"compressed data");
-        barrier(resource2, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_DEST);
-        direct_command_list->CopyResource(resource2, resource);
-        barrier(resource2, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COMMON);
-
-        direct_command_list->Close();
-        ID3D12CommandList *ppCommandLists[] = { direct_command_list };
-        direct_command_queue->ExecuteCommandLists(_countof(ppCommandLists), ppCommandLists);
-        direct_wait();
-
-        resource->Release();
-
-        //printf("copied...\n");
-
-        DXVA_PicParams_HEVC p = {};
-        DXVA_Qmatrix_HEVC im = {};
-        hevc_parser.FillDXVA(&p, &im);
-
-        static uint32_t frame_counter = 0;
-        p.StatusReportFeedbackNumber = ++frame_counter;
-
-        DXVA_Slice_HEVC_Short slice = {
-            0,
-            (UINT) (header_size + compressed_size),
-        };
-
-        //d3d12_video_decoder_log_pic_params_hevc(&p);
-        //printf("Index7Bits 0x%x\n", p.CurrPic.Index7Bits);
+        if (rgba_texture) {
+            rgba_texture->Release();
+        }
+        CD3DX12_HEAP_PROPERTIES properties(D3D12_HEAP_TYPE_DEFAULT);
+        const D3D12_RESOURCE_DESC desc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R8G8B8A8_UNORM, dl->width, dl->height, 1, 1);
+        HRESULT hr = device->CreateCommittedResource(&properties, D3D12_HEAP_FLAG_NONE, &desc,
+                D3D12_RESOURCE_STATE_COMMON, NULL, IID_PPV_ARGS(&rgba_texture));
+        CHECK(hr);
+        rgba_width = dl->width;
+        rgba_height = dl->height;
+        return rgba_texture;
+    }
 
-        int w, h;
-        hevc_parser.GetDimensions(&w, &h);
+    /* the pipeline has decoded a picture into the session's output texture */
+    static void Decode(DecodeBackend *session, uint64_t ticket, void *opaque) {
+        auto impl = (Win32DecoderImpl *) opaque;
+        auto dl = impl->dl;
+        impl->session = (D3D12DecodeSession *) session;
+        impl->ticket = ticket;
 
-        if (w != heap_width || h != heap_height) {
-            /* change of image size detected, can no lounger user existing heap or nv12_texture */
-            if (decoder_heap) {
-                decoder_heap->Release();
-                decoder_heap = nullptr;
-            }
-            if (nv12_texture) {
-                nv12_texture->Release();
-                nv12_texture = nullptr;
-            }
-            if (reference_texture) {
-                reference_texture->Release();
-            }
-        }
-        hevc_parser.GetUnpaddedDimensions(&dl->width, &dl->height);
+        impl->pipeline->GetUnpaddedDimensions(&dl->width, &dl->height);
         assert(dl->width);
         assert(dl->height);
 
-        if (!decoder_heap) {
-            D3D12_VIDEO_DECODER_HEAP_DESC heap_desc = {};
-            heap_desc.NodeMask = 0;
-            heap_desc.Configuration = decode_config;
-            heap_desc.DecodeWidth = w;
-            heap_desc.DecodeHeight = h;
-            heap_desc.Format = DXGI_FORMAT_NV12;
-
-            printf("create %dx%d decoder heap\n", w, h);
-            hr = video_device->CreateVideoDecoderHeap(&heap_desc, IID_PPV_ARGS(&decoder_heap));
-            CHECK(hr);
-
-            heap_width = w;
-            heap_height = h;
-
-            D3D12_RESOURCE_DESC nv12_resource_desc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_NV12, w, h, 1, 1);
-            CD3DX12_HEAP_PROPERTIES heapProperties(D3D12_HEAP_TYPE_DEFAULT);
-            hr = device->CreateCommittedResource(
-                &heapProperties,
-                D3D12_HEAP_FLAG_NONE,
-                &nv12_resource_desc,
-                D3D12_RESOURCE_STATE_COMMON, NULL, IID_PPV_ARGS(&nv12_texture));
-            CHECK(hr);
-            nv12_texture->SetName(L"nv12_texture");
-
-            D3D12_RESOURCE_DESC reference_resource_desc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_NV12, w, h, num_reference_textures, 1);
-            reference_resource_desc.Flags = D3D12_RESOURCE_FLAG_VIDEO_DECODE_REFERENCE_ONLY | D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE;
-
-            hr = device->CreateCommittedResource(
-                &heapProperties,
-                D3D12_HEAP_FLAG_NONE,
-                &reference_resource_desc,
-                D3D12_RESOURCE_STATE_COMMON, NULL, IID_PPV_ARGS(&reference_texture));
-            CHECK(hr);
-            reference_texture->SetName(L"reference_texture");
-        }
-
-
-        D3D12_VIDEO_DECODE_INPUT_STREAM_ARGUMENTS input_arguments = {};
-        assert(decoder_heap);
-        input_arguments.pHeap = decoder_heap;
-        input_arguments.NumFrameArguments = 3;
-
-        input_arguments.FrameArguments[0].Type = D3D12_VIDEO_DECODE_ARGUMENT_TYPE_PICTURE_PARAMETERS;
-        input_arguments.FrameArguments[0].Size = sizeof(p);
-        input_arguments.FrameArguments[0].pData = &p;
-
-        input_arguments.FrameArguments[1].Type = D3D12_VIDEO_DECODE_ARGUMENT_TYPE_INVERSE_QUANTIZATION_MATRIX;
-        input_arguments.FrameArguments[1].Size = sizeof(im);
-        input_arguments.FrameArguments[1].pData = &im;
-
-        input_arguments.FrameArguments[2].Type = D3D12_VIDEO_DECODE_ARGUMENT_TYPE_SLICE_CONTROL;
-        input_arguments.FrameArguments[2].Size = sizeof(slice);
-        input_arguments.FrameArguments[2].pData = &slice;
-
-        input_arguments.CompressedBitstream.pBuffer = resource2;
-        input_arguments.CompressedBitstream.Offset = 0;
-        input_arguments.CompressedBitstream.Size = header_size + compressed_size;
-
-        input_arguments.ReferenceFrames.NumTexture2Ds = num_reference_textures;
-
-        /* AMD seems to only support TIER1 decoding, which means we have to pass the
-         * references textures as a texture array, and provide a list of identical
-         * resources here. */
-        ID3D12Resource *references[num_reference_textures];
-        for (int i = 0; i < num_reference_textures; ++i) {
-            references[i] = reference_texture;
-        }
-        input_arguments.ReferenceFrames.ppTexture2Ds = references;
-
-        /* Intel driver will choke on pSubresources being NULL, so pass pointer
-         * to a zero-filled array. This is clearly a bug in Intel's driver. */
-        UINT none[num_reference_textures] = {};
-        input_arguments.ReferenceFrames.pSubresources = none;
-
-        /* docs are unclear as to whether or not we need to pass in an array of heaps, so here we go */
-        ID3D12VideoDecoderHeap *heaps[num_reference_textures];
-        for (int i = 0; i < num_reference_textures; ++i) {
-            heaps[i] = decoder_heap;
+        if (impl->convert_output) {
+            impl->convert_nv12_to_rgba(impl->session->OutputTexture(), impl->rgba_output());
         }
-        input_arguments.ReferenceFrames.ppHeaps = heaps;
-
-        D3D12_VIDEO_DECODE_OUTPUT_STREAM_ARGUMENTS output_arguments = {};
-        output_arguments.pOutputTexture2D = nv12_texture;
-        output_arguments.ConversionArguments.pReferenceTexture2D = nv12_texture;
-
-        hr = video_command_allocator->Reset();
-        CHECK(hr);
-
-        hr = video_command_list->Reset(video_command_allocator);
-        CHECK(hr);
-
-        video_barrier(resource2, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_VIDEO_DECODE_READ);
-
-        video_barrier(reference_texture, D3D12_RESOURCE_STATE_COMMON, is_key ? D3D12_RESOURCE_STATE_VIDEO_DECODE_WRITE : D3D12_RESOURCE_STATE_VIDEO_DECODE_READ);
-
-        video_barrier(nv12_texture, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_VIDEO_DECODE_WRITE);
-        printf("call DecodeFrame\n");
-        video_command_list->DecodeFrame(video_decoder, &output_arguments, &input_arguments);
-        video_barrier(resource2, D3D12_RESOURCE_STATE_VIDEO_DECODE_READ, D3D12_RESOURCE_STATE_COMMON);
-        video_barrier(nv12_texture, D3D12_RESOURCE_STATE_VIDEO_DECODE_WRITE, D3D12_RESOURCE_STATE_COMMON);
-
-        video_barrier(reference_texture, is_key ? D3D12_RESOURCE_STATE_VIDEO_DECODE_WRITE : D3D12_RESOURCE_STATE_VIDEO_DECODE_READ, D3D12_RESOURCE_STATE_COMMON);
-
-        hr = video_command_list->Close();
-        CHECK(hr);
-        ID3D12CommandList *pcl2[] = { video_command_list };
-        assert(video_command_queue);
-        video_command_queue->ExecuteCommandLists(1, pcl2);
-        video_wait();
-
-        resource2->Release();
-
-        printf("video frame decoded! exiting cleanly! (change code to decode more frames)\n");
-        exit(0);
 #if 0
         // XXX this is where we pass the decoding frame texture to the surrounding code,
         // disabled for AMD test
@@ -861,20 +539,12 @@ protected:
         buffer->ToDevice(dl->device);
         auto gpu_buffer = (GPUBuffer *) buffer->GetDevicePointer();
 
-        convert_nv12_to_rgba(nv12_texture, gpu_buffer->resource);
+        impl->convert_nv12_to_rgba(impl->session->OutputTexture(), gpu_buffer->resource);
 
         dl->PutFrame(buffer);
 #endif
     }
 
-    static void Decode(const uint8_t *bytes, size_t compressed_size, void *opaque) {
-        ((Win32DecoderImpl *) opaque)->Decode(bytes, compressed_size);
-    }
-
-    bool ReceiveBytes(const uint8_t *bytes, size_t compressed_size) {
-        return hevc_parser.Parse(bytes, compressed_size, Decode, this);
-    }
-
 };
 
 Win32DecodingLayer::Win32DecodingLayer(Device *device)
@@ -886,7 +556,84 @@ Win32DecodingLayer::~Win32DecodingLayer() {
     delete impl;
 }
 
+int Win32DecodingLayer::Prewarm(const Resolution *resolutions, int count) {
+    return impl->pipeline->Prewarm(resolutions, count);
+}
+
+void Win32DecodingLayer::SetSurfaceBudget(size_t bytes) {
+    impl->pipeline->SetSurfaceBudget(bytes);
+}
+
+void Win32DecodingLayer::GetMemoryStats(DecoderMemoryStats *stats) {
+    impl->pipeline->GetMemoryStats(stats);
+}
+
+void Win32DecodingLayer::GetErrorStats(DecoderErrorStats *stats) {
+    impl->pipeline->GetErrorStats(stats);
+}
+
+bool Win32DecodingLayer::SetCodecConfig(VideoCodec codec, const uint8_t *config, size_t size) {
+    bool ok = impl->pipeline->SetCodecConfig(codec, config, size);
+    this->codec = impl->pipeline->GetCodec();
+    return ok;
+}
+
+void Win32DecodingLayer::SetParamDump(FILE *f) {
+    impl->pipeline->SetParamDump(f);
+}
+
+void Win32DecodingLayer::SetKeyframesOnly(bool enable) {
+    impl->pipeline->SetKeyframesOnly(enable);
+}
+
+void Win32DecodingLayer::SetHoldPictures(bool enable) {
+    impl->pipeline->SetHoldPictures(enable);
+}
+
+void Win32DecodingLayer::SetVerification(bool enable) {
+    impl->pipeline->SetVerification(enable);
+}
+
+void Win32DecodingLayer::GetVerifyStats(DecoderVerifyStats *stats) {
+    impl->pipeline->GetVerifyStats(stats);
+}
+
+void Win32DecodingLayer::SetMaxTemporalId(int temporal_id) {
+    impl->pipeline->SetMaxTemporalId(temporal_id);
+}
+
+uint64_t Win32DecodingLayer::GetPictureCount() {
+    return impl->pipeline->GetPictureCount();
+}
+
+void Win32DecodingLayer::SetOutputConversion(bool enable, bool cpu) {
+    impl->convert_output = enable;
+    impl->force_cpu_convert = cpu;
+}
+
+void Win32DecodingLayer::SetFrameLimit(uint64_t frames) {
+    impl->pipeline->SetFrameLimit(frames);
+}
+
+bool Win32DecodingLayer::Done() {
+    return impl->pipeline->Done();
+}
+
 bool Win32DecodingLayer::ReceiveBytes(const uint8_t *bytes,
     size_t compressed_size) {
-    return impl->ReceiveBytes(bytes, compressed_size);
+    bool have_frame = impl->pipeline->ReceiveBytes(bytes, compressed_size);
+    codec = impl->pipeline->GetCodec();
+    return have_frame;
+}
+
+bool Win32DecodingLayer::ReceiveNALU(VideoCodec codec, const uint8_t *nalu, size_t size) {
+    bool ok = impl->pipeline->ReceiveNALU(codec, nalu, size);
+    this->codec = impl->pipeline->GetCodec();
+    return ok;
+}
+
+bool Win32DecodingLayer::Flush() {
+    bool have_frame = impl->pipeline->Flush();
+    codec = impl->pipeline->GetCodec();
+    return have_frame;
 }
@@ -1,8 +1,12 @@
 #ifndef __WIN32DECODINGLAYER_H__
 #define __WIN32DECODINGLAYER_H__
 
+#include <stdio.h>
+
+#include "decodepipeline.h"
 #include "decodinglayer.h"
 #include "lock.h"
+#include "surfacecache.h"
 
 class Win32DecoderImpl;
 
@@ -13,7 +17,55 @@ class Win32DecodingLayer : public DecodingLayer {
 public:
     Win32DecodingLayer(Device *device);
     ~Win32DecodingLayer();
+    /* Annex-B input may be cut into ReceiveBytes() calls anywhere, the
+     * last NALU is only decoded once Flush() says the stream has ended */
     bool ReceiveBytes(const uint8_t *bytes, size_t compressed_size);
+    bool Flush();
+    /* for input already split into NALUs, e.g. by RTPDepacketizer, passed
+     * without start code. The codec is known from elsewhere, such as the
+     * SDP, and not probed for. Returns false if it differs from that of the
+     * stream so far. */
+    bool ReceiveNALU(VideoCodec codec, const uint8_t *nalu, size_t size);
+
+    /* create decoder surfaces ahead of time for the coded sizes a stream is
+     * expected to switch between, e.g. an ABR ladder, returns how many were
+     * created. Surfaces depend on the codec, so until ReceiveBytes() has
+     * identified it the request is held back and 0 is returned. Call from
+     * the thread that calls ReceiveBytes(). */
+    int Prewarm(const Resolution *resolutions, int count);
+    /* device memory the cached decoder surfaces may use, least recently
+     * used sizes are released first */
+    void SetSurfaceBudget(size_t bytes);
+    void GetMemoryStats(DecoderMemoryStats *stats);
+    void GetErrorStats(DecoderErrorStats *stats);
+    /* for MP4-style length-prefixed input, pass the hvcC or avcC box (its
+     * payload, without the box header) before the first ReceiveBytes(). The
+     * codec is then known and not probed for, and each ReceiveBytes() must
+     * be given whole samples. Returns false if the box is malformed or the
+     * codec differs from that of the stream so far. */
+    bool SetCodecConfig(VideoCodec codec, const uint8_t *config, size_t size);
+    /* write the parameters built for each picture to f as text, see
+     * hevcdump.h, rather than decoding it. H.264 pictures are not dumped. */
+    void SetParamDump(FILE *f);
+    /* decode IRAP pictures only, skipping everything else before it is
+     * parsed, e.g. for thumbnails (HEVC only) */
+    void SetKeyframesOnly(bool enable);
+    /* see DecodePipeline::SetHoldPictures() */
+    void SetHoldPictures(bool enable);
+    /* see DecodePipeline::SetVerification() */
+    void SetVerification(bool enable);
+    void GetVerifyStats(DecoderVerifyStats *stats);
+    /* decode temporal sub-layers up to temporal_id only, see
+     * HEVCParser::SetMaxTemporalId() (HEVC only) */
+    void SetMaxTemporalId(int temporal_id);
+    /* pictures decoded, or dumped, so far */
+    uint64_t GetPictureCount();
+    /* convert every decoded picture to RGBA, with the video processor or,
+     * if it is missing or cpu is set, on the CPU with ColorConverter */
+    void SetOutputConversion(bool enable, bool cpu);
+    /* see DecodePipeline::SetFrameLimit() */
+    void SetFrameLimit(uint64_t frames);
+    bool Done();
 };
 
 
@@ -0,0 +1,111 @@
+#ifndef __WORKERPOOL_H__
+#define __WORKERPOOL_H__
+
+#include <thread>
+#include <vector>
+
+#include "condition.h"
+#include "lock.h"
+
+/* a fixed set of worker threads for fork/join style parallelism. Run() hands
+ * out task indices 0..num_tasks-1 to the workers and the calling thread, and
+ * returns once all of them are done. Tasks are meant to be coarse (row bands,
+ * GOPs), so they are handed out under the condition lock. */
+
+class WorkerPool {
+
+public:
+    typedef void (*task_fn_t)(int task, void *opaque);
+
+private:
+    Condition cond;
+    Lock run_lock; // one Run() at a time
+    std::vector<std::thread> threads;
+
+    task_fn_t fn = nullptr;
+    void *opaque = nullptr;
+    int num_tasks = 0;
+    int next_task = 0;
+    int tasks_done = 0;
+    bool quit = false;
+
+    /* called with cond locked, returns with cond locked */
+    void Work() {
+        while (next_task < num_tasks) {
+            int task = next_task++;
+            auto task_fn = fn;
+            auto task_opaque = opaque;
+            cond.Unlock();
+            task_fn(task, task_opaque);
+            cond.Lock();
+            if (++tasks_done == num_tasks) {
+                cond.Broadcast();
+            }
+        }
+    }
+
+    void ThreadMain() {
+        cond.Lock();
+        while (!quit) {
+            if (next_task < num_tasks) {
+                Work();
+            } else {
+                cond.Wait();
+            }
+        }
+        cond.Unlock();
+    }
+
+public:
+    /* num_threads is the total including the thread calling Run(), 0 means
+     * one per hardware thread. */
+    WorkerPool(int num_threads = 0) {
+        if (num_threads <= 0) {
+            num_threads = (int) std::thread::hardware_concurrency();
+        }
+        for (int i = 1; i < num_threads; ++i) {
+            threads.emplace_back(&WorkerPool::ThreadMain, this);
+        }
+    }
+
+    ~WorkerPool() {
+        cond.Lock();
+        quit = true;
+        cond.Broadcast();
+        cond.Unlock();
+        for (auto &t : threads) {
+            t.join();
+        }
+    }
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    int NumThreads() const {
+        return (int) threads.size() + 1;
+    }
+
+    void Run(int n, task_fn_t task_fn, void *task_opaque) {
+        ScopedLock l(run_lock);
+        if (threads.empty() || n <= 1) {
+            for (int i = 0; i < n; ++i) {
+                task_fn(i, task_opaque);
+            }
+            return;
+        }
+        cond.Lock();
+        fn = task_fn;
+        opaque = task_opaque;
+        num_tasks = n;
+        next_task = 0;
+        tasks_done = 0;
+        cond.Broadcast();
+        Work();
+        while (tasks_done < num_tasks) {
+            cond.Wait();
+        }
+        cond.Unlock();
+    }
+};
+
+#endif /* __WORKERPOOL_H__ */